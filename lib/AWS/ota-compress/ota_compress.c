@@ -0,0 +1,231 @@
+/*
+ * FreeRTOS V202011.00
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://aws.amazon.com/freertos
+ *
+ */
+
+/**
+ * @file ota_compress.c
+ * @brief Decompresses the frames of a compressed OTA file.
+ */
+
+/* Standard includes. */
+#include <string.h>
+
+/* OTA compress include. */
+#include "ota_compress.h"
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Shortest match of the LZ4 block format.
+ */
+#define MIN_MATCH    ( 4U )
+
+/**
+ * @brief Decode the length that continues in the bytes after a token.
+ *
+ * @param[in,out] ppucIn The next byte of the compressed data, advanced past
+ * the length.
+ * @param[in] pucEnd The end of the compressed data.
+ * @param[in,out] pxLength The length in the token, to which the rest is added.
+ *
+ * @return pdTRUE if the length was decoded, otherwise pdFALSE.
+ */
+static BaseType_t prvReadLength( const uint8_t ** ppucIn,
+                                 const uint8_t * pucEnd,
+                                 size_t * pxLength );
+
+/**
+ * @brief Read little endian values.
+ */
+static uint16_t prvRead16( const uint8_t * pucData );
+static uint32_t prvRead32( const uint8_t * pucData );
+
+/*-----------------------------------------------------------*/
+
+static uint16_t prvRead16( const uint8_t * pucData )
+{
+    return ( uint16_t ) ( ( uint16_t ) pucData[ 0 ] | ( ( uint16_t ) pucData[ 1 ] << 8 ) );
+}
+
+/*-----------------------------------------------------------*/
+
+static uint32_t prvRead32( const uint8_t * pucData )
+{
+    return ( uint32_t ) pucData[ 0 ] |
+           ( ( uint32_t ) pucData[ 1 ] << 8 ) |
+           ( ( uint32_t ) pucData[ 2 ] << 16 ) |
+           ( ( uint32_t ) pucData[ 3 ] << 24 );
+}
+
+/*-----------------------------------------------------------*/
+
+static BaseType_t prvReadLength( const uint8_t ** ppucIn,
+                                 const uint8_t * pucEnd,
+                                 size_t * pxLength )
+{
+    BaseType_t xResult = pdTRUE;
+    uint8_t ucByte;
+
+    if( *pxLength == 15U )
+    {
+        do
+        {
+            /* No length in a frame can exceed the frame's run. */
+            if( ( *ppucIn >= pucEnd ) || ( *pxLength > OTA_COMPRESS_MAX_FRAME_LENGTH ) )
+            {
+                xResult = pdFALSE;
+                break;
+            }
+
+            ucByte = **ppucIn;
+            ( *ppucIn )++;
+            *pxLength += ucByte;
+        } while( ucByte == 255U );
+    }
+
+    return xResult;
+}
+
+/*-----------------------------------------------------------*/
+
+BaseType_t OtaCompress_ParseFrame( const uint8_t * pucBlock,
+                                   size_t xBlockLength,
+                                   OtaCompressFrame_t * pxFrame )
+{
+    BaseType_t xResult = pdFALSE;
+
+    if( ( pucBlock != NULL ) &&
+        ( xBlockLength >= OTA_COMPRESS_HEADER_SIZE ) &&
+        ( memcmp( pucBlock, "OTAZ", 4U ) == 0 ) &&
+        ( pucBlock[ 4 ] == OTA_COMPRESS_VERSION ) )
+    {
+        pxFrame->ucLog2BlockSize = pucBlock[ 5 ];
+        pxFrame->ulImageSize = prvRead32( &( pucBlock[ 8 ] ) );
+        pxFrame->ulOffset = prvRead32( &( pucBlock[ 12 ] ) );
+        pxFrame->ulLength = prvRead16( &( pucBlock[ 16 ] ) );
+        pxFrame->xDataLength = prvRead16( &( pucBlock[ 18 ] ) );
+        pxFrame->pucData = &( pucBlock[ OTA_COMPRESS_HEADER_SIZE ] );
+
+        if( ( pxFrame->xDataLength <= ( xBlockLength - OTA_COMPRESS_HEADER_SIZE ) ) &&
+            ( pxFrame->ulLength <= OTA_COMPRESS_MAX_FRAME_LENGTH ) &&
+            ( pxFrame->ulOffset <= pxFrame->ulImageSize ) &&
+            ( pxFrame->ulLength <= ( pxFrame->ulImageSize - pxFrame->ulOffset ) ) )
+        {
+            xResult = pdTRUE;
+        }
+    }
+
+    return xResult;
+}
+
+/*-----------------------------------------------------------*/
+
+BaseType_t OtaCompress_Decompress( const OtaCompressFrame_t * pxFrame,
+                                   uint8_t * pucOut,
+                                   size_t xOutSize )
+{
+    BaseType_t xResult = pdTRUE;
+    const uint8_t * pucIn = pxFrame->pucData;
+    const uint8_t * pucEnd = &( pxFrame->pucData[ pxFrame->xDataLength ] );
+    size_t xOut = 0U;
+    size_t xLiterals;
+    size_t xMatch;
+    size_t xOffset;
+    uint8_t ucToken;
+
+    if( xOutSize < pxFrame->ulLength )
+    {
+        xResult = pdFALSE;
+    }
+    else
+    {
+        xOutSize = pxFrame->ulLength;
+    }
+
+    /* Each sequence is literal bytes then a match with earlier output, except
+     * the last, which ends the data after its literal bytes. */
+    while( ( xResult == pdTRUE ) && ( pucIn < pucEnd ) )
+    {
+        ucToken = *pucIn;
+        pucIn++;
+        xLiterals = ( size_t ) ucToken >> 4;
+
+        if( ( prvReadLength( &pucIn, pucEnd, &xLiterals ) == pdFALSE ) ||
+            ( xLiterals > ( size_t ) ( pucEnd - pucIn ) ) ||
+            ( xLiterals > ( xOutSize - xOut ) ) )
+        {
+            xResult = pdFALSE;
+            break;
+        }
+
+        ( void ) memcpy( &( pucOut[ xOut ] ), pucIn, xLiterals );
+        pucIn += xLiterals;
+        xOut += xLiterals;
+
+        if( pucIn == pucEnd )
+        {
+            break;
+        }
+
+        if( ( pucEnd - pucIn ) < 2 )
+        {
+            xResult = pdFALSE;
+            break;
+        }
+
+        xOffset = prvRead16( pucIn );
+        pucIn += 2;
+        xMatch = ( size_t ) ucToken & 0x0FU;
+
+        if( ( xOffset == 0U ) ||
+            ( xOffset > xOut ) ||
+            ( prvReadLength( &pucIn, pucEnd, &xMatch ) == pdFALSE ) ||
+            ( ( xMatch + MIN_MATCH ) > ( xOutSize - xOut ) ) )
+        {
+            xResult = pdFALSE;
+            break;
+        }
+
+        xMatch += MIN_MATCH;
+
+        if( xOffset >= xMatch )
+        {
+            ( void ) memcpy( &( pucOut[ xOut ] ), &( pucOut[ xOut - xOffset ] ), xMatch );
+            xOut += xMatch;
+        }
+        else
+        {
+            /* The match overlaps the bytes it makes, repeating them. */
+            while( xMatch > 0U )
+            {
+                pucOut[ xOut ] = pucOut[ xOut - xOffset ];
+                xOut++;
+                xMatch--;
+            }
+        }
+    }
+
+    return ( ( xResult == pdTRUE ) && ( xOut == pxFrame->ulLength ) ) ? pdTRUE : pdFALSE;
+}
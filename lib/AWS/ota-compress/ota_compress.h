@@ -0,0 +1,111 @@
+/*
+ * FreeRTOS V202011.00
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://aws.amazon.com/freertos
+ *
+ */
+
+/**
+ * @file ota_compress.h
+ * @brief Decompresses the blocks of a compressed OTA file, in any order.
+ *
+ * A compressed file is made of frames, one to each block of the file as it is
+ * sent by the OTA service, made by lib/AWS/tools/ota_compress/ota_compress.py.
+ * Each frame holds a run of the image compressed on its own, with no
+ * reference to another frame, and says where in the image the run goes.  A
+ * block can therefore be decompressed as soon as it is received, whatever
+ * order the blocks arrive in.
+ *
+ * All values are little endian.  A frame is the magic "OTAZ", a version byte,
+ * the log2 of the block size, two reserved bytes, then the size of the whole
+ * image and the offset of the run in it, each 4 bytes, then the length of the
+ * run and of the compressed data, each 2 bytes.  The compressed data follows,
+ * in the LZ4 block format, and the rest of the block is padding.
+ */
+#ifndef OTA_COMPRESS_H
+#define OTA_COMPRESS_H
+
+/* Standard includes. */
+#include <stddef.h>
+#include <stdint.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+
+/**
+ * @brief Size of the frame header.
+ */
+#define OTA_COMPRESS_HEADER_SIZE         ( 20U )
+
+/**
+ * @brief The version of the format this decompresses.
+ */
+#define OTA_COMPRESS_VERSION             ( 1U )
+
+/**
+ * @brief The longest run of the image a frame may hold, which is the size of
+ * the buffer a frame is decompressed into.
+ */
+#define OTA_COMPRESS_MAX_FRAME_LENGTH    ( 32768U )
+
+/**
+ * @brief A frame header, decoded.
+ */
+typedef struct OtaCompressFrame
+{
+    uint32_t ulImageSize;          /**< Size of the whole image. */
+    uint32_t ulOffset;             /**< Offset of the run in the image. */
+    uint32_t ulLength;             /**< Length of the run. */
+    uint8_t ucLog2BlockSize;       /**< The block size the file was made for. */
+    const uint8_t * pucData;       /**< The compressed data, pointing into the block. */
+    size_t xDataLength;            /**< Length of the compressed data. */
+} OtaCompressFrame_t;
+
+/**
+ * @brief Decode the header of the frame in a block.
+ *
+ * @param[in] pucBlock The block.
+ * @param[in] xBlockLength Length of the block.
+ * @param[out] pxFrame Set to the decoded header.
+ *
+ * @return pdTRUE if the block holds a frame that fits within it and within the
+ * image, otherwise pdFALSE.
+ */
+BaseType_t OtaCompress_ParseFrame( const uint8_t * pucBlock,
+                                   size_t xBlockLength,
+                                   OtaCompressFrame_t * pxFrame );
+
+/**
+ * @brief Decompress a frame.
+ *
+ * @param[in] pxFrame The frame, decoded by OtaCompress_ParseFrame().
+ * @param[out] pucOut Buffer the run is decompressed into.
+ * @param[in] xOutSize Size of pucOut, at least pxFrame->ulLength.
+ *
+ * @return pdTRUE if the compressed data made exactly pxFrame->ulLength
+ * bytes, otherwise pdFALSE.
+ */
+BaseType_t OtaCompress_Decompress( const OtaCompressFrame_t * pxFrame,
+                                   uint8_t * pucOut,
+                                   size_t xOutSize );
+
+#endif /* OTA_COMPRESS_H */
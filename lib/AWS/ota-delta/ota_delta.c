@@ -0,0 +1,391 @@
+/*
+ * FreeRTOS V202011.00
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://aws.amazon.com/freertos
+ *
+ */
+
+/**
+ * @file ota_delta.c
+ * @brief Applies a delta encoded OTA file to the running image.
+ */
+
+/* Standard includes. */
+#include <string.h>
+
+/* OTA delta include. */
+#include "ota_delta.h"
+
+/* File storage include, for its CRC-32. */
+#include "file_storage.h"
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Check the header and that the running image is the one the delta
+ * file was made from.
+ *
+ * @param[in] pxContext The state of the file being applied, with the whole
+ * header received.
+ *
+ * @return OtaDeltaSuccess if the file can be applied, otherwise the reason not.
+ */
+static OtaDeltaStatus_t prvCheckHeader( OtaDeltaContext_t * pxContext );
+
+/**
+ * @brief Copy a run of bytes from the running image to the reconstructed image.
+ *
+ * @param[in] pxContext The state of the file being applied.
+ * @param[in] ulLength Number of bytes to copy, from pxContext->ulCopyOffset.
+ *
+ * @return OtaDeltaSuccess if the bytes were copied, otherwise the reason not.
+ */
+static OtaDeltaStatus_t prvCopy( OtaDeltaContext_t * pxContext,
+                                 uint32_t ulLength );
+
+/**
+ * @brief Apply the value of a command once all of it has been decoded.
+ *
+ * @param[in] pxContext The state of the file being applied.
+ *
+ * @return OtaDeltaSuccess if the value is valid, otherwise the reason not.
+ */
+static OtaDeltaStatus_t prvApplyValue( OtaDeltaContext_t * pxContext );
+
+/**
+ * @brief Read a little endian 32 bit value.
+ */
+static uint32_t prvRead32( const uint8_t * pucData );
+
+/*-----------------------------------------------------------*/
+
+static uint32_t prvRead32( const uint8_t * pucData )
+{
+    return ( uint32_t ) pucData[ 0 ] |
+           ( ( uint32_t ) pucData[ 1 ] << 8 ) |
+           ( ( uint32_t ) pucData[ 2 ] << 16 ) |
+           ( ( uint32_t ) pucData[ 3 ] << 24 );
+}
+
+/*-----------------------------------------------------------*/
+
+static OtaDeltaStatus_t prvCheckHeader( OtaDeltaContext_t * pxContext )
+{
+    OtaDeltaStatus_t xStatus = OtaDeltaSuccess;
+    uint32_t ulOffset = 0U;
+    uint32_t ulCrc = 0U;
+    size_t xChunk;
+
+    if( ( OtaDelta_IsDelta( pxContext->ucHeader, OTA_DELTA_HEADER_SIZE ) == pdFALSE ) ||
+        ( pxContext->ucHeader[ 4 ] != OTA_DELTA_VERSION ) )
+    {
+        xStatus = OtaDeltaBadHeader;
+    }
+    else
+    {
+        pxContext->ulSourceSize = prvRead32( &( pxContext->ucHeader[ 8 ] ) );
+        pxContext->ulTargetSize = prvRead32( &( pxContext->ucHeader[ 16 ] ) );
+
+        /* Copies trust the running image to be the one the file was made
+         * from, so it is checked once here rather than each copy. */
+        while( ( xStatus == OtaDeltaSuccess ) && ( ulOffset < pxContext->ulSourceSize ) )
+        {
+            xChunk = pxContext->ulSourceSize - ulOffset;
+            xChunk = ( xChunk < sizeof( pxContext->ucCopyBuffer ) ) ? xChunk : sizeof( pxContext->ucCopyBuffer );
+
+            if( pxContext->xReadSource( pxContext->pvContext, ulOffset, pxContext->ucCopyBuffer, xChunk ) == pdTRUE )
+            {
+                ulCrc = FileStorage_Crc32( ulCrc, pxContext->ucCopyBuffer, xChunk );
+                ulOffset += ( uint32_t ) xChunk;
+            }
+            else
+            {
+                /* The running image is shorter than the one the file needs. */
+                xStatus = OtaDeltaWrongSource;
+            }
+        }
+
+        if( ( xStatus == OtaDeltaSuccess ) &&
+            ( ulCrc != prvRead32( &( pxContext->ucHeader[ 12 ] ) ) ) )
+        {
+            xStatus = OtaDeltaWrongSource;
+        }
+    }
+
+    return xStatus;
+}
+
+/*-----------------------------------------------------------*/
+
+static OtaDeltaStatus_t prvCopy( OtaDeltaContext_t * pxContext,
+                                 uint32_t ulLength )
+{
+    OtaDeltaStatus_t xStatus = OtaDeltaSuccess;
+    uint32_t ulOffset = pxContext->ulCopyOffset;
+    size_t xChunk;
+
+    while( ( xStatus == OtaDeltaSuccess ) && ( ulLength > 0U ) )
+    {
+        xChunk = ( ulLength < sizeof( pxContext->ucCopyBuffer ) ) ? ulLength : sizeof( pxContext->ucCopyBuffer );
+
+        if( ( pxContext->xReadSource( pxContext->pvContext, ulOffset, pxContext->ucCopyBuffer, xChunk ) == pdTRUE ) &&
+            ( pxContext->xWriteTarget( pxContext->pvContext, pxContext->ucCopyBuffer, xChunk ) == pdTRUE ) )
+        {
+            ulOffset += ( uint32_t ) xChunk;
+            ulLength -= ( uint32_t ) xChunk;
+            pxContext->ulWritten += ( uint32_t ) xChunk;
+            pxContext->ulCopied += ( uint32_t ) xChunk;
+        }
+        else
+        {
+            xStatus = OtaDeltaIoError;
+        }
+    }
+
+    return xStatus;
+}
+
+/*-----------------------------------------------------------*/
+
+static OtaDeltaStatus_t prvApplyValue( OtaDeltaContext_t * pxContext )
+{
+    OtaDeltaStatus_t xStatus = OtaDeltaSuccess;
+    uint32_t ulValue = pxContext->ulValue;
+    uint32_t ulDelta;
+
+    switch( pxContext->xState )
+    {
+        case OtaDeltaStateCopyOffset:
+
+            /* Zigzag decoding, so small moves either way are short. */
+            ulDelta = ( ulValue >> 1 ) ^ ( 0U - ( ulValue & 1U ) );
+            pxContext->ulCopyOffset = pxContext->ulCopyEnd + ulDelta;
+
+            /* The offset is within the image if it did not wrap either way. */
+            if( pxContext->ulCopyOffset >= pxContext->ulSourceSize )
+            {
+                xStatus = OtaDeltaBadCommand;
+            }
+            else
+            {
+                pxContext->xState = OtaDeltaStateCopyLength;
+            }
+
+            break;
+
+        case OtaDeltaStateCopyLength:
+
+            if( ( ulValue > ( pxContext->ulSourceSize - pxContext->ulCopyOffset ) ) ||
+                ( ulValue > ( pxContext->ulTargetSize - pxContext->ulWritten ) ) )
+            {
+                xStatus = OtaDeltaBadCommand;
+            }
+            else
+            {
+                xStatus = prvCopy( pxContext, ulValue );
+                pxContext->ulCopyEnd = pxContext->ulCopyOffset + ulValue;
+                pxContext->xState = OtaDeltaStateOpcode;
+            }
+
+            break;
+
+        case OtaDeltaStateAddLength:
+
+            if( ulValue > ( pxContext->ulTargetSize - pxContext->ulWritten ) )
+            {
+                xStatus = OtaDeltaBadCommand;
+            }
+            else
+            {
+                pxContext->ulAddRemaining = ulValue;
+                pxContext->xState = ( ulValue > 0U ) ? OtaDeltaStateAddData : OtaDeltaStateOpcode;
+            }
+
+            break;
+
+        default:
+            xStatus = OtaDeltaBadCommand;
+            break;
+    }
+
+    return xStatus;
+}
+
+/*-----------------------------------------------------------*/
+
+BaseType_t OtaDelta_IsDelta( const uint8_t * pucData,
+                             size_t xLength )
+{
+    return ( ( pucData != NULL ) &&
+             ( xLength >= 4U ) &&
+             ( memcmp( pucData, "OTAD", 4U ) == 0 ) ) ? pdTRUE : pdFALSE;
+}
+
+/*-----------------------------------------------------------*/
+
+void OtaDelta_Init( OtaDeltaContext_t * pxContext,
+                    OtaDeltaReadSource_t xReadSource,
+                    OtaDeltaWriteTarget_t xWriteTarget,
+                    void * pvContext )
+{
+    ( void ) memset( pxContext, 0, sizeof( *pxContext ) );
+    pxContext->xReadSource = xReadSource;
+    pxContext->xWriteTarget = xWriteTarget;
+    pxContext->pvContext = pvContext;
+    pxContext->xState = OtaDeltaStateHeader;
+}
+
+/*-----------------------------------------------------------*/
+
+OtaDeltaStatus_t OtaDelta_Apply( OtaDeltaContext_t * pxContext,
+                                 const uint8_t * pucData,
+                                 size_t xLength )
+{
+    OtaDeltaStatus_t xStatus = OtaDeltaSuccess;
+    size_t xIndex = 0U;
+    size_t xChunk;
+    uint8_t ucByte;
+
+    if( pxContext->xState == OtaDeltaStateFailed )
+    {
+        xStatus = OtaDeltaBadCommand;
+    }
+
+    while( ( xStatus == OtaDeltaSuccess ) && ( xIndex < xLength ) )
+    {
+        switch( pxContext->xState )
+        {
+            case OtaDeltaStateHeader:
+                xChunk = OTA_DELTA_HEADER_SIZE - pxContext->xHeaderLength;
+                xChunk = ( xChunk < ( xLength - xIndex ) ) ? xChunk : ( xLength - xIndex );
+                ( void ) memcpy( &( pxContext->ucHeader[ pxContext->xHeaderLength ] ), &( pucData[ xIndex ] ), xChunk );
+                pxContext->xHeaderLength += xChunk;
+                xIndex += xChunk;
+
+                if( pxContext->xHeaderLength == OTA_DELTA_HEADER_SIZE )
+                {
+                    xStatus = prvCheckHeader( pxContext );
+                    pxContext->xState = OtaDeltaStateOpcode;
+                }
+
+                break;
+
+            case OtaDeltaStateOpcode:
+                ucByte = pucData[ xIndex ];
+                xIndex++;
+                pxContext->ulValue = 0U;
+                pxContext->ucShift = 0U;
+
+                if( ucByte == OTA_DELTA_OP_COPY )
+                {
+                    pxContext->xState = OtaDeltaStateCopyOffset;
+                }
+                else if( ucByte == OTA_DELTA_OP_ADD )
+                {
+                    pxContext->xState = OtaDeltaStateAddLength;
+                }
+                else if( ( ucByte == OTA_DELTA_OP_END ) &&
+                         ( pxContext->ulWritten == pxContext->ulTargetSize ) )
+                {
+                    pxContext->xState = OtaDeltaStateDone;
+                }
+                else
+                {
+                    xStatus = OtaDeltaBadCommand;
+                }
+
+                break;
+
+            case OtaDeltaStateCopyOffset:
+            case OtaDeltaStateCopyLength:
+            case OtaDeltaStateAddLength:
+                ucByte = pucData[ xIndex ];
+                xIndex++;
+
+                /* LEB128, of at most 32 bits. */
+                if( ( pxContext->ucShift > 28U ) ||
+                    ( ( pxContext->ucShift == 28U ) && ( ( ucByte & 0x70U ) != 0U ) ) )
+                {
+                    xStatus = OtaDeltaBadCommand;
+                }
+                else
+                {
+                    pxContext->ulValue |= ( uint32_t ) ( ucByte & 0x7FU ) << pxContext->ucShift;
+                    pxContext->ucShift += 7U;
+
+                    if( ( ucByte & 0x80U ) == 0U )
+                    {
+                        xStatus = prvApplyValue( pxContext );
+                        pxContext->ulValue = 0U;
+                        pxContext->ucShift = 0U;
+                    }
+                }
+
+                break;
+
+            case OtaDeltaStateAddData:
+
+                /* Literal bytes are written from where they lie. */
+                xChunk = ( pxContext->ulAddRemaining < ( xLength - xIndex ) ) ?
+                         pxContext->ulAddRemaining : ( xLength - xIndex );
+
+                if( pxContext->xWriteTarget( pxContext->pvContext, &( pucData[ xIndex ] ), xChunk ) == pdTRUE )
+                {
+                    xIndex += xChunk;
+                    pxContext->ulAddRemaining -= ( uint32_t ) xChunk;
+                    pxContext->ulWritten += ( uint32_t ) xChunk;
+                    pxContext->ulAdded += ( uint32_t ) xChunk;
+
+                    if( pxContext->ulAddRemaining == 0U )
+                    {
+                        pxContext->xState = OtaDeltaStateOpcode;
+                    }
+                }
+                else
+                {
+                    xStatus = OtaDeltaIoError;
+                }
+
+                break;
+
+            default:
+
+                /* Nothing may follow the end command. */
+                xStatus = OtaDeltaBadCommand;
+                break;
+        }
+    }
+
+    if( xStatus != OtaDeltaSuccess )
+    {
+        pxContext->xState = OtaDeltaStateFailed;
+    }
+
+    return xStatus;
+}
+
+/*-----------------------------------------------------------*/
+
+BaseType_t OtaDelta_IsComplete( const OtaDeltaContext_t * pxContext )
+{
+    return ( pxContext->xState == OtaDeltaStateDone ) ? pdTRUE : pdFALSE;
+}
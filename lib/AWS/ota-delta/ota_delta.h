@@ -0,0 +1,216 @@
+/*
+ * FreeRTOS V202011.00
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://aws.amazon.com/freertos
+ *
+ */
+
+/**
+ * @file ota_delta.h
+ * @brief Applies a delta encoded OTA file to the running image as the file is
+ * received, reconstructing the new image.
+ *
+ * A delta file starts with a header naming the image it was made from, by
+ * size and CRC-32, and the size of the image it reconstructs.  A sequence of
+ * commands follows, each either copying a run of bytes from the running image
+ * or adding literal bytes, and then an end command.  Copies are what make the
+ * file small: code that did not change, even if it moved, is copied rather
+ * than sent.  The file is made by lib/AWS/tools/ota_delta/ota_delta.py.
+ *
+ * The file is consumed in order, in pieces of any size, so it can be applied
+ * from the prefix of the file received so far.  The running image is read and
+ * the reconstructed image written through callbacks.
+ *
+ * All values are little endian.  The header is the magic "OTAD", a version
+ * byte, three reserved bytes, then the source size, source CRC-32 and target
+ * size, each 4 bytes.  A command is an opcode byte followed by LEB128 encoded
+ * values:
+ * - OTA_DELTA_OP_COPY: the offset of the copy in the running image, relative
+ *   to the end of the previous copy and zigzag encoded, then its length.
+ * - OTA_DELTA_OP_ADD: a length, then that many literal bytes.
+ * - OTA_DELTA_OP_END: nothing, and must be the last byte of the file.
+ */
+#ifndef OTA_DELTA_H
+#define OTA_DELTA_H
+
+/* Standard includes. */
+#include <stddef.h>
+#include <stdint.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+
+/**
+ * @brief Size of the delta file header.
+ */
+#define OTA_DELTA_HEADER_SIZE    ( 20U )
+
+/**
+ * @brief The version of the format this applies.
+ */
+#define OTA_DELTA_VERSION        ( 1U )
+
+/**
+ * @brief Command opcodes.
+ */
+#define OTA_DELTA_OP_END         ( 0x00U )
+#define OTA_DELTA_OP_COPY        ( 0x01U )
+#define OTA_DELTA_OP_ADD         ( 0x02U )
+
+/**
+ * @brief Size of the buffer a copy from the running image is read through.
+ */
+#ifndef OTA_DELTA_COPY_BUFFER_SIZE
+    #define OTA_DELTA_COPY_BUFFER_SIZE    ( 1024U )
+#endif
+
+/**
+ * @brief Read bytes from the running image.
+ *
+ * @param[in] pvContext The context passed to OtaDelta_Init().
+ * @param[in] ulOffset Offset in the image to read from.
+ * @param[out] pucBuffer Buffer to read into.
+ * @param[in] xLength Number of bytes to read.
+ *
+ * @return pdTRUE if all xLength bytes were read, otherwise pdFALSE.
+ */
+typedef BaseType_t ( * OtaDeltaReadSource_t )( void * pvContext,
+                                               uint32_t ulOffset,
+                                               uint8_t * pucBuffer,
+                                               size_t xLength );
+
+/**
+ * @brief Append bytes to the reconstructed image.
+ *
+ * @param[in] pvContext The context passed to OtaDelta_Init().
+ * @param[in] pucData Bytes to append.
+ * @param[in] xLength Number of bytes.
+ *
+ * @return pdTRUE if the bytes were written, otherwise pdFALSE.
+ */
+typedef BaseType_t ( * OtaDeltaWriteTarget_t )( void * pvContext,
+                                                const uint8_t * pucData,
+                                                size_t xLength );
+
+/**
+ * @brief Result of applying part of a delta file.
+ */
+typedef enum OtaDeltaStatus
+{
+    OtaDeltaSuccess = 0,  /**< The bytes were applied. */
+    OtaDeltaBadHeader,    /**< The file is not a delta file of a supported version. */
+    OtaDeltaWrongSource,  /**< The file was made from a different image than the one running. */
+    OtaDeltaBadCommand,   /**< A command is malformed or out of range. */
+    OtaDeltaIoError       /**< A callback failed. */
+} OtaDeltaStatus_t;
+
+/**
+ * @brief Where the applier is in the delta file.
+ */
+typedef enum OtaDeltaState
+{
+    OtaDeltaStateHeader = 0,
+    OtaDeltaStateOpcode,
+    OtaDeltaStateCopyOffset,
+    OtaDeltaStateCopyLength,
+    OtaDeltaStateAddLength,
+    OtaDeltaStateAddData,
+    OtaDeltaStateDone,
+    OtaDeltaStateFailed
+} OtaDeltaState_t;
+
+/**
+ * @brief State of a delta file being applied.  Treat as opaque.
+ */
+typedef struct OtaDeltaContext
+{
+    OtaDeltaReadSource_t xReadSource;
+    OtaDeltaWriteTarget_t xWriteTarget;
+    void * pvContext;
+    OtaDeltaState_t xState;
+    uint8_t ucHeader[ OTA_DELTA_HEADER_SIZE ];
+    size_t xHeaderLength;
+    uint32_t ulSourceSize;
+    uint32_t ulTargetSize;
+    uint32_t ulWritten;       /**< Bytes of the image reconstructed so far. */
+    uint32_t ulCopyEnd;       /**< Offset after the end of the previous copy. */
+    uint32_t ulCopyOffset;
+    uint32_t ulValue;         /**< Value being decoded. */
+    uint8_t ucShift;          /**< Bits of the value decoded so far. */
+    uint32_t ulAddRemaining;  /**< Literal bytes still to come. */
+    uint32_t ulCopied;        /**< Bytes copied from the running image. */
+    uint32_t ulAdded;         /**< Literal bytes added. */
+    uint8_t ucCopyBuffer[ OTA_DELTA_COPY_BUFFER_SIZE ];
+} OtaDeltaContext_t;
+
+/**
+ * @brief Check whether the start of a file is a delta file header.
+ *
+ * @param[in] pucData The first bytes of the file.
+ * @param[in] xLength Number of bytes, at least 4 to recognise the file.
+ *
+ * @return pdTRUE if the file is a delta file, otherwise pdFALSE.
+ */
+BaseType_t OtaDelta_IsDelta( const uint8_t * pucData,
+                             size_t xLength );
+
+/**
+ * @brief Prepare to apply a delta file from its first byte.
+ *
+ * @param[out] pxContext The state to initialize.
+ * @param[in] xReadSource Reads the running image.
+ * @param[in] xWriteTarget Writes the reconstructed image.
+ * @param[in] pvContext Passed to the callbacks.
+ */
+void OtaDelta_Init( OtaDeltaContext_t * pxContext,
+                    OtaDeltaReadSource_t xReadSource,
+                    OtaDeltaWriteTarget_t xWriteTarget,
+                    void * pvContext );
+
+/**
+ * @brief Apply the next bytes of a delta file.
+ *
+ * Once the header is complete the running image is checked against it, which
+ * reads the whole image once.
+ *
+ * @param[in] pxContext The state of the file being applied.
+ * @param[in] pucData The bytes that follow those already applied.
+ * @param[in] xLength Number of bytes.
+ *
+ * @return OtaDeltaSuccess, or the reason the file cannot be applied, after
+ * which every call fails.
+ */
+OtaDeltaStatus_t OtaDelta_Apply( OtaDeltaContext_t * pxContext,
+                                 const uint8_t * pucData,
+                                 size_t xLength );
+
+/**
+ * @brief Check whether the whole delta file has been applied, so the image is
+ * complete.
+ *
+ * @param[in] pxContext The state of the file being applied.
+ *
+ * @return pdTRUE if the end command was applied, otherwise pdFALSE.
+ */
+BaseType_t OtaDelta_IsComplete( const OtaDeltaContext_t * pxContext );
+
+#endif /* OTA_DELTA_H */
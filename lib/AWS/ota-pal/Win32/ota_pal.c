@@ -27,7 +27,12 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <io.h>
 #include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
 #include "ota_config.h"
 
 #include "iot_crypto.h"
@@ -35,6 +40,8 @@
 
 #include "aws_ota_codesigner_certificate.h"
 #include "ota_pal.h"
+#include "ota_delta.h"
+#include "ota_compress.h"
 
 /* Specify the OTA signature algorithm we support on this platform. */
 const char OTA_JsonFileSignatureKey[ OTA_FILE_SIG_KEY_STR_MAX_LENGTH ] = "sig-sha256-ecdsa";
@@ -57,6 +64,1046 @@ static inline BaseType_t prvContextValidate( OtaFileContext_t* pFileContext )
 /* Size of buffer used in file operations on this platform (Windows). */
 #define OTA_PAL_WIN_BUF_SIZE ( ( size_t ) 4096UL )
 
+/* The signature of the file being received is hashed as its blocks are
+ * written, so closing the file only has to check the signature rather than
+ * read the whole file back.  Blocks that arrive ahead of the hashed prefix of
+ * the file are recorded in a bitmap, and read back from the file to be hashed
+ * once the blocks before them arrive. */
+typedef struct OtaPalHashState
+{
+    OtaFileContext_t * pxFileContext; /* The file being hashed, or NULL. */
+    void * pvSigVerifyContext;        /* Signature verification context the file is hashed into. */
+    uint32_t ulHashedBytes;           /* Length of the prefix of the file hashed so far. */
+    uint8_t * pucBlocksWritten;       /* Bitmap of the blocks written, one bit per block. */
+    uint32_t ulBytesReread;           /* Bytes read back from the file to be hashed. */
+} OtaPalHashState_t;
+
+static OtaPalHashState_t xHashState = { 0 };
+
+/* Blocks are collected into extents of this size, each ending on a multiple
+ * of the size, and written by a writer task so the OTA agent does not wait
+ * for the file system on every block. */
+#ifndef OTA_PAL_WRITE_EXTENT_SIZE
+    #define OTA_PAL_WRITE_EXTENT_SIZE    ( 64UL * 1024UL )
+#endif
+
+/* Number of extents.  One is filled by the OTA agent while the others are
+ * waiting for or being written by the writer task. */
+#if ( OTA_PAL_WRITE_EXTENT_SIZE % otaconfigFILE_BLOCK_SIZE ) != 0
+    #error "OTA_PAL_WRITE_EXTENT_SIZE must be a multiple of otaconfigFILE_BLOCK_SIZE."
+#endif
+
+#ifndef OTA_PAL_WRITE_EXTENT_COUNT
+    #define OTA_PAL_WRITE_EXTENT_COUNT    ( 2U )
+#endif
+
+#ifndef OTA_PAL_WRITER_TASK_PRIORITY
+    #define OTA_PAL_WRITER_TASK_PRIORITY    ( tskIDLE_PRIORITY + 1 )
+#endif
+
+#ifndef OTA_PAL_WRITER_TASK_STACK_SIZE
+    #define OTA_PAL_WRITER_TASK_STACK_SIZE    ( configMINIMAL_STACK_SIZE * 2 )
+#endif
+
+/* A run of consecutive blocks to be written with one fwrite(). */
+typedef struct OtaPalWriteExtent
+{
+    FILE * pFile;       /* File the extent is written to. */
+    uint32_t ulOffset;  /* Offset in the file of the first block. */
+    uint32_t ulLength;  /* Bytes collected so far. */
+    uint8_t * pucData;  /* OTA_PAL_WRITE_EXTENT_SIZE bytes. */
+} OtaPalWriteExtent_t;
+
+/* The extents circulate between the queue of free extents, the OTA agent
+ * while it fills one, and the queue of extents for the writer task to write.
+ * Blocks are acknowledged once copied into an extent, so a write error is
+ * reported by the next write, or when the file is closed. */
+typedef struct OtaPalWriteBehind
+{
+    QueueHandle_t xFreeExtents;        /* Extents that can be filled. */
+    QueueHandle_t xFullExtents;        /* Extents waiting to be written. */
+    OtaPalWriteExtent_t * pxFilling;   /* Extent blocks are being collected into, or NULL. */
+    volatile int32_t lError;           /* errno of the first write that failed, or 0. */
+    uint32_t ulBlocks;                 /* Blocks written through the extents since the file was created. */
+    volatile uint32_t ulExtents;       /* Extents written since the file was created. */
+} OtaPalWriteBehind_t;
+
+static OtaPalWriteBehind_t xWriteBehind = { 0 };
+
+/* Create the extents and the writer task the first time a file is received.
+ * If this fails blocks are written one at a time as they arrive. */
+static BaseType_t prvWriteBehindInit( void );
+
+/* Write the extents sent by the OTA agent. */
+static void prvWriterTask( void * pvParameters );
+
+/* Copy a block into the extent being filled, sending the extent to the
+ * writer task first if the block does not follow on from it. */
+static int32_t prvWriteBehindQueue( OtaFileContext_t * const C,
+                                    uint32_t ulOffset,
+                                    const uint8_t * pucData,
+                                    uint32_t ulBlockSize );
+
+/* Send the extent being filled to the writer task. */
+static void prvWriteBehindSubmit( void );
+
+/* Wait until every extent is written, or discarded if xDiscard is pdTRUE,
+ * and return the errno of the first write that failed, or 0. */
+static int32_t prvWriteBehindDrain( BaseType_t xDiscard );
+
+/* Write the blocks waiting to be written and commit the file to disk, and
+ * return the errno of the first write that failed, or 0. */
+static int32_t prvSyncFile( OtaFileContext_t * const C );
+
+/* Start hashing a file created to receive an update.  If this fails the file
+ * is read back to be hashed when it is closed. */
+static void prvHashStart( OtaFileContext_t * const C );
+
+/* Hash a block that was written, if it extends the hashed prefix of the file,
+ * followed by any blocks written earlier that are now in order. */
+static void prvHashBlock( OtaFileContext_t * const C,
+                          uint32_t ulOffset,
+                          const uint8_t * pucData,
+                          uint32_t ulBlockSize );
+
+/* Hash the blocks written after the hashed prefix of the file, reading them
+ * back from the file, up to the first block not yet written. */
+static void prvHashWrittenBlocks( OtaFileContext_t * const C );
+
+/* Stop hashing, freeing the verification context unless it has been handed
+ * to CRYPTO_SignatureVerificationFinal(). */
+static void prvHashStop( BaseType_t xFreeContext );
+
+/* Hash the next bytes of the received file, in order, or if the file is a
+ * delta file apply them and hash the image they reconstruct.  Returns pdFALSE
+ * if hashing stopped. */
+static BaseType_t prvHashUpdate( OtaFileContext_t * const C,
+                                 const uint8_t * pucData,
+                                 uint32_t ulLength );
+
+/* Path of the image delta files are applied to, or NULL for the running
+ * executable, which is the simulator's image and what an update replaces. */
+#ifndef OTA_PAL_DELTA_SOURCE_PATH
+    #define OTA_PAL_DELTA_SOURCE_PATH    NULL
+#endif
+
+/* Appended to the path of a received delta file to name the file the image is
+ * reconstructed into, which replaces the received file once it is verified. */
+#ifndef OTA_PAL_DELTA_TARGET_SUFFIX
+    #define OTA_PAL_DELTA_TARGET_SUFFIX    ".new"
+#endif
+
+/* Set in the file attributes of the job document to mark a delta file.  Only
+ * a file the job marks this way is applied as a delta file, so a plain image
+ * whose first bytes happen to match the delta header is installed as it was
+ * sent. */
+#ifndef OTA_PAL_FILE_ATTRIBUTE_DELTA
+    #define OTA_PAL_FILE_ATTRIBUTE_DELTA    ( 1UL << 9 )
+#endif
+
+/* A received file that is a delta file is applied to the running image as its
+ * blocks join the hashed prefix of the file, and the image it reconstructs is
+ * hashed in place of the received file, as that is what is signed.  If the
+ * file cannot be applied as it is received it is applied when it is closed. */
+typedef struct OtaPalDeltaState
+{
+    OtaFileContext_t * pxFileContext; /* The received delta file, or NULL. */
+    FILE * pxSource;                  /* The running image. */
+    FILE * pxTarget;                  /* The image being reconstructed. */
+    char * pcTargetPath;              /* Path of pxTarget. */
+    BaseType_t xHashTarget;           /* Whether the reconstructed image is hashed as it is written. */
+    OtaDeltaContext_t xDelta;         /* State of the delta file applied so far. */
+} OtaPalDeltaState_t;
+
+static OtaPalDeltaState_t xDeltaState = { 0 };
+
+/* Start applying a received delta file from its first byte. */
+static BaseType_t prvDeltaStart( OtaFileContext_t * const C,
+                                 BaseType_t xHashTarget );
+
+/* Stop applying a delta file, removing the image it reconstructed if asked. */
+static void prvDeltaStop( BaseType_t xRemoveTarget );
+
+/* Finish applying a received delta file once all of it is received, and put
+ * the reconstructed image in its place for the signature check.  Returns 0,
+ * or an errno value if the job marks the file a delta file and it cannot be
+ * applied. */
+static int32_t prvDeltaFinish( OtaFileContext_t * const C );
+
+/* Callbacks of the delta applier. */
+static BaseType_t prvDeltaReadSource( void * pvContext,
+                                      uint32_t ulOffset,
+                                      uint8_t * pucBuffer,
+                                      size_t xLength );
+static BaseType_t prvDeltaWriteTarget( void * pvContext,
+                                       const uint8_t * pucData,
+                                       size_t xLength );
+
+/* Set in the file attributes of the job document to mark a compressed file.
+ * Only a file the job marks this way is decompressed, so a plain image whose
+ * first bytes happen to look like a frame is installed as it was sent. */
+#ifndef OTA_PAL_FILE_ATTRIBUTE_COMPRESSED
+    #define OTA_PAL_FILE_ATTRIBUTE_COMPRESSED    ( 1UL << 8 )
+#endif
+
+/* Appended to the path of a received compressed file to name the file the
+ * image is decompressed into, which replaces the received file once the
+ * received file is verified. */
+#ifndef OTA_PAL_DECOMPRESS_TARGET_SUFFIX
+    #define OTA_PAL_DECOMPRESS_TARGET_SUFFIX    ".new"
+#endif
+
+/* Each block of a compressed file is a frame that is decompressed on its own
+ * into the image as the block is written, whatever order the blocks arrive in.
+ * The received file is kept, so it is hashed, checkpointed and verified as
+ * before, and blocks not decompressed as they arrived, as after a reset, are
+ * read back and decompressed when it is closed. */
+typedef struct OtaPalDecompressState
+{
+    OtaFileContext_t * pxFileContext; /* The file the first block was written to, or NULL. */
+    BaseType_t xCompressed;           /* Whether that file is compressed. */
+    FILE * pxImage;                   /* The image the frames are decompressed into. */
+    char * pcImagePath;               /* Path of pxImage. */
+    uint8_t * pucFrameBuffer;         /* OTA_COMPRESS_MAX_FRAME_LENGTH bytes a frame is decompressed into. */
+    uint8_t * pucBlocksDone;          /* Bitmap of the blocks decompressed, one bit per block. */
+    uint32_t ulImageSize;             /* Size of the image, from the first frame. */
+    uint32_t ulImageBytes;            /* Bytes decompressed into the image. */
+} OtaPalDecompressState_t;
+
+static OtaPalDecompressState_t xDecompressState = { 0 };
+
+/* Decompress a block written to the received file, if the job marks the file
+ * compressed.  Returns pdFALSE if the file is compressed and the block cannot
+ * be decompressed. */
+static BaseType_t prvDecompressBlock( OtaFileContext_t * const C,
+                                      uint32_t ulOffset,
+                                      const uint8_t * pucData,
+                                      uint32_t ulLength );
+
+/* Start decompressing a file into its image, given its first frame. */
+static BaseType_t prvDecompressStart( OtaFileContext_t * const C,
+                                      const OtaCompressFrame_t * pxFrame );
+
+/* Stop decompressing, removing the image if asked. */
+static void prvDecompressStop( BaseType_t xRemoveImage );
+
+/* Decompress the blocks of a verified compressed file not yet decompressed,
+ * and commit the image to disk.  Returns 0, or an errno value if the image
+ * cannot be made. */
+static int32_t prvDecompressFinish( OtaFileContext_t * const C );
+
+/* Put a file made from the received file in its place.  Returns 0, or an
+ * errno value. */
+static int32_t prvReplaceReceivedFile( OtaFileContext_t * const C,
+                                       const char * pcPath );
+
+static void prvHashStart( OtaFileContext_t * const C )
+{
+    uint32_t ulBlockCount;
+
+    prvHashStop( pdTRUE );
+
+    /* A delta file is applied again from its first byte. */
+    prvDeltaStop( pdTRUE );
+
+    if( C->fileSize > 0UL )
+    {
+        ulBlockCount = ( C->fileSize + otaconfigFILE_BLOCK_SIZE - 1UL ) >> otaconfigLOG2_FILE_BLOCK_SIZE;
+        xHashState.pucBlocksWritten = pvPortMalloc( ( ulBlockCount + 7UL ) / 8UL );
+
+        if( xHashState.pucBlocksWritten == NULL )
+        {
+            LogWarn( ( "No memory to hash the file as it is received.\r\n" ) );
+        }
+        else if( pdFALSE == CRYPTO_SignatureVerificationStart( &xHashState.pvSigVerifyContext, cryptoASYMMETRIC_ALGORITHM_ECDSA, cryptoHASH_ALGORITHM_SHA256 ) )
+        {
+            vPortFree( xHashState.pucBlocksWritten );
+            xHashState.pucBlocksWritten = NULL;
+        }
+        else
+        {
+            memset( xHashState.pucBlocksWritten, 0, ( ulBlockCount + 7UL ) / 8UL );
+            xHashState.pxFileContext = C;
+            xHashState.ulHashedBytes = 0UL;
+            xHashState.ulBytesReread = 0UL;
+        }
+    }
+}
+
+static void prvHashBlock( OtaFileContext_t * const C,
+                          uint32_t ulOffset,
+                          const uint8_t * pucData,
+                          uint32_t ulBlockSize )
+{
+    uint32_t ulBlock = ulOffset >> otaconfigLOG2_FILE_BLOCK_SIZE;
+
+    if( ( xHashState.pxFileContext == C ) &&
+        ( ulOffset >= xHashState.ulHashedBytes ) &&
+        ( ( ulOffset + ulBlockSize ) <= C->fileSize ) )
+    {
+        xHashState.pucBlocksWritten[ ulBlock >> 3 ] |= ( uint8_t ) ( 1U << ( ulBlock & 7UL ) );
+
+        if( ( ulOffset == xHashState.ulHashedBytes ) &&
+            ( prvHashUpdate( C, pucData, ulBlockSize ) == pdTRUE ) )
+        {
+            xHashState.ulHashedBytes += ulBlockSize;
+
+            /* Hash the blocks that arrived early and now follow the prefix. */
+            prvHashWrittenBlocks( C );
+        }
+    }
+}
+
+static void prvHashWrittenBlocks( OtaFileContext_t * const C )
+{
+    uint32_t ulBlock;
+    uint32_t ulBytesToRead;
+    uint8_t * pucBuf = NULL;
+
+    while( ( xHashState.pxFileContext == C ) && ( xHashState.ulHashedBytes < C->fileSize ) )
+    {
+        ulBlock = xHashState.ulHashedBytes >> otaconfigLOG2_FILE_BLOCK_SIZE;
+
+        if( ( xHashState.pucBlocksWritten[ ulBlock >> 3 ] & ( 1U << ( ulBlock & 7UL ) ) ) == 0U )
+        {
+            break;
+        }
+
+        if( pucBuf == NULL )
+        {
+            /* The block may still be waiting to be written. */
+            ( void ) prvWriteBehindDrain( pdFALSE );
+            pucBuf = pvPortMalloc( otaconfigFILE_BLOCK_SIZE );
+        }
+
+        ulBytesToRead = C->fileSize - xHashState.ulHashedBytes;
+        ulBytesToRead = ( ulBytesToRead < otaconfigFILE_BLOCK_SIZE ) ? ulBytesToRead : otaconfigFILE_BLOCK_SIZE;
+
+        if( ( pucBuf == NULL ) ||
+            ( fseek( C->pFile, ( long ) xHashState.ulHashedBytes, SEEK_SET ) != 0 ) || /*lint !e586
+                                                                                          * C standard library call is being used for portability. */
+            ( fread( pucBuf, 1, ulBytesToRead, C->pFile ) != ulBytesToRead ) ) /*lint !e586
+                                                                                  * C standard library call is being used for portability. */
+        {
+            /* Give up and read the whole file back when it is closed. */
+            LogWarn( ( "Failed to read back block %u to hash it.\r\n", ( unsigned ) ulBlock ) );
+            prvHashStop( pdTRUE );
+            break;
+        }
+
+        if( prvHashUpdate( C, pucBuf, ulBytesToRead ) == pdFALSE )
+        {
+            break;
+        }
+
+        xHashState.ulHashedBytes += ulBytesToRead;
+        xHashState.ulBytesReread += ulBytesToRead;
+    }
+
+    if( pucBuf != NULL )
+    {
+        vPortFree( pucBuf );
+    }
+}
+
+static void prvHashStop( BaseType_t xFreeContext )
+{
+    if( ( xFreeContext == pdTRUE ) && ( xHashState.pvSigVerifyContext != NULL ) )
+    {
+        /* Called with only the context this just frees it. */
+        ( void ) CRYPTO_SignatureVerificationFinal( xHashState.pvSigVerifyContext, NULL, 0, NULL, 0 );
+    }
+
+    if( xHashState.pucBlocksWritten != NULL )
+    {
+        vPortFree( xHashState.pucBlocksWritten );
+    }
+
+    memset( &xHashState, 0, sizeof( xHashState ) );
+}
+
+static BaseType_t prvHashUpdate( OtaFileContext_t * const C,
+                                 const uint8_t * pucData,
+                                 uint32_t ulLength )
+{
+    BaseType_t xHashing = pdTRUE;
+    OtaDeltaStatus_t xStatus;
+
+    if( ( xHashState.ulHashedBytes == 0UL ) &&
+        ( ( C->fileAttributes & OTA_PAL_FILE_ATTRIBUTE_DELTA ) != 0UL ) &&
+        ( OtaDelta_IsDelta( pucData, ulLength ) == pdTRUE ) )
+    {
+        xHashing = prvDeltaStart( C, pdTRUE );
+    }
+
+    if( xHashing == pdFALSE )
+    {
+        /* Nothing to do. */
+    }
+    else if( xDeltaState.pxFileContext == C )
+    {
+        /* The reconstructed image is hashed as it is written. */
+        xStatus = OtaDelta_Apply( &xDeltaState.xDelta, pucData, ( size_t ) ulLength );
+
+        if( xStatus != OtaDeltaSuccess )
+        {
+            LogWarn( ( "Failed to apply the delta file at byte %u: %d.\r\n",
+                       ( unsigned ) xHashState.ulHashedBytes, ( int ) xStatus ) );
+            prvDeltaStop( pdTRUE );
+            xHashing = pdFALSE;
+        }
+    }
+    else
+    {
+        CRYPTO_SignatureVerificationUpdate( xHashState.pvSigVerifyContext, pucData, ulLength );
+    }
+
+    if( xHashing == pdFALSE )
+    {
+        /* The file is applied and checked when it is closed. */
+        prvHashStop( pdTRUE );
+    }
+
+    return xHashing;
+}
+
+static BaseType_t prvDeltaReadSource( void * pvContext,
+                                      uint32_t ulOffset,
+                                      uint8_t * pucBuffer,
+                                      size_t xLength )
+{
+    ( void ) pvContext;
+
+    return ( ( fseek( xDeltaState.pxSource, ( long ) ulOffset, SEEK_SET ) == 0 ) && /*lint !e586
+                                                                                      * C standard library call is being used for portability. */
+             ( fread( pucBuffer, 1, xLength, xDeltaState.pxSource ) == xLength ) ) ? pdTRUE : pdFALSE; /*lint !e586
+                                                                                                          * C standard library call is being used for portability. */
+}
+
+static BaseType_t prvDeltaWriteTarget( void * pvContext,
+                                       const uint8_t * pucData,
+                                       size_t xLength )
+{
+    BaseType_t xResult = pdFALSE;
+
+    if( fwrite( pucData, 1, xLength, xDeltaState.pxTarget ) == xLength ) /*lint !e586
+                                                                          * C standard library call is being used for portability. */
+    {
+        if( ( xDeltaState.xHashTarget == pdTRUE ) && ( xHashState.pxFileContext == pvContext ) )
+        {
+            CRYPTO_SignatureVerificationUpdate( xHashState.pvSigVerifyContext, pucData, xLength );
+        }
+
+        xResult = pdTRUE;
+    }
+
+    return xResult;
+}
+
+static BaseType_t prvDeltaStart( OtaFileContext_t * const C,
+                                 BaseType_t xHashTarget )
+{
+    const char * pcSourcePath = OTA_PAL_DELTA_SOURCE_PATH;
+    char * pcExecutablePath = NULL;
+    size_t xPathLength = strlen( ( const char * ) C->pFilePath );
+
+    prvDeltaStop( pdTRUE );
+
+    if( ( pcSourcePath == NULL ) && ( _get_pgmptr( &pcExecutablePath ) == 0 ) )
+    {
+        pcSourcePath = pcExecutablePath;
+    }
+
+    xDeltaState.pcTargetPath = pvPortMalloc( xPathLength + sizeof( OTA_PAL_DELTA_TARGET_SUFFIX ) );
+
+    if( ( pcSourcePath != NULL ) && ( xDeltaState.pcTargetPath != NULL ) )
+    {
+        ( void ) memcpy( xDeltaState.pcTargetPath, C->pFilePath, xPathLength );
+        ( void ) memcpy( &( xDeltaState.pcTargetPath[ xPathLength ] ), OTA_PAL_DELTA_TARGET_SUFFIX, sizeof( OTA_PAL_DELTA_TARGET_SUFFIX ) );
+
+        xDeltaState.pxSource = fopen( pcSourcePath, "rb" );                /*lint !e586
+                                                                            * C standard library call is being used for portability. */
+        xDeltaState.pxTarget = fopen( xDeltaState.pcTargetPath, "w+b" ); /*lint !e586
+                                                                            * C standard library call is being used for portability. */
+    }
+
+    if( ( xDeltaState.pxSource != NULL ) && ( xDeltaState.pxTarget != NULL ) )
+    {
+        LogInfo( ( "Receiving a delta file, applying it to %s.\r\n", pcSourcePath ) );
+        OtaDelta_Init( &xDeltaState.xDelta, prvDeltaReadSource, prvDeltaWriteTarget, C );
+        xDeltaState.pxFileContext = C;
+        xDeltaState.xHashTarget = xHashTarget;
+    }
+    else
+    {
+        LogError( ( "Failed to open the image to apply the delta file to, or the file to reconstruct it in.\r\n" ) );
+        prvDeltaStop( pdTRUE );
+    }
+
+    return ( xDeltaState.pxFileContext == C ) ? pdTRUE : pdFALSE;
+}
+
+static void prvDeltaStop( BaseType_t xRemoveTarget )
+{
+    if( xDeltaState.pxSource != NULL )
+    {
+        ( void ) fclose( xDeltaState.pxSource ); /*lint !e586
+                                                  * C standard library call is being used for portability. */
+    }
+
+    if( xDeltaState.pxTarget != NULL )
+    {
+        ( void ) fclose( xDeltaState.pxTarget ); /*lint !e586
+                                                  * C standard library call is being used for portability. */
+    }
+
+    if( xDeltaState.pcTargetPath != NULL )
+    {
+        if( xRemoveTarget == pdTRUE )
+        {
+            ( void ) remove( xDeltaState.pcTargetPath ); /*lint !e586
+                                                          * C standard library call is being used for portability. */
+        }
+
+        vPortFree( xDeltaState.pcTargetPath );
+    }
+
+    memset( &xDeltaState, 0, sizeof( xDeltaState ) );
+}
+
+static int32_t prvDeltaFinish( OtaFileContext_t * const C )
+{
+    int32_t lError = 0;
+    OtaDeltaStatus_t xStatus = OtaDeltaSuccess;
+    uint8_t * pucBuf = NULL;
+    size_t xBytesRead;
+
+    if( ( C->fileAttributes & OTA_PAL_FILE_ATTRIBUTE_DELTA ) == 0UL )
+    {
+        /* Not a delta file, so there is nothing to do. */
+    }
+    else if( ( xDeltaState.pxFileContext != C ) || ( OtaDelta_IsComplete( &xDeltaState.xDelta ) == pdFALSE ) )
+    {
+        pucBuf = pvPortMalloc( OTA_PAL_WIN_BUF_SIZE );
+
+        if( pucBuf == NULL )
+        {
+            lError = ENOMEM;
+        }
+        else if( ( fseek( C->pFile, 0L, SEEK_SET ) != 0 ) || /*lint !e586
+                                                               * C standard library call is being used for portability. */
+                 ( fread( pucBuf, 1, OTA_DELTA_HEADER_SIZE, C->pFile ) != OTA_DELTA_HEADER_SIZE ) ) /*lint !e586
+                                                                                                      * C standard library call is being used for portability. */
+        {
+            lError = EIO;
+        }
+        else if( OtaDelta_IsDelta( pucBuf, OTA_DELTA_HEADER_SIZE ) == pdFALSE )
+        {
+            LogError( ( "The job marks the file a delta file but it does not start with a delta header.\r\n" ) );
+            lError = EINVAL;
+        }
+        else if( prvDeltaStart( C, pdFALSE ) == pdFALSE )
+        {
+            lError = EIO;
+        }
+        else
+        {
+            /* The file was not applied as it was received, so it is applied
+             * now and the image read back to check its signature. */
+            LogInfo( ( "Applying the delta file now it is received.\r\n" ) );
+            prvHashStop( pdTRUE );
+
+            if( fseek( C->pFile, 0L, SEEK_SET ) == 0 ) /*lint !e586
+                                                        * C standard library call is being used for portability. */
+            {
+                do
+                {
+                    xBytesRead = fread( pucBuf, 1, OTA_PAL_WIN_BUF_SIZE, C->pFile ); /*lint !e586
+                                                                                      * C standard library call is being used for portability. */
+                    xStatus = OtaDelta_Apply( &xDeltaState.xDelta, pucBuf, xBytesRead );
+                } while( ( xBytesRead > 0U ) && ( xStatus == OtaDeltaSuccess ) );
+            }
+        }
+
+        if( pucBuf != NULL )
+        {
+            vPortFree( pucBuf );
+        }
+    }
+
+    if( ( lError == 0 ) && ( xDeltaState.pxFileContext == C ) )
+    {
+        if( OtaDelta_IsComplete( &xDeltaState.xDelta ) == pdFALSE )
+        {
+            LogError( ( "Failed to apply the delta file: %d.\r\n", ( int ) xStatus ) );
+            lError = ( xStatus == OtaDeltaIoError ) ? EIO : EINVAL;
+        }
+        else if( ( fflush( xDeltaState.pxTarget ) != 0 ) || ( _commit( _fileno( xDeltaState.pxTarget ) ) != 0 ) )
+        {
+            lError = errno;
+        }
+        else
+        {
+            LogInfo( ( "Delta file of %u bytes applied, making a %u byte image of which %u bytes were copied from the running image.\r\n",
+                       ( unsigned ) C->fileSize, ( unsigned ) xDeltaState.xDelta.ulTargetSize, ( unsigned ) xDeltaState.xDelta.ulCopied ) );
+
+            /* The received file is no longer needed, the image is checked in its place. */
+            ( void ) fclose( C->pFile ); /*lint !e586
+                                          * C standard library call is being used for portability. */
+            C->pFile = xDeltaState.pxTarget;
+            xDeltaState.pxTarget = NULL;
+        }
+    }
+
+    return lError;
+}
+
+static BaseType_t prvDecompressStart( OtaFileContext_t * const C,
+                                      const OtaCompressFrame_t * pxFrame )
+{
+    size_t xPathLength = strlen( ( const char * ) C->pFilePath );
+    uint32_t ulBitmapSize = ( ( ( C->fileSize + otaconfigFILE_BLOCK_SIZE - 1UL ) >> otaconfigLOG2_FILE_BLOCK_SIZE ) + 7UL ) / 8UL;
+
+    prvDecompressStop( pdTRUE );
+
+    xDecompressState.pxFileContext = C;
+    xDecompressState.xCompressed = pdTRUE;
+    xDecompressState.ulImageSize = pxFrame->ulImageSize;
+    xDecompressState.pucFrameBuffer = pvPortMalloc( OTA_COMPRESS_MAX_FRAME_LENGTH );
+    xDecompressState.pucBlocksDone = pvPortMalloc( ulBitmapSize );
+    xDecompressState.pcImagePath = pvPortMalloc( xPathLength + sizeof( OTA_PAL_DECOMPRESS_TARGET_SUFFIX ) );
+
+    if( ( xDecompressState.pucFrameBuffer != NULL ) &&
+        ( xDecompressState.pucBlocksDone != NULL ) &&
+        ( xDecompressState.pcImagePath != NULL ) )
+    {
+        memset( xDecompressState.pucBlocksDone, 0, ulBitmapSize );
+        ( void ) memcpy( xDecompressState.pcImagePath, C->pFilePath, xPathLength );
+        ( void ) memcpy( &( xDecompressState.pcImagePath[ xPathLength ] ), OTA_PAL_DECOMPRESS_TARGET_SUFFIX, sizeof( OTA_PAL_DECOMPRESS_TARGET_SUFFIX ) );
+
+        xDecompressState.pxImage = fopen( xDecompressState.pcImagePath, "w+b" ); /*lint !e586
+                                                                                  * C standard library call is being used for portability. */
+    }
+
+    if( xDecompressState.pxImage != NULL )
+    {
+        LogInfo( ( "Receiving a compressed file, decompressing it into a %u byte image.\r\n",
+                   ( unsigned ) xDecompressState.ulImageSize ) );
+    }
+    else
+    {
+        LogError( ( "Failed to create the file to decompress the image into.\r\n" ) );
+    }
+
+    return ( xDecompressState.pxImage != NULL ) ? pdTRUE : pdFALSE;
+}
+
+static void prvDecompressStop( BaseType_t xRemoveImage )
+{
+    if( xDecompressState.pxImage != NULL )
+    {
+        ( void ) fclose( xDecompressState.pxImage ); /*lint !e586
+                                                      * C standard library call is being used for portability. */
+    }
+
+    if( xDecompressState.pcImagePath != NULL )
+    {
+        if( xRemoveImage == pdTRUE )
+        {
+            ( void ) remove( xDecompressState.pcImagePath ); /*lint !e586
+                                                              * C standard library call is being used for portability. */
+        }
+
+        vPortFree( xDecompressState.pcImagePath );
+    }
+
+    if( xDecompressState.pucFrameBuffer != NULL )
+    {
+        vPortFree( xDecompressState.pucFrameBuffer );
+    }
+
+    if( xDecompressState.pucBlocksDone != NULL )
+    {
+        vPortFree( xDecompressState.pucBlocksDone );
+    }
+
+    memset( &xDecompressState, 0, sizeof( xDecompressState ) );
+}
+
+static BaseType_t prvDecompressBlock( OtaFileContext_t * const C,
+                                      uint32_t ulOffset,
+                                      const uint8_t * pucData,
+                                      uint32_t ulLength )
+{
+    BaseType_t xResult = pdTRUE;
+    OtaCompressFrame_t xFrame;
+    uint32_t ulBlock = ulOffset >> otaconfigLOG2_FILE_BLOCK_SIZE;
+    BaseType_t xIsFrame = OtaCompress_ParseFrame( pucData, ( size_t ) ulLength, &xFrame );
+
+    if( xDecompressState.pxFileContext != C )
+    {
+        if( ( C->fileAttributes & OTA_PAL_FILE_ATTRIBUTE_COMPRESSED ) == 0UL )
+        {
+            /* Remember the file is not compressed. */
+            prvDecompressStop( pdTRUE );
+            xDecompressState.pxFileContext = C;
+        }
+        else if( xIsFrame == pdTRUE )
+        {
+            xResult = prvDecompressStart( C, &xFrame );
+        }
+        else
+        {
+            LogError( ( "The job marks the file compressed but block %u is not a frame.\r\n", ( unsigned ) ulBlock ) );
+            xResult = pdFALSE;
+        }
+    }
+
+    if( ( xResult == pdFALSE ) || ( xDecompressState.xCompressed == pdFALSE ) )
+    {
+        /* Nothing to do. */
+    }
+    else if( xDecompressState.pxImage == NULL )
+    {
+        /* The image could not be created. */
+        xResult = pdFALSE;
+    }
+    else if( ( xIsFrame == pdFALSE ) ||
+             ( xFrame.ucLog2BlockSize != otaconfigLOG2_FILE_BLOCK_SIZE ) ||
+             ( xFrame.ulImageSize != xDecompressState.ulImageSize ) ||
+             ( ( ulOffset & ( otaconfigFILE_BLOCK_SIZE - 1UL ) ) != 0UL ) ||
+             ( ulOffset >= C->fileSize ) )
+    {
+        LogError( ( "Block %u of the compressed file is not a frame of it.\r\n", ( unsigned ) ulBlock ) );
+        xResult = pdFALSE;
+    }
+    else if( ( xDecompressState.pucBlocksDone[ ulBlock >> 3 ] & ( 1U << ( ulBlock & 7UL ) ) ) != 0U )
+    {
+        /* Already decompressed. */
+    }
+    else if( OtaCompress_Decompress( &xFrame, xDecompressState.pucFrameBuffer, OTA_COMPRESS_MAX_FRAME_LENGTH ) == pdFALSE )
+    {
+        LogError( ( "Failed to decompress block %u.\r\n", ( unsigned ) ulBlock ) );
+        xResult = pdFALSE;
+    }
+    else if( ( fseek( xDecompressState.pxImage, ( long ) xFrame.ulOffset, SEEK_SET ) != 0 ) || /*lint !e586
+                                                                                                 * C standard library call is being used for portability. */
+             ( fwrite( xDecompressState.pucFrameBuffer, 1, xFrame.ulLength, xDecompressState.pxImage ) != xFrame.ulLength ) ) /*lint !e586
+                                                                                                                               * C standard library call is being used for portability. */
+    {
+        LogError( ( "Failed to write the decompressed block %u.\r\n", ( unsigned ) ulBlock ) );
+        xResult = pdFALSE;
+    }
+    else
+    {
+        xDecompressState.pucBlocksDone[ ulBlock >> 3 ] |= ( uint8_t ) ( 1U << ( ulBlock & 7UL ) );
+        xDecompressState.ulImageBytes += xFrame.ulLength;
+    }
+
+    return xResult;
+}
+
+static int32_t prvDecompressFinish( OtaFileContext_t * const C )
+{
+    int32_t lError = 0;
+    uint32_t ulBlock;
+    uint32_t ulBlockCount = ( C->fileSize + otaconfigFILE_BLOCK_SIZE - 1UL ) >> otaconfigLOG2_FILE_BLOCK_SIZE;
+    uint32_t ulBytesToRead;
+    uint32_t ulBlocksRead = 0UL;
+    uint8_t * pucBuf = NULL;
+
+    for( ulBlock = 0UL; ( lError == 0 ) && ( ulBlock < ulBlockCount ); ulBlock++ )
+    {
+        if( ( xDecompressState.pxFileContext == C ) &&
+            ( ( xDecompressState.xCompressed == pdFALSE ) ||
+              ( ( xDecompressState.pucBlocksDone[ ulBlock >> 3 ] & ( 1U << ( ulBlock & 7UL ) ) ) != 0U ) ) )
+        {
+            continue;
+        }
+
+        if( pucBuf == NULL )
+        {
+            pucBuf = pvPortMalloc( otaconfigFILE_BLOCK_SIZE );
+        }
+
+        ulBytesToRead = C->fileSize - ( ulBlock << otaconfigLOG2_FILE_BLOCK_SIZE );
+        ulBytesToRead = ( ulBytesToRead < otaconfigFILE_BLOCK_SIZE ) ? ulBytesToRead : otaconfigFILE_BLOCK_SIZE;
+
+        if( ( pucBuf == NULL ) ||
+            ( fseek( C->pFile, ( long ) ( ulBlock << otaconfigLOG2_FILE_BLOCK_SIZE ), SEEK_SET ) != 0 ) || /*lint !e586
+                                                                                                              * C standard library call is being used for portability. */
+            ( fread( pucBuf, 1, ulBytesToRead, C->pFile ) != ulBytesToRead ) ) /*lint !e586
+                                                                                * C standard library call is being used for portability. */
+        {
+            lError = ( pucBuf == NULL ) ? ENOMEM : EIO;
+        }
+        else if( prvDecompressBlock( C, ulBlock << otaconfigLOG2_FILE_BLOCK_SIZE, pucBuf, ulBytesToRead ) == pdFALSE )
+        {
+            lError = EINVAL;
+        }
+        else
+        {
+            ulBlocksRead++;
+        }
+    }
+
+    if( pucBuf != NULL )
+    {
+        vPortFree( pucBuf );
+    }
+
+    if( ( lError == 0 ) && ( xDecompressState.pxFileContext == C ) && ( xDecompressState.xCompressed == pdTRUE ) )
+    {
+        if( xDecompressState.ulImageBytes != xDecompressState.ulImageSize )
+        {
+            LogError( ( "The frames of the compressed file make %u of the %u bytes of the image.\r\n",
+                        ( unsigned ) xDecompressState.ulImageBytes, ( unsigned ) xDecompressState.ulImageSize ) );
+            lError = EINVAL;
+        }
+        else if( ( fflush( xDecompressState.pxImage ) != 0 ) || ( _commit( _fileno( xDecompressState.pxImage ) ) != 0 ) )
+        {
+            lError = errno;
+        }
+        else
+        {
+            LogInfo( ( "Compressed file of %u bytes decompressed into a %u byte image, %u blocks read back.\r\n",
+                       ( unsigned ) C->fileSize, ( unsigned ) xDecompressState.ulImageSize, ( unsigned ) ulBlocksRead ) );
+        }
+    }
+
+    return lError;
+}
+
+static int32_t prvReplaceReceivedFile( OtaFileContext_t * const C,
+                                       const char * pcPath )
+{
+    int32_t lError = 0;
+
+    if( ( remove( ( const char * ) C->pFilePath ) != 0 ) ||     /*lint !e586
+                                                                 * C standard library call is being used for portability. */
+        ( rename( pcPath, ( const char * ) C->pFilePath ) != 0 ) ) /*lint !e586
+                                                                    * C standard library call is being used for portability. */
+    {
+        LogError( ( "Failed to replace the received file with the image.\r\n" ) );
+        lError = errno;
+    }
+
+    return lError;
+}
+
+static BaseType_t prvWriteBehindInit( void )
+{
+    static OtaPalWriteExtent_t xExtents[ OTA_PAL_WRITE_EXTENT_COUNT ];
+    OtaPalWriteExtent_t * pxExtent;
+    uint32_t ulIndex;
+
+    if( xWriteBehind.xFreeExtents == NULL )
+    {
+        xWriteBehind.xFreeExtents = xQueueCreate( OTA_PAL_WRITE_EXTENT_COUNT, sizeof( OtaPalWriteExtent_t * ) );
+        xWriteBehind.xFullExtents = xQueueCreate( OTA_PAL_WRITE_EXTENT_COUNT, sizeof( OtaPalWriteExtent_t * ) );
+
+        if( ( xWriteBehind.xFreeExtents != NULL ) && ( xWriteBehind.xFullExtents != NULL ) )
+        {
+            for( ulIndex = 0; ulIndex < OTA_PAL_WRITE_EXTENT_COUNT; ulIndex++ )
+            {
+                xExtents[ ulIndex ].pucData = pvPortMalloc( OTA_PAL_WRITE_EXTENT_SIZE );
+
+                if( xExtents[ ulIndex ].pucData == NULL )
+                {
+                    break;
+                }
+
+                pxExtent = &xExtents[ ulIndex ];
+                ( void ) xQueueSend( xWriteBehind.xFreeExtents, &pxExtent, 0 );
+            }
+        }
+
+        if( ( xWriteBehind.xFreeExtents == NULL ) ||
+            ( xWriteBehind.xFullExtents == NULL ) ||
+            ( ulIndex < OTA_PAL_WRITE_EXTENT_COUNT ) ||
+            ( xTaskCreate( prvWriterTask,
+                           "OTAWriter",
+                           OTA_PAL_WRITER_TASK_STACK_SIZE,
+                           NULL,
+                           OTA_PAL_WRITER_TASK_PRIORITY,
+                           NULL ) != pdPASS ) )
+        {
+            LogWarn( ( "Failed to start the OTA writer task, blocks will be written as they arrive.\r\n" ) );
+
+            for( ulIndex = 0; ulIndex < OTA_PAL_WRITE_EXTENT_COUNT; ulIndex++ )
+            {
+                vPortFree( xExtents[ ulIndex ].pucData );
+                xExtents[ ulIndex ].pucData = NULL;
+            }
+
+            if( xWriteBehind.xFreeExtents != NULL )
+            {
+                vQueueDelete( xWriteBehind.xFreeExtents );
+            }
+
+            if( xWriteBehind.xFullExtents != NULL )
+            {
+                vQueueDelete( xWriteBehind.xFullExtents );
+            }
+
+            memset( &xWriteBehind, 0, sizeof( xWriteBehind ) );
+        }
+    }
+
+    return( xWriteBehind.xFreeExtents != NULL );
+}
+
+static void prvWriterTask( void * pvParameters )
+{
+    OtaPalWriteExtent_t * pxExtent;
+
+    ( void ) pvParameters;
+
+    for( ; ; )
+    {
+        if( xQueueReceive( xWriteBehind.xFullExtents, &pxExtent, portMAX_DELAY ) == pdTRUE )
+        {
+            /* Once a write has failed the file is bad, so the rest are not
+             * attempted. */
+            if( xWriteBehind.lError == 0 )
+            {
+                if( ( fseek( pxExtent->pFile, ( long ) pxExtent->ulOffset, SEEK_SET ) != 0 ) || /*lint !e586
+                                                                                                 * C standard library call is being used for portability. */
+                    ( fwrite( pxExtent->pucData, 1, pxExtent->ulLength, pxExtent->pFile ) != pxExtent->ulLength ) ) /*lint !e586
+                                                                                                                     * C standard library call is being used for portability. */
+                {
+                    LogError( ( "ERROR - Failed to write %u bytes at offset %u.\r\n",
+                                ( unsigned ) pxExtent->ulLength, ( unsigned ) pxExtent->ulOffset ) );
+                    xWriteBehind.lError = ( errno != 0 ) ? errno : EIO;
+                }
+                else
+                {
+                    xWriteBehind.ulExtents++;
+                }
+            }
+
+            ( void ) xQueueSend( xWriteBehind.xFreeExtents, &pxExtent, portMAX_DELAY );
+        }
+    }
+}
+
+static int32_t prvWriteBehindQueue( OtaFileContext_t * const C,
+                                    uint32_t ulOffset,
+                                    const uint8_t * pucData,
+                                    uint32_t ulBlockSize )
+{
+    OtaPalWriteExtent_t * pxExtent = xWriteBehind.pxFilling;
+    int32_t lResult = ( int32_t ) ulBlockSize;
+
+    if( xWriteBehind.lError != 0 )
+    {
+        lResult = OTA_PAL_INT16_NEGATIVE_MASK | xWriteBehind.lError;
+    }
+    else
+    {
+        if( ( pxExtent != NULL ) &&
+            ( ( pxExtent->pFile != C->pFile ) ||
+              ( ulOffset != ( pxExtent->ulOffset + pxExtent->ulLength ) ) ||
+              ( ( pxExtent->ulLength + ulBlockSize ) > ( OTA_PAL_WRITE_EXTENT_SIZE - ( pxExtent->ulOffset % OTA_PAL_WRITE_EXTENT_SIZE ) ) ) ) )
+        {
+            prvWriteBehindSubmit();
+        }
+
+        if( xWriteBehind.pxFilling == NULL )
+        {
+            /* Waits for the writer task if every extent is waiting to be
+             * written, so the OTA agent is only held up by a file system
+             * slower than the blocks arrive. */
+            ( void ) xQueueReceive( xWriteBehind.xFreeExtents, &xWriteBehind.pxFilling, portMAX_DELAY );
+            xWriteBehind.pxFilling->pFile = C->pFile;
+            xWriteBehind.pxFilling->ulOffset = ulOffset;
+            xWriteBehind.pxFilling->ulLength = 0UL;
+        }
+
+        pxExtent = xWriteBehind.pxFilling;
+        configASSERT( ( pxExtent->ulLength + ulBlockSize ) <= OTA_PAL_WRITE_EXTENT_SIZE );
+        memcpy( &pxExtent->pucData[ pxExtent->ulLength ], pucData, ulBlockSize );
+        pxExtent->ulLength += ulBlockSize;
+        xWriteBehind.ulBlocks++;
+
+        if( ( ( pxExtent->ulOffset + pxExtent->ulLength ) % OTA_PAL_WRITE_EXTENT_SIZE ) == 0UL )
+        {
+            prvWriteBehindSubmit();
+        }
+    }
+
+    return lResult;
+}
+
+static void prvWriteBehindSubmit( void )
+{
+    if( xWriteBehind.pxFilling != NULL )
+    {
+        ( void ) xQueueSend( xWriteBehind.xFullExtents, &xWriteBehind.pxFilling, portMAX_DELAY );
+        xWriteBehind.pxFilling = NULL;
+    }
+}
+
+static int32_t prvWriteBehindDrain( BaseType_t xDiscard )
+{
+    OtaPalWriteExtent_t * pxExtents[ OTA_PAL_WRITE_EXTENT_COUNT ];
+    uint32_t ulIndex;
+    int32_t lError = 0;
+
+    if( xWriteBehind.xFreeExtents != NULL )
+    {
+        if( xWriteBehind.pxFilling != NULL )
+        {
+            if( xDiscard == pdTRUE )
+            {
+                ( void ) xQueueSend( xWriteBehind.xFreeExtents, &xWriteBehind.pxFilling, 0 );
+                xWriteBehind.pxFilling = NULL;
+            }
+            else
+            {
+                prvWriteBehindSubmit();
+            }
+        }
+
+        if( xDiscard == pdTRUE )
+        {
+            /* Extents received by the writer task after this are not
+             * written. */
+            xWriteBehind.lError = ECANCELED;
+        }
+
+        /* The writer task is idle once it has returned every extent. */
+        for( ulIndex = 0; ulIndex < OTA_PAL_WRITE_EXTENT_COUNT; ulIndex++ )
+        {
+            ( void ) xQueueReceive( xWriteBehind.xFreeExtents, &pxExtents[ ulIndex ], portMAX_DELAY );
+        }
+
+        for( ulIndex = 0; ulIndex < OTA_PAL_WRITE_EXTENT_COUNT; ulIndex++ )
+        {
+            ( void ) xQueueSend( xWriteBehind.xFreeExtents, &pxExtents[ ulIndex ], 0 );
+        }
+
+        lError = ( xDiscard == pdTRUE ) ? 0 : xWriteBehind.lError;
+    }
+
+    return lError;
+}
+
+static int32_t prvSyncFile( OtaFileContext_t * const C )
+{
+    int32_t lError = prvWriteBehindDrain( pdFALSE );
+
+    if( ( lError == 0 ) &&
+        ( ( fflush( C->pFile ) != 0 ) || ( _commit( _fileno( C->pFile ) ) != 0 ) ) )
+    {
+        lError = errno;
+    }
+
+    return lError;
+}
+
+/*-----------------------------------------------------------*/
+
 /* Attempt to create a new receive file for the file chunks as they come in. */
 
 OtaPalStatus_t otaPal_CreateFileForRx( OtaFileContext_t* const C )
@@ -68,13 +1115,30 @@ OtaPalStatus_t otaPal_CreateFileForRx( OtaFileContext_t* const C )
     {
         if ( C->pFilePath != NULL )
         {
+            /* Forget the extents and any error of the last file. */
+            if( prvWriteBehindInit() == pdTRUE )
+            {
+                ( void ) prvWriteBehindDrain( pdTRUE );
+                xWriteBehind.lError = 0;
+                xWriteBehind.ulBlocks = 0UL;
+                xWriteBehind.ulExtents = 0UL;
+            }
+
+            prvDecompressStop( pdTRUE );
+
             C->pFile = fopen( ( const char * )C->pFilePath, "w+b" ); /*lint !e586
                                                                            * C standard library call is being used for portability. */
 
             if ( C->pFile != NULL )
             {
+                /* Blocks are written whole, so a stdio buffer would only add
+                 * a copy of each block on its way from the agent's decode buffer
+                 * to the file. */
+                ( void ) setvbuf( C->pFile, NULL, _IONBF, 0 );
+
                 mainErr = OtaPalSuccess;
                 LogInfo( ( "Receive file created.\r\n" ) );
+                prvHashStart( C );
             }
             else
             {
@@ -99,6 +1163,98 @@ OtaPalStatus_t otaPal_CreateFileForRx( OtaFileContext_t* const C )
 }
 
 
+/* Reopen a receive file that was partly received before a reset. */
+
+OtaPalStatus_t otaPal_ResumeFileForRx( OtaFileContext_t * const C )
+{
+    OtaPalMainStatus_t mainErr = OtaPalRxFileCreateFailed;
+    OtaPalSubStatus_t subErr = 0;
+    uint32_t ulBlock, ulBlockCount;
+
+    if( ( C != NULL ) && ( C->pFilePath != NULL ) && ( C->pRxBlockBitmap != NULL ) )
+    {
+        if( prvWriteBehindInit() == pdTRUE )
+        {
+            ( void ) prvWriteBehindDrain( pdTRUE );
+            xWriteBehind.lError = 0;
+            xWriteBehind.ulBlocks = 0UL;
+            xWriteBehind.ulExtents = 0UL;
+        }
+
+        /* Blocks received before the reset are decompressed when the file is
+         * closed. */
+        prvDecompressStop( pdTRUE );
+
+        /* Open the file without truncating it, keeping the blocks received. */
+        C->pFile = fopen( ( const char * ) C->pFilePath, "r+b" ); /*lint !e586
+                                                                   * C standard library call is being used for portability. */
+
+        if( C->pFile != NULL )
+        {
+            ( void ) setvbuf( C->pFile, NULL, _IONBF, 0 );
+            mainErr = OtaPalSuccess;
+
+            /* The hash of the blocks received cannot be saved, so the received
+             * prefix of the file is read back and hashed again. */
+            prvHashStart( C );
+
+            if( xHashState.pxFileContext == C )
+            {
+                ulBlockCount = ( C->fileSize + otaconfigFILE_BLOCK_SIZE - 1UL ) >> otaconfigLOG2_FILE_BLOCK_SIZE;
+
+                for( ulBlock = 0; ulBlock < ulBlockCount; ulBlock++ )
+                {
+                    /* A clear bit in the agent's bitmap is a block received. */
+                    if( ( C->pRxBlockBitmap[ ulBlock >> 3 ] & ( 1U << ( ulBlock & 7UL ) ) ) == 0U )
+                    {
+                        xHashState.pucBlocksWritten[ ulBlock >> 3 ] |= ( uint8_t ) ( 1U << ( ulBlock & 7UL ) );
+                    }
+                }
+
+                prvHashWrittenBlocks( C );
+            }
+
+            LogInfo( ( "Receive file reopened, %u bytes hashed.\r\n", ( unsigned ) xHashState.ulHashedBytes ) );
+        }
+        else
+        {
+            subErr = errno;
+            LogError( ( "ERROR - Failed to reopen the receive file.\r\n" ) );
+        }
+    }
+    else
+    {
+        LogError( ( "ERROR - Invalid file context provided.\r\n" ) );
+    }
+
+    return OTA_PAL_COMBINE_ERR( mainErr, subErr );
+}
+
+/* Commit the blocks written so far to disk. */
+
+OtaPalStatus_t otaPal_SyncFile( OtaFileContext_t * const C )
+{
+    OtaPalMainStatus_t mainErr = OtaPalSuccess;
+    OtaPalSubStatus_t subErr = 0;
+
+    if( prvContextValidate( C ) == pdTRUE )
+    {
+        subErr = ( OtaPalSubStatus_t ) prvSyncFile( C );
+
+        if( subErr != 0 )
+        {
+            LogError( ( "ERROR - Failed to commit the receive file.\r\n" ) );
+            mainErr = OtaPalFileClose;
+        }
+    }
+    else
+    {
+        mainErr = OtaPalFileClose;
+    }
+
+    return OTA_PAL_COMBINE_ERR( mainErr, subErr );
+}
+
 /* Abort receiving the specified OTA update by closing the file. */
 
 OtaPalStatus_t otaPal_Abort( OtaFileContext_t * const C )
@@ -110,9 +1266,27 @@ OtaPalStatus_t otaPal_Abort( OtaFileContext_t * const C )
 
     if( NULL != C )
     {
+        if( xHashState.pxFileContext == C )
+        {
+            prvHashStop( pdTRUE );
+        }
+
+        if( xDeltaState.pxFileContext == C )
+        {
+            prvDeltaStop( pdTRUE );
+        }
+
+        if( xDecompressState.pxFileContext == C )
+        {
+            prvDecompressStop( pdTRUE );
+        }
+
         /* Close the OTA update file if it's open. */
         if( NULL != C->pFile )
         {
+            /* The blocks not yet written are not needed. */
+            ( void ) prvWriteBehindDrain( pdTRUE );
+
             lFileCloseResult = fclose( C->pFile ); /*lint !e482 !e586
                                                       * Context file handle state is managed by this API. */
             C->pFile = NULL;
@@ -152,7 +1326,25 @@ int16_t otaPal_WriteBlock( OtaFileContext_t * const C,
 {
     int32_t lResult = 0;
 
-    if( prvContextValidate( C ) == pdTRUE )
+    if( ( prvContextValidate( C ) == pdTRUE ) && ( xWriteBehind.xFreeExtents != NULL ) )
+    {
+        lResult = prvWriteBehindQueue( C, ulOffset, pacData, ulBlockSize );
+
+        if( lResult == ( int32_t ) ulBlockSize )
+        {
+            prvHashBlock( C, ulOffset, pacData, ulBlockSize );
+
+            if( prvDecompressBlock( C, ulOffset, pacData, ulBlockSize ) == pdFALSE )
+            {
+                lResult = -1;
+            }
+        }
+        else
+        {
+            LogError( ( "ERROR - A write of an earlier block failed\r\n" ) );
+        }
+    }
+    else if( prvContextValidate( C ) == pdTRUE )
     {
         lResult = fseek( C->pFile, ulOffset, SEEK_SET ); /*lint !e586 !e713 !e9034
                                                             * C standard library call is being used for portability. */
@@ -162,7 +1354,16 @@ int16_t otaPal_WriteBlock( OtaFileContext_t * const C,
             lResult = fwrite( pacData, 1, ulBlockSize, C->pFile ); /*lint !e586 !e713 !e9034
                                                                       * C standard library call is being used for portability. */
 
-            if( lResult < 0 )
+            if( lResult == ( int32_t ) ulBlockSize )
+            {
+                prvHashBlock( C, ulOffset, pacData, ulBlockSize );
+
+                if( prvDecompressBlock( C, ulOffset, pacData, ulBlockSize ) == pdFALSE )
+                {
+                    lResult = -1;
+                }
+            }
+            else if( lResult < 0 )
             {
                 LogError( ( "ERROR - fwrite failed\r\n" ) );
                 /* Mask to return a negative value. */
@@ -199,15 +1400,46 @@ OtaPalStatus_t otaPal_CloseFile( OtaFileContext_t * const C )
 
     if( prvContextValidate( C ) == pdTRUE )
     {
-        if( C->pSignature != NULL )
+        /* Write the blocks still waiting, then commit the file to disk once. */
+        lWindowsError = prvSyncFile( C );
+
+        if( xWriteBehind.xFreeExtents != NULL )
+        {
+            LogInfo( ( "%u blocks written in %u extents.\r\n",
+                       ( unsigned ) xWriteBehind.ulBlocks, ( unsigned ) xWriteBehind.ulExtents ) );
+        }
+
+        if( lWindowsError == 0 )
+        {
+            /* A delta file is checked as the image it reconstructs. */
+            lWindowsError = prvDeltaFinish( C );
+        }
+
+        if( lWindowsError != 0 )
+        {
+            LogError( ( "Failed to write OTA update file.\r\n" ) );
+            mainErr = OtaPalFileClose;
+            subErr = lWindowsError;
+            prvHashStop( pdTRUE );
+        }
+        else if( C->pSignature != NULL )
         {
             /* Verify the file signature, close the file and return the signature verification result. */
             mainErr = otaPal_CheckFileSignature( C );
+
+            /* A compressed file is decompressed once it is known to be genuine. */
+            if( ( mainErr == OtaPalSuccess ) &&
+                ( ( lWindowsError = prvDecompressFinish( C ) ) != 0 ) )
+            {
+                mainErr = OtaPalFileClose;
+                subErr = lWindowsError;
+            }
         }
         else
         {
             LogError( ( "NULL OTA Signature structure.\r\n" ) );
             mainErr = OtaPalSignatureCheckFailed;
+            prvHashStop( pdTRUE );
         }
 
         /* Close the file. */
@@ -222,6 +1454,41 @@ OtaPalStatus_t otaPal_CloseFile( OtaFileContext_t * const C )
             subErr = errno;
         }
 
+        if( xDeltaState.pxFileContext == C )
+        {
+            /* Keep the reconstructed image in place of the received delta file,
+             * or remove it if it failed verification. */
+            if( ( mainErr == OtaPalSuccess ) &&
+                ( ( lWindowsError = prvReplaceReceivedFile( C, xDeltaState.pcTargetPath ) ) != 0 ) )
+            {
+                mainErr = OtaPalFileClose;
+                subErr = lWindowsError;
+            }
+
+            prvDeltaStop( ( mainErr == OtaPalSuccess ) ? pdFALSE : pdTRUE );
+        }
+
+        if( xDecompressState.pxFileContext == C )
+        {
+            /* Likewise keep the decompressed image of a compressed file. */
+            if( xDecompressState.pxImage != NULL )
+            {
+                ( void ) fclose( xDecompressState.pxImage ); /*lint !e586
+                                                              * C standard library call is being used for portability. */
+                xDecompressState.pxImage = NULL;
+            }
+
+            if( ( mainErr == OtaPalSuccess ) &&
+                ( xDecompressState.xCompressed == pdTRUE ) &&
+                ( ( lWindowsError = prvReplaceReceivedFile( C, xDecompressState.pcImagePath ) ) != 0 ) )
+            {
+                mainErr = OtaPalFileClose;
+                subErr = lWindowsError;
+            }
+
+            prvDecompressStop( ( mainErr == OtaPalSuccess ) ? pdFALSE : pdTRUE );
+        }
+
         if( mainErr == OtaPalSuccess )
         {
             LogInfo( ( "%s signature verification passed.\r\n", OTA_JsonFileSignatureKey ) );
@@ -257,8 +1524,42 @@ static OtaPalMainStatus_t otaPal_CheckFileSignature( OtaFileContext_t * const C
     uint8_t * pucBuf, * pucSignerCert;
     void * pvSigVerifyContext;
 
-    if( prvContextValidate( C ) == pdTRUE )
+    if( ( prvContextValidate( C ) == pdTRUE ) &&
+        ( xHashState.pxFileContext == C ) &&
+        ( xHashState.ulHashedBytes == C->fileSize ) )
+    {
+        /* The whole file was hashed as it was received. */
+        LogInfo( ( "Started %s signature verification of file hashed as received, %u bytes read back, file: %s\r\n",
+                    OTA_JsonFileSignatureKey, ( unsigned ) xHashState.ulBytesReread, ( const char * ) C->pCertFilepath ) );
+        pvSigVerifyContext = xHashState.pvSigVerifyContext;
+        prvHashStop( pdFALSE );
+        pucSignerCert = otaPal_ReadAndAssumeCertificate( ( const uint8_t * const ) C->pCertFilepath, &ulSignerCertSize );
+
+        if( pucSignerCert != NULL )
+        {
+            if( pdFALSE == CRYPTO_SignatureVerificationFinal( pvSigVerifyContext,
+                                                              ( char * ) pucSignerCert,
+                                                              ( size_t ) ulSignerCertSize,
+                                                              C->pSignature->data,
+                                                              C->pSignature->size ) ) /*lint !e732 !e9034 Allow comparison in this context. */
+            {
+                eResult = OtaPalSignatureCheckFailed;
+            }
+
+            /* Free the signer certificate that we now own after prvReadAndAssumeCertificate(). */
+            vPortFree( pucSignerCert );
+        }
+        else
+        {
+            ( void ) CRYPTO_SignatureVerificationFinal( pvSigVerifyContext, NULL, 0, NULL, 0 );
+            eResult = OtaPalBadSignerCert;
+        }
+    }
+    else if( prvContextValidate( C ) == pdTRUE )
     {
+        /* The file could not be hashed as it was received, so read it back. */
+        prvHashStop( pdTRUE );
+
         /* Verify an ECDSA-SHA256 signature. */
         if( pdFALSE == CRYPTO_SignatureVerificationStart( &pvSigVerifyContext, cryptoASYMMETRIC_ALGORITHM_ECDSA, cryptoHASH_ALGORITHM_SHA256 ) )
         {
@@ -82,6 +82,39 @@ OtaPalStatus_t  otaPal_Abort( OtaFileContext_t * const C );
  */
 OtaPalStatus_t  otaPal_CreateFileForRx( OtaFileContext_t * const C );
 
+/**
+ * @brief Reopen a receive file that was partly received before a reset,
+ * keeping the blocks already written.
+ *
+ * @note Used in place of otaPal_CreateFileForRx() when a checkpoint of the file
+ * is found.  The blocks received are those whose bits are clear in
+ * C->pRxBlockBitmap, which must be restored from the checkpoint first.
+ *
+ * @param[in] C OTA file context information.
+ *
+ * @return The OTA PAL layer error code combined with the MCU specific error code. See OTA Agent
+ * error codes information in ota.h.
+ *
+ * OTA_ERR_NONE is returned when the file was reopened.
+ * OTA_ERR_RX_FILE_CREATE_FAILED is returned if the file could not be reopened, in which case it
+ * should be created again with otaPal_CreateFileForRx().
+ */
+OtaPalStatus_t  otaPal_ResumeFileForRx( OtaFileContext_t * const C );
+
+/**
+ * @brief Commit the blocks written to the receive file so far to the storage
+ * medium, so a checkpoint saved after this returns can rely on them.
+ *
+ * @param[in] C OTA file context information.
+ *
+ * @return The OTA PAL layer error code combined with the MCU specific error code. See OTA Agent
+ * error codes information in ota.h.
+ *
+ * OTA_ERR_NONE is returned when the blocks were committed.
+ * OTA_ERR_FILE_CLOSE is returned if a block could not be written.
+ */
+OtaPalStatus_t  otaPal_SyncFile( OtaFileContext_t * const C );
+
 /* @brief Authenticate and close the underlying receive file in the specified OTA context.
  *
  * @note The input OtaFileContext_t C is checked for NULL by the OTA agent before this
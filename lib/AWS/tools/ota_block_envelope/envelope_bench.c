@@ -0,0 +1,257 @@
+/*
+ * FreeRTOS V202011.00
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://aws.amazon.com/freertos
+ *
+ */
+
+/*
+ * Measures how fast ota_block_envelope.c decodes stream block messages of the
+ * OTA block size, with the specialized parser and with the general tinycbor
+ * parser it falls back to.  Before timing, it checks the two agree on the
+ * block messages and on many corrupted copies of them.  See README.md to build.
+ *
+ *     envelope_bench [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ota_config.h"
+#include "ota_block_envelope.h"
+#include "cbor.h"
+
+/* Messages decoded in turn, each of a different block. */
+#define MESSAGE_COUNT      64U
+
+/* Room for a block and the rest of its message. */
+#define MESSAGE_SIZE       ( otaconfigFILE_BLOCK_SIZE + 64U )
+
+/* Corrupted copies of each message checked. */
+#define MUTATION_COUNT     20000U
+
+typedef bool ( * DecodeFunction_t )( const uint8_t * pucMessage,
+                                     size_t xMessageLength,
+                                     OtaBlockEnvelope_t * pxEnvelope );
+
+typedef struct BenchMessage
+{
+    uint8_t ucData[ MESSAGE_SIZE ];
+    size_t xLength;
+} BenchMessage_t;
+
+static BenchMessage_t xMessages[ MESSAGE_COUNT ];
+
+/* Encode a block message as the streaming service does, with an extra key
+ * when xExtraKey is set so that it is decoded by the general parser. */
+static size_t prvEncodeBlock( uint8_t * pucOut,
+                              size_t xOutSize,
+                              int lFileId,
+                              int lBlockId,
+                              const uint8_t * pucPayload,
+                              size_t xPayloadLength,
+                              bool xExtraKey )
+{
+    CborEncoder xEncoder, xMapEncoder;
+    CborError xError;
+
+    cbor_encoder_init( &xEncoder, pucOut, xOutSize, 0 );
+    xError = cbor_encoder_create_map( &xEncoder, &xMapEncoder, xExtraKey ? 5 : 4 );
+    xError |= cbor_encode_text_stringz( &xMapEncoder, "f" );
+    xError |= cbor_encode_int( &xMapEncoder, lFileId );
+    xError |= cbor_encode_text_stringz( &xMapEncoder, "i" );
+    xError |= cbor_encode_int( &xMapEncoder, lBlockId );
+    xError |= cbor_encode_text_stringz( &xMapEncoder, "l" );
+    xError |= cbor_encode_int( &xMapEncoder, ( int64_t ) xPayloadLength );
+
+    if( xExtraKey )
+    {
+        xError |= cbor_encode_text_stringz( &xMapEncoder, "x" );
+        xError |= cbor_encode_int( &xMapEncoder, 0 );
+    }
+
+    xError |= cbor_encode_text_stringz( &xMapEncoder, "p" );
+    xError |= cbor_encode_byte_string( &xMapEncoder, pucPayload, xPayloadLength );
+    xError |= cbor_encoder_close_container( &xEncoder, &xMapEncoder );
+
+    if( xError != CborNoError )
+    {
+        fprintf( stderr, "failed to encode a block message\n" );
+        exit( 1 );
+    }
+
+    return cbor_encoder_get_buffer_size( &xEncoder, pucOut );
+}
+
+/* Decode with both parsers and report whether they agree. */
+static bool prvAgree( const uint8_t * pucMessage,
+                      size_t xLength )
+{
+    OtaBlockEnvelope_t xSpecialized = { 0 }, xGeneric = { 0 };
+    bool xSpecializedDecoded = decodeOtaBlockEnvelope( pucMessage, xLength, &xSpecialized );
+    bool xGenericDecoded = decodeOtaBlockEnvelopeGeneric( pucMessage, xLength, &xGeneric );
+
+    return ( xSpecializedDecoded == xGenericDecoded ) &&
+           ( ( xSpecializedDecoded == false ) ||
+             ( ( xSpecialized.lFileId == xGeneric.lFileId ) &&
+               ( xSpecialized.lBlockId == xGeneric.lBlockId ) &&
+               ( xSpecialized.pucPayload == xGeneric.pucPayload ) &&
+               ( xSpecialized.xPayloadLength == xGeneric.xPayloadLength ) ) );
+}
+
+/* Check the parsers agree on each message and on corrupted copies of it, with
+ * bytes changed, bytes cut from the end, or both. */
+static unsigned prvCheck( void )
+{
+    static uint8_t ucCopy[ MESSAGE_SIZE ];
+    unsigned uxMismatches = 0U;
+    unsigned uxMessage, uxMutation, uxChanges;
+    size_t xLength;
+
+    srand( 1U );
+
+    for( uxMessage = 0U; uxMessage < MESSAGE_COUNT; uxMessage++ )
+    {
+        uxMismatches += prvAgree( xMessages[ uxMessage ].ucData, xMessages[ uxMessage ].xLength ) ? 0U : 1U;
+
+        for( uxMutation = 0U; uxMutation < MUTATION_COUNT / MESSAGE_COUNT; uxMutation++ )
+        {
+            xLength = xMessages[ uxMessage ].xLength;
+            memcpy( ucCopy, xMessages[ uxMessage ].ucData, xLength );
+
+            /* The fields are at the start of the message. */
+            for( uxChanges = 1U + ( unsigned ) rand() % 3U; uxChanges > 0U; uxChanges-- )
+            {
+                ucCopy[ ( unsigned ) rand() % 16U ] = ( uint8_t ) rand();
+            }
+
+            if( ( rand() % 4 ) == 0 )
+            {
+                xLength -= ( size_t ) rand() % xLength;
+            }
+
+            uxMismatches += prvAgree( ucCopy, xLength ) ? 0U : 1U;
+        }
+    }
+
+    return uxMismatches;
+}
+
+static double prvNow( void )
+{
+    struct timespec xNow;
+
+    clock_gettime( CLOCK_MONOTONIC, &xNow );
+
+    return ( double ) xNow.tv_sec + ( ( double ) xNow.tv_nsec / 1e9 );
+}
+
+/* Time the decoding of the messages, returning the best time of a message. */
+static double prvTime( DecodeFunction_t xDecode,
+                       const BenchMessage_t * pxMessages,
+                       unsigned uxIterations )
+{
+    OtaBlockEnvelope_t xEnvelope;
+    volatile int32_t lSum = 0;
+    unsigned uxRun, uxIteration, uxMessage;
+    double dStart, dElapsed, dBest = 0.0;
+
+    for( uxRun = 0U; uxRun < 5U; uxRun++ )
+    {
+        dStart = prvNow();
+
+        for( uxIteration = 0U; uxIteration < uxIterations; uxIteration++ )
+        {
+            for( uxMessage = 0U; uxMessage < MESSAGE_COUNT; uxMessage++ )
+            {
+                if( xDecode( pxMessages[ uxMessage ].ucData, pxMessages[ uxMessage ].xLength, &xEnvelope ) == false )
+                {
+                    fprintf( stderr, "failed to decode a block message\n" );
+                    exit( 1 );
+                }
+
+                lSum += xEnvelope.lBlockId;
+            }
+        }
+
+        dElapsed = ( prvNow() - dStart ) / ( ( double ) uxIterations * MESSAGE_COUNT );
+        dBest = ( ( uxRun == 0U ) || ( dElapsed < dBest ) ) ? dElapsed : dBest;
+    }
+
+    ( void ) lSum;
+
+    return dBest;
+}
+
+int main( int argc,
+          char ** argv )
+{
+    static BenchMessage_t xExtraKeyMessages[ MESSAGE_COUNT ];
+    static uint8_t ucPayload[ otaconfigFILE_BLOCK_SIZE ];
+    int lIterations = ( argc > 1 ) ? atoi( argv[ 1 ] ) : 20000;
+    unsigned uxMessage, uxMismatches;
+    size_t xIndex;
+    double dSpecialized, dGeneric, dFallback;
+
+    if( lIterations < 1 )
+    {
+        fprintf( stderr, "usage: %s [iterations]\n", argv[ 0 ] );
+        return 2;
+    }
+
+    for( xIndex = 0U; xIndex < sizeof( ucPayload ); xIndex++ )
+    {
+        ucPayload[ xIndex ] = ( uint8_t ) ( xIndex * 31U + 7U );
+    }
+
+    /* Blocks of a file of a few hundred blocks, so the block IDs take one
+     * and two byte arguments. */
+    for( uxMessage = 0U; uxMessage < MESSAGE_COUNT; uxMessage++ )
+    {
+        xMessages[ uxMessage ].xLength = prvEncodeBlock( xMessages[ uxMessage ].ucData, MESSAGE_SIZE, 1,
+                                                         ( int ) ( uxMessage * 5U ), ucPayload, sizeof( ucPayload ), false );
+        xExtraKeyMessages[ uxMessage ].xLength = prvEncodeBlock( xExtraKeyMessages[ uxMessage ].ucData, MESSAGE_SIZE, 1,
+                                                                 ( int ) ( uxMessage * 5U ), ucPayload, sizeof( ucPayload ), true );
+    }
+
+    uxMismatches = prvCheck();
+
+    printf( "%u byte block messages, %u corrupted copies checked, %u disagreements\n",
+            ( unsigned ) xMessages[ 0 ].xLength, MUTATION_COUNT, uxMismatches );
+
+    if( uxMismatches != 0U )
+    {
+        return 1;
+    }
+
+    dSpecialized = prvTime( decodeOtaBlockEnvelope, xMessages, ( unsigned ) lIterations );
+    dGeneric = prvTime( decodeOtaBlockEnvelopeGeneric, xMessages, ( unsigned ) lIterations );
+    dFallback = prvTime( decodeOtaBlockEnvelope, xExtraKeyMessages, ( unsigned ) lIterations );
+
+    printf( "specialized: %.1f ns a message\n", dSpecialized * 1e9 );
+    printf( "tinycbor:    %.1f ns a message, %.1fx the specialized parser\n", dGeneric * 1e9, dGeneric / dSpecialized );
+    printf( "fallback:    %.1f ns a message with an unknown key\n", dFallback * 1e9 );
+
+    return 0;
+}
@@ -0,0 +1,39 @@
+/*
+ * FreeRTOS V202011.00
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://aws.amazon.com/freertos
+ *
+ */
+
+/*
+ * Stands in for the OTA configuration when ota_block_envelope.c is built on
+ * the host for envelope_bench.c, supplying only the definitions it uses.  Not
+ * for use in the firmware build.
+ */
+#ifndef OTA_BLOCK_ENVELOPE_HOST_OTA_CONFIG_H
+#define OTA_BLOCK_ENVELOPE_HOST_OTA_CONFIG_H
+
+/* The OTA file block size of the demo, as in source/configuration-files/ota_config.h. */
+#define otaconfigLOG2_FILE_BLOCK_SIZE    11UL
+#define otaconfigFILE_BLOCK_SIZE         ( 1UL << otaconfigLOG2_FILE_BLOCK_SIZE )
+
+#endif /* OTA_BLOCK_ENVELOPE_HOST_OTA_CONFIG_H */
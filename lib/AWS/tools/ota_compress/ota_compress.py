@@ -0,0 +1,249 @@
+#!/usr/bin/env python3
+"""Compress and decompress OTA files.
+
+A compressed OTA file is made of frames, one to each block the OTA service
+sends, each holding a run of the image compressed on its own.  The device
+decompresses each block as it arrives, in any order.  The format is described
+in lib/AWS/ota-compress/ota_compress.h.
+
+    ota_compress.py compress image.bin image.otaz
+    ota_compress.py decompress image.otaz check.bin
+
+The block size must be the device's otaconfigFILE_BLOCK_SIZE.
+"""
+
+import argparse
+import struct
+import sys
+import time
+
+MAGIC = b"OTAZ"
+VERSION = 1
+HEADER = struct.Struct("<4sBBxxIIHH")
+
+# The longest run a frame may hold, OTA_COMPRESS_MAX_FRAME_LENGTH.
+MAX_FRAME_LENGTH = 32768
+
+# otaconfigFILE_BLOCK_SIZE of the demo.
+DEFAULT_BLOCK_SIZE = 2048
+
+MIN_MATCH = 4
+
+# Earlier positions tried for each match, the most recent first.
+CHAIN = 16
+
+
+def length_cost(length):
+    """Bytes taken by the part of a length that does not fit in the token."""
+    return 0 if length < 15 else (length - 15) // 255 + 1
+
+
+def put_length(out, length):
+    if length >= 15:
+        length -= 15
+        while length >= 255:
+            out.append(255)
+            length -= 255
+        out.append(length)
+
+
+def sequence(out, literals, offset=None, match=0):
+    """Append an LZ4 sequence: literal bytes, then a match unless it is the last."""
+    lit = len(literals)
+    m = match - MIN_MATCH if offset is not None else 0
+    out.append((min(lit, 15) << 4) | min(m, 15))
+    put_length(out, lit)
+    out += literals
+    if offset is not None:
+        out += struct.pack("<H", offset)
+        put_length(out, m)
+
+
+def compress_frame(data, start, budget):
+    """Compress as much of data from start as fits in budget bytes.
+
+    Returns the compressed bytes and the length of the run they hold.
+    """
+    limit = min(len(data), start + MAX_FRAME_LENGTH)
+    out = bytearray()
+    table = {}
+    anchor = start
+    pos = start
+
+    def final_fits(literal_end):
+        lit = literal_end - anchor
+        return len(out) + 1 + length_cost(lit) + lit <= budget
+
+    while pos + MIN_MATCH <= limit:
+        key = data[pos:pos + MIN_MATCH]
+        chain = table.setdefault(key, [])
+        best_len = 0
+        best_pos = 0
+        for cand in reversed(chain):
+            if pos - cand > 0xFFFF:
+                break
+            length = MIN_MATCH
+            while pos + length < limit and data[cand + length] == data[pos + length]:
+                length += 1
+            if length > best_len:
+                best_len, best_pos = length, cand
+        chain.append(pos)
+        if len(chain) > CHAIN:
+            del chain[0]
+
+        if best_len >= MIN_MATCH:
+            lit = pos - anchor
+            cost = 1 + length_cost(lit) + lit + 2 + length_cost(best_len - MIN_MATCH)
+            # Keep room for the last sequence, which may be empty.
+            if len(out) + cost + 1 <= budget:
+                sequence(out, data[anchor:pos], pos - best_pos, best_len)
+                for p in range(pos + 1, min(pos + best_len, limit - MIN_MATCH + 1)):
+                    c = table.setdefault(data[p:p + MIN_MATCH], [])
+                    c.append(p)
+                    if len(c) > CHAIN:
+                        del c[0]
+                pos += best_len
+                anchor = pos
+                continue
+            break
+
+        if not final_fits(pos + 1):
+            break
+        pos += 1
+
+    # The rest as literal bytes, as many as fit.
+    end = min(limit, anchor + budget - len(out))
+    while end > anchor and not final_fits(end):
+        end -= 1
+    sequence(out, data[anchor:end])
+    return bytes(out), end - start
+
+
+def decompress_frame(payload, length):
+    out = bytearray()
+    pos = 0
+    while pos < len(payload):
+        token = payload[pos]
+        pos += 1
+        lit = token >> 4
+        if lit == 15:
+            while True:
+                b = payload[pos]
+                pos += 1
+                lit += b
+                if b != 255:
+                    break
+        out += payload[pos:pos + lit]
+        pos += lit
+        if pos == len(payload):
+            break
+        offset = payload[pos] | (payload[pos + 1] << 8)
+        pos += 2
+        match = token & 15
+        if match == 15:
+            while True:
+                b = payload[pos]
+                pos += 1
+                match += b
+                if b != 255:
+                    break
+        match += MIN_MATCH
+        if offset == 0 or offset > len(out):
+            raise ValueError("match out of range")
+        for _ in range(match):
+            out.append(out[-offset])
+    if len(out) != length:
+        raise ValueError("frame length mismatch")
+    return bytes(out)
+
+
+def compress(image, block_size):
+    if block_size & (block_size - 1) or block_size <= HEADER.size + 16:
+        raise ValueError("the block size must be a power of two larger than %d" % (HEADER.size + 16))
+    log2 = block_size.bit_length() - 1
+    budget = min(block_size - HEADER.size, 0xFFFF)
+    frames = []
+    offset = 0
+    while offset < len(image) or not frames:
+        payload, length = compress_frame(image, offset, budget)
+        frame = HEADER.pack(MAGIC, VERSION, log2, len(image), offset, length, len(payload)) + payload
+        frames.append(frame)
+        offset += length
+        if length == 0:
+            break
+    # Every block but the last is padded to the block size.
+    return b"".join(f.ljust(block_size, b"\0") for f in frames[:-1]) + frames[-1], len(frames)
+
+
+def decompress(data, block_size=None):
+    if len(data) < HEADER.size:
+        raise ValueError("too short")
+    log2 = data[5]
+    if block_size is None:
+        block_size = 1 << log2
+    image = None
+    covered = 0
+    for start in range(0, len(data), block_size):
+        block = data[start:start + block_size]
+        magic, version, blog2, size, offset, length, plen = HEADER.unpack_from(block)
+        if magic != MAGIC or version != VERSION or blog2 != log2:
+            raise ValueError("block %d is not a frame" % (start // block_size))
+        if image is None:
+            image = bytearray(size)
+        if plen > len(block) - HEADER.size or offset + length > size:
+            raise ValueError("block %d is malformed" % (start // block_size))
+        image[offset:offset + length] = decompress_frame(block[HEADER.size:HEADER.size + plen], length)
+        covered += length
+    if covered != len(image):
+        raise ValueError("the frames do not cover the image")
+    return bytes(image)
+
+
+def read(path):
+    with open(path, "rb") as f:
+        return f.read()
+
+
+def write(path, data):
+    with open(path, "wb") as f:
+        f.write(data)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest="command", required=True)
+    p = sub.add_parser("compress", help="compress an image into an OTA file")
+    p.add_argument("image")
+    p.add_argument("compressed")
+    p.add_argument("--block-size", type=int, default=DEFAULT_BLOCK_SIZE,
+                   help="the device's OTA block size (default %d)" % DEFAULT_BLOCK_SIZE)
+    p = sub.add_parser("decompress", help="decompress an OTA file")
+    p.add_argument("compressed")
+    p.add_argument("image")
+    args = parser.parse_args()
+
+    if args.command == "compress":
+        image = read(args.image)
+        start = time.perf_counter()
+        data, frames = compress(image, args.block_size)
+        elapsed = time.perf_counter() - start
+
+        # Never ship a file that does not decompress to the image.
+        if decompress(data, args.block_size) != image:
+            sys.exit("internal error: the file does not decompress to the image")
+
+        write(args.compressed, data)
+        print("%s: %d bytes in %d blocks, %.1f%% of %d, %.2fx smaller, made in %.2f s" %
+              (args.compressed, len(data), frames, 100.0 * len(data) / max(1, len(image)), len(image),
+               len(image) / max(1, len(data)), elapsed))
+    else:
+        try:
+            image = decompress(read(args.compressed))
+        except (ValueError, IndexError, struct.error) as e:
+            sys.exit("%s: %s" % (args.compressed, e))
+        write(args.image, image)
+        print("%s: %d bytes" % (args.image, len(image)))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,183 @@
+/*
+ * FreeRTOS V202011.00
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://aws.amazon.com/freertos
+ *
+ */
+
+/*
+ * Measures how fast ota_delta.c applies a delta file, reading the old image
+ * from a file and writing the new image to a file, as the OTA PAL does.  The
+ * delta file is fed in blocks of the OTA block size.  See README.md to build.
+ *
+ *     delta_bench old.bin update.delta new.bin [repeat]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ota_delta.h"
+
+/* The OTA file block size, otaconfigFILE_BLOCK_SIZE, of the demo. */
+#define BLOCK_SIZE    2048U
+
+typedef struct BenchFiles
+{
+    FILE * pxSource;
+    FILE * pxTarget;
+} BenchFiles_t;
+
+static BaseType_t prvReadSource( void * pvContext,
+                                 uint32_t ulOffset,
+                                 uint8_t * pucBuffer,
+                                 size_t xLength )
+{
+    BenchFiles_t * pxFiles = pvContext;
+
+    return ( ( fseek( pxFiles->pxSource, ( long ) ulOffset, SEEK_SET ) == 0 ) &&
+             ( fread( pucBuffer, 1, xLength, pxFiles->pxSource ) == xLength ) ) ? pdTRUE : pdFALSE;
+}
+
+static BaseType_t prvWriteTarget( void * pvContext,
+                                  const uint8_t * pucData,
+                                  size_t xLength )
+{
+    BenchFiles_t * pxFiles = pvContext;
+
+    return ( fwrite( pucData, 1, xLength, pxFiles->pxTarget ) == xLength ) ? pdTRUE : pdFALSE;
+}
+
+static uint8_t * prvReadFile( const char * pcPath,
+                              size_t * pxLength )
+{
+    FILE * pxFile = fopen( pcPath, "rb" );
+    uint8_t * pucData = NULL;
+    long lSize;
+
+    if( pxFile != NULL )
+    {
+        if( ( fseek( pxFile, 0, SEEK_END ) == 0 ) && ( ( lSize = ftell( pxFile ) ) >= 0 ) &&
+            ( fseek( pxFile, 0, SEEK_SET ) == 0 ) )
+        {
+            pucData = malloc( ( size_t ) lSize + 1U );
+
+            if( ( pucData != NULL ) && ( fread( pucData, 1, ( size_t ) lSize, pxFile ) != ( size_t ) lSize ) )
+            {
+                free( pucData );
+                pucData = NULL;
+            }
+
+            *pxLength = ( size_t ) lSize;
+        }
+
+        fclose( pxFile );
+    }
+
+    return pucData;
+}
+
+static double prvNow( void )
+{
+    struct timespec xNow;
+
+    clock_gettime( CLOCK_MONOTONIC, &xNow );
+
+    return ( double ) xNow.tv_sec + ( ( double ) xNow.tv_nsec / 1e9 );
+}
+
+int main( int argc,
+          char ** argv )
+{
+    static OtaDeltaContext_t xDelta;
+    BenchFiles_t xFiles;
+    OtaDeltaStatus_t xStatus = OtaDeltaSuccess;
+    uint8_t * pucDelta;
+    size_t xDeltaLength = 0U;
+    size_t xOffset;
+    size_t xChunk;
+    int lRepeat = ( argc > 4 ) ? atoi( argv[ 4 ] ) : 10;
+    int lRun;
+    double dStart, dBest = 0.0, dElapsed;
+
+    if( ( argc < 4 ) || ( lRepeat < 1 ) )
+    {
+        fprintf( stderr, "usage: %s old.bin update.delta new.bin [repeat]\n", argv[ 0 ] );
+        return 2;
+    }
+
+    pucDelta = prvReadFile( argv[ 2 ], &xDeltaLength );
+
+    if( pucDelta == NULL )
+    {
+        fprintf( stderr, "%s: cannot read\n", argv[ 2 ] );
+        return 1;
+    }
+
+    for( lRun = 0; ( lRun < lRepeat ) && ( xStatus == OtaDeltaSuccess ); lRun++ )
+    {
+        xFiles.pxSource = fopen( argv[ 1 ], "rb" );
+        xFiles.pxTarget = fopen( argv[ 3 ], "wb" );
+
+        if( ( xFiles.pxSource == NULL ) || ( xFiles.pxTarget == NULL ) )
+        {
+            fprintf( stderr, "cannot open %s or %s\n", argv[ 1 ], argv[ 3 ] );
+            return 1;
+        }
+
+        dStart = prvNow();
+        OtaDelta_Init( &xDelta, prvReadSource, prvWriteTarget, &xFiles );
+
+        for( xOffset = 0U; ( xOffset < xDeltaLength ) && ( xStatus == OtaDeltaSuccess ); xOffset += xChunk )
+        {
+            xChunk = ( ( xDeltaLength - xOffset ) < BLOCK_SIZE ) ? ( xDeltaLength - xOffset ) : BLOCK_SIZE;
+            xStatus = OtaDelta_Apply( &xDelta, &( pucDelta[ xOffset ] ), xChunk );
+        }
+
+        fclose( xFiles.pxSource );
+
+        if( fclose( xFiles.pxTarget ) != 0 )
+        {
+            xStatus = OtaDeltaIoError;
+        }
+
+        dElapsed = prvNow() - dStart;
+        dBest = ( ( lRun == 0 ) || ( dElapsed < dBest ) ) ? dElapsed : dBest;
+    }
+
+    if( ( xStatus != OtaDeltaSuccess ) || ( OtaDelta_IsComplete( &xDelta ) == pdFALSE ) )
+    {
+        fprintf( stderr, "%s: failed to apply, status %d\n", argv[ 2 ], ( int ) xStatus );
+        return 1;
+    }
+
+    printf( "%u byte delta file applied to a %u byte image, making %u bytes (%u copied, %u added)\n",
+            ( unsigned ) xDeltaLength, ( unsigned ) xDelta.ulSourceSize, ( unsigned ) xDelta.ulTargetSize,
+            ( unsigned ) xDelta.ulCopied, ( unsigned ) xDelta.ulAdded );
+    printf( "best of %d: %.2f ms, %.1f MB/s of image made, including the check of the old image\n",
+            lRepeat, dBest * 1e3, ( ( double ) xDelta.ulTargetSize / 1e6 ) / dBest );
+
+    free( pucDelta );
+
+    return 0;
+}
@@ -0,0 +1,255 @@
+#!/usr/bin/env python3
+"""Make and apply delta encoded OTA files.
+
+A delta file reconstructs a new firmware image from the image running on the
+device, so only what changed between the two images is sent over the air.  The
+format is described in lib/AWS/ota-delta/ota_delta.h.
+
+    ota_delta.py make old.bin new.bin update.delta
+    ota_delta.py apply old.bin update.delta check.bin
+
+Sign new.bin, not the delta file: the device checks the signature against the
+image it reconstructs.  See README.md.
+"""
+
+import argparse
+import struct
+import sys
+import time
+import zlib
+
+MAGIC = b"OTAD"
+VERSION = 1
+HEADER = struct.Struct("<4sB3xIII")
+
+OP_END = 0x00
+OP_COPY = 0x01
+OP_ADD = 0x02
+
+# Length of the runs of the old image that are indexed, and the distance
+# between them.  A run of the new image found in the old one is only found if
+# it contains an indexed run, so matches shorter than SEED + STRIDE - 1 bytes
+# may be missed.
+SEED = 16
+STRIDE = 8
+
+# Shortest copy worth a command.  A copy costs an opcode and two values, so a
+# shorter one is cheaper sent as literal bytes, unless it continues the last
+# copy, when its offset costs one byte.
+MIN_COPY = 24
+MIN_CONTINUATION = 6
+
+# Positions kept for each indexed run, the first found.
+CANDIDATES = 4
+
+
+def leb128(value):
+    out = bytearray()
+    while True:
+        byte = value & 0x7F
+        value >>= 7
+        if value:
+            out.append(byte | 0x80)
+        else:
+            out.append(byte)
+            return bytes(out)
+
+
+def zigzag(value):
+    return ((value << 1) ^ (value >> 31)) & 0xFFFFFFFF
+
+
+def read_leb128(data, pos):
+    value = 0
+    shift = 0
+    while True:
+        byte = data[pos]
+        pos += 1
+        value |= (byte & 0x7F) << shift
+        shift += 7
+        if not byte & 0x80:
+            return value, pos
+
+
+def match_length(old, old_pos, new, new_pos, limit):
+    """Length of the common run of old and new from the given positions."""
+    length = 0
+    # Compare in slices, which is much faster than a byte at a time.
+    step = 64
+    while length < limit:
+        n = min(step, limit - length)
+        if old[old_pos + length:old_pos + length + n] == new[new_pos + length:new_pos + length + n]:
+            length += n
+            step *= 2
+        elif n == 1:
+            break
+        else:
+            step = max(1, n // 2)
+    return length
+
+
+class Encoder:
+    def __init__(self):
+        self.out = bytearray()
+        self.copy_end = 0
+        self.copied = 0
+        self.added = 0
+        self.copies = 0
+
+    def add(self, data):
+        if data:
+            self.out.append(OP_ADD)
+            self.out += leb128(len(data))
+            self.out += data
+            self.added += len(data)
+
+    def copy(self, offset, length):
+        self.out.append(OP_COPY)
+        self.out += leb128(zigzag(offset - self.copy_end))
+        self.out += leb128(length)
+        self.copy_end = offset + length
+        self.copied += length
+        self.copies += 1
+
+
+def make_delta(old, new):
+    if len(old) >= 1 << 31 or len(new) >= 1 << 31:
+        raise ValueError("images must be smaller than 2 GB")
+
+    index = {}
+    for pos in range(0, len(old) - SEED + 1, STRIDE):
+        positions = index.setdefault(old[pos:pos + SEED], [])
+        if len(positions) < CANDIDATES:
+            positions.append(pos)
+
+    enc = Encoder()
+    literal_start = 0
+    pos = 0
+    end = len(new)
+
+    while pos + SEED <= end:
+        best_len = 0
+        best_old = 0
+
+        # The bytes after the last copy usually follow on in the old image too,
+        # past a few changed bytes such as an updated address.
+        expected = enc.copy_end + (pos - literal_start)
+        if enc.copies and literal_start < pos and 0 <= expected < len(old):
+            length = match_length(old, expected, new, pos, min(len(old) - expected, end - pos))
+            if length >= MIN_CONTINUATION:
+                best_len, best_old = length, expected
+
+        if best_len < MIN_COPY:
+            for old_pos in index.get(new[pos:pos + SEED], ()):
+                length = match_length(old, old_pos, new, pos, min(len(old) - old_pos, end - pos))
+                if length > best_len:
+                    best_len, best_old = length, old_pos
+
+        if best_len < MIN_CONTINUATION or (best_len < MIN_COPY and best_old != expected):
+            pos += 1
+            continue
+
+        # Take in the bytes before the match that also match.
+        while pos > literal_start and best_old > 0 and old[best_old - 1] == new[pos - 1]:
+            pos -= 1
+            best_old -= 1
+            best_len += 1
+
+        enc.add(new[literal_start:pos])
+        enc.copy(best_old, best_len)
+        pos += best_len
+        literal_start = pos
+
+    enc.add(new[literal_start:])
+    enc.out.append(OP_END)
+
+    header = HEADER.pack(MAGIC, VERSION, len(old), zlib.crc32(old) & 0xFFFFFFFF, len(new))
+    return header + bytes(enc.out), enc
+
+
+def apply_delta(old, delta):
+    magic, version, old_size, old_crc, new_size = HEADER.unpack_from(delta)
+    if magic != MAGIC or version != VERSION:
+        raise ValueError("not a delta file of version %d" % VERSION)
+    if len(old) != old_size or (zlib.crc32(old) & 0xFFFFFFFF) != old_crc:
+        raise ValueError("the delta file was made from a different image")
+
+    out = bytearray()
+    copy_end = 0
+    pos = HEADER.size
+    while True:
+        op = delta[pos]
+        pos += 1
+        if op == OP_END:
+            break
+        if op == OP_COPY:
+            value, pos = read_leb128(delta, pos)
+            offset = (copy_end + ((value >> 1) ^ -(value & 1))) & 0xFFFFFFFF
+            length, pos = read_leb128(delta, pos)
+            if offset + length > old_size:
+                raise ValueError("copy out of range")
+            out += old[offset:offset + length]
+            copy_end = offset + length
+        elif op == OP_ADD:
+            length, pos = read_leb128(delta, pos)
+            out += delta[pos:pos + length]
+            pos += length
+        else:
+            raise ValueError("unknown command 0x%02x" % op)
+
+    if pos != len(delta) or len(out) != new_size:
+        raise ValueError("the delta file is malformed")
+    return bytes(out)
+
+
+def read(path):
+    with open(path, "rb") as f:
+        return f.read()
+
+
+def write(path, data):
+    with open(path, "wb") as f:
+        f.write(data)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest="command", required=True)
+    p = sub.add_parser("make", help="make a delta file from the old image to the new one")
+    p.add_argument("old")
+    p.add_argument("new")
+    p.add_argument("delta")
+    p = sub.add_parser("apply", help="apply a delta file to the old image")
+    p.add_argument("old")
+    p.add_argument("delta")
+    p.add_argument("new")
+    args = parser.parse_args()
+
+    if args.command == "make":
+        old = read(args.old)
+        new = read(args.new)
+        start = time.perf_counter()
+        delta, enc = make_delta(old, new)
+        elapsed = time.perf_counter() - start
+
+        # Never ship a delta file that does not reconstruct the image.
+        if apply_delta(old, delta) != new:
+            sys.exit("internal error: the delta file does not reconstruct the new image")
+
+        write(args.delta, delta)
+        print("%s: %d bytes, %.1f%% of %d, %.1fx smaller" %
+              (args.delta, len(delta), 100.0 * len(delta) / max(1, len(new)), len(new),
+               len(new) / max(1, len(delta))))
+        print("%d bytes in %d copies, %d literal bytes, made in %.2f s" %
+              (enc.copied, enc.copies, enc.added, elapsed))
+    else:
+        try:
+            new = apply_delta(read(args.old), read(args.delta))
+        except (ValueError, IndexError, struct.error) as e:
+            sys.exit("%s: %s" % (args.delta, e))
+        write(args.new, new)
+        print("%s: %d bytes" % (args.new, len(new)))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,200 @@
+/*
+ * FreeRTOS V202011.00
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://aws.amazon.com/freertos
+ *
+ */
+
+/**
+ * @file agent_buffer_pool.c
+ * @brief Implements a pool of reference counted network buffers.
+ */
+
+/* Standard includes. */
+#include <string.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/* Header include. */
+#include "agent_buffer_pool.h"
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief The pool of network buffers.
+ */
+static uint8_t networkBufferPool[ MQTT_AGENT_NUM_NETWORK_BUFFERS ][ MQTT_AGENT_NETWORK_BUFFER_SIZE ];
+
+/**
+ * @brief The number of references held to each buffer in networkBufferPool.  A
+ * buffer with no references is unused.  Only accessed from within critical
+ * sections as buffers are released by application tasks.
+ */
+static uint8_t referenceCounts[ MQTT_AGENT_NUM_NETWORK_BUFFERS ];
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Find the pooled buffer containing a pointer.
+ *
+ * @param[in] pData The pointer.
+ *
+ * @return Index of the buffer in networkBufferPool, or
+ * MQTT_AGENT_NUM_NETWORK_BUFFERS if pData is not in the pool.
+ */
+static size_t getBufferIndex( const void * pData );
+
+/*-----------------------------------------------------------*/
+
+static size_t getBufferIndex( const void * pData )
+{
+    size_t i = MQTT_AGENT_NUM_NETWORK_BUFFERS;
+    const uint8_t * pByte = ( const uint8_t * ) pData;
+
+    if( ( pByte >= &( networkBufferPool[ 0 ][ 0 ] ) ) &&
+        ( pByte < &( networkBufferPool[ 0 ][ 0 ] ) + sizeof( networkBufferPool ) ) )
+    {
+        i = ( size_t ) ( pByte - &( networkBufferPool[ 0 ][ 0 ] ) ) / MQTT_AGENT_NETWORK_BUFFER_SIZE;
+    }
+
+    return i;
+}
+
+/*-----------------------------------------------------------*/
+
+uint8_t * Agent_GetNetworkBuffer( void )
+{
+    uint8_t * pBuffer = NULL;
+    size_t i;
+
+    taskENTER_CRITICAL();
+    {
+        for( i = 0; i < MQTT_AGENT_NUM_NETWORK_BUFFERS; i++ )
+        {
+            if( referenceCounts[ i ] == 0U )
+            {
+                referenceCounts[ i ] = 1U;
+                pBuffer = networkBufferPool[ i ];
+                break;
+            }
+        }
+    }
+    taskEXIT_CRITICAL();
+
+    return pBuffer;
+}
+
+/*-----------------------------------------------------------*/
+
+bool Agent_RetainNetworkBuffer( const void * pData )
+{
+    bool retained = false;
+    size_t i, bufferIndex = getBufferIndex( pData );
+
+    if( bufferIndex < MQTT_AGENT_NUM_NETWORK_BUFFERS )
+    {
+        taskENTER_CRITICAL();
+        {
+            if( referenceCounts[ bufferIndex ] > 1U )
+            {
+                /* Already retained, so an unused buffer was available when it
+                 * was first retained and has not been given to anyone else. */
+                retained = true;
+            }
+            else if( referenceCounts[ bufferIndex ] == 1U )
+            {
+                /* Only the agent holds this buffer.  It can only be retained
+                 * if there is another buffer for the agent to move to. */
+                for( i = 0; i < MQTT_AGENT_NUM_NETWORK_BUFFERS; i++ )
+                {
+                    if( referenceCounts[ i ] == 0U )
+                    {
+                        retained = true;
+                        break;
+                    }
+                }
+            }
+            else
+            {
+                /* An unused buffer does not hold a publish. */
+            }
+
+            if( retained == true )
+            {
+                configASSERT( referenceCounts[ bufferIndex ] < UINT8_MAX );
+                referenceCounts[ bufferIndex ]++;
+            }
+        }
+        taskEXIT_CRITICAL();
+    }
+
+    return retained;
+}
+
+/*-----------------------------------------------------------*/
+
+bool Agent_ReleaseNetworkBuffer( const void * pData )
+{
+    bool released = false;
+    size_t bufferIndex = getBufferIndex( pData );
+
+    if( bufferIndex < MQTT_AGENT_NUM_NETWORK_BUFFERS )
+    {
+        taskENTER_CRITICAL();
+        {
+            if( referenceCounts[ bufferIndex ] > 0U )
+            {
+                referenceCounts[ bufferIndex ]--;
+                released = true;
+            }
+        }
+        taskEXIT_CRITICAL();
+
+        if( released == false )
+        {
+            LogError( ( "Released network buffer %d, which had no references.", ( int ) bufferIndex ) );
+        }
+    }
+
+    return released;
+}
+
+/*-----------------------------------------------------------*/
+
+bool Agent_IsNetworkBufferShared( const void * pData )
+{
+    bool shared = false;
+    size_t bufferIndex = getBufferIndex( pData );
+
+    if( bufferIndex < MQTT_AGENT_NUM_NETWORK_BUFFERS )
+    {
+        taskENTER_CRITICAL();
+        {
+            shared = ( referenceCounts[ bufferIndex ] > 1U );
+        }
+        taskEXIT_CRITICAL();
+    }
+
+    return shared;
+}
@@ -0,0 +1,108 @@
+/*
+ * FreeRTOS V202011.00
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://aws.amazon.com/freertos
+ *
+ */
+
+/**
+ * @file agent_buffer_pool.h
+ * @brief Functions to obtain, retain and release the buffers the MQTT agent
+ * uses to send and receive MQTT packets.
+ */
+#ifndef AGENT_BUFFER_POOL_H
+#define AGENT_BUFFER_POOL_H
+
+/* Standard includes. */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* MQTT agent includes. */
+#include "freertos_mqtt_agent.h"
+
+/**
+ * @brief The number of network buffers in the pool.
+ *
+ * @note The MQTT agent always holds one buffer.  The others can be retained by
+ * tasks that want to keep using an incoming publish after its callback has
+ * returned, without copying it.  The higher this number is the greater the
+ * agent's RAM consumption will be, as each buffer is
+ * MQTT_AGENT_NETWORK_BUFFER_SIZE bytes.
+ */
+#ifndef MQTT_AGENT_NUM_NETWORK_BUFFERS
+    #define MQTT_AGENT_NUM_NETWORK_BUFFERS    ( 2 )
+#endif
+
+/**
+ * @brief Obtain an unused network buffer from the pool.  The caller holds the
+ * only reference to the buffer.
+ *
+ * @note Called by the application to obtain the buffer it passes to
+ * MQTTAgent_Init(), and by the MQTT agent to replace its buffer once the buffer
+ * has been retained.
+ *
+ * @return A buffer of MQTT_AGENT_NETWORK_BUFFER_SIZE bytes, or NULL if every
+ * buffer is in use.
+ */
+uint8_t * Agent_GetNetworkBuffer( void );
+
+/**
+ * @brief Take a reference to the network buffer holding an incoming publish so
+ * the publish remains valid after its callback returns.
+ *
+ * @note May only be called from an incoming publish callback, for the publish
+ * passed to that callback.  The MQTT agent replaces the buffer it uses with an
+ * unused one before it next receives, so a buffer is only retained if an unused
+ * buffer is available - otherwise the caller must copy the publish.
+ *
+ * @param[in] pData Any pointer into the publish, for example its pPayload.
+ *
+ * @return true if the buffer was retained, in which case the publish's topic
+ * and payload remain valid until Agent_ReleaseNetworkBuffer() is called.  false
+ * if pData is not in a pooled buffer, or no unused buffer is available.
+ */
+bool Agent_RetainNetworkBuffer( const void * pData );
+
+/**
+ * @brief Drop a reference to a network buffer.  The buffer returns to the pool
+ * once its last reference is dropped.
+ *
+ * @param[in] pData Any pointer into the buffer, for example the pPayload of a
+ * publish for which Agent_RetainNetworkBuffer() returned true.
+ *
+ * @return true if pData is in a pooled buffer that had a reference, otherwise
+ * false.
+ */
+bool Agent_ReleaseNetworkBuffer( const void * pData );
+
+/**
+ * @brief Query whether anything other than its current holder has retained a
+ * network buffer.
+ *
+ * @param[in] pData Any pointer into the buffer.
+ *
+ * @return true if the buffer is in the pool and has more than one reference.
+ */
+bool Agent_IsNetworkBufferShared( const void * pData );
+
+#endif /* AGENT_BUFFER_POOL_H */
@@ -51,6 +51,7 @@
 /* MQTT agent include. */
 #include "freertos_mqtt_agent.h"
 #include "agent_command_pool.h"
+#include "agent_buffer_pool.h"
 
 /*-----------------------------------------------------------*/
 
@@ -213,6 +214,99 @@ static MQTTStatus_t createAndAddCommand( CommandType_t commandType,
  * false;
  */
 static bool isSpaceInPendingAckList( MQTTAgentContext_t * pAgentContext );
+
+/**
+ * @brief Replace the network buffer used by an MQTT connection with an unused
+ * buffer from the pool if an incoming publish callback retained the current
+ * buffer, so the next packet received does not overwrite the retained publish.
+ *
+ * @note Must be called after each call to MQTT_ProcessLoop().  The agent always
+ * calls MQTT_ProcessLoop() with a zero timeout, so each call receives at most
+ * one packet.
+ *
+ * @param[in] pAgentContext Agent context for the MQTT connection.
+ */
+static void replaceRetainedNetworkBuffer( MQTTAgentContext_t * pAgentContext );
+
+/**
+ * @brief Determine if a command is one of the SUBSCRIBE commands sent by
+ * MQTTAgent_RestoreSubscriptions().
+ *
+ * @param[in] pAgentContext Agent context for the MQTT connection.
+ * @param[in] pCommand Command to check.
+ *
+ * @return `true` if the command is restoring subscriptions, otherwise `false`.
+ */
+static bool isRestoreCommand( MQTTAgentContext_t * pAgentContext,
+                              Command_t * pCommand );
+
+/**
+ * @brief Calculate how many of a set of subscriptions fit in a single SUBSCRIBE
+ * packet.
+ *
+ * @param[in] pAgentContext Agent context for the MQTT connection.
+ * @param[in] pSubscribeInfo Subscriptions to pack, starting with the first
+ * subscription to place in the packet.
+ * @param[in] numSubscriptions Number of entries in pSubscribeInfo.
+ *
+ * @return The number of subscriptions that fit in the network buffer, which is
+ * 0 if not even the first subscription fits.
+ */
+static size_t getSubscriptionsPerPacket( MQTTAgentContext_t * pAgentContext,
+                                         MQTTSubscribeInfo_t * pSubscribeInfo,
+                                         size_t numSubscriptions );
+
+/**
+ * @brief Hold a command back until subscriptions have been restored.
+ *
+ * @param[in] pAgentContext Agent context for the MQTT connection.
+ * @param[in] pCommand Command to defer.
+ *
+ * @return `true` if the command was deferred, `false` if the list of deferred
+ * commands is full.
+ */
+static bool deferCommand( MQTTAgentContext_t * pAgentContext,
+                          Command_t * pCommand );
+
+/**
+ * @brief Obtain the oldest deferred command once the agent is connected and
+ * subscriptions have been restored.
+ *
+ * @param[in] pAgentContext Agent context for the MQTT connection.
+ *
+ * @return The oldest deferred command, or NULL if there are no deferred
+ * commands, the agent is reconnecting, or subscriptions are still being
+ * restored.
+ */
+static Command_t * getDeferredCommand( MQTTAgentContext_t * pAgentContext );
+
+/**
+ * @brief Close the transport after the MQTT connection is lost and start
+ * attempting to reconnect.
+ *
+ * @param[in] pAgentContext Agent context for the MQTT connection.
+ */
+static void handleConnectionLoss( MQTTAgentContext_t * pAgentContext );
+
+/**
+ * @brief Attempt to reconnect if the time for the next attempt has been reached.
+ *
+ * @param[in] pAgentContext Agent context for the MQTT connection.
+ *
+ * @return The maximum time in milliseconds to wait for a command before calling
+ * this function again.
+ */
+static uint32_t attemptReconnect( MQTTAgentContext_t * pAgentContext );
+
+/**
+ * @brief Handle a command received while the agent is reconnecting.  Commands
+ * that send data are held back until the connection is restored.
+ *
+ * @param[in] pAgentContext Agent context for the MQTT connection.
+ * @param[in] pCommand Command received, can be NULL.
+ */
+static void holdCommand( MQTTAgentContext_t * pAgentContext,
+                         Command_t * pCommand );
 /*-----------------------------------------------------------*/
 
 /**
@@ -253,6 +347,210 @@ static bool isSpaceInPendingAckList( MQTTAgentContext_t * pAgentContext )
 
 /*-----------------------------------------------------------*/
 
+static void replaceRetainedNetworkBuffer( MQTTAgentContext_t * pAgentContext )
+{
+    MQTTFixedBuffer_t * pNetworkBuffer = &( pAgentContext->mqttContext.networkBuffer );
+    uint8_t * pNewBuffer;
+
+    if( Agent_IsNetworkBufferShared( pNetworkBuffer->pBuffer ) )
+    {
+        /* Agent_RetainNetworkBuffer() only succeeds if an unused buffer
+         * exists, and only the agent takes unused buffers from the pool. */
+        pNewBuffer = Agent_GetNetworkBuffer();
+        assert( pNewBuffer != NULL );
+
+        if( pNewBuffer != NULL )
+        {
+            ( void ) Agent_ReleaseNetworkBuffer( pNetworkBuffer->pBuffer );
+            pNetworkBuffer->pBuffer = pNewBuffer;
+        }
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static bool isRestoreCommand( MQTTAgentContext_t * pAgentContext,
+                              Command_t * pCommand )
+{
+    const MQTTAgentSubscribeArgs_t * pArgs = ( const MQTTAgentSubscribeArgs_t * ) pCommand->pArgs;
+
+    return ( pCommand->commandType == SUBSCRIBE ) &&
+           ( pArgs >= &( pAgentContext->restoreArgs[ 0 ] ) ) &&
+           ( pArgs < &( pAgentContext->restoreArgs[ MQTT_AGENT_MAX_RESTORE_PACKETS ] ) );
+}
+
+/*-----------------------------------------------------------*/
+
+static size_t getSubscriptionsPerPacket( MQTTAgentContext_t * pAgentContext,
+                                         MQTTSubscribeInfo_t * pSubscribeInfo,
+                                         size_t numSubscriptions )
+{
+    size_t count = 0, remainingLength = 0, packetSize = 0;
+    MQTTStatus_t sizeStatus;
+
+    /* Grow the packet one subscription at a time until the next subscription
+     * would no longer fit in the network buffer. */
+    while( count < numSubscriptions )
+    {
+        sizeStatus = MQTT_GetSubscribePacketSize( pSubscribeInfo,
+                                                  count + 1U,
+                                                  &remainingLength,
+                                                  &packetSize );
+
+        if( ( sizeStatus != MQTTSuccess ) ||
+            ( packetSize > pAgentContext->mqttContext.networkBuffer.size ) )
+        {
+            break;
+        }
+
+        count++;
+    }
+
+    return count;
+}
+
+/*-----------------------------------------------------------*/
+
+static bool deferCommand( MQTTAgentContext_t * pAgentContext,
+                          Command_t * pCommand )
+{
+    bool deferred = false;
+    size_t tail;
+
+    if( pAgentContext->deferredCount < MQTT_AGENT_MAX_DEFERRED_COMMANDS )
+    {
+        tail = ( pAgentContext->deferredHead + pAgentContext->deferredCount ) % MQTT_AGENT_MAX_DEFERRED_COMMANDS;
+        pAgentContext->pDeferredCommands[ tail ] = pCommand;
+        pAgentContext->deferredCount++;
+        deferred = true;
+    }
+
+    return deferred;
+}
+
+/*-----------------------------------------------------------*/
+
+static Command_t * getDeferredCommand( MQTTAgentContext_t * pAgentContext )
+{
+    Command_t * pCommand = NULL;
+
+    if( ( pAgentContext->connectionState == MQTTAgentStateConnected ) &&
+        ( pAgentContext->pendingRestoreAcks == 0U ) &&
+        ( pAgentContext->deferredCount > 0U ) )
+    {
+        pCommand = pAgentContext->pDeferredCommands[ pAgentContext->deferredHead ];
+        pAgentContext->deferredHead = ( pAgentContext->deferredHead + 1U ) % MQTT_AGENT_MAX_DEFERRED_COMMANDS;
+        pAgentContext->deferredCount--;
+    }
+
+    return pCommand;
+}
+
+/*-----------------------------------------------------------*/
+
+static void handleConnectionLoss( MQTTAgentContext_t * pAgentContext )
+{
+    if( pAgentContext->connectionInterface.disconnect != NULL )
+    {
+        pAgentContext->connectionInterface.disconnect( pAgentContext );
+    }
+
+    pAgentContext->mqttContext.connectStatus = MQTTNotConnected;
+    pAgentContext->connectionState = MQTTAgentStateReconnecting;
+
+    /* Make the first attempt straight away. */
+    pAgentContext->reconnectTimeMs = pAgentContext->mqttContext.getTime();
+}
+
+/*-----------------------------------------------------------*/
+
+static uint32_t attemptReconnect( MQTTAgentContext_t * pAgentContext )
+{
+    uint32_t waitTimeMs = MQTT_AGENT_MAX_EVENT_QUEUE_WAIT_TIME, retryDelayMs = 0U;
+    uint32_t timeNowMs = pAgentContext->mqttContext.getTime();
+    int32_t remainingMs = ( int32_t ) ( pAgentContext->reconnectTimeMs - timeNowMs );
+
+    if( remainingMs <= 0 )
+    {
+        if( pAgentContext->connectionInterface.reconnect( pAgentContext, &retryDelayMs ) == MQTTSuccess )
+        {
+            /* Send the publishes resent and the subscriptions restored while
+             * reconnecting now, rather than leave them in the transport until
+             * the next command is processed. */
+            if( ( pAgentContext->connectionInterface.flush != NULL ) &&
+                ( pAgentContext->connectionInterface.flush( pAgentContext ) != MQTTSuccess ) )
+            {
+                LogWarn( ( "Failed to send the packets restoring the session, reconnecting again.\n" ) );
+                handleConnectionLoss( pAgentContext );
+            }
+            else
+            {
+                LogInfo( ( "MQTT connection re-established.\n" ) );
+                pAgentContext->connectionState = MQTTAgentStateConnected;
+            }
+        }
+        else
+        {
+            LogWarn( ( "Reconnect attempt failed, retrying in %u ms.\n", ( unsigned int ) retryDelayMs ) );
+            pAgentContext->reconnectTimeMs = pAgentContext->mqttContext.getTime() + retryDelayMs;
+            waitTimeMs = ( retryDelayMs < waitTimeMs ) ? retryDelayMs : waitTimeMs;
+        }
+    }
+    else if( ( uint32_t ) remainingMs < waitTimeMs )
+    {
+        waitTimeMs = ( uint32_t ) remainingMs;
+    }
+
+    return waitTimeMs;
+}
+
+/*-----------------------------------------------------------*/
+
+static void holdCommand( MQTTAgentContext_t * pAgentContext,
+                         Command_t * pCommand )
+{
+    bool commandHeld = false;
+    MQTTAgentReturnInfo_t returnInfo = { 0 };
+
+    if( pCommand != NULL )
+    {
+        switch( pCommand->commandType )
+        {
+            case PUBLISH:
+            case SUBSCRIBE:
+            case UNSUBSCRIBE:
+                commandHeld = deferCommand( pAgentContext, pCommand );
+
+                /* Fail straight away rather than keep the sender waiting. */
+                returnInfo.returnCode = MQTTNoMemory;
+                break;
+
+            case PROCESSLOOP:
+            case DISCONNECT:
+            case TERMINATE:
+                /* There is no connection to process or disconnect. */
+                returnInfo.returnCode = MQTTSuccess;
+                break;
+
+            default:
+                returnInfo.returnCode = MQTTIllegalState;
+                break;
+        }
+
+        if( !commandHeld )
+        {
+            if( pCommand->pCommandCompleteCallback != NULL )
+            {
+                pCommand->pCommandCompleteCallback( pCommand->pCmdContext, &returnInfo );
+            }
+
+            Agent_ReleaseCommand( pCommand );
+        }
+    }
+}
+
+/*-----------------------------------------------------------*/
+
 static bool addAwaitingOperation( MQTTAgentContext_t * pAgentContext,
                                   uint16_t packetId,
                                   Command_t * pCommand )
@@ -271,6 +569,7 @@ static bool addAwaitingOperation( MQTTAgentContext_t * pAgentContext,
         {
             pendingAcks[ i ].packetId = packetId;
             pendingAcks[ i ].pOriginalCommand = pCommand;
+            pendingAcks[ i ].resendOnResume = false;
             ackAdded = true;
             break;
         }
@@ -460,7 +759,7 @@ static MQTTStatus_t processCommand( MQTTAgentContext_t * pMqttAgentContext,
 {
     MQTTStatus_t operationStatus = MQTTSuccess;
     uint16_t packetId = MQTT_PACKET_ID_INVALID;
-    bool addAckToList = false, ackAdded = false;
+    bool addAckToList = false, ackAdded = false, commandDeferred = false;
     MQTTPublishInfo_t * pPublishInfo;
     MQTTAgentSubscribeArgs_t * pSubscribeArgs;
     MQTTContext_t * pMQTTContext;
@@ -479,6 +778,21 @@ static MQTTStatus_t processCommand( MQTTAgentContext_t * pMqttAgentContext,
             case PUBLISH:
                 pPublishInfo = ( MQTTPublishInfo_t * ) ( pCommand->pArgs );
 
+                /* Hold the publish back if subscriptions are still being
+                 * restored, so a response to it cannot arrive on a topic that
+                 * is not yet subscribed. */
+                if( pMqttAgentContext->pendingRestoreAcks > 0U )
+                {
+                    commandDeferred = deferCommand( pMqttAgentContext, pCommand );
+
+                    if( commandDeferred )
+                    {
+                        break;
+                    }
+
+                    LogWarn( ( "Deferred command list full, publishing before subscriptions are restored.\n" ) );
+                }
+
                 if( pPublishInfo->qos != MQTTQoS0 )
                 {
                     packetId = MQTT_GetPacketId( pMQTTContext );
@@ -562,7 +876,18 @@ static MQTTStatus_t processCommand( MQTTAgentContext_t * pMqttAgentContext,
             }
         }
 
-        if( !ackAdded )
+        /* Let the application save the publish as part of the session. */
+        if( ackAdded &&
+            ( pCommand->commandType == PUBLISH ) &&
+            ( pMqttAgentContext->sessionChangeCallback != NULL ) )
+        {
+            pMqttAgentContext->sessionChangeCallback( pMqttAgentContext,
+                                                      MQTTAgentSessionPublishSent,
+                                                      packetId,
+                                                      pPublishInfo );
+        }
+
+        if( !ackAdded && !commandDeferred )
         {
             /* The command is complete, call the callback. */
             if( pCommand->pCommandCompleteCallback != NULL )
@@ -590,10 +915,20 @@ static MQTTStatus_t processCommand( MQTTAgentContext_t * pMqttAgentContext,
                 ( pMQTTContext->connectStatus == MQTTConnected ) )
             {
                 operationStatus = MQTT_ProcessLoop( pMQTTContext, processLoopTimeoutMs );
+                replaceRetainedNetworkBuffer( pMqttAgentContext );
             }
         } while( pMqttAgentContext->packetReceivedInLoop );
     }
 
+    /* Send the packets written by the command and the process loop, which the
+     * transport may have collected into as few records as possible. */
+    if( ( operationStatus == MQTTSuccess ) &&
+        ( pMQTTContext->connectStatus == MQTTConnected ) &&
+        ( pMqttAgentContext->connectionInterface.flush != NULL ) )
+    {
+        operationStatus = pMqttAgentContext->connectionInterface.flush( pMqttAgentContext );
+    }
+
     return operationStatus;
 }
 
@@ -617,6 +952,13 @@ static void handleSubscriptionAcks( MQTTAgentContext_t * pAgentContext,
     /* A SUBACK's status codes start 2 bytes after the variable header. */
     pSubackCodes = ( packetType == MQTT_PACKET_TYPE_SUBACK ) ? pPacketInfo->pRemainingData + 2U : NULL;
 
+    /* Deferred commands are sent once every restoring SUBSCRIBE is acknowledged. */
+    if( isRestoreCommand( pAgentContext, pAckInfo->pOriginalCommand ) &&
+        ( pAgentContext->pendingRestoreAcks > 0U ) )
+    {
+        pAgentContext->pendingRestoreAcks--;
+    }
+
     if( ackCallback != NULL )
     {
         returnInfo.returnCode = pDeserializedInfo->deserializationResult;
@@ -677,6 +1019,14 @@ static void mqttEventCallback( MQTTContext_t * pMqttContext,
 
                 if( ackInfo.packetId == packetIdentifier )
                 {
+                    if( pAgentContext->sessionChangeCallback != NULL )
+                    {
+                        pAgentContext->sessionChangeCallback( pAgentContext,
+                                                              MQTTAgentSessionPublishAcked,
+                                                              packetIdentifier,
+                                                              NULL );
+                    }
+
                     ackCallback = ackInfo.pOriginalCommand->pCommandCompleteCallback;
 
                     if( ackCallback != NULL )
@@ -822,11 +1172,161 @@ MQTTStatus_t MQTTAgent_Init( MQTTAgentContext_t * pMqttAgentContext,
 
 /*-----------------------------------------------------------*/
 
+MQTTStatus_t MQTTAgent_SetConnectionInterface( MQTTAgentContext_t * pMqttAgentContext,
+                                               const MQTTAgentConnectionInterface_t * pConnectionInterface )
+{
+    MQTTStatus_t statusReturn = MQTTBadParameter;
+
+    if( ( pMqttAgentContext != NULL ) &&
+        ( pConnectionInterface != NULL ) &&
+        ( pConnectionInterface->reconnect != NULL ) &&
+        ( pConnectionInterface->disconnect != NULL ) )
+    {
+        pMqttAgentContext->connectionInterface = *pConnectionInterface;
+        statusReturn = MQTTSuccess;
+    }
+
+    return statusReturn;
+}
+
+/*-----------------------------------------------------------*/
+
+MQTTStatus_t MQTTAgent_SetSessionChangeCallback( MQTTAgentContext_t * pMqttAgentContext,
+                                                 MQTTAgentSessionChangeFunc_t sessionChangeCallback )
+{
+    MQTTStatus_t statusReturn = MQTTBadParameter;
+
+    if( pMqttAgentContext != NULL )
+    {
+        pMqttAgentContext->sessionChangeCallback = sessionChangeCallback;
+        statusReturn = MQTTSuccess;
+    }
+
+    return statusReturn;
+}
+
+/*-----------------------------------------------------------*/
+
+MQTTStatus_t MQTTAgent_LoadSession( MQTTAgentContext_t * pMqttAgentContext,
+                                    MQTTAgentSessionPublish_t * pPublishes,
+                                    size_t numPublishes,
+                                    uint16_t nextPacketId,
+                                    CommandCallback_t cmdCompleteCallback )
+{
+    MQTTStatus_t statusResult = MQTTSuccess;
+    MQTTContext_t * pMqttContext;
+    MQTTPublishInfo_t * pPublishInfo;
+    Command_t * pCommand;
+    size_t i, j;
+
+    /* If the packet ID is zero then the MQTT context has not been initialized as 0
+     * is the initial value but not a valid packet ID. */
+    if( ( pMqttAgentContext == NULL ) ||
+        ( pMqttAgentContext->mqttContext.nextPacketId == 0 ) ||
+        ( pMqttAgentContext->mqttContext.connectStatus == MQTTConnected ) )
+    {
+        statusResult = MQTTIllegalState;
+    }
+    else if( ( ( pPublishes == NULL ) && ( numPublishes > 0U ) ) ||
+             ( numPublishes > MQTT_STATE_ARRAY_MAX_COUNT ) )
+    {
+        statusResult = MQTTBadParameter;
+    }
+    else
+    {
+        pMqttContext = &( pMqttAgentContext->mqttContext );
+
+        for( i = 0; ( i < numPublishes ) && ( statusResult == MQTTSuccess ); i++ )
+        {
+            pPublishInfo = pPublishes[ i ].pPublishInfo;
+
+            if( ( pPublishes[ i ].packetId == MQTT_PACKET_ID_INVALID ) ||
+                ( pPublishInfo == NULL ) ||
+                ( pPublishInfo->qos == MQTTQoS0 ) )
+            {
+                statusResult = MQTTBadParameter;
+                break;
+            }
+
+            pCommand = Agent_GetCommand( 0U );
+
+            if( pCommand == NULL )
+            {
+                LogError( ( "Out of commands loading the session after %u publishes.\n",
+                            ( unsigned int ) i ) );
+                statusResult = MQTTNoMemory;
+                break;
+            }
+
+            /* Also checks there is space in the pending ack list. */
+            statusResult = createCommand( PUBLISH,
+                                          pMqttAgentContext,
+                                          pPublishInfo,
+                                          cmdCompleteCallback,
+                                          ( CommandContext_t * ) &( pPublishes[ i ] ),
+                                          pCommand );
+
+            if( statusResult == MQTTSuccess )
+            {
+                /* Cannot fail as createCommand() found space and only the agent
+                 * task adds pending acks. */
+                ( void ) addAwaitingOperation( pMqttAgentContext, pPublishes[ i ].packetId, pCommand );
+
+                /* The MQTT library has no record of the publish, so
+                 * MQTTAgent_ResumeSession() resends it from the pending ack.  A
+                 * QoS 2 publish is resent even if its PUBREC was received before
+                 * the reset, which the broker handles as a duplicate. */
+                for( j = 0; j < MQTT_AGENT_MAX_OUTSTANDING_ACKS; j++ )
+                {
+                    if( pMqttAgentContext->pPendingAcks[ j ].packetId == pPublishes[ i ].packetId )
+                    {
+                        pMqttAgentContext->pPendingAcks[ j ].resendOnResume = true;
+                        break;
+                    }
+                }
+            }
+            else
+            {
+                Agent_ReleaseCommand( pCommand );
+            }
+        }
+
+        if( ( statusResult == MQTTSuccess ) && ( nextPacketId != MQTT_PACKET_ID_INVALID ) )
+        {
+            pMqttContext->nextPacketId = nextPacketId;
+        }
+    }
+
+    return statusResult;
+}
+
+/*-----------------------------------------------------------*/
+
+MQTTAgentConnectionState_t MQTTAgent_GetConnectionState( const MQTTAgentContext_t * pMqttAgentContext )
+{
+    MQTTAgentConnectionState_t state = MQTTAgentStateDisconnected;
+
+    if( pMqttAgentContext != NULL )
+    {
+        state = pMqttAgentContext->connectionState;
+
+        if( ( state == MQTTAgentStateConnected ) && ( pMqttAgentContext->pendingRestoreAcks > 0U ) )
+        {
+            state = MQTTAgentStateRestoring;
+        }
+    }
+
+    return state;
+}
+
+/*-----------------------------------------------------------*/
+
 MQTTStatus_t MQTTAgent_CommandLoop( MQTTAgentContext_t * pMqttAgentContext )
 {
     Command_t * pCommand;
     MQTTStatus_t operationStatus = MQTTSuccess;
     CommandType_t currentCommandType = NONE;
+    uint32_t waitTimeMs;
 
     /* The command queue should have been created before this task gets created. */
     assert( pMqttAgentContext->pMessageCtx );
@@ -835,16 +1335,56 @@ MQTTStatus_t MQTTAgent_CommandLoop( MQTTAgentContext_t * pMqttAgentContext )
     {
         operationStatus = MQTTBadParameter;
     }
+    else
+    {
+        pMqttAgentContext->connectionState = ( pMqttAgentContext->mqttContext.connectStatus == MQTTConnected ) ?
+                                             MQTTAgentStateConnected : MQTTAgentStateDisconnected;
+    }
 
     /* Loop until an error or we receive a terminate command. */
     while( operationStatus == MQTTSuccess )
     {
-        /* Wait for the next command, if any. */
-        pCommand = NULL;
-        ( void ) Agent_MessageReceive( pMqttAgentContext->pMessageCtx, &( pCommand ), MQTT_AGENT_MAX_EVENT_QUEUE_WAIT_TIME );
+        waitTimeMs = MQTT_AGENT_MAX_EVENT_QUEUE_WAIT_TIME;
+
+        /* Reconnect attempts are made between servicing the command queue so
+         * commands continue to be accepted while the connection is down. */
+        if( pMqttAgentContext->connectionState == MQTTAgentStateReconnecting )
+        {
+            waitTimeMs = attemptReconnect( pMqttAgentContext );
+        }
+
+        /* Commands held back while reconnecting or restoring subscriptions are
+         * processed before any new command.  Otherwise wait for the next
+         * command, if any. */
+        pCommand = getDeferredCommand( pMqttAgentContext );
+
+        if( pCommand == NULL )
+        {
+            ( void ) Agent_MessageReceive( pMqttAgentContext->pMessageCtx, &( pCommand ), waitTimeMs );
+        }
+
         /* Set the command type in case the command is released while processing. */
         currentCommandType = ( pCommand ) ? pCommand->commandType : NONE;
-        operationStatus = processCommand( pMqttAgentContext, pCommand );
+
+        if( pMqttAgentContext->connectionState == MQTTAgentStateReconnecting )
+        {
+            holdCommand( pMqttAgentContext, pCommand );
+        }
+        else
+        {
+            operationStatus = processCommand( pMqttAgentContext, pCommand );
+
+            /* Reconnect rather than return if the application allows it. */
+            if( ( operationStatus != MQTTSuccess ) &&
+                ( currentCommandType != DISCONNECT ) &&
+                ( pMqttAgentContext->connectionInterface.reconnect != NULL ) )
+            {
+                LogError( ( "MQTT operation failed with status %s, reconnecting.\n",
+                            MQTT_Status_strerror( operationStatus ) ) );
+                handleConnectionLoss( pMqttAgentContext );
+                operationStatus = MQTTSuccess;
+            }
+        }
 
         /* Return the current MQTT context on disconnect or error. */
         if( ( currentCommandType == DISCONNECT ) || ( operationStatus != MQTTSuccess ) )
@@ -854,6 +1394,17 @@ MQTTStatus_t MQTTAgent_CommandLoop( MQTTAgentContext_t * pMqttAgentContext )
                 LogError( ( "MQTT operation failed with status %s\n",
                             MQTT_Status_strerror( operationStatus ) ) );
             }
+            else if( ( pMqttAgentContext->connectionState == MQTTAgentStateConnected ) &&
+                     ( pMqttAgentContext->connectionInterface.disconnect != NULL ) )
+            {
+                pMqttAgentContext->connectionInterface.disconnect( pMqttAgentContext );
+                pMqttAgentContext->connectionState = MQTTAgentStateDisconnected;
+            }
+            else if( pMqttAgentContext->connectionState == MQTTAgentStateReconnecting )
+            {
+                /* The transport was closed when the connection was lost. */
+                pMqttAgentContext->connectionState = MQTTAgentStateDisconnected;
+            }
 
             break;
         }
@@ -861,6 +1412,13 @@ MQTTStatus_t MQTTAgent_CommandLoop( MQTTAgentContext_t * pMqttAgentContext )
         /* Terminate the loop if we receive the termination command. */
         if( currentCommandType == TERMINATE )
         {
+            /* Stop reconnecting.  A connection that is still up is left for the
+             * application to close. */
+            if( pMqttAgentContext->connectionState == MQTTAgentStateReconnecting )
+            {
+                pMqttAgentContext->connectionState = MQTTAgentStateDisconnected;
+            }
+
             break;
         }
     }
@@ -878,6 +1436,7 @@ MQTTStatus_t MQTTAgent_ResumeSession( MQTTAgentContext_t * pMqttAgentContext,
     MQTTAgentContext_t * pAgentContext;
     AckInfo_t * pendingAcks;
     MQTTPublishInfo_t * originalPublish = NULL;
+    size_t i;
 
     /* If the packet ID is zero then the MQTT context has not been initialized as 0
      * is the initial value but not a valid packet ID. */
@@ -887,6 +1446,10 @@ MQTTStatus_t MQTTAgent_ResumeSession( MQTTAgentContext_t * pMqttAgentContext,
         pAgentContext = pMqttAgentContext;
         pendingAcks = pAgentContext->pPendingAcks;
 
+        /* SUBACKs for subscriptions being restored when the connection dropped
+         * will never arrive, so stop holding back deferred commands for them. */
+        pAgentContext->pendingRestoreAcks = 0U;
+
         /* Resend publishes if session is present. NOTE: It's possible that some
          * of the operations that were in progress during the network interruption
          * were subscribes. In that case, we would want to mark those operations
@@ -921,6 +1484,29 @@ MQTTStatus_t MQTTAgent_ResumeSession( MQTTAgentContext_t * pMqttAgentContext,
 
                 packetId = MQTT_PublishToResend( pMqttContext, &cursor );
             }
+
+            /* Resend the publishes loaded from a saved session.  Publishing with
+             * the DUP flag set makes the MQTT library record each again, after
+             * which it is resent with the others on later reconnects. */
+            for( i = 0; ( i < MQTT_AGENT_MAX_OUTSTANDING_ACKS ) && ( statusResult == MQTTSuccess ); i++ )
+            {
+                if( ( pendingAcks[ i ].packetId != MQTT_PACKET_ID_INVALID ) &&
+                    ( pendingAcks[ i ].resendOnResume == true ) )
+                {
+                    originalPublish = ( MQTTPublishInfo_t * ) ( pendingAcks[ i ].pOriginalCommand->pArgs );
+                    originalPublish->dup = true;
+                    statusResult = MQTT_Publish( pMqttContext, originalPublish, pendingAcks[ i ].packetId );
+
+                    if( statusResult == MQTTSuccess )
+                    {
+                        pendingAcks[ i ].resendOnResume = false;
+                    }
+                    else
+                    {
+                        LogError( ( "Error in resending loaded publishes. Error code=%s\n", MQTT_Status_strerror( statusResult ) ) );
+                    }
+                }
+            }
         }
 
         /* If we wanted to resume a session but none existed with the broker, we
@@ -929,7 +1515,6 @@ MQTTStatus_t MQTTAgent_ResumeSession( MQTTAgentContext_t * pMqttAgentContext,
          * the subscription list, so tasks do not unexpectedly lose their subscriptions. */
         else
         {
-            size_t i = 0;
             MQTTAgentReturnInfo_t returnInfo = { 0 };
             returnInfo.returnCode = MQTTBadResponse;
 
@@ -948,6 +1533,14 @@ MQTTStatus_t MQTTAgent_ResumeSession( MQTTAgentContext_t * pMqttAgentContext,
                     getAwaitingOperation( pMqttAgentContext, pendingAcks[ i ].packetId, true );
                 }
             }
+
+            if( pAgentContext->sessionChangeCallback != NULL )
+            {
+                pAgentContext->sessionChangeCallback( pAgentContext,
+                                                      MQTTAgentSessionCleared,
+                                                      MQTT_PACKET_ID_INVALID,
+                                                      NULL );
+            }
         }
     }
     else
@@ -960,6 +1553,130 @@ MQTTStatus_t MQTTAgent_ResumeSession( MQTTAgentContext_t * pMqttAgentContext,
 
 /*-----------------------------------------------------------*/
 
+MQTTStatus_t MQTTAgent_RestoreSubscriptions( MQTTAgentContext_t * pMqttAgentContext,
+                                             MQTTSubscribeInfo_t * pSubscribeInfo,
+                                             size_t numSubscriptions,
+                                             CommandCallback_t cmdCompleteCallback )
+{
+    MQTTStatus_t statusResult = MQTTSuccess;
+    MQTTAgentSubscribeArgs_t * pRestoreArgs;
+    Command_t * pCommand;
+    size_t firstSubscription = 0, subscriptionsInPacket, packetCount = 0;
+    uint16_t packetId;
+
+    /* If the packet ID is zero then the MQTT context has not been initialized as 0
+     * is the initial value but not a valid packet ID. */
+    if( ( pMqttAgentContext == NULL ) || ( pMqttAgentContext->mqttContext.nextPacketId == 0 ) )
+    {
+        statusResult = MQTTIllegalState;
+    }
+    else if( ( pSubscribeInfo == NULL ) && ( numSubscriptions > 0U ) )
+    {
+        statusResult = MQTTBadParameter;
+    }
+    else if( MQTTAgent_IsRestoringSubscriptions( pMqttAgentContext ) == true )
+    {
+        /* The restore arguments are still referenced by the pending acks. */
+        LogError( ( "Subscriptions are already being restored.\n" ) );
+        statusResult = MQTTIllegalState;
+    }
+    else
+    {
+        pMqttAgentContext->pendingRestoreAcks = 0U;
+
+        /* Send every packet before waiting for any SUBACK.  The SUBACKs are
+         * processed by the command loop like those of any other SUBSCRIBE. */
+        while( ( firstSubscription < numSubscriptions ) && ( statusResult == MQTTSuccess ) )
+        {
+            subscriptionsInPacket = getSubscriptionsPerPacket( pMqttAgentContext,
+                                                               &( pSubscribeInfo[ firstSubscription ] ),
+                                                               numSubscriptions - firstSubscription );
+
+            if( subscriptionsInPacket == 0U )
+            {
+                LogError( ( "Topic filter %.*s does not fit in the network buffer.\n",
+                            ( int ) pSubscribeInfo[ firstSubscription ].topicFilterLength,
+                            pSubscribeInfo[ firstSubscription ].pTopicFilter ) );
+                statusResult = MQTTNoMemory;
+                break;
+            }
+
+            pCommand = ( packetCount < MQTT_AGENT_MAX_RESTORE_PACKETS ) ? Agent_GetCommand( 0U ) : NULL;
+
+            if( pCommand == NULL )
+            {
+                LogError( ( "Out of resources restoring subscriptions after %u packets.\n",
+                            ( unsigned int ) packetCount ) );
+                statusResult = MQTTNoMemory;
+                break;
+            }
+
+            pRestoreArgs = &( pMqttAgentContext->restoreArgs[ packetCount ] );
+            pRestoreArgs->pSubscribeInfo = &( pSubscribeInfo[ firstSubscription ] );
+            pRestoreArgs->numSubscriptions = subscriptionsInPacket;
+
+            /* Also checks there is space in the pending ack list. */
+            statusResult = createCommand( SUBSCRIBE,
+                                          pMqttAgentContext,
+                                          pRestoreArgs,
+                                          cmdCompleteCallback,
+                                          ( CommandContext_t * ) pRestoreArgs,
+                                          pCommand );
+
+            if( statusResult == MQTTSuccess )
+            {
+                packetId = MQTT_GetPacketId( &( pMqttAgentContext->mqttContext ) );
+                statusResult = MQTT_Subscribe( &( pMqttAgentContext->mqttContext ),
+                                               pRestoreArgs->pSubscribeInfo,
+                                               pRestoreArgs->numSubscriptions,
+                                               packetId );
+            }
+
+            if( statusResult == MQTTSuccess )
+            {
+                /* Cannot fail as createCommand() found space and only the agent
+                 * task adds pending acks. */
+                ( void ) addAwaitingOperation( pMqttAgentContext, packetId, pCommand );
+
+                LogInfo( ( "Restoring %u subscriptions with packet id %u.\n",
+                           ( unsigned int ) subscriptionsInPacket,
+                           packetId ) );
+
+                pMqttAgentContext->pendingRestoreAcks++;
+                firstSubscription += subscriptionsInPacket;
+                packetCount++;
+            }
+            else
+            {
+                Agent_ReleaseCommand( pCommand );
+            }
+        }
+    }
+
+    return statusResult;
+}
+
+/*-----------------------------------------------------------*/
+
+bool MQTTAgent_IsRestoringSubscriptions( MQTTAgentContext_t * pMqttAgentContext )
+{
+    bool restoring = false;
+    size_t i;
+
+    if( pMqttAgentContext != NULL )
+    {
+        for( i = 0; ( i < MQTT_AGENT_MAX_OUTSTANDING_ACKS ) && ( restoring == false ); i++ )
+        {
+            restoring = ( pMqttAgentContext->pPendingAcks[ i ].packetId != MQTT_PACKET_ID_INVALID ) &&
+                        isRestoreCommand( pMqttAgentContext, pMqttAgentContext->pPendingAcks[ i ].pOriginalCommand );
+        }
+    }
+
+    return restoring;
+}
+
+/*-----------------------------------------------------------*/
+
 MQTTStatus_t MQTTAgent_Subscribe( MQTTAgentContext_t * pMqttAgentContext,
                                   MQTTAgentSubscribeArgs_t * pSubscriptionArgs,
                                   CommandInfo_t * pCommandInfo )
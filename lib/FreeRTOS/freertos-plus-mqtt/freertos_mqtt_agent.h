@@ -64,6 +64,36 @@
     #define MQTT_AGENT_MAX_EVENT_QUEUE_WAIT_TIME    ( 1000 )
 #endif
 
+/**
+ * @brief The maximum number of SUBSCRIBE packets MQTTAgent_RestoreSubscriptions()
+ * can split a set of subscriptions into.
+ *
+ * @note Each SUBSCRIBE packet must fit in the network buffer, so only very large
+ * subscription sets need more than one packet.  Each packet also occupies a
+ * pending acknowledgment and a command structure until its SUBACK arrives.
+ */
+#ifndef MQTT_AGENT_MAX_RESTORE_PACKETS
+    #define MQTT_AGENT_MAX_RESTORE_PACKETS    ( 4 )
+#endif
+
+/**
+ * @brief The maximum number of commands the agent holds back while the
+ * connection is being re-established, or while subscriptions are being restored
+ * after a reconnect.
+ *
+ * @note Commands received while the agent is reconnecting are held back, and
+ * sent in order once the connection is restored.  Commands that do not fit
+ * complete immediately with `MQTTNoMemory`, rather than leaving the sending
+ * task blocked on a full command queue.  Publishes are also held back while
+ * subscriptions are restored so responses to them are not missed because the
+ * subscription they arrive on has not been restored yet.  If more publishes
+ * than this arrive before every SUBACK has been received then the excess
+ * publishes are sent immediately.
+ */
+#ifndef MQTT_AGENT_MAX_DEFERRED_COMMANDS
+    #define MQTT_AGENT_MAX_DEFERRED_COMMANDS    ( 10 )
+#endif
+
 /*-----------------------------------------------------------*/
 
 /**
@@ -104,6 +134,7 @@ typedef struct ackInfo
 {
     uint16_t packetId;            /**< Packet ID of the pending acknowledgment. */
     Command_t * pOriginalCommand; /**< Command expecting acknowledgment. */
+    bool resendOnResume;          /**< Publish loaded by MQTTAgent_LoadSession() and not yet resent, so unknown to the MQTT library. */
 } AckInfo_t;
 
 /**
@@ -138,6 +169,109 @@ typedef void (* IncomingPublishCallback_t )( MQTTAgentContext_t * pMqttAgentCont
                                              uint16_t packetId,
                                              MQTTPublishInfo_t * pPublishInfo );
 
+/**
+ * @brief State of the connection managed by an MQTT agent.
+ */
+typedef enum MQTTAgentConnectionState
+{
+    MQTTAgentStateDisconnected = 0, /**< @brief Not connected, and not attempting to connect. */
+    MQTTAgentStateReconnecting,     /**< @brief The connection was lost, the agent is re-establishing it. */
+    MQTTAgentStateRestoring,        /**< @brief Connected, waiting for subscriptions to be restored. */
+    MQTTAgentStateConnected         /**< @brief Connected. */
+} MQTTAgentConnectionState_t;
+
+/**
+ * @brief Function called by the agent to make one attempt at re-establishing a
+ * lost connection.
+ *
+ * @note The function should connect the transport, send an MQTT CONNECT, and then
+ * call MQTTAgent_ResumeSession() and, if needed, MQTTAgent_RestoreSubscriptions().
+ * It should make a single attempt and not delay between retries itself, as the
+ * agent continues to service its command queue while waiting to retry.
+ *
+ * @param[in] pMqttAgentContext The MQTT agent that lost its connection.
+ * @param[out] pRetryDelayMs If the attempt fails, set to the time in milliseconds
+ * to wait before the next attempt.
+ *
+ * @return `MQTTSuccess` if the connection was re-established, otherwise an
+ * appropriate error code.
+ */
+typedef MQTTStatus_t (* MQTTAgentReconnectFunc_t )( MQTTAgentContext_t * pMqttAgentContext,
+                                                    uint32_t * pRetryDelayMs );
+
+/**
+ * @brief Function called by the agent to close the transport after the MQTT
+ * connection is lost or disconnected.
+ *
+ * @param[in] pMqttAgentContext The MQTT agent whose transport is to be closed.
+ */
+typedef void (* MQTTAgentDisconnectFunc_t )( MQTTAgentContext_t * pMqttAgentContext );
+
+/**
+ * @brief Function called by the agent after processing each command, to write
+ * out any packets the transport has buffered rather than sent.
+ *
+ * @param[in] pMqttAgentContext The MQTT agent whose transport is to be flushed.
+ *
+ * @return `MQTTSuccess` if the buffered packets were sent, otherwise an
+ * appropriate error code, which the agent handles as a lost connection.
+ */
+typedef MQTTStatus_t (* MQTTAgentFlushFunc_t )( MQTTAgentContext_t * pMqttAgentContext );
+
+/**
+ * @brief Functions used by the agent to manage the transport connection.
+ */
+typedef struct MQTTAgentConnectionInterface
+{
+    MQTTAgentReconnectFunc_t reconnect;   /**< @brief Attempt to re-establish the connection. */
+    MQTTAgentDisconnectFunc_t disconnect; /**< @brief Close the transport connection. */
+    MQTTAgentFlushFunc_t flush;           /**< @brief Optional.  Send the packets the transport has buffered. */
+} MQTTAgentConnectionInterface_t;
+
+/**
+ * @brief Change to the in-flight state of an MQTT session.
+ */
+typedef enum MQTTAgentSessionEvent
+{
+    MQTTAgentSessionPublishSent = 0, /**< @brief A QoS 1 or 2 publish was sent and is waiting to be acknowledged. */
+    MQTTAgentSessionPublishAcked,    /**< @brief A publish was acknowledged, so is no longer part of the session. */
+    MQTTAgentSessionCleared          /**< @brief The broker had no session, so every unacknowledged publish was discarded. */
+} MQTTAgentSessionEvent_t;
+
+/**
+ * @brief Function called by the agent task each time the in-flight state of
+ * the session changes, so the state can be saved incrementally.
+ *
+ * @param[in] pMqttAgentContext The MQTT agent whose session changed.
+ * @param[in] event What changed.
+ * @param[in] packetId Packet ID of the publish that was sent or acknowledged,
+ * otherwise #MQTT_PACKET_ID_INVALID.
+ * @param[in] pPublishInfo For #MQTTAgentSessionPublishSent, the publish that was
+ * sent, otherwise NULL.  Only valid for the duration of the call.
+ */
+typedef void (* MQTTAgentSessionChangeFunc_t )( MQTTAgentContext_t * pMqttAgentContext,
+                                                MQTTAgentSessionEvent_t event,
+                                                uint16_t packetId,
+                                                const MQTTPublishInfo_t * pPublishInfo );
+
+/**
+ * @brief An unacknowledged publish passed to MQTTAgent_LoadSession().
+ */
+typedef struct MQTTAgentSessionPublish
+{
+    uint16_t packetId;                /**< @brief Packet ID the publish was sent with. */
+    MQTTPublishInfo_t * pPublishInfo; /**< @brief The publish, which is resent by MQTTAgent_ResumeSession(). */
+} MQTTAgentSessionPublish_t;
+
+/**
+ * @brief Struct holding arguments for a SUBSCRIBE or UNSUBSCRIBE call.
+ */
+typedef struct MQTTAgentSubscribeArgs
+{
+    MQTTSubscribeInfo_t * pSubscribeInfo;
+    size_t numSubscriptions;
+} MQTTAgentSubscribeArgs_t;
+
 /**
  * @brief Information used by each MQTT agent. A context will be initialized by
  * MQTTAgent_Init(), and every API function will accept a pointer to the
@@ -151,17 +285,17 @@ struct MQTTAgentContext
     IncomingPublishCallback_t pIncomingCallback;
     void * pIncomingCallbackContext;
     bool packetReceivedInLoop;
+    MQTTAgentSubscribeArgs_t restoreArgs[ MQTT_AGENT_MAX_RESTORE_PACKETS ]; /**< The subscriptions carried by each SUBSCRIBE sent by MQTTAgent_RestoreSubscriptions(). */
+    size_t pendingRestoreAcks;                                              /**< Number of restoring SUBSCRIBE packets not yet acknowledged. */
+    Command_t * pDeferredCommands[ MQTT_AGENT_MAX_DEFERRED_COMMANDS ];      /**< FIFO of commands held back until restoring completes. */
+    size_t deferredHead;                                                    /**< Index of the oldest deferred command. */
+    size_t deferredCount;                                                   /**< Number of deferred commands. */
+    MQTTAgentConnectionInterface_t connectionInterface;                     /**< Set by MQTTAgent_SetConnectionInterface(). */
+    MQTTAgentConnectionState_t connectionState;                             /**< Whether the agent is connected or reconnecting. */
+    uint32_t reconnectTimeMs;                                               /**< Time at which to next attempt to reconnect. */
+    MQTTAgentSessionChangeFunc_t sessionChangeCallback;                     /**< Set by MQTTAgent_SetSessionChangeCallback(). */
 };
 
-/**
- * @brief Struct holding arguments for a SUBSCRIBE or UNSUBSCRIBE call.
- */
-typedef struct MQTTAgentSubscribeArgs
-{
-    MQTTSubscribeInfo_t * pSubscribeInfo;
-    size_t numSubscriptions;
-} MQTTAgentSubscribeArgs_t;
-
 /**
  * @brief Struct holding arguments for a CONNECT call.
  */
@@ -223,9 +357,96 @@ MQTTStatus_t MQTTAgent_Init( MQTTAgentContext_t * pMqttAgentContext,
                              IncomingPublishCallback_t incomingCallback,
                              void * pIncomingPacketContext );
 
+/**
+ * @brief Let the agent re-establish a lost connection itself, rather than
+ * returning from MQTTAgent_CommandLoop() when the connection is lost.
+ *
+ * @note Once set, the agent also closes the transport using the interface's
+ * disconnect function after processing a DISCONNECT command.
+ *
+ * @param[in] pMqttAgentContext The MQTT agent to use.
+ * @param[in] pConnectionInterface Functions the agent calls to reconnect and
+ * to close the transport.  The structure is copied.
+ *
+ * @return `MQTTSuccess` if the interface was set, otherwise `MQTTBadParameter`.
+ */
+MQTTStatus_t MQTTAgent_SetConnectionInterface( MQTTAgentContext_t * pMqttAgentContext,
+                                               const MQTTAgentConnectionInterface_t * pConnectionInterface );
+
+/**
+ * @brief Obtain the state of the connection managed by an MQTT agent.
+ *
+ * @note The state is only a snapshot, as it is updated by the agent task.  It
+ * can be used, for example, to stop producing data that is not worth holding
+ * back while the agent is reconnecting.
+ *
+ * @param[in] pMqttAgentContext The MQTT agent to query.
+ *
+ * @return The current connection state.
+ */
+MQTTAgentConnectionState_t MQTTAgent_GetConnectionState( const MQTTAgentContext_t * pMqttAgentContext );
+
+/**
+ * @brief Set a function to be called each time a QoS 1 or 2 publish is sent or
+ * acknowledged, so the session can be saved and reloaded with
+ * MQTTAgent_LoadSession() after a reset.
+ *
+ * @note The function is called from the agent task, which cannot process
+ * commands or packets until it returns.
+ *
+ * @param[in] pMqttAgentContext The MQTT agent to use.
+ * @param[in] sessionChangeCallback The function to call, or NULL to stop calling
+ * a previously set function.
+ *
+ * @return `MQTTSuccess` if the function was set, otherwise `MQTTBadParameter`.
+ */
+MQTTStatus_t MQTTAgent_SetSessionChangeCallback( MQTTAgentContext_t * pMqttAgentContext,
+                                                 MQTTAgentSessionChangeFunc_t sessionChangeCallback );
+
+/**
+ * @brief Reload the unacknowledged publishes of a session saved before a reset.
+ *
+ * The publishes are added to the agent's pending acknowledgments, so
+ * connecting without a clean session and then calling MQTTAgent_ResumeSession()
+ * resends them, with the DUP flag set, if the broker still has the session.
+ * Resending them recreates the MQTT library's publish state.  If the broker does
+ * not have the session, the callback of each is called with an error.
+ *
+ * @note Must be called after MQTTAgent_Init() and before connecting.
+ * pPublishes and the publishes it references MUST stay in scope until each
+ * callback has been called.
+ *
+ * @param[in] pMqttAgentContext The MQTT agent to use.
+ * @param[in] pPublishes Array of unacknowledged publishes.
+ * @param[in] numPublishes Number of entries in pPublishes.
+ * @param[in] nextPacketId The packet ID to use for the next packet sent, so
+ * IDs still in use by the broker's session are not reused.  Ignored if
+ * #MQTT_PACKET_ID_INVALID.
+ * @param[in] cmdCompleteCallback Optional callback invoked when each publish
+ * completes.  Its context parameter points to the publish's entry in
+ * pPublishes.
+ *
+ * @return `MQTTSuccess` if every publish was loaded, `MQTTNoMemory` if there
+ * are more publishes than pending acknowledgments or commands available, else
+ * `MQTTBadParameter` or `MQTTIllegalState`.
+ */
+MQTTStatus_t MQTTAgent_LoadSession( MQTTAgentContext_t * pMqttAgentContext,
+                                    MQTTAgentSessionPublish_t * pPublishes,
+                                    size_t numPublishes,
+                                    uint16_t nextPacketId,
+                                    CommandCallback_t cmdCompleteCallback );
+
 /**
  * @brief Process commands from the command queue in a loop.
  *
+ * @note If a connection interface has been set with
+ * MQTTAgent_SetConnectionInterface() then losing the connection does not end
+ * the loop.  Instead the agent closes the transport and calls the reconnect
+ * function between servicing the command queue until the connection is
+ * re-established.  Commands received in the meantime are held back, up to
+ * #MQTT_AGENT_MAX_DEFERRED_COMMANDS of them, then processed in order once the
+ * connection is restored.
+ *
  * @param[in] pMqttAgentContext The MQTT agent to use.
  *
  * @return appropriate error code, or `MQTTSuccess` from a successful disconnect
@@ -246,6 +467,56 @@ MQTTStatus_t MQTTAgent_CommandLoop( MQTTAgentContext_t * pMqttAgentContext );
 MQTTStatus_t MQTTAgent_ResumeSession( MQTTAgentContext_t * pMqttAgentContext,
                                       bool sessionPresent );
 
+/**
+ * @brief Restore subscriptions after reconnecting without a session present.
+ *
+ * The subscriptions are split into as few SUBSCRIBE packets as will each fit in
+ * the network buffer, and every packet is sent without waiting for the SUBACK
+ * of the one before.  Each subscription is requested with the QoS held in its
+ * MQTTSubscribeInfo_t.  PUBLISH commands processed before every SUBACK has been
+ * received are held back, then sent in the order they were received once the
+ * subscriptions are restored.
+ *
+ * @note Must be called from the agent task after MQTTAgent_ResumeSession(),
+ * either before MQTTAgent_CommandLoop() or from the reconnect function the
+ * command loop calls.  pSubscribeInfo and the topic filters it references
+ * MUST stay in scope until each callback has been called, so must not be
+ * reused while MQTTAgent_IsRestoringSubscriptions() returns true.
+ *
+ * @param[in] pMqttAgentContext The MQTT agent to use.
+ * @param[in] pSubscribeInfo Array of subscriptions to restore.
+ * @param[in] numSubscriptions Number of entries in pSubscribeInfo.
+ * @param[in] cmdCompleteCallback Optional callback invoked when the SUBACK for
+ * each SUBSCRIBE packet is received.  Its context parameter points to the
+ * #MQTTAgentSubscribeArgs_t describing the subscriptions carried by that packet,
+ * in the same order as the SUBACK codes.
+ *
+ * @return `MQTTSuccess` if every SUBSCRIBE packet was sent, `MQTTNoMemory` if
+ * the subscriptions need more packets, pending acknowledgments or commands than
+ * are available, `MQTTIllegalState` if a SUBSCRIBE packet sent by an earlier
+ * call is still waiting for its SUBACK, else an appropriate error code from
+ * `MQTT_Subscribe()`.
+ */
+MQTTStatus_t MQTTAgent_RestoreSubscriptions( MQTTAgentContext_t * pMqttAgentContext,
+                                             MQTTSubscribeInfo_t * pSubscribeInfo,
+                                             size_t numSubscriptions,
+                                             CommandCallback_t cmdCompleteCallback );
+
+/**
+ * @brief Determine whether a SUBSCRIBE packet sent by
+ * MQTTAgent_RestoreSubscriptions() is still waiting for its SUBACK, in which
+ * case the subscriptions passed to it are still in use.
+ *
+ * @note Must be called from the agent task.  A session that is not present
+ * when reconnecting discards the restore, as MQTTAgent_ResumeSession() clears
+ * every pending acknowledgment.
+ *
+ * @param[in] pMqttAgentContext The MQTT agent to query.
+ *
+ * @return `true` if subscriptions are being restored, otherwise `false`.
+ */
+bool MQTTAgent_IsRestoringSubscriptions( MQTTAgentContext_t * pMqttAgentContext );
+
 /**
  * @brief Add a command to call MQTT_Subscribe() for an MQTT connection.
  *
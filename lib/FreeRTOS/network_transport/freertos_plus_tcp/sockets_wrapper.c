@@ -29,6 +29,7 @@
 
 /* FreeRTOS includes. */
 #include "FreeRTOS.h"
+#include "task.h"
 
 #include "sockets_wrapper.h"
 
@@ -42,6 +43,528 @@
 /* A negative error code indicating a network failure. */
 #define FREERTOS_SOCKETS_WRAPPER_NETWORK_ERROR    ( -1 )
 
+/* Maximum number of endpoints Sockets_ConnectAny() can race. */
+#ifndef FREERTOS_SOCKETS_WRAPPER_MAX_ENDPOINTS
+    #define FREERTOS_SOCKETS_WRAPPER_MAX_ENDPOINTS    ( 4 )
+#endif
+
+/* Time Sockets_ConnectAny() waits for an attempt to connect before also
+ * starting one to the next endpoint.  A few round trips is enough for a
+ * healthy endpoint to answer. */
+#ifndef FREERTOS_SOCKETS_WRAPPER_CONNECT_STAGGER_MS
+    #define FREERTOS_SOCKETS_WRAPPER_CONNECT_STAGGER_MS    ( 250U )
+#endif
+
+/* Time after which Sockets_ConnectAny() abandons an attempt to connect. */
+#ifndef FREERTOS_SOCKETS_WRAPPER_CONNECT_TIMEOUT_MS
+    #define FREERTOS_SOCKETS_WRAPPER_CONNECT_TIMEOUT_MS    ( 10000U )
+#endif
+
+/* Number of host names whose addresses are cached. */
+#ifndef FREERTOS_SOCKETS_WRAPPER_DNS_CACHE_ENTRIES
+    #define FREERTOS_SOCKETS_WRAPPER_DNS_CACHE_ENTRIES    ( 2 )
+#endif
+
+/* Number of addresses cached for each host name.  Set
+ * ipconfigDNS_CACHE_ADDRESSES_PER_ENTRY to at least this for FreeRTOS+TCP to
+ * keep the extra addresses a DNS reply carries. */
+#ifndef FREERTOS_SOCKETS_WRAPPER_DNS_ADDRESSES
+    #define FREERTOS_SOCKETS_WRAPPER_DNS_ADDRESSES    ( 4 )
+#endif
+
+/* Time after which cached addresses are resolved again before being used.
+ * FreeRTOS_gethostbyname() does not report the TTL of a DNS record, so this is
+ * a maximum.  The addresses are resolved through the FreeRTOS+TCP DNS cache,
+ * which honours the TTL of each record. */
+#ifndef FREERTOS_SOCKETS_WRAPPER_DNS_CACHE_TTL_MS
+    #define FREERTOS_SOCKETS_WRAPPER_DNS_CACHE_TTL_MS    ( 5U * 60U * 1000U )
+#endif
+
+/* Time after which cached addresses are refreshed in the background while
+ * still being used, so they are seldom resolved while connecting. */
+#ifndef FREERTOS_SOCKETS_WRAPPER_DNS_REFRESH_MS
+    #define FREERTOS_SOCKETS_WRAPPER_DNS_REFRESH_MS    ( ( FREERTOS_SOCKETS_WRAPPER_DNS_CACHE_TTL_MS / 4U ) * 3U )
+#endif
+
+/* Time to wait for a background refresh to be answered. */
+#ifndef FREERTOS_SOCKETS_WRAPPER_DNS_REFRESH_TIMEOUT_MS
+    #define FREERTOS_SOCKETS_WRAPPER_DNS_REFRESH_TIMEOUT_MS    ( 5000U )
+#endif
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief The addresses a host name resolved to.
+ */
+typedef struct DnsCacheEntry
+{
+    char hostName[ ipconfigDNS_CACHE_NAME_LENGTH ];                  /**< @brief The host name, or empty if the entry is unused. */
+    uint32_t addresses[ FREERTOS_SOCKETS_WRAPPER_DNS_ADDRESSES ]; /**< @brief The addresses, in network byte order. */
+    size_t addressCount;                                             /**< @brief Number of valid entries in addresses. */
+    size_t currentAddress;                                           /**< @brief Index of the address to connect to next. */
+    TickType_t resolvedTime;                                         /**< @brief Tick count when the addresses were last resolved. */
+    BaseType_t refreshPending;                                       /**< @brief pdTRUE while a background refresh is outstanding. */
+} DnsCacheEntry_t;
+
+/**
+ * @brief Addresses of the host names most recently connected to.
+ */
+static DnsCacheEntry_t dnsCache[ FREERTOS_SOCKETS_WRAPPER_DNS_CACHE_ENTRIES ];
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Find the cache entry of a host name.
+ *
+ * @note Must be called from within a critical section.
+ *
+ * @param[in] pHostName The host name.
+ *
+ * @return The entry, or NULL if the host name is not cached.
+ */
+static DnsCacheEntry_t * findDnsEntry( const char * pHostName );
+
+/**
+ * @brief Add an address to the cache entry of a host name, creating the entry
+ * in place of the least recently resolved one if needed.  The entry is only
+ * marked resolved if it holds the address, so an entry that is full of other
+ * addresses still expires and is resolved again in full.
+ *
+ * @note Must be called from within a critical section.
+ *
+ * @param[in] pHostName The host name.
+ * @param[in] address The address, in network byte order.
+ * @param[in] replace pdTRUE to discard the addresses already cached first.
+ */
+static void cacheDnsAddress( const char * pHostName,
+                             uint32_t address,
+                             BaseType_t replace );
+
+/**
+ * @brief Get the address to connect to for a host name.
+ *
+ * Cached addresses are used until they expire, and refreshed in the
+ * background once they are old.  Expired addresses are resolved again, but
+ * used anyway if that fails, since the host is more likely to still be at its
+ * old address than the connection is to succeed without one.
+ *
+ * @param[in] pHostName The host name.
+ *
+ * @return The address in network byte order, or 0 if none is known.
+ */
+static uint32_t resolveHostName( const char * pHostName );
+
+/**
+ * @brief Move on to the next cached address of a host name after connecting
+ * to one of them failed.
+ *
+ * @param[in] pHostName The host name.
+ * @param[in] failedAddress The address that could not be connected to.
+ */
+static void rotateDnsAddress( const char * pHostName,
+                              uint32_t failedAddress );
+
+/**
+ * @brief Set the receive and send timeouts of a connected socket.
+ *
+ * @param[in] tcpSocket The socket.
+ * @param[in] receiveTimeoutMs Timeout (in milliseconds) for transport receive.
+ * @param[in] sendTimeoutMs Timeout (in milliseconds) for transport send.
+ */
+static void setSocketTimeouts( Socket_t tcpSocket,
+                               uint32_t receiveTimeoutMs,
+                               uint32_t sendTimeoutMs );
+
+/**
+ * @brief Order endpoints by how likely they are to connect quickly.
+ *
+ * @param[in] pEndpoints The endpoints.
+ * @param[in] endpointCount Number of endpoints.
+ * @param[out] pOrder Receives the indexes of the endpoints, best first.
+ */
+static void orderEndpoints( const SocketsEndpoint_t * pEndpoints,
+                            size_t endpointCount,
+                            size_t * pOrder );
+
+/**
+ * @brief Start connecting to an endpoint without waiting for the connection
+ * to complete.
+ *
+ * @param[in] pEndpoint The endpoint.
+ * @param[in] socketSet The set to add the socket to.
+ * @param[out] pAddress Receives the address connected to, so it can be
+ * rotated if the connection does not complete.
+ *
+ * @return The connecting socket, or FREERTOS_INVALID_SOCKET if the attempt
+ * could not be started.
+ */
+static Socket_t startConnect( const SocketsEndpoint_t * pEndpoint,
+                              SocketSet_t socketSet,
+                              uint32_t * pAddress );
+
+#if ( ipconfigDNS_USE_CALLBACKS == 1 )
+
+/**
+ * @brief Called by the IP task with the result of a background refresh.
+ *
+ * @param[in] pHostName The host name that was resolved.
+ * @param[in] pSearchId Unused.
+ * @param[in] address The address, or 0 if the host name could not be resolved.
+ */
+    static void dnsRefreshCallback( const char * pHostName,
+                                    void * pSearchId,
+                                    uint32_t address );
+#endif
+
+/*-----------------------------------------------------------*/
+
+static DnsCacheEntry_t * findDnsEntry( const char * pHostName )
+{
+    DnsCacheEntry_t * pEntry = NULL;
+    size_t i;
+
+    for( i = 0; ( i < FREERTOS_SOCKETS_WRAPPER_DNS_CACHE_ENTRIES ) && ( pEntry == NULL ); i++ )
+    {
+        if( strncmp( dnsCache[ i ].hostName, pHostName, sizeof( dnsCache[ i ].hostName ) ) == 0 )
+        {
+            pEntry = &( dnsCache[ i ] );
+        }
+    }
+
+    return pEntry;
+}
+
+/*-----------------------------------------------------------*/
+
+static void cacheDnsAddress( const char * pHostName,
+                             uint32_t address,
+                             BaseType_t replace )
+{
+    DnsCacheEntry_t * pEntry = findDnsEntry( pHostName );
+    TickType_t now = xTaskGetTickCount();
+    size_t i;
+
+    if( pEntry == NULL )
+    {
+        /* Reuse the entry resolved longest ago, or an unused one. */
+        pEntry = &( dnsCache[ 0 ] );
+
+        for( i = 1; i < FREERTOS_SOCKETS_WRAPPER_DNS_CACHE_ENTRIES; i++ )
+        {
+            if( ( dnsCache[ i ].addressCount == 0U ) ||
+                ( ( now - dnsCache[ i ].resolvedTime ) > ( now - pEntry->resolvedTime ) ) )
+            {
+                pEntry = &( dnsCache[ i ] );
+            }
+        }
+
+        ( void ) memset( pEntry, 0x00, sizeof( DnsCacheEntry_t ) );
+        ( void ) strncpy( pEntry->hostName, pHostName, sizeof( pEntry->hostName ) - 1U );
+    }
+
+    if( replace == pdTRUE )
+    {
+        pEntry->addressCount = 0U;
+        pEntry->currentAddress = 0U;
+        pEntry->refreshPending = pdFALSE;
+    }
+
+    for( i = 0; ( i < pEntry->addressCount ) && ( pEntry->addresses[ i ] != address ); i++ )
+    {
+    }
+
+    /* A new address is added if there is room. */
+    if( ( i == pEntry->addressCount ) && ( i < FREERTOS_SOCKETS_WRAPPER_DNS_ADDRESSES ) )
+    {
+        pEntry->addresses[ i ] = address;
+        pEntry->addressCount++;
+    }
+
+    /* An address that did not fit shows the host may have moved, so the
+     * addresses cached are left to age. */
+    if( i < pEntry->addressCount )
+    {
+        pEntry->resolvedTime = now;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static uint32_t resolveHostName( const char * pHostName )
+{
+    DnsCacheEntry_t * pEntry;
+    uint32_t address = 0U;
+    uint32_t resolvedAddress;
+    TickType_t age = 0U;
+    BaseType_t startRefresh = pdFALSE;
+    size_t i;
+
+    taskENTER_CRITICAL();
+    {
+        pEntry = findDnsEntry( pHostName );
+
+        if( ( pEntry != NULL ) && ( pEntry->addressCount > 0U ) )
+        {
+            address = pEntry->addresses[ pEntry->currentAddress ];
+            age = xTaskGetTickCount() - pEntry->resolvedTime;
+
+            if( ( age >= pdMS_TO_TICKS( FREERTOS_SOCKETS_WRAPPER_DNS_REFRESH_MS ) ) &&
+                ( pEntry->refreshPending == pdFALSE ) )
+            {
+                pEntry->refreshPending = pdTRUE;
+                startRefresh = pdTRUE;
+            }
+        }
+    }
+    taskEXIT_CRITICAL();
+
+    if( ( address != 0U ) && ( age < pdMS_TO_TICKS( FREERTOS_SOCKETS_WRAPPER_DNS_CACHE_TTL_MS ) ) )
+    {
+        #if ( ipconfigDNS_USE_CALLBACKS == 1 )
+            if( startRefresh == pdTRUE )
+            {
+                LogDebug( ( "Refreshing the addresses of %s in the background.", pHostName ) );
+
+                /* The address is returned directly if FreeRTOS+TCP still has
+                 * it cached, otherwise the callback is called later. */
+                resolvedAddress = FreeRTOS_gethostbyname_a( pHostName,
+                                                            dnsRefreshCallback,
+                                                            NULL,
+                                                            pdMS_TO_TICKS( FREERTOS_SOCKETS_WRAPPER_DNS_REFRESH_TIMEOUT_MS ) );
+
+                if( resolvedAddress != 0U )
+                {
+                    dnsRefreshCallback( pHostName, NULL, resolvedAddress );
+                }
+            }
+        #else
+            ( void ) startRefresh;
+        #endif
+    }
+    else
+    {
+        /* FreeRTOS+TCP returns the addresses of a host name in turn, so
+         * repeating the lookup collects each address the reply carried.  Only
+         * the first lookup is sent to the DNS server. */
+        resolvedAddress = ( uint32_t ) FreeRTOS_gethostbyname( pHostName );
+
+        if( resolvedAddress != 0U )
+        {
+            taskENTER_CRITICAL();
+            {
+                cacheDnsAddress( pHostName, resolvedAddress, pdTRUE );
+            }
+            taskEXIT_CRITICAL();
+
+            address = resolvedAddress;
+
+            for( i = 1; i < FREERTOS_SOCKETS_WRAPPER_DNS_ADDRESSES; i++ )
+            {
+                resolvedAddress = ( uint32_t ) FreeRTOS_gethostbyname( pHostName );
+
+                if( ( resolvedAddress == 0U ) || ( resolvedAddress == address ) )
+                {
+                    break;
+                }
+
+                taskENTER_CRITICAL();
+                {
+                    cacheDnsAddress( pHostName, resolvedAddress, pdFALSE );
+                }
+                taskEXIT_CRITICAL();
+            }
+        }
+        else if( address != 0U )
+        {
+            LogWarn( ( "DNS resolution of %s failed, using the address it last resolved to.",
+                       pHostName ) );
+        }
+        else
+        {
+            /* Empty else for MISRA 15.7 compliance. */
+        }
+    }
+
+    return address;
+}
+
+/*-----------------------------------------------------------*/
+
+static void rotateDnsAddress( const char * pHostName,
+                              uint32_t failedAddress )
+{
+    DnsCacheEntry_t * pEntry;
+
+    taskENTER_CRITICAL();
+    {
+        pEntry = findDnsEntry( pHostName );
+
+        if( ( pEntry != NULL ) &&
+            ( pEntry->addressCount > 1U ) &&
+            ( pEntry->addresses[ pEntry->currentAddress ] == failedAddress ) )
+        {
+            pEntry->currentAddress = ( pEntry->currentAddress + 1U ) % pEntry->addressCount;
+        }
+    }
+    taskEXIT_CRITICAL();
+}
+
+/*-----------------------------------------------------------*/
+
+#if ( ipconfigDNS_USE_CALLBACKS == 1 )
+
+    static void dnsRefreshCallback( const char * pHostName,
+                                    void * pSearchId,
+                                    uint32_t address )
+    {
+        DnsCacheEntry_t * pEntry;
+
+        ( void ) pSearchId;
+
+        taskENTER_CRITICAL();
+        {
+            pEntry = findDnsEntry( pHostName );
+
+            if( pEntry != NULL )
+            {
+                pEntry->refreshPending = pdFALSE;
+
+                /* Keep the addresses already cached, as the reply may only
+                 * carry one of them.  On failure the addresses age until they
+                 * are resolved again before use. */
+                if( address != 0U )
+                {
+                    cacheDnsAddress( pHostName, address, pdFALSE );
+                }
+            }
+        }
+        taskEXIT_CRITICAL();
+    }
+#endif /* if ( ipconfigDNS_USE_CALLBACKS == 1 ) */
+
+/*-----------------------------------------------------------*/
+
+static void setSocketTimeouts( Socket_t tcpSocket,
+                               uint32_t receiveTimeoutMs,
+                               uint32_t sendTimeoutMs )
+{
+    TickType_t transportTimeout = 0;
+
+    /* Set socket receive timeout. */
+    transportTimeout = pdMS_TO_TICKS( receiveTimeoutMs );
+    /* Setting the receive block time cannot fail. */
+    ( void ) FreeRTOS_setsockopt( tcpSocket,
+                                  0,
+                                  FREERTOS_SO_RCVTIMEO,
+                                  &transportTimeout,
+                                  sizeof( TickType_t ) );
+
+    /* Set socket send timeout. */
+    transportTimeout = pdMS_TO_TICKS( sendTimeoutMs );
+    /* Setting the send block time cannot fail. */
+    ( void ) FreeRTOS_setsockopt( tcpSocket,
+                                  0,
+                                  FREERTOS_SO_SNDTIMEO,
+                                  &transportTimeout,
+                                  sizeof( TickType_t ) );
+}
+
+/*-----------------------------------------------------------*/
+
+static void orderEndpoints( const SocketsEndpoint_t * pEndpoints,
+                            size_t endpointCount,
+                            size_t * pOrder )
+{
+    size_t i, j, index;
+    const SocketsEndpoint_t * pEndpoint;
+    const SocketsEndpoint_t * pPrevious;
+
+    /* Insertion sort, which keeps the list order of equal endpoints.  An
+     * endpoint never connected to sorts after those with a known latency. */
+    for( i = 0; i < endpointCount; i++ )
+    {
+        index = i;
+        pEndpoint = &( pEndpoints[ index ] );
+
+        for( j = i; j > 0U; j-- )
+        {
+            pPrevious = &( pEndpoints[ pOrder[ j - 1U ] ] );
+
+            if( ( pEndpoint->failures > pPrevious->failures ) ||
+                ( ( pEndpoint->failures == pPrevious->failures ) &&
+                  ( ( pEndpoint->latencyMs == 0U ) ||
+                    ( ( pPrevious->latencyMs != 0U ) && ( pEndpoint->latencyMs >= pPrevious->latencyMs ) ) ) ) )
+            {
+                break;
+            }
+
+            pOrder[ j ] = pOrder[ j - 1U ];
+        }
+
+        pOrder[ j ] = index;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static Socket_t startConnect( const SocketsEndpoint_t * pEndpoint,
+                              SocketSet_t socketSet,
+                              uint32_t * pAddress )
+{
+    Socket_t tcpSocket = FREERTOS_INVALID_SOCKET;
+    BaseType_t socketStatus = 0;
+    struct freertos_sockaddr serverAddress = { 0 };
+    const TickType_t noBlock = 0;
+
+    serverAddress.sin_family = FREERTOS_AF_INET;
+    serverAddress.sin_port = FreeRTOS_htons( pEndpoint->port );
+    serverAddress.sin_addr = resolveHostName( pEndpoint->pHostName );
+    serverAddress.sin_len = ( uint8_t ) sizeof( serverAddress );
+    *pAddress = serverAddress.sin_addr;
+
+    if( serverAddress.sin_addr == 0U )
+    {
+        LogError( ( "DNS resolution failed: Hostname=%s.", pEndpoint->pHostName ) );
+    }
+    else
+    {
+        tcpSocket = FreeRTOS_socket( FREERTOS_AF_INET, FREERTOS_SOCK_STREAM, FREERTOS_IPPROTO_TCP );
+
+        if( tcpSocket == FREERTOS_INVALID_SOCKET )
+        {
+            LogError( ( "Failed to create new socket." ) );
+        }
+    }
+
+    if( tcpSocket != FREERTOS_INVALID_SOCKET )
+    {
+        /* With no send block time FreeRTOS_connect() returns once the SYN is
+         * queued, and the socket becomes writable when it connects. */
+        ( void ) FreeRTOS_setsockopt( tcpSocket, 0, FREERTOS_SO_SNDTIMEO, &noBlock, sizeof( TickType_t ) );
+        FreeRTOS_FD_SET( tcpSocket, socketSet, eSELECT_WRITE | eSELECT_EXCEPT );
+
+        LogDebug( ( "Creating TCP Connection to %s.", pEndpoint->pHostName ) );
+        socketStatus = FreeRTOS_connect( tcpSocket, &serverAddress, sizeof( serverAddress ) );
+
+        if( ( socketStatus != 0 ) &&
+            ( socketStatus != -pdFREERTOS_ERRNO_EWOULDBLOCK ) &&
+            ( socketStatus != -pdFREERTOS_ERRNO_EINPROGRESS ) )
+        {
+            LogError( ( "Failed to connect to server: FreeRTOS_Connect failed: ReturnCode=%d,"
+                        " Hostname=%s, Port=%u.",
+                        ( int ) socketStatus,
+                        pEndpoint->pHostName,
+                        pEndpoint->port ) );
+            rotateDnsAddress( pEndpoint->pHostName, serverAddress.sin_addr );
+            FreeRTOS_FD_CLR( tcpSocket, socketSet, eSELECT_ALL );
+            ( void ) FreeRTOS_closesocket( tcpSocket );
+            tcpSocket = FREERTOS_INVALID_SOCKET;
+        }
+    }
+
+    return tcpSocket;
+}
+
 /*-----------------------------------------------------------*/
 
 BaseType_t Sockets_Connect( Socket_t * pTcpSocket,
@@ -53,7 +576,6 @@ BaseType_t Sockets_Connect( Socket_t * pTcpSocket,
     Socket_t tcpSocket = FREERTOS_INVALID_SOCKET;
     BaseType_t socketStatus = 0;
     struct freertos_sockaddr serverAddress = { 0 };
-    TickType_t transportTimeout = 0;
 
     /* Create a new TCP socket. */
     tcpSocket = FreeRTOS_socket( FREERTOS_AF_INET, FREERTOS_SOCK_STREAM, FREERTOS_IPPROTO_TCP );
@@ -70,7 +592,7 @@ BaseType_t Sockets_Connect( Socket_t * pTcpSocket,
         /* Connection parameters. */
         serverAddress.sin_family = FREERTOS_AF_INET;
         serverAddress.sin_port = FreeRTOS_htons( port );
-        serverAddress.sin_addr = ( uint32_t ) FreeRTOS_gethostbyname( pHostName );
+        serverAddress.sin_addr = resolveHostName( pHostName );
         serverAddress.sin_len = ( uint8_t ) sizeof( serverAddress );
 
         /* Check for errors from DNS lookup. */
@@ -90,6 +612,9 @@ BaseType_t Sockets_Connect( Socket_t * pTcpSocket,
 
         if( socketStatus != 0 )
         {
+            /* Try the host's next address, if it has several, next time. */
+            rotateDnsAddress( pHostName, serverAddress.sin_addr );
+
             LogError( ( "Failed to connect to server: FreeRTOS_Connect failed: ReturnCode=%d,"
                         " Hostname=%s, Port=%u.",
                         socketStatus,
@@ -100,23 +625,7 @@ BaseType_t Sockets_Connect( Socket_t * pTcpSocket,
 
     if( socketStatus == 0 )
     {
-        /* Set socket receive timeout. */
-        transportTimeout = pdMS_TO_TICKS( receiveTimeoutMs );
-        /* Setting the receive block time cannot fail. */
-        ( void ) FreeRTOS_setsockopt( tcpSocket,
-                                      0,
-                                      FREERTOS_SO_RCVTIMEO,
-                                      &transportTimeout,
-                                      sizeof( TickType_t ) );
-
-        /* Set socket send timeout. */
-        transportTimeout = pdMS_TO_TICKS( sendTimeoutMs );
-        /* Setting the send block time cannot fail. */
-        ( void ) FreeRTOS_setsockopt( tcpSocket,
-                                      0,
-                                      FREERTOS_SO_SNDTIMEO,
-                                      &transportTimeout,
-                                      sizeof( TickType_t ) );
+        setSocketTimeouts( tcpSocket, receiveTimeoutMs, sendTimeoutMs );
     }
 
     /* Clean up on failure. */
@@ -139,6 +648,195 @@ BaseType_t Sockets_Connect( Socket_t * pTcpSocket,
 
 /*-----------------------------------------------------------*/
 
+BaseType_t Sockets_ConnectAny( Socket_t * pTcpSocket,
+                               SocketsEndpoint_t * pEndpoints,
+                               size_t endpointCount,
+                               uint32_t receiveTimeoutMs,
+                               uint32_t sendTimeoutMs,
+                               size_t * pEndpointIndex )
+{
+    Socket_t attemptSockets[ FREERTOS_SOCKETS_WRAPPER_MAX_ENDPOINTS ];
+    TickType_t attemptStartTimes[ FREERTOS_SOCKETS_WRAPPER_MAX_ENDPOINTS ];
+    uint32_t attemptAddresses[ FREERTOS_SOCKETS_WRAPPER_MAX_ENDPOINTS ];
+    size_t order[ FREERTOS_SOCKETS_WRAPPER_MAX_ENDPOINTS ];
+    SocketSet_t socketSet = NULL;
+    SocketsEndpoint_t * pEndpoint;
+    BaseType_t socketStatus = FREERTOS_SOCKETS_WRAPPER_NETWORK_ERROR;
+    size_t attemptsStarted = 0U, attemptsActive = 0U, i;
+    size_t winner = endpointCount;
+    TickType_t now, lastStartTime = 0U, waitTime, elapsed;
+    const TickType_t staggerTime = pdMS_TO_TICKS( FREERTOS_SOCKETS_WRAPPER_CONNECT_STAGGER_MS );
+    const TickType_t attemptTimeout = pdMS_TO_TICKS( FREERTOS_SOCKETS_WRAPPER_CONNECT_TIMEOUT_MS );
+    uint32_t latencyMs;
+
+    /* Never leave the caller holding a socket from an earlier connection. */
+    if( pTcpSocket != NULL )
+    {
+        *pTcpSocket = FREERTOS_INVALID_SOCKET;
+    }
+
+    if( ( pTcpSocket == NULL ) || ( pEndpoints == NULL ) || ( pEndpointIndex == NULL ) ||
+        ( endpointCount == 0U ) || ( endpointCount > FREERTOS_SOCKETS_WRAPPER_MAX_ENDPOINTS ) )
+    {
+        LogError( ( "Invalid parameters: between 1 and %d endpoints are required.",
+                    FREERTOS_SOCKETS_WRAPPER_MAX_ENDPOINTS ) );
+    }
+    else
+    {
+        socketSet = FreeRTOS_CreateSocketSet();
+
+        if( socketSet == NULL )
+        {
+            LogError( ( "Failed to create socket set." ) );
+        }
+    }
+
+    if( socketSet != NULL )
+    {
+        orderEndpoints( pEndpoints, endpointCount, order );
+
+        for( i = 0; i < endpointCount; i++ )
+        {
+            attemptSockets[ i ] = FREERTOS_INVALID_SOCKET;
+        }
+
+        while( ( winner == endpointCount ) &&
+               ( ( attemptsStarted < endpointCount ) || ( attemptsActive > 0U ) ) )
+        {
+            now = xTaskGetTickCount();
+
+            /* Start the next attempt when the stagger time has passed, or
+             * straight away if no attempt is still in progress. */
+            if( ( attemptsStarted < endpointCount ) &&
+                ( ( attemptsActive == 0U ) || ( ( now - lastStartTime ) >= staggerTime ) ) )
+            {
+                pEndpoint = &( pEndpoints[ order[ attemptsStarted ] ] );
+                attemptSockets[ attemptsStarted ] = startConnect( pEndpoint, socketSet, &( attemptAddresses[ attemptsStarted ] ) );
+                attemptStartTimes[ attemptsStarted ] = now;
+                lastStartTime = now;
+
+                if( attemptSockets[ attemptsStarted ] != FREERTOS_INVALID_SOCKET )
+                {
+                    attemptsActive++;
+                }
+                else
+                {
+                    pEndpoint->failures++;
+                }
+
+                attemptsStarted++;
+            }
+
+            /* Wait until an attempt completes, or it is time to start the next
+             * attempt or give up on one. */
+            waitTime = ( attemptsStarted < endpointCount ) ? staggerTime : attemptTimeout;
+
+            for( i = 0; i < attemptsStarted; i++ )
+            {
+                if( attemptSockets[ i ] != FREERTOS_INVALID_SOCKET )
+                {
+                    elapsed = now - attemptStartTimes[ i ];
+
+                    /* An attempt already past its timeout is abandoned
+                     * without waiting. */
+                    if( elapsed >= attemptTimeout )
+                    {
+                        waitTime = 0U;
+                    }
+                    else if( ( attemptTimeout - elapsed ) < waitTime )
+                    {
+                        waitTime = attemptTimeout - elapsed;
+                    }
+                    else
+                    {
+                        /* Empty else for MISRA 15.7 compliance. */
+                    }
+                }
+            }
+
+            if( attemptsActive > 0U )
+            {
+                ( void ) FreeRTOS_select( socketSet, waitTime );
+            }
+
+            now = xTaskGetTickCount();
+
+            for( i = 0; ( i < attemptsStarted ) && ( winner == endpointCount ); i++ )
+            {
+                if( attemptSockets[ i ] == FREERTOS_INVALID_SOCKET )
+                {
+                    /* Not started, failed or abandoned. */
+                }
+                else if( FreeRTOS_issocketconnected( attemptSockets[ i ] ) == pdTRUE )
+                {
+                    winner = i;
+                }
+                else if( ( ( FreeRTOS_FD_ISSET( attemptSockets[ i ], socketSet ) & eSELECT_EXCEPT ) != 0U ) ||
+                         ( ( now - attemptStartTimes[ i ] ) >= attemptTimeout ) )
+                {
+                    pEndpoint = &( pEndpoints[ order[ i ] ] );
+                    LogWarn( ( "Failed to connect to %s:%u.", pEndpoint->pHostName, pEndpoint->port ) );
+                    pEndpoint->failures++;
+
+                    /* Try the host's next address, if it has several, next time. */
+                    rotateDnsAddress( pEndpoint->pHostName, attemptAddresses[ i ] );
+                    FreeRTOS_FD_CLR( attemptSockets[ i ], socketSet, eSELECT_ALL );
+                    ( void ) FreeRTOS_closesocket( attemptSockets[ i ] );
+                    attemptSockets[ i ] = FREERTOS_INVALID_SOCKET;
+                    attemptsActive--;
+                }
+                else
+                {
+                    /* Still connecting. */
+                }
+            }
+        }
+
+        /* Keep the connection that completed first and abandon the others. */
+        for( i = 0; i < attemptsStarted; i++ )
+        {
+            if( attemptSockets[ i ] != FREERTOS_INVALID_SOCKET )
+            {
+                FreeRTOS_FD_CLR( attemptSockets[ i ], socketSet, eSELECT_ALL );
+
+                if( i != winner )
+                {
+                    ( void ) FreeRTOS_closesocket( attemptSockets[ i ] );
+                }
+            }
+        }
+
+        FreeRTOS_DeleteSocketSet( socketSet );
+    }
+
+    if( winner < endpointCount )
+    {
+        pEndpoint = &( pEndpoints[ order[ winner ] ] );
+        latencyMs = ( uint32_t ) ( ( xTaskGetTickCount() - attemptStartTimes[ winner ] ) * portTICK_PERIOD_MS );
+
+        /* Smooth the latency so one slow connection does not reorder the
+         * endpoints.  Latency is at least 1 so the endpoint counts as known. */
+        latencyMs = ( latencyMs == 0U ) ? 1U : latencyMs;
+        pEndpoint->latencyMs = ( pEndpoint->latencyMs == 0U ) ? latencyMs :
+                               ( ( ( pEndpoint->latencyMs * 3U ) + latencyMs ) / 4U );
+        pEndpoint->failures = 0U;
+
+        setSocketTimeouts( attemptSockets[ winner ], receiveTimeoutMs, sendTimeoutMs );
+
+        *pTcpSocket = attemptSockets[ winner ];
+        *pEndpointIndex = order[ winner ];
+        socketStatus = 0;
+
+        LogInfo( ( "Established TCP connection with %s in %u ms.",
+                   pEndpoint->pHostName,
+                   ( unsigned int ) latencyMs ) );
+    }
+
+    return socketStatus;
+}
+
+/*-----------------------------------------------------------*/
+
 void Sockets_Disconnect( Socket_t tcpSocket )
 {
     BaseType_t waitForShutdownLoopCount = 0;
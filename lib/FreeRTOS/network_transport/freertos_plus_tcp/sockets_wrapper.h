@@ -89,6 +89,49 @@ BaseType_t Sockets_Connect( Socket_t * pTcpSocket,
                             uint32_t receiveTimeoutMs,
                             uint32_t sendTimeoutMs );
 
+/**
+ * @brief One of the endpoints a connection can be made to, with a record of
+ * how connecting to it has gone that Sockets_ConnectAny() uses to order its
+ * attempts.  Zero-initialize the record before first use.
+ */
+typedef struct SocketsEndpoint
+{
+    const char * pHostName; /**< @brief Server hostname. */
+    uint16_t port;          /**< @brief Server port. */
+    uint32_t latencyMs;     /**< @brief Smoothed time to connect, or 0 if never connected. */
+    uint32_t failures;      /**< @brief Consecutive attempts that failed to connect. */
+} SocketsEndpoint_t;
+
+/**
+ * @brief Establish a connection to whichever of several endpoints answers
+ * first.
+ *
+ * Endpoints are tried in order of fewest recent failures, then lowest
+ * latency, then list order.  A connection attempt is started to the first
+ * and, if it has not connected within #FREERTOS_SOCKETS_WRAPPER_CONNECT_STAGGER_MS,
+ * to the next while the first carries on, and so on.  An attempt that fails
+ * starts the next at once.  The first connection to complete is kept, and the
+ * other attempts are abandoned.
+ *
+ * @param[out] pTcpSocket The output parameter to return the created socket descriptor.
+ * @param[in,out] pEndpoints The endpoints, whose records are updated.
+ * @param[in] endpointCount Number of endpoints, at most
+ * #FREERTOS_SOCKETS_WRAPPER_MAX_ENDPOINTS.
+ * @param[in] receiveTimeoutMs Timeout (in milliseconds) for transport receive.
+ * @param[in] sendTimeoutMs Timeout (in milliseconds) for transport send.
+ * @param[out] pEndpointIndex Set to the index of the endpoint connected to.
+ *
+ * @note A timeout of 0 means infinite timeout.
+ *
+ * @return Non-zero value on error, 0 on success.
+ */
+BaseType_t Sockets_ConnectAny( Socket_t * pTcpSocket,
+                               SocketsEndpoint_t * pEndpoints,
+                               size_t endpointCount,
+                               uint32_t receiveTimeoutMs,
+                               uint32_t sendTimeoutMs,
+                               size_t * pEndpointIndex );
+
 /**
  * @brief End connection to server.
  *
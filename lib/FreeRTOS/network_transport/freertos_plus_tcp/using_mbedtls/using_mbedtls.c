@@ -30,6 +30,7 @@
 
 /* FreeRTOS includes. */
 #include "FreeRTOS.h"
+#include "task.h"
 
 /* FreeRTOS+TCP includes. */
 #include "FreeRTOS_IP.h"
@@ -178,6 +179,16 @@ static TlsTransportStatus_t tlsSetup( NetworkContext_t * pNetworkContext,
                                       const char * pHostName,
                                       const NetworkCredentials_t * pNetworkCredentials );
 
+/**
+ * @brief Get the code mbed TLS uses for a maximum fragment length.
+ *
+ * @param[in] maxFragmentLength The maximum fragment length in bytes.
+ *
+ * @return The code, or MBEDTLS_SSL_MAX_FRAG_LEN_INVALID if the length is not
+ * one the max fragment length extension can negotiate.
+ */
+static unsigned char maxFragmentLengthCode( uint16_t maxFragmentLength );
+
 /**
  * @brief Perform the TLS handshake on a TCP connection.
  *
@@ -189,6 +200,33 @@ static TlsTransportStatus_t tlsSetup( NetworkContext_t * pNetworkContext,
 static TlsTransportStatus_t tlsHandshake( NetworkContext_t * pNetworkContext,
                                           const NetworkCredentials_t * pNetworkCredentials );
 
+/**
+ * @brief Save the session negotiated by a successful handshake, and count
+ * whether the handshake resumed the session that was offered.
+ *
+ * @param[in] pNetworkContext Network context.
+ * @param[in,out] pSession The session offered, replaced by the new session.
+ * @param[in] handshakeTimeMs Duration of the handshake.
+ */
+static void saveSession( NetworkContext_t * pNetworkContext,
+                         TlsSession_t * pSession,
+                         uint32_t handshakeTimeMs );
+
+/**
+ * @brief Pass bytes to mbed TLS to be encrypted and sent.
+ *
+ * @param[in] pNetworkContext The network context.
+ * @param[in] pBuffer Buffer containing the bytes to send.
+ * @param[in] bytesToSend Number of bytes to send from the buffer.
+ *
+ * @return Number of bytes (> 0) sent on success;
+ * 0 if the socket times out without sending any bytes;
+ * else a negative value to represent error.
+ */
+static int32_t tlsWrite( NetworkContext_t * pNetworkContext,
+                         const void * pBuffer,
+                         size_t bytesToSend );
+
 /**
  * @brief Initialize mbedTLS.
  *
@@ -416,24 +454,60 @@ static void setOptionalConfigurations( SSLContext_t * pSslContext,
 
     /* Set Maximum Fragment Length if enabled. */
     #ifdef MBEDTLS_SSL_MAX_FRAGMENT_LENGTH
-
-        /* Enable the max fragment extension. 4096 bytes is currently the largest fragment size permitted.
-         * See RFC 8449 https://tools.ietf.org/html/rfc8449 for more information.
-         *
-         * Smaller values can be found in "mbedtls/include/ssl.h".
-         */
-        mbedtlsError = mbedtls_ssl_conf_max_frag_len( &( pSslContext->config ), MBEDTLS_SSL_MAX_FRAG_LEN_4096 );
-
-        if( mbedtlsError != 0 )
+        if( pNetworkCredentials->maxFragmentLength != 0U )
         {
-            LogError( ( "Failed to maximum fragment length extension: mbedTLSError= %s : %s.",
-                        mbedtlsHighLevelCodeOrDefault( mbedtlsError ),
-                        mbedtlsLowLevelCodeOrDefault( mbedtlsError ) ) );
+            /* Ask the server to limit the records it sends to the fragment
+             * length, which mbed TLS also uses for the records it sends.  With
+             * MBEDTLS_SSL_VARIABLE_BUFFER_LENGTH the I/O buffers are shrunk to
+             * the negotiated length after the handshake.  The value was
+             * checked by TLS_FreeRTOS_Connect().
+             * See RFC 6066 https://tools.ietf.org/html/rfc6066#section-4 for
+             * more information. */
+            mbedtlsError = mbedtls_ssl_conf_max_frag_len( &( pSslContext->config ),
+                                                          maxFragmentLengthCode( pNetworkCredentials->maxFragmentLength ) );
+
+            if( mbedtlsError != 0 )
+            {
+                LogError( ( "Failed to maximum fragment length extension: mbedTLSError= %s : %s.",
+                            mbedtlsHighLevelCodeOrDefault( mbedtlsError ),
+                            mbedtlsLowLevelCodeOrDefault( mbedtlsError ) ) );
+            }
         }
     #endif /* ifdef MBEDTLS_SSL_MAX_FRAGMENT_LENGTH */
 }
 /*-----------------------------------------------------------*/
 
+static unsigned char maxFragmentLengthCode( uint16_t maxFragmentLength )
+{
+    unsigned char code;
+
+    switch( maxFragmentLength )
+    {
+        case 512U:
+            code = MBEDTLS_SSL_MAX_FRAG_LEN_512;
+            break;
+
+        case 1024U:
+            code = MBEDTLS_SSL_MAX_FRAG_LEN_1024;
+            break;
+
+        case 2048U:
+            code = MBEDTLS_SSL_MAX_FRAG_LEN_2048;
+            break;
+
+        case 4096U:
+            code = MBEDTLS_SSL_MAX_FRAG_LEN_4096;
+            break;
+
+        default:
+            code = MBEDTLS_SSL_MAX_FRAG_LEN_INVALID;
+            break;
+    }
+
+    return code;
+}
+/*-----------------------------------------------------------*/
+
 static TlsTransportStatus_t tlsSetup( NetworkContext_t * pNetworkContext,
                                       const char * pHostName,
                                       const NetworkCredentials_t * pNetworkCredentials )
@@ -491,6 +565,7 @@ static TlsTransportStatus_t tlsHandshake( NetworkContext_t * pNetworkContext,
 {
     TlsTransportStatus_t returnStatus = TLS_TRANSPORT_SUCCESS;
     int32_t mbedtlsError = 0;
+    TickType_t startTime;
 
     configASSERT( pNetworkContext != NULL );
     configASSERT( pNetworkCredentials != NULL );
@@ -509,6 +584,22 @@ static TlsTransportStatus_t tlsHandshake( NetworkContext_t * pNetworkContext,
     }
     else
     {
+        /* Offer the session saved from the previous connection.  If the
+         * server does not resume it a full handshake is performed. */
+        if( ( pNetworkCredentials->pSession != NULL ) &&
+            ( pNetworkCredentials->pSession->isValid == pdTRUE ) )
+        {
+            mbedtlsError = mbedtls_ssl_set_session( &( pNetworkContext->sslContext.context ),
+                                                    &( pNetworkCredentials->pSession->session ) );
+
+            if( mbedtlsError != 0 )
+            {
+                LogWarn( ( "Failed to offer the saved TLS session: mbedTLSError= %s : %s.",
+                           mbedtlsHighLevelCodeOrDefault( mbedtlsError ),
+                           mbedtlsLowLevelCodeOrDefault( mbedtlsError ) ) );
+            }
+        }
+
         /* Set the underlying IO for the TLS connection. */
 
         /* MISRA Rule 11.2 flags the following line for casting the second
@@ -525,6 +616,8 @@ static TlsTransportStatus_t tlsHandshake( NetworkContext_t * pNetworkContext,
 
     if( returnStatus == TLS_TRANSPORT_SUCCESS )
     {
+        startTime = xTaskGetTickCount();
+
         /* Perform the TLS handshake. */
         do
         {
@@ -538,12 +631,25 @@ static TlsTransportStatus_t tlsHandshake( NetworkContext_t * pNetworkContext,
                         mbedtlsHighLevelCodeOrDefault( mbedtlsError ),
                         mbedtlsLowLevelCodeOrDefault( mbedtlsError ) ) );
 
+            /* Do not offer a session the server may have rejected again. */
+            if( pNetworkCredentials->pSession != NULL )
+            {
+                TLS_FreeRTOS_FreeSession( pNetworkCredentials->pSession );
+            }
+
             returnStatus = TLS_TRANSPORT_HANDSHAKE_FAILED;
         }
         else
         {
             LogInfo( ( "(Network connection %p) TLS handshake successful.",
                        pNetworkContext ) );
+
+            if( pNetworkCredentials->pSession != NULL )
+            {
+                saveSession( pNetworkContext,
+                             pNetworkCredentials->pSession,
+                             ( uint32_t ) ( ( xTaskGetTickCount() - startTime ) * portTICK_PERIOD_MS ) );
+            }
         }
     }
 
@@ -551,6 +657,113 @@ static TlsTransportStatus_t tlsHandshake( NetworkContext_t * pNetworkContext,
 }
 /*-----------------------------------------------------------*/
 
+static void saveSession( NetworkContext_t * pNetworkContext,
+                         TlsSession_t * pSession,
+                         uint32_t handshakeTimeMs )
+{
+    mbedtls_ssl_session newSession;
+    BaseType_t resumed = pdFALSE;
+    int32_t mbedtlsError;
+
+    /* The session outlives the connection, so must not be allocated from the
+     * connection's arena. */
+    mbedtls_freertos_arena_select( NULL );
+
+    mbedtls_ssl_session_init( &newSession );
+    mbedtlsError = mbedtls_ssl_get_session( &( pNetworkContext->sslContext.context ),
+                                            &newSession );
+
+    if( pNetworkContext->arena.pBuffer != NULL )
+    {
+        mbedtls_freertos_arena_select( &( pNetworkContext->arena ) );
+    }
+
+    /* A resumed session keeps the master secret of the session offered,
+     * whereas a full handshake derives a new one.  This holds for both session
+     * ID and session ticket resumption. */
+    if( ( mbedtlsError == 0 ) &&
+        ( pSession->isValid == pdTRUE ) &&
+        ( memcmp( newSession.master, pSession->session.master, sizeof( newSession.master ) ) == 0 ) )
+    {
+        resumed = pdTRUE;
+    }
+
+    if( resumed == pdTRUE )
+    {
+        pSession->resumedHandshakes++;
+    }
+    else
+    {
+        pSession->fullHandshakes++;
+    }
+
+    pSession->lastHandshakeTimeMs = handshakeTimeMs;
+
+    LogInfo( ( "(Network connection %p) TLS %s in %u ms.",
+               pNetworkContext,
+               ( resumed == pdTRUE ) ? "session resumed" : "full handshake completed",
+               ( unsigned int ) handshakeTimeMs ) );
+
+    /* Keep the negotiated session, which may hold a new ticket, to offer on
+     * the next connection. */
+    mbedtls_ssl_session_free( &( pSession->session ) );
+
+    if( mbedtlsError == 0 )
+    {
+        pSession->session = newSession;
+        pSession->isValid = pdTRUE;
+    }
+    else
+    {
+        LogWarn( ( "Failed to save the TLS session: mbedTLSError= %s : %s.",
+                   mbedtlsHighLevelCodeOrDefault( mbedtlsError ),
+                   mbedtlsLowLevelCodeOrDefault( mbedtlsError ) ) );
+        mbedtls_ssl_session_free( &newSession );
+        mbedtls_ssl_session_init( &( pSession->session ) );
+        pSession->isValid = pdFALSE;
+    }
+}
+/*-----------------------------------------------------------*/
+
+static int32_t tlsWrite( NetworkContext_t * pNetworkContext,
+                         const void * pBuffer,
+                         size_t bytesToSend )
+{
+    int32_t tlsStatus = 0;
+
+    tlsStatus = ( int32_t ) mbedtls_ssl_write( &( pNetworkContext->sslContext.context ),
+                                               pBuffer,
+                                               bytesToSend );
+
+    if( ( tlsStatus == MBEDTLS_ERR_SSL_TIMEOUT ) ||
+        ( tlsStatus == MBEDTLS_ERR_SSL_WANT_READ ) ||
+        ( tlsStatus == MBEDTLS_ERR_SSL_WANT_WRITE ) )
+    {
+        LogDebug( ( "Failed to send data. However, send can be retried on this error. "
+                    "mbedTLSError= %s : %s.",
+                    mbedtlsHighLevelCodeOrDefault( tlsStatus ),
+                    mbedtlsLowLevelCodeOrDefault( tlsStatus ) ) );
+
+        /* Mark these set of errors as a timeout. The libraries may retry send
+         * on these errors. */
+        tlsStatus = 0;
+    }
+    else if( tlsStatus < 0 )
+    {
+        LogError( ( "Failed to send data:  mbedTLSError= %s : %s.",
+                    mbedtlsHighLevelCodeOrDefault( tlsStatus ),
+                    mbedtlsLowLevelCodeOrDefault( tlsStatus ) ) );
+    }
+    else
+    {
+        pNetworkContext->recordWrites++;
+        pNetworkContext->bytesWritten += ( uint32_t ) tlsStatus;
+    }
+
+    return tlsStatus;
+}
+/*-----------------------------------------------------------*/
+
 static TlsTransportStatus_t initMbedtls( mbedtls_entropy_context * pEntropyContext,
                                          mbedtls_ctr_drbg_context * pCtrDrgbContext )
 {
@@ -615,19 +828,52 @@ TlsTransportStatus_t TLS_FreeRTOS_Connect( NetworkContext_t * pNetworkContext,
                                            const NetworkCredentials_t * pNetworkCredentials,
                                            uint32_t receiveTimeoutMs,
                                            uint32_t sendTimeoutMs )
+{
+    SocketsEndpoint_t endpoint = { 0 };
+    size_t endpointIndex = 0U;
+
+    endpoint.pHostName = pHostName;
+    endpoint.port = port;
+
+    return TLS_FreeRTOS_ConnectEndpoints( pNetworkContext,
+                                          &endpoint,
+                                          1U,
+                                          pNetworkCredentials,
+                                          receiveTimeoutMs,
+                                          sendTimeoutMs,
+                                          &endpointIndex );
+}
+/*-----------------------------------------------------------*/
+
+TlsTransportStatus_t TLS_FreeRTOS_ConnectEndpoints( NetworkContext_t * pNetworkContext,
+                                                    SocketsEndpoint_t * pEndpoints,
+                                                    size_t endpointCount,
+                                                    const NetworkCredentials_t * pNetworkCredentials,
+                                                    uint32_t receiveTimeoutMs,
+                                                    uint32_t sendTimeoutMs,
+                                                    size_t * pEndpointIndex )
 {
     TlsTransportStatus_t returnStatus = TLS_TRANSPORT_SUCCESS;
     BaseType_t socketStatus = 0;
+    const char * pHostName = NULL;
+    size_t i;
 
     if( ( pNetworkContext == NULL ) ||
-        ( pHostName == NULL ) ||
-        ( pNetworkCredentials == NULL ) )
+        ( pEndpoints == NULL ) ||
+        ( pNetworkCredentials == NULL ) ||
+        ( pEndpointIndex == NULL ) )
     {
         LogError( ( "Invalid input parameter(s): Arguments cannot be NULL. pNetworkContext=%p, "
-                    "pHostName=%p, pNetworkCredentials=%p.",
+                    "pEndpoints=%p, pNetworkCredentials=%p, pEndpointIndex=%p.",
                     pNetworkContext,
-                    pHostName,
-                    pNetworkCredentials ) );
+                    pEndpoints,
+                    pNetworkCredentials,
+                    pEndpointIndex ) );
+        returnStatus = TLS_TRANSPORT_INVALID_PARAMETER;
+    }
+    else if( endpointCount == 0U )
+    {
+        LogError( ( "At least one endpoint is required." ) );
         returnStatus = TLS_TRANSPORT_INVALID_PARAMETER;
     }
     else if( ( pNetworkCredentials->pRootCa == NULL ) )
@@ -635,27 +881,70 @@ TlsTransportStatus_t TLS_FreeRTOS_Connect( NetworkContext_t * pNetworkContext,
         LogError( ( "pRootCa cannot be NULL." ) );
         returnStatus = TLS_TRANSPORT_INVALID_PARAMETER;
     }
+    else if( ( pNetworkCredentials->maxFragmentLength != 0U ) &&
+             ( maxFragmentLengthCode( pNetworkCredentials->maxFragmentLength ) == MBEDTLS_SSL_MAX_FRAG_LEN_INVALID ) )
+    {
+        LogError( ( "maxFragmentLength must be 0, 512, 1024, 2048 or 4096, not %u.",
+                    ( unsigned int ) pNetworkCredentials->maxFragmentLength ) );
+        returnStatus = TLS_TRANSPORT_INVALID_PARAMETER;
+    }
     else
     {
-        /* Empty else for MISRA 15.7 compliance. */
+        for( i = 0; i < endpointCount; i++ )
+        {
+            if( pEndpoints[ i ].pHostName == NULL )
+            {
+                LogError( ( "Endpoint %u has no hostname.", ( unsigned int ) i ) );
+                returnStatus = TLS_TRANSPORT_INVALID_PARAMETER;
+            }
+        }
     }
 
-    /* Establish a TCP connection with the server. */
+    /* Establish a TCP connection with whichever server answers first. */
     if( returnStatus == TLS_TRANSPORT_SUCCESS )
     {
-        socketStatus = Sockets_Connect( &( pNetworkContext->tcpSocket ),
-                                        pHostName,
-                                        port,
-                                        receiveTimeoutMs,
-                                        sendTimeoutMs );
+        socketStatus = Sockets_ConnectAny( &( pNetworkContext->tcpSocket ),
+                                           pEndpoints,
+                                           endpointCount,
+                                           receiveTimeoutMs,
+                                           sendTimeoutMs,
+                                           pEndpointIndex );
 
         if( socketStatus != 0 )
         {
-            LogError( ( "Failed to connect to %s with error %d.",
-                        pHostName,
+            LogError( ( "Failed to connect to any of %u endpoints with error %d.",
+                        ( unsigned int ) endpointCount,
                         socketStatus ) );
             returnStatus = TLS_TRANSPORT_CONNECT_FAILURE;
         }
+        else
+        {
+            pHostName = pEndpoints[ *pEndpointIndex ].pHostName;
+        }
+    }
+
+    /* Collect sends in the cork buffer, if one was given. */
+    if( returnStatus == TLS_TRANSPORT_SUCCESS )
+    {
+        pNetworkContext->pCorkBuffer = pNetworkCredentials->pCorkBuffer;
+        pNetworkContext->corkBufferSize = pNetworkCredentials->corkBufferSize;
+        pNetworkContext->corkedBytes = 0U;
+        pNetworkContext->recordWrites = 0U;
+        pNetworkContext->bytesWritten = 0U;
+    }
+
+    /* Serve the mbed TLS allocations made while connecting from the arena. */
+    if( returnStatus == TLS_TRANSPORT_SUCCESS )
+    {
+        pNetworkContext->handshakeHeapAllocations = mbedtls_freertos_heap_allocations();
+
+        if( pNetworkCredentials->pArenaBuffer != NULL )
+        {
+            mbedtls_freertos_arena_init( &( pNetworkContext->arena ),
+                                         pNetworkCredentials->pArenaBuffer,
+                                         pNetworkCredentials->arenaBufferSize );
+            mbedtls_freertos_arena_select( &( pNetworkContext->arena ) );
+        }
     }
 
     /* Initialize mbedtls. */
@@ -677,6 +966,17 @@ TlsTransportStatus_t TLS_FreeRTOS_Connect( NetworkContext_t * pNetworkContext,
         returnStatus = tlsHandshake( pNetworkContext, pNetworkCredentials );
     }
 
+    if( ( pNetworkContext != NULL ) && ( pNetworkContext->arena.pBuffer != NULL ) )
+    {
+        mbedtls_freertos_arena_select( NULL );
+    }
+
+    if( returnStatus == TLS_TRANSPORT_SUCCESS )
+    {
+        pNetworkContext->handshakeHeapAllocations = mbedtls_freertos_heap_allocations() -
+                                                    pNetworkContext->handshakeHeapAllocations;
+    }
+
     /* Clean up on failure. */
     if( returnStatus != TLS_TRANSPORT_SUCCESS )
     {
@@ -684,9 +984,15 @@ TlsTransportStatus_t TLS_FreeRTOS_Connect( NetworkContext_t * pNetworkContext,
         {
             sslContextFree( &( pNetworkContext->sslContext ) );
 
+            if( pNetworkContext->arena.pBuffer != NULL )
+            {
+                mbedtls_freertos_arena_deinit( &( pNetworkContext->arena ) );
+            }
+
             if( pNetworkContext->tcpSocket != FREERTOS_INVALID_SOCKET )
             {
                 ( void ) FreeRTOS_closesocket( pNetworkContext->tcpSocket );
+                pNetworkContext->tcpSocket = FREERTOS_INVALID_SOCKET;
             }
         }
     }
@@ -701,12 +1007,130 @@ TlsTransportStatus_t TLS_FreeRTOS_Connect( NetworkContext_t * pNetworkContext,
 }
 /*-----------------------------------------------------------*/
 
+void TLS_FreeRTOS_InitSession( TlsSession_t * pSession )
+{
+    configASSERT( pSession != NULL );
+
+    memset( pSession, 0x00, sizeof( TlsSession_t ) );
+    mbedtls_ssl_session_init( &( pSession->session ) );
+    pSession->isValid = pdFALSE;
+}
+/*-----------------------------------------------------------*/
+
+void TLS_FreeRTOS_FreeSession( TlsSession_t * pSession )
+{
+    configASSERT( pSession != NULL );
+
+    mbedtls_ssl_session_free( &( pSession->session ) );
+    mbedtls_ssl_session_init( &( pSession->session ) );
+    pSession->isValid = pdFALSE;
+}
+/*-----------------------------------------------------------*/
+
+TlsTransportStatus_t TLS_FreeRTOS_SaveSession( const TlsSession_t * pSession,
+                                               uint8_t * pBuffer,
+                                               size_t bufferSize,
+                                               size_t * pLength )
+{
+    TlsTransportStatus_t returnStatus = TLS_TRANSPORT_SUCCESS;
+    int32_t mbedtlsError;
+
+    if( ( pSession == NULL ) || ( pSession->isValid != pdTRUE ) || ( pLength == NULL ) )
+    {
+        returnStatus = TLS_TRANSPORT_INVALID_PARAMETER;
+    }
+    else
+    {
+        mbedtlsError = mbedtls_ssl_session_save( &( pSession->session ),
+                                                 pBuffer,
+                                                 bufferSize,
+                                                 pLength );
+
+        if( mbedtlsError != 0 )
+        {
+            LogError( ( "Failed to serialize the TLS session: mbedTLSError= %s : %s.",
+                        mbedtlsHighLevelCodeOrDefault( mbedtlsError ),
+                        mbedtlsLowLevelCodeOrDefault( mbedtlsError ) ) );
+            returnStatus = ( mbedtlsError == MBEDTLS_ERR_SSL_BUFFER_TOO_SMALL ) ?
+                           TLS_TRANSPORT_INSUFFICIENT_MEMORY : TLS_TRANSPORT_INVALID_PARAMETER;
+        }
+    }
+
+    return returnStatus;
+}
+/*-----------------------------------------------------------*/
+
+TlsTransportStatus_t TLS_FreeRTOS_LoadSession( TlsSession_t * pSession,
+                                               const uint8_t * pBuffer,
+                                               size_t length )
+{
+    TlsTransportStatus_t returnStatus = TLS_TRANSPORT_SUCCESS;
+    int32_t mbedtlsError;
+
+    if( ( pSession == NULL ) || ( pBuffer == NULL ) )
+    {
+        returnStatus = TLS_TRANSPORT_INVALID_PARAMETER;
+    }
+    else
+    {
+        TLS_FreeRTOS_FreeSession( pSession );
+        mbedtlsError = mbedtls_ssl_session_load( &( pSession->session ), pBuffer, length );
+
+        if( mbedtlsError == 0 )
+        {
+            pSession->isValid = pdTRUE;
+        }
+        else
+        {
+            LogWarn( ( "Failed to restore the TLS session: mbedTLSError= %s : %s.",
+                       mbedtlsHighLevelCodeOrDefault( mbedtlsError ),
+                       mbedtlsLowLevelCodeOrDefault( mbedtlsError ) ) );
+            TLS_FreeRTOS_FreeSession( pSession );
+            returnStatus = TLS_TRANSPORT_INVALID_PARAMETER;
+        }
+    }
+
+    return returnStatus;
+}
+/*-----------------------------------------------------------*/
+
+void TLS_FreeRTOS_GetMemoryStats( const NetworkContext_t * pNetworkContext,
+                                  MbedtlsArenaStats_t * pArenaStats,
+                                  uint32_t * pHeapAllocations )
+{
+    configASSERT( pNetworkContext != NULL );
+    configASSERT( pArenaStats != NULL );
+    configASSERT( pHeapAllocations != NULL );
+
+    if( pNetworkContext->arena.pBuffer != NULL )
+    {
+        mbedtls_freertos_arena_get_stats( &( pNetworkContext->arena ), pArenaStats );
+    }
+    else
+    {
+        memset( pArenaStats, 0x00, sizeof( MbedtlsArenaStats_t ) );
+    }
+
+    *pHeapAllocations = pNetworkContext->handshakeHeapAllocations;
+}
+/*-----------------------------------------------------------*/
+
 void TLS_FreeRTOS_Disconnect( NetworkContext_t * pNetworkContext )
 {
     BaseType_t tlsStatus = 0;
+    MbedtlsArenaStats_t arenaStats;
 
     if( pNetworkContext != NULL )
     {
+        /* Send what is left in the cork buffer, such as an MQTT DISCONNECT. */
+        ( void ) TLS_FreeRTOS_Flush( pNetworkContext );
+        pNetworkContext->corkedBytes = 0U;
+
+        LogInfo( ( "(Network connection %p) %u bytes sent in %u calls to mbedtls_ssl_write.",
+                   pNetworkContext,
+                   ( unsigned int ) pNetworkContext->bytesWritten,
+                   ( unsigned int ) pNetworkContext->recordWrites ) );
+
         /* Attempting to terminate TLS connection. */
         tlsStatus = ( BaseType_t ) mbedtls_ssl_close_notify( &( pNetworkContext->sslContext.context ) );
 
@@ -738,11 +1162,25 @@ void TLS_FreeRTOS_Disconnect( NetworkContext_t * pNetworkContext )
 #endif
         }
 
-        /* Call socket shutdown function to close connection. */
+        /* Call socket shutdown function to close connection.  The socket
+         * is forgotten so a failed reconnect does not close it again. */
         Sockets_Disconnect( pNetworkContext->tcpSocket );
+        pNetworkContext->tcpSocket = FREERTOS_INVALID_SOCKET;
 
         /* Free mbed TLS contexts. */
         sslContextFree( &( pNetworkContext->sslContext ) );
+
+        /* Every block of the arena has now been freed, so the next
+         * connection can reuse the whole buffer. */
+        if( pNetworkContext->arena.pBuffer != NULL )
+        {
+            mbedtls_freertos_arena_get_stats( &( pNetworkContext->arena ), &arenaStats );
+            LogInfo( ( "(Network connection %p) mbed TLS arena peak usage %u bytes, %u bytes carved.",
+                       pNetworkContext,
+                       ( unsigned int ) arenaStats.peakBytesInUse,
+                       ( unsigned int ) arenaStats.bytesCarved ) );
+            mbedtls_freertos_arena_deinit( &( pNetworkContext->arena ) );
+        }
     }
 
     /* Clear the mutex functions for mbed TLS thread safety. */
@@ -756,9 +1194,19 @@ int32_t TLS_FreeRTOS_recv( NetworkContext_t * pNetworkContext,
 {
     int32_t tlsStatus = 0;
 
-    tlsStatus = ( int32_t ) mbedtls_ssl_read( &( pNetworkContext->sslContext.context ),
-                                              pBuffer,
-                                              bytesToRecv );
+    /* A response cannot arrive before the request is sent, so write any
+     * collected bytes first. */
+    if( pNetworkContext->corkedBytes > 0U )
+    {
+        tlsStatus = TLS_FreeRTOS_Flush( pNetworkContext );
+    }
+
+    if( tlsStatus >= 0 )
+    {
+        tlsStatus = ( int32_t ) mbedtls_ssl_read( &( pNetworkContext->sslContext.context ),
+                                                  pBuffer,
+                                                  bytesToRecv );
+    }
 
     if( ( tlsStatus == MBEDTLS_ERR_SSL_TIMEOUT ) ||
         ( tlsStatus == MBEDTLS_ERR_SSL_WANT_READ ) ||
@@ -794,32 +1242,80 @@ int32_t TLS_FreeRTOS_send( NetworkContext_t * pNetworkContext,
 {
     int32_t tlsStatus = 0;
 
-    tlsStatus = ( int32_t ) mbedtls_ssl_write( &( pNetworkContext->sslContext.context ),
-                                               pBuffer,
-                                               bytesToSend );
+    if( pNetworkContext->pCorkBuffer == NULL )
+    {
+        tlsStatus = tlsWrite( pNetworkContext, pBuffer, bytesToSend );
+    }
+    else
+    {
+        /* Make room for the bytes by writing those already collected. */
+        if( bytesToSend > ( pNetworkContext->corkBufferSize - pNetworkContext->corkedBytes ) )
+        {
+            tlsStatus = TLS_FreeRTOS_Flush( pNetworkContext );
+        }
 
-    if( ( tlsStatus == MBEDTLS_ERR_SSL_TIMEOUT ) ||
-        ( tlsStatus == MBEDTLS_ERR_SSL_WANT_READ ) ||
-        ( tlsStatus == MBEDTLS_ERR_SSL_WANT_WRITE ) )
+        if( tlsStatus < 0 )
+        {
+            /* The connection failed, which the flush has logged. */
+        }
+        else if( bytesToSend <= ( pNetworkContext->corkBufferSize - pNetworkContext->corkedBytes ) )
+        {
+            ( void ) memcpy( &( pNetworkContext->pCorkBuffer[ pNetworkContext->corkedBytes ] ),
+                             pBuffer,
+                             bytesToSend );
+            pNetworkContext->corkedBytes += bytesToSend;
+            tlsStatus = ( int32_t ) bytesToSend;
+        }
+        else if( pNetworkContext->corkedBytes == 0U )
+        {
+            /* Too large to collect, so gains nothing from being collected. */
+            tlsStatus = tlsWrite( pNetworkContext, pBuffer, bytesToSend );
+        }
+        else
+        {
+            /* The flush timed out, so the send can be retried. */
+            tlsStatus = 0;
+        }
+    }
+
+    return tlsStatus;
+}
+/*-----------------------------------------------------------*/
+
+int32_t TLS_FreeRTOS_Flush( NetworkContext_t * pNetworkContext )
+{
+    int32_t tlsStatus = 1;
+    size_t bytesFlushed = 0U;
+
+    while( ( bytesFlushed < pNetworkContext->corkedBytes ) && ( tlsStatus > 0 ) )
     {
-        LogDebug( ( "Failed to send data. However, send can be retried on this error. "
-                    "mbedTLSError= %s : %s.",
-                    mbedtlsHighLevelCodeOrDefault( tlsStatus ),
-                    mbedtlsLowLevelCodeOrDefault( tlsStatus ) ) );
+        tlsStatus = tlsWrite( pNetworkContext,
+                              &( pNetworkContext->pCorkBuffer[ bytesFlushed ] ),
+                              pNetworkContext->corkedBytes - bytesFlushed );
 
-        /* Mark these set of errors as a timeout. The libraries may retry send
-         * on these errors. */
-        tlsStatus = 0;
+        if( tlsStatus > 0 )
+        {
+            bytesFlushed += ( size_t ) tlsStatus;
+        }
     }
-    else if( tlsStatus < 0 )
+
+    if( tlsStatus >= 0 )
     {
-        LogError( ( "Failed to send data:  mbedTLSError= %s : %s.",
-                    mbedtlsHighLevelCodeOrDefault( tlsStatus ),
-                    mbedtlsLowLevelCodeOrDefault( tlsStatus ) ) );
+        /* Keep the bytes left by a write that timed out for the next flush. */
+        pNetworkContext->corkedBytes -= bytesFlushed;
+
+        if( ( pNetworkContext->corkedBytes > 0U ) && ( bytesFlushed > 0U ) )
+        {
+            ( void ) memmove( pNetworkContext->pCorkBuffer,
+                              &( pNetworkContext->pCorkBuffer[ bytesFlushed ] ),
+                              pNetworkContext->corkedBytes );
+        }
+
+        tlsStatus = ( int32_t ) pNetworkContext->corkedBytes;
     }
     else
     {
-        /* Empty else marker. */
+        pNetworkContext->corkedBytes = 0U;
     }
 
     return tlsStatus;
@@ -68,6 +68,9 @@ extern void vLoggingPrintf( const char * pcFormatString,
 /* FreeRTOS+TCP include. */
 #include "FreeRTOS_Sockets.h"
 
+/* Sockets wrapper include, for the endpoint list. */
+#include "sockets_wrapper.h"
+
 /* Transport interface include. */
 #include "transport_interface.h"
 
@@ -77,6 +80,7 @@ extern void vLoggingPrintf( const char * pcFormatString,
 #include "mbedtls/ssl.h"
 #include "mbedtls/threading.h"
 #include "mbedtls/x509.h"
+#include "mbedtls_freertos_port.h"
 
 /**
  * @brief Secured connection context.
@@ -101,8 +105,33 @@ struct NetworkContext
 {
     Socket_t tcpSocket;
     SSLContext_t sslContext;
+    MbedtlsArena_t arena;              /**< @brief Serves the connection's mbed TLS allocations if an arena buffer was given. */
+    uint32_t handshakeHeapAllocations; /**< @brief mbed TLS heap allocations made while connecting. */
+    uint8_t * pCorkBuffer;             /**< @brief Collects sent bytes until they are flushed, or NULL to send immediately. */
+    size_t corkBufferSize;             /**< @brief Size of #NetworkContext.pCorkBuffer. */
+    size_t corkedBytes;                /**< @brief Bytes in #NetworkContext.pCorkBuffer not yet written. */
+    uint32_t recordWrites;             /**< @brief Calls made to mbedtls_ssl_write(), each of which writes at least one record. */
+    uint32_t bytesWritten;             /**< @brief Bytes passed to mbedtls_ssl_write(). */
 };
 
+/**
+ * @brief A TLS session kept from one connection so it can be resumed by the
+ * next, avoiding the certificate exchange and key agreement of a full
+ * handshake, along with counters of how each handshake completed.
+ *
+ * Resumption uses a session ticket if the server issued one, otherwise the
+ * session ID.  The server decides whether to resume, so offering a session
+ * that has expired simply results in a full handshake.
+ */
+typedef struct TlsSession
+{
+    mbedtls_ssl_session session;  /**< @brief Session negotiated by the last successful handshake. */
+    BaseType_t isValid;           /**< @brief pdTRUE if #TlsSession_t.session can be offered. */
+    uint32_t fullHandshakes;      /**< @brief Handshakes that negotiated a new session. */
+    uint32_t resumedHandshakes;   /**< @brief Handshakes that resumed the offered session. */
+    uint32_t lastHandshakeTimeMs; /**< @brief Duration of the last successful handshake. */
+} TlsSession_t;
+
 /**
  * @brief Contains the credentials necessary for tls connection setup.
  */
@@ -129,6 +158,43 @@ typedef struct NetworkCredentials
     size_t clientCertSize;       /**< @brief Size associated with #NetworkCredentials.pClientCert. */
     const uint8_t * pPrivateKey; /**< @brief String representing the client certificate's private key. */
     size_t privateKeySize;       /**< @brief Size associated with #NetworkCredentials.pPrivateKey. */
+
+    /**
+     * @brief Optional.  Session to offer to the server, initialized with
+     * TLS_FreeRTOS_InitSession().  It is replaced by the session negotiated
+     * by each successful handshake.
+     */
+    TlsSession_t * pSession;
+
+    /**
+     * @brief Optional.  Buffer the mbed TLS allocations of the connection are
+     * served from while connecting, rather than the FreeRTOS heap.  It is
+     * reused from the start by each connection, so must not be shared by
+     * connections that are open at the same time.  Allocations that do not
+     * fit fall back to the heap.
+     */
+    uint8_t * pArenaBuffer;
+    size_t arenaBufferSize; /**< @brief Size associated with #NetworkCredentials.pArenaBuffer. */
+
+    /**
+     * @brief Optional.  Buffer that sends are collected in, so an MQTT packet
+     * written in several pieces is encrypted as one record rather than one
+     * record per piece.  The collected bytes are written by TLS_FreeRTOS_Flush(),
+     * before receiving, and when the buffer fills.  Sends larger than the
+     * buffer are written directly.
+     */
+    uint8_t * pCorkBuffer;
+    size_t corkBufferSize; /**< @brief Size associated with #NetworkCredentials.pCorkBuffer. */
+
+    /**
+     * @brief Largest record payload, in bytes, to negotiate with the server
+     * using the max fragment length extension: 512, 1024, 2048 or 4096.  Set
+     * to 0 to not negotiate, which allows records of up to 16384 bytes.
+     *
+     * Smaller fragments let mbed TLS use smaller I/O buffers once the
+     * handshake completes, but split large MQTT packets into more records.
+     */
+    uint16_t maxFragmentLength;
 } NetworkCredentials_t;
 
 /**
@@ -166,6 +232,98 @@ TlsTransportStatus_t TLS_FreeRTOS_Connect( NetworkContext_t * pNetworkContext,
                                            uint32_t receiveTimeoutMs,
                                            uint32_t sendTimeoutMs );
 
+/**
+ * @brief Create a TLS connection to whichever of several endpoints accepts a
+ * TCP connection first.
+ *
+ * The TCP connections are raced with Sockets_ConnectAny(), and the TLS
+ * handshake is then performed with the endpoint that won, using its hostname
+ * for server name indication.  The endpoints' records are updated so that the
+ * next connection tries the fastest reliable endpoint first.
+ *
+ * @param[out] pNetworkContext Pointer to a network context to contain the
+ * initialized socket handle.
+ * @param[in,out] pEndpoints The endpoints to connect to.
+ * @param[in] endpointCount Number of endpoints.
+ * @param[in] pNetworkCredentials Credentials for the TLS connection.
+ * @param[in] receiveTimeoutMs Receive socket timeout.
+ * @param[in] sendTimeoutMs Send socket timeout.
+ * @param[out] pEndpointIndex Set to the index of the endpoint connected to.
+ *
+ * @return #TLS_TRANSPORT_SUCCESS, #TLS_TRANSPORT_INSUFFICIENT_MEMORY, #TLS_TRANSPORT_INVALID_CREDENTIALS,
+ * #TLS_TRANSPORT_HANDSHAKE_FAILED, #TLS_TRANSPORT_INTERNAL_ERROR, or #TLS_TRANSPORT_CONNECT_FAILURE.
+ */
+TlsTransportStatus_t TLS_FreeRTOS_ConnectEndpoints( NetworkContext_t * pNetworkContext,
+                                                    SocketsEndpoint_t * pEndpoints,
+                                                    size_t endpointCount,
+                                                    const NetworkCredentials_t * pNetworkCredentials,
+                                                    uint32_t receiveTimeoutMs,
+                                                    uint32_t sendTimeoutMs,
+                                                    size_t * pEndpointIndex );
+
+/**
+ * @brief Initialize a session before it is first used by TLS_FreeRTOS_Connect().
+ *
+ * @param[out] pSession The session to initialize.
+ */
+void TLS_FreeRTOS_InitSession( TlsSession_t * pSession );
+
+/**
+ * @brief Discard the session, so the next connection performs a full
+ * handshake.  The counters are kept.
+ *
+ * @param[in] pSession The session to discard.
+ */
+void TLS_FreeRTOS_FreeSession( TlsSession_t * pSession );
+
+/**
+ * @brief Serialize a session so it can be stored and resumed after a reset.
+ *
+ * @note The serialized session contains the session's master secret, so must
+ * be stored where only the device can read it.
+ *
+ * @param[in] pSession The session to serialize.
+ * @param[out] pBuffer Buffer to serialize the session into.
+ * @param[in] bufferSize Size of pBuffer.
+ * @param[out] pLength Set to the length of the serialized session.
+ *
+ * @return #TLS_TRANSPORT_SUCCESS, #TLS_TRANSPORT_INVALID_PARAMETER if there is
+ * no valid session, or #TLS_TRANSPORT_INSUFFICIENT_MEMORY if pBuffer is too
+ * small.
+ */
+TlsTransportStatus_t TLS_FreeRTOS_SaveSession( const TlsSession_t * pSession,
+                                               uint8_t * pBuffer,
+                                               size_t bufferSize,
+                                               size_t * pLength );
+
+/**
+ * @brief Restore a session serialized by TLS_FreeRTOS_SaveSession().
+ *
+ * @param[in] pSession An initialized session to restore into.
+ * @param[in] pBuffer The serialized session.
+ * @param[in] length Length of the serialized session.
+ *
+ * @return #TLS_TRANSPORT_SUCCESS, or #TLS_TRANSPORT_INVALID_PARAMETER if the
+ * serialized session is invalid or from an incompatible build.
+ */
+TlsTransportStatus_t TLS_FreeRTOS_LoadSession( TlsSession_t * pSession,
+                                               const uint8_t * pBuffer,
+                                               size_t length );
+
+/**
+ * @brief Get how much memory the mbed TLS allocations of a connection used.
+ *
+ * @param[in] pNetworkContext Network context of a connection established by
+ * TLS_FreeRTOS_Connect().
+ * @param[out] pArenaStats Receives the counters of the connection's arena,
+ * which are zero if #NetworkCredentials_t.pArenaBuffer was NULL.
+ * @param[out] pHeapAllocations Receives the number of mbed TLS allocations
+ * taken from the FreeRTOS heap while connecting.
+ */
+void TLS_FreeRTOS_GetMemoryStats( const NetworkContext_t * pNetworkContext,
+                                  MbedtlsArenaStats_t * pArenaStats,
+                                  uint32_t * pHeapAllocations );
+
 /**
  * @brief Gracefully disconnect an established TLS connection.
  *
@@ -209,4 +367,16 @@ int32_t TLS_FreeRTOS_send( NetworkContext_t * pNetworkContext,
                            const void * pBuffer,
                            size_t bytesToSend );
 
+/**
+ * @brief Write the bytes collected in the cork buffer of a connection.
+ *
+ * Does nothing if #NetworkCredentials_t.pCorkBuffer was NULL.
+ *
+ * @param[in] pNetworkContext The Network context.
+ *
+ * @return The number of bytes still collected, which is 0 unless the write
+ * timed out, or a negative value on error.
+ */
+int32_t TLS_FreeRTOS_Flush( NetworkContext_t * pNetworkContext );
+
 #endif /* ifndef USING_MBEDTLS */
@@ -0,0 +1,508 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file sockets_posix.c
+ * @brief Connects and services native Linux TCP sockets for FreeRTOS tasks
+ * running on the POSIX port, without FreeRTOS+TCP.
+ *
+ * In the POSIX port a task that blocks in a system call is still running as
+ * far as the scheduler is concerned, so no task of lower priority runs until
+ * the call returns.  Sockets are therefore non-blocking, and the waits of
+ * tasks that send and receive poll with a zero timeout between task delays.
+ * The readiness task is the exception: it runs at the idle priority, so it can
+ * block in epoll_wait() until a socket is ready without holding up any other
+ * task.  Name resolution with getaddrinfo() also blocks, so connections are
+ * best made before latency-sensitive tasks start, or to a numeric address.
+ */
+
+/* Standard includes. */
+#include <string.h>
+#include <stdio.h>
+
+/* POSIX includes. */
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+/* FreeRTOS includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "sockets_posix.h"
+
+/* Maximum number of sockets that can have a ready callback at once. */
+#ifndef SOCKETS_POSIX_MAX_READY_SOCKETS
+    #define SOCKETS_POSIX_MAX_READY_SOCKETS    ( 4 )
+#endif
+
+/* Maximum number of buffers Sockets_Posix_Send() can send at once. */
+#ifndef SOCKETS_POSIX_MAX_IO_VECTORS
+    #define SOCKETS_POSIX_MAX_IO_VECTORS    ( 8 )
+#endif
+
+/* Longest time the readiness task blocks in epoll_wait().  Data arriving ends
+ * the wait at once, so this only limits how long the task goes without
+ * returning to the scheduler when no socket is ready. */
+#ifndef SOCKETS_POSIX_READY_WAIT_MS
+    #define SOCKETS_POSIX_READY_WAIT_MS    ( 100 )
+#endif
+
+/* Stack size and priority of the readiness task.  The task stays ready while
+ * it blocks in epoll_wait(), so any priority above the idle priority would
+ * stop the tasks below it from running. */
+#ifndef SOCKETS_POSIX_READY_TASK_STACK_SIZE
+    #define SOCKETS_POSIX_READY_TASK_STACK_SIZE    ( configMINIMAL_STACK_SIZE * 2 )
+#endif
+#ifndef SOCKETS_POSIX_READY_TASK_PRIORITY
+    #define SOCKETS_POSIX_READY_TASK_PRIORITY    ( tskIDLE_PRIORITY )
+#endif
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief A socket registered with the epoll set, and the function to call
+ * when it is ready.
+ */
+typedef struct ReadyEntry
+{
+    int tcpSocket;                        /**< @brief Socket descriptor, or -1 if the entry is free. */
+    SocketsPosixReadyCallback_t callback; /**< @brief Called when the socket is ready. */
+    void * pCallbackContext;              /**< @brief Passed to the callback. */
+} ReadyEntry_t;
+
+/**
+ * @brief The registered sockets.  Changed with the scheduler suspended so the
+ * readiness task reads a consistent entry.
+ */
+static ReadyEntry_t readyEntries[ SOCKETS_POSIX_MAX_READY_SOCKETS ];
+
+/**
+ * @brief The epoll set of the registered sockets, or -1 until first used.
+ */
+static int epollSet = -1;
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Create the epoll set and the task that services it.
+ *
+ * @return #SOCKETS_POSIX_SUCCESS or #SOCKETS_POSIX_NO_MEMORY.
+ */
+static BaseType_t startReadyTask( void );
+
+/**
+ * @brief Wait for registered sockets to be ready and call their callbacks.
+ *
+ * @param[in] pvParameters Unused.
+ */
+static void readyTask( void * pvParameters );
+
+/*-----------------------------------------------------------*/
+
+static BaseType_t startReadyTask( void )
+{
+    BaseType_t status = SOCKETS_POSIX_SUCCESS;
+    size_t i;
+
+    epollSet = epoll_create1( EPOLL_CLOEXEC );
+
+    if( epollSet < 0 )
+    {
+        LogError( ( "Failed to create epoll set: errno=%d.", errno ) );
+        status = SOCKETS_POSIX_NO_MEMORY;
+    }
+    else
+    {
+        for( i = 0; i < SOCKETS_POSIX_MAX_READY_SOCKETS; i++ )
+        {
+            readyEntries[ i ].tcpSocket = -1;
+        }
+
+        if( xTaskCreate( readyTask,
+                         "PosixReady",
+                         SOCKETS_POSIX_READY_TASK_STACK_SIZE,
+                         NULL,
+                         SOCKETS_POSIX_READY_TASK_PRIORITY,
+                         NULL ) != pdPASS )
+        {
+            LogError( ( "Failed to create the socket readiness task." ) );
+            ( void ) close( epollSet );
+            epollSet = -1;
+            status = SOCKETS_POSIX_NO_MEMORY;
+        }
+    }
+
+    return status;
+}
+/*-----------------------------------------------------------*/
+
+static void readyTask( void * pvParameters )
+{
+    struct epoll_event events[ SOCKETS_POSIX_MAX_READY_SOCKETS ];
+    ReadyEntry_t entry;
+    ReadyEntry_t * pEntry;
+    int eventCount, i;
+
+    ( void ) pvParameters;
+
+    for( ; ; )
+    {
+        /* The tick signal interrupts the wait to switch tasks, in which case
+         * it fails with EINTR and is made again. */
+        eventCount = epoll_wait( epollSet, events, SOCKETS_POSIX_MAX_READY_SOCKETS, SOCKETS_POSIX_READY_WAIT_MS );
+
+        if( ( eventCount < 0 ) && ( errno != EINTR ) )
+        {
+            LogError( ( "Failed to wait for sockets to be ready: errno=%d.", errno ) );
+            vTaskDelay( pdMS_TO_TICKS( SOCKETS_POSIX_READY_WAIT_MS ) );
+        }
+
+        for( i = 0; i < eventCount; i++ )
+        {
+            /* Copy the entry, as it may be removed once the scheduler resumes. */
+            pEntry = ( ReadyEntry_t * ) events[ i ].data.ptr;
+            vTaskSuspendAll();
+            entry = *pEntry;
+            ( void ) xTaskResumeAll();
+
+            if( ( entry.tcpSocket >= 0 ) && ( entry.callback != NULL ) )
+            {
+                entry.callback( entry.pCallbackContext );
+            }
+        }
+    }
+}
+/*-----------------------------------------------------------*/
+
+BaseType_t Sockets_Posix_Connect( int * pTcpSocket,
+                                  const char * pHostName,
+                                  uint16_t port,
+                                  uint32_t connectTimeoutMs )
+{
+    BaseType_t status = SOCKETS_POSIX_SUCCESS;
+    struct addrinfo hints = { 0 };
+    struct addrinfo * pAddresses = NULL;
+    const struct addrinfo * pAddress;
+    char portString[ 6 ];
+    int tcpSocket = -1;
+    int socketError = 0;
+    socklen_t socketErrorLength = sizeof( socketError );
+    const int noDelay = 1;
+
+    if( ( pTcpSocket == NULL ) || ( pHostName == NULL ) )
+    {
+        LogError( ( "Invalid parameters: pTcpSocket=%p, pHostName=%p.", pTcpSocket, pHostName ) );
+        status = SOCKETS_POSIX_INVALID_PARAMETER;
+    }
+    else
+    {
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_protocol = IPPROTO_TCP;
+        ( void ) snprintf( portString, sizeof( portString ), "%u", ( unsigned int ) port );
+
+        if( getaddrinfo( pHostName, portString, &hints, &pAddresses ) != 0 )
+        {
+            LogError( ( "DNS resolution failed: Hostname=%s.", pHostName ) );
+            status = SOCKETS_POSIX_DNS_FAILURE;
+        }
+    }
+
+    /* Try each address in turn until one connects. */
+    for( pAddress = pAddresses;
+         ( status == SOCKETS_POSIX_SUCCESS ) && ( pAddress != NULL ) && ( tcpSocket < 0 );
+         pAddress = pAddress->ai_next )
+    {
+        tcpSocket = socket( pAddress->ai_family, pAddress->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, pAddress->ai_protocol );
+
+        if( tcpSocket >= 0 )
+        {
+            /* MQTT packets are collected by the transport before they are
+             * sent, so Nagle's algorithm would only delay them. */
+            ( void ) setsockopt( tcpSocket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof( noDelay ) );
+        }
+
+        if( ( tcpSocket >= 0 ) &&
+            ( connect( tcpSocket, pAddress->ai_addr, pAddress->ai_addrlen ) != 0 ) &&
+            ( ( errno != EINPROGRESS ) ||
+              ( Sockets_Posix_Wait( tcpSocket, POLLOUT, connectTimeoutMs ) == pdFALSE ) ||
+              ( getsockopt( tcpSocket, SOL_SOCKET, SO_ERROR, &socketError, &socketErrorLength ) != 0 ) ||
+              ( socketError != 0 ) ) )
+        {
+            ( void ) close( tcpSocket );
+            tcpSocket = -1;
+        }
+    }
+
+    if( pAddresses != NULL )
+    {
+        freeaddrinfo( pAddresses );
+    }
+
+    if( ( status == SOCKETS_POSIX_SUCCESS ) && ( tcpSocket < 0 ) )
+    {
+        LogError( ( "Failed to connect to server: Hostname=%s, Port=%u, errno=%d.",
+                    pHostName,
+                    ( unsigned int ) port,
+                    ( socketError != 0 ) ? socketError : errno ) );
+        status = SOCKETS_POSIX_CONNECT_FAILURE;
+    }
+
+    if( status == SOCKETS_POSIX_SUCCESS )
+    {
+        LogDebug( ( "Established TCP connection with %s.", pHostName ) );
+        *pTcpSocket = tcpSocket;
+    }
+
+    return status;
+}
+/*-----------------------------------------------------------*/
+
+void Sockets_Posix_Disconnect( int tcpSocket )
+{
+    if( tcpSocket >= 0 )
+    {
+        ( void ) Sockets_Posix_SetReadyCallback( tcpSocket, NULL, NULL );
+        ( void ) shutdown( tcpSocket, SHUT_RDWR );
+        ( void ) close( tcpSocket );
+    }
+}
+/*-----------------------------------------------------------*/
+
+BaseType_t Sockets_Posix_Wait( int tcpSocket,
+                               short events,
+                               uint32_t timeoutMs )
+{
+    struct pollfd pollSocket;
+    const TickType_t startTime = xTaskGetTickCount();
+    const TickType_t timeout = pdMS_TO_TICKS( timeoutMs );
+    BaseType_t ready = pdFALSE;
+    int pollStatus;
+
+    pollSocket.fd = tcpSocket;
+    pollSocket.events = events;
+
+    for( ; ; )
+    {
+        pollSocket.revents = 0;
+
+        pollStatus = poll( &pollSocket, 1, 0 );
+
+        if( ( pollStatus > 0 ) || ( ( pollStatus < 0 ) && ( errno != EINTR ) ) )
+        {
+            /* Ready, or an error that the caller will see when it next uses
+             * the socket. */
+            ready = pdTRUE;
+            break;
+        }
+
+        if( ( xTaskGetTickCount() - startTime ) >= timeout )
+        {
+            break;
+        }
+
+        vTaskDelay( 1 );
+    }
+
+    return ready;
+}
+/*-----------------------------------------------------------*/
+
+int32_t Sockets_Posix_Send( int tcpSocket,
+                            const struct iovec * pIoVec,
+                            size_t ioVecCount,
+                            uint32_t timeoutMs )
+{
+    struct iovec remaining[ SOCKETS_POSIX_MAX_IO_VECTORS ];
+    struct msghdr message = { 0 };
+    size_t remainingCount = 0U, i;
+    ssize_t sent;
+    int32_t totalSent = 0;
+
+    if( ( pIoVec == NULL ) || ( ioVecCount > SOCKETS_POSIX_MAX_IO_VECTORS ) )
+    {
+        LogError( ( "Invalid parameters: pIoVec=%p, ioVecCount=%u.", pIoVec, ( unsigned int ) ioVecCount ) );
+        totalSent = -1;
+    }
+    else
+    {
+        /* Copy the vector, skipping empty buffers, so it can be advanced past
+         * what a partial send wrote. */
+        for( i = 0; i < ioVecCount; i++ )
+        {
+            if( pIoVec[ i ].iov_len > 0U )
+            {
+                remaining[ remainingCount ] = pIoVec[ i ];
+                remainingCount++;
+            }
+        }
+    }
+
+    while( ( totalSent >= 0 ) && ( remainingCount > 0U ) )
+    {
+        message.msg_iov = remaining;
+        message.msg_iovlen = remainingCount;
+
+        /* sendmsg() rather than writev() so SIGPIPE is not raised if the
+         * server has closed the connection. */
+        sent = sendmsg( tcpSocket, &message, MSG_NOSIGNAL );
+
+        if( sent > 0 )
+        {
+            totalSent += ( int32_t ) sent;
+
+            /* Advance past the bytes sent. */
+            while( ( remainingCount > 0U ) && ( ( size_t ) sent >= remaining[ 0 ].iov_len ) )
+            {
+                sent -= ( ssize_t ) remaining[ 0 ].iov_len;
+                remainingCount--;
+                ( void ) memmove( &( remaining[ 0 ] ), &( remaining[ 1 ] ), remainingCount * sizeof( remaining[ 0 ] ) );
+            }
+
+            if( remainingCount > 0U )
+            {
+                remaining[ 0 ].iov_base = ( uint8_t * ) remaining[ 0 ].iov_base + sent;
+                remaining[ 0 ].iov_len -= ( size_t ) sent;
+            }
+        }
+        else if( ( sent < 0 ) && ( errno == EINTR ) )
+        {
+            /* Interrupted before anything was sent. */
+        }
+        else if( ( sent < 0 ) && ( ( errno == EAGAIN ) || ( errno == EWOULDBLOCK ) ) )
+        {
+            if( Sockets_Posix_Wait( tcpSocket, POLLOUT, timeoutMs ) == pdFALSE )
+            {
+                /* Return what was sent; the caller retries the rest. */
+                break;
+            }
+        }
+        else
+        {
+            LogError( ( "Failed to send: errno=%d.", errno ) );
+            totalSent = -1;
+        }
+    }
+
+    return totalSent;
+}
+/*-----------------------------------------------------------*/
+
+BaseType_t Sockets_Posix_SetReadyCallback( int tcpSocket,
+                                           SocketsPosixReadyCallback_t callback,
+                                           void * pCallbackContext )
+{
+    BaseType_t status = SOCKETS_POSIX_SUCCESS;
+    ReadyEntry_t * pEntry = NULL;
+    struct epoll_event event = { 0 };
+    size_t i;
+
+    if( tcpSocket < 0 )
+    {
+        status = SOCKETS_POSIX_INVALID_PARAMETER;
+    }
+    else if( ( epollSet < 0 ) && ( callback != NULL ) )
+    {
+        status = startReadyTask();
+    }
+    else
+    {
+        /* Empty else for MISRA 15.7 compliance. */
+    }
+
+    if( ( status == SOCKETS_POSIX_SUCCESS ) && ( epollSet >= 0 ) )
+    {
+        /* Find the socket's entry, or a free one to add it. */
+        for( i = 0; ( i < SOCKETS_POSIX_MAX_READY_SOCKETS ) && ( pEntry == NULL ); i++ )
+        {
+            if( readyEntries[ i ].tcpSocket == tcpSocket )
+            {
+                pEntry = &( readyEntries[ i ] );
+            }
+        }
+
+        for( i = 0; ( i < SOCKETS_POSIX_MAX_READY_SOCKETS ) && ( pEntry == NULL ) && ( callback != NULL ); i++ )
+        {
+            if( readyEntries[ i ].tcpSocket < 0 )
+            {
+                pEntry = &( readyEntries[ i ] );
+            }
+        }
+
+        if( ( pEntry == NULL ) && ( callback != NULL ) )
+        {
+            LogError( ( "Only %d sockets can have a ready callback.", SOCKETS_POSIX_MAX_READY_SOCKETS ) );
+            status = SOCKETS_POSIX_NO_MEMORY;
+        }
+        else if( pEntry == NULL )
+        {
+            /* Removing a socket that had no callback. */
+        }
+        else if( callback == NULL )
+        {
+            ( void ) epoll_ctl( epollSet, EPOLL_CTL_DEL, tcpSocket, NULL );
+            vTaskSuspendAll();
+            pEntry->tcpSocket = -1;
+            pEntry->callback = NULL;
+            ( void ) xTaskResumeAll();
+        }
+        else
+        {
+            /* Edge triggered, so the callback is called once each time data
+             * arrives, as with FREERTOS_SO_WAKEUP_CALLBACK, rather than until
+             * the data is read. */
+            event.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+            event.data.ptr = pEntry;
+
+            vTaskSuspendAll();
+            pEntry->callback = callback;
+            pEntry->pCallbackContext = pCallbackContext;
+
+            if( ( epoll_ctl( epollSet, ( pEntry->tcpSocket == tcpSocket ) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, tcpSocket, &event ) ) != 0 )
+            {
+                pEntry->tcpSocket = -1;
+                pEntry->callback = NULL;
+                status = SOCKETS_POSIX_INVALID_PARAMETER;
+            }
+            else
+            {
+                pEntry->tcpSocket = tcpSocket;
+            }
+
+            ( void ) xTaskResumeAll();
+
+            if( status != SOCKETS_POSIX_SUCCESS )
+            {
+                LogError( ( "Failed to add socket %d to the epoll set: errno=%d.", tcpSocket, errno ) );
+            }
+        }
+    }
+
+    return status;
+}
+/*-----------------------------------------------------------*/
@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef SOCKETS_POSIX_H
+#define SOCKETS_POSIX_H
+
+/* Standard includes. */
+#include <stdint.h>
+#include <stddef.h>
+
+/* POSIX includes. */
+#include <sys/uio.h>
+
+/* FreeRTOS includes. */
+#include "FreeRTOS.h"
+
+/**************************************************/
+/******* DO NOT CHANGE the following order ********/
+/**************************************************/
+
+/* Logging related header files are required to be included in the following order:
+ * 1. Include the header file "logging_levels.h".
+ * 2. Define LIBRARY_LOG_NAME and  LIBRARY_LOG_LEVEL.
+ * 3. Include the header file "logging_stack.h".
+ */
+
+/* Include header that defines log levels. */
+#include "logging_levels.h"
+
+/* Logging configuration for the Sockets. */
+#ifndef LIBRARY_LOG_NAME
+    #define LIBRARY_LOG_NAME     "PosixSockets"
+#endif
+#ifndef LIBRARY_LOG_LEVEL
+    #define LIBRARY_LOG_LEVEL    LOG_ERROR
+#endif
+
+/* Prototype for the function used to print to console. */
+extern void vLoggingPrintf( const char * pcFormatString,
+                            ... );
+
+/* Map the SdkLog macro to the logging function. */
+#ifndef SdkLog
+    #define SdkLog( message )    vLoggingPrintf message
+#endif
+
+#include "logging_stack.h"
+
+/************ End of logging configuration ****************/
+
+/* Error codes. */
+#define SOCKETS_POSIX_SUCCESS            ( 0 )
+#define SOCKETS_POSIX_INVALID_PARAMETER  ( -1 )
+#define SOCKETS_POSIX_DNS_FAILURE        ( -2 )
+#define SOCKETS_POSIX_CONNECT_FAILURE    ( -3 )
+#define SOCKETS_POSIX_NO_MEMORY          ( -4 )
+
+/**
+ * @brief Called, from the readiness task, when data or a disconnection is
+ * waiting on a socket.  Must not block.
+ *
+ * This is the equivalent of the FreeRTOS+TCP FREERTOS_SO_WAKEUP_CALLBACK, and
+ * is normally used to wake the task that reads the socket.
+ */
+typedef void ( * SocketsPosixReadyCallback_t )( void * pCallbackContext );
+
+/**
+ * @brief Establish a connection to server.
+ *
+ * The socket is non-blocking.  Use Sockets_Posix_Wait() to wait for it to be
+ * readable or writable without blocking the FreeRTOS scheduler.
+ *
+ * @param[out] pTcpSocket The output parameter to return the socket descriptor.
+ * @param[in] pHostName Server hostname to connect to.
+ * @param[in] port Server port to connect to.
+ * @param[in] connectTimeoutMs Time (in milliseconds) to wait for the
+ * connection to complete.
+ *
+ * @return #SOCKETS_POSIX_SUCCESS or a negative error code.
+ */
+BaseType_t Sockets_Posix_Connect( int * pTcpSocket,
+                                  const char * pHostName,
+                                  uint16_t port,
+                                  uint32_t connectTimeoutMs );
+
+/**
+ * @brief End connection to server, removing its ready callback if one was set.
+ *
+ * @param[in] tcpSocket The socket descriptor.
+ */
+void Sockets_Posix_Disconnect( int tcpSocket );
+
+/**
+ * @brief Wait for a socket to be readable or writable.
+ *
+ * @param[in] tcpSocket The socket descriptor.
+ * @param[in] events POLLIN, POLLOUT, or both.
+ * @param[in] timeoutMs Time (in milliseconds) to wait.
+ *
+ * @return pdTRUE if the socket became ready or has an error to report,
+ * pdFALSE on timeout.
+ */
+BaseType_t Sockets_Posix_Wait( int tcpSocket,
+                               short events,
+                               uint32_t timeoutMs );
+
+/**
+ * @brief Send a vector of buffers with as few system calls as possible.
+ *
+ * @param[in] tcpSocket The socket descriptor.
+ * @param[in] pIoVec The buffers to send.
+ * @param[in] ioVecCount Number of buffers, at most
+ * SOCKETS_POSIX_MAX_IO_VECTORS.
+ * @param[in] timeoutMs Time (in milliseconds) to wait for space to send into.
+ *
+ * @return Number of bytes sent, which is less than the total if the timeout
+ * expired, or a negative value on error.
+ */
+int32_t Sockets_Posix_Send( int tcpSocket,
+                            const struct iovec * pIoVec,
+                            size_t ioVecCount,
+                            uint32_t timeoutMs );
+
+/**
+ * @brief Call a function whenever data or a disconnection is waiting on a
+ * socket.
+ *
+ * The readiness of every registered socket is collected by one epoll set,
+ * serviced by a task created on first use.  Pass a NULL callback to remove
+ * the socket.
+ *
+ * @param[in] tcpSocket The socket descriptor.
+ * @param[in] callback The function to call, or NULL.
+ * @param[in] pCallbackContext Passed to the callback.
+ *
+ * @return #SOCKETS_POSIX_SUCCESS or a negative error code.
+ */
+BaseType_t Sockets_Posix_SetReadyCallback( int tcpSocket,
+                                           SocketsPosixReadyCallback_t callback,
+                                           void * pCallbackContext );
+
+#endif /* ifndef SOCKETS_POSIX_H */
@@ -0,0 +1,647 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file using_mbedtls_posix.c
+ * @brief TLS transport interface implementation over a native POSIX socket.
+ * This implementation uses mbedTLS, with the operating system's random number
+ * generator as its entropy source.
+ */
+
+/* Standard includes. */
+#include <string.h>
+
+/* POSIX includes. */
+#include <errno.h>
+#include <poll.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+
+/* FreeRTOS includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/* TLS transport header. */
+#include "using_mbedtls_posix.h"
+#include "mbedtls/net_sockets.h"
+
+/* mbedTLS util includes. */
+#include "mbedtls_error.h"
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Represents string to be logged when mbedTLS returned error
+ * does not contain a high-level code.
+ */
+static const char * pNoHighLevelMbedTlsCodeStr = "<No-High-Level-Code>";
+
+/**
+ * @brief Represents string to be logged when mbedTLS returned error
+ * does not contain a low-level code.
+ */
+static const char * pNoLowLevelMbedTlsCodeStr = "<No-Low-Level-Code>";
+
+/**
+ * @brief Utility for converting the high-level code in an mbedTLS error to string,
+ * if the code-contains a high-level code; otherwise, using a default string.
+ */
+#define mbedtlsHighLevelCodeOrDefault( mbedTlsCode )        \
+    ( mbedtls_strerror_highlevel( mbedTlsCode ) != NULL ) ? \
+    mbedtls_strerror_highlevel( mbedTlsCode ) : pNoHighLevelMbedTlsCodeStr
+
+/**
+ * @brief Utility for converting the level-level code in an mbedTLS error to string,
+ * if the code-contains a level-level code; otherwise, using a default string.
+ */
+#define mbedtlsLowLevelCodeOrDefault( mbedTlsCode )        \
+    ( mbedtls_strerror_lowlevel( mbedTlsCode ) != NULL ) ? \
+    mbedtls_strerror_lowlevel( mbedTlsCode ) : pNoLowLevelMbedTlsCodeStr
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Fill a buffer from the operating system's random number generator.
+ *
+ * @param[in] data Callback context, not used.
+ * @param[out] output The buffer to fill.
+ * @param[in] len Size of the buffer.
+ * @param[out] olen The number of bytes written.
+ *
+ * @return 0 on success, MBEDTLS_ERR_ENTROPY_SOURCE_FAILED otherwise.
+ */
+static int entropyPoll( void * data,
+                        unsigned char * output,
+                        size_t len,
+                        size_t * olen );
+
+/**
+ * @brief Send callback given to mbed TLS.
+ *
+ * @param[in] ctx The network context.
+ * @param[in] buf Buffer containing the bytes to send.
+ * @param[in] len Number of bytes to send from the buffer.
+ *
+ * @return Number of bytes sent, MBEDTLS_ERR_SSL_WANT_WRITE if none could be
+ * sent before the send timeout, or MBEDTLS_ERR_NET_SEND_FAILED.
+ */
+static int socketSend( void * ctx,
+                       const unsigned char * buf,
+                       size_t len );
+
+/**
+ * @brief Receive callback given to mbed TLS.  Does not block.
+ *
+ * @param[in] ctx The network context.
+ * @param[out] buf Buffer to receive bytes into.
+ * @param[in] len Size of the buffer.
+ *
+ * @return Number of bytes received, MBEDTLS_ERR_SSL_WANT_READ if none are
+ * waiting, or MBEDTLS_ERR_NET_CONN_RESET or MBEDTLS_ERR_NET_RECV_FAILED.
+ */
+static int socketRecv( void * ctx,
+                       unsigned char * buf,
+                       size_t len );
+
+/**
+ * @brief Initialize the mbed TLS structures and random number generator of a
+ * connection, and set the credentials and options.
+ *
+ * @param[in] pNetworkContext Network context.
+ * @param[in] pHostName Remote host name, used for server name indication.
+ * @param[in] pNetworkCredentials TLS setup parameters.
+ *
+ * @return #TLS_TRANSPORT_SUCCESS, #TLS_TRANSPORT_INSUFFICIENT_MEMORY,
+ * #TLS_TRANSPORT_INVALID_CREDENTIALS, or #TLS_TRANSPORT_INTERNAL_ERROR.
+ */
+static TlsTransportStatus_t tlsSetup( NetworkContext_t * pNetworkContext,
+                                      const char * pHostName,
+                                      const NetworkCredentials_t * pNetworkCredentials );
+
+/**
+ * @brief Perform the TLS handshake, waiting on the socket between steps
+ * rather than spinning.
+ *
+ * @param[in] pNetworkContext Network context.
+ *
+ * @return #TLS_TRANSPORT_SUCCESS, #TLS_TRANSPORT_INTERNAL_ERROR, or
+ * #TLS_TRANSPORT_HANDSHAKE_FAILED.
+ */
+static TlsTransportStatus_t tlsHandshake( NetworkContext_t * pNetworkContext );
+
+/**
+ * @brief Free the mbed TLS structures in a network connection.
+ *
+ * @param[in] pSslContext The SSL context to free.
+ */
+static void sslContextFree( SSLContext_t * pSslContext );
+
+/*-----------------------------------------------------------*/
+
+static int entropyPoll( void * data,
+                        unsigned char * output,
+                        size_t len,
+                        size_t * olen )
+{
+    int status = 0;
+    ssize_t generated;
+
+    ( void ) data;
+
+    generated = getrandom( output, len, 0 );
+
+    if( ( generated >= 0 ) && ( ( size_t ) generated == len ) )
+    {
+        *olen = len;
+    }
+    else
+    {
+        *olen = 0;
+        status = MBEDTLS_ERR_ENTROPY_SOURCE_FAILED;
+    }
+
+    return status;
+}
+/*-----------------------------------------------------------*/
+
+static int socketSend( void * ctx,
+                       const unsigned char * buf,
+                       size_t len )
+{
+    NetworkContext_t * pNetworkContext = ( NetworkContext_t * ) ctx;
+    struct iovec ioVec;
+    int32_t bytesSent;
+    int status;
+
+    ioVec.iov_base = ( void * ) buf;
+    ioVec.iov_len = len;
+
+    bytesSent = Sockets_Posix_Send( pNetworkContext->tcpSocket,
+                                    &ioVec,
+                                    1U,
+                                    pNetworkContext->sendTimeoutMs );
+
+    if( bytesSent > 0 )
+    {
+        status = ( int ) bytesSent;
+    }
+    else if( bytesSent == 0 )
+    {
+        status = MBEDTLS_ERR_SSL_WANT_WRITE;
+    }
+    else
+    {
+        status = MBEDTLS_ERR_NET_SEND_FAILED;
+    }
+
+    return status;
+}
+/*-----------------------------------------------------------*/
+
+static int socketRecv( void * ctx,
+                       unsigned char * buf,
+                       size_t len )
+{
+    NetworkContext_t * pNetworkContext = ( NetworkContext_t * ) ctx;
+    ssize_t bytesReceived;
+    int status;
+
+    bytesReceived = recv( pNetworkContext->tcpSocket, buf, len, MSG_DONTWAIT );
+
+    if( bytesReceived > 0 )
+    {
+        status = ( int ) bytesReceived;
+    }
+    else if( bytesReceived == 0 )
+    {
+        status = MBEDTLS_ERR_NET_CONN_RESET;
+    }
+    else if( ( errno == EAGAIN ) || ( errno == EWOULDBLOCK ) || ( errno == EINTR ) )
+    {
+        status = MBEDTLS_ERR_SSL_WANT_READ;
+    }
+    else
+    {
+        status = MBEDTLS_ERR_NET_RECV_FAILED;
+    }
+
+    return status;
+}
+/*-----------------------------------------------------------*/
+
+static void sslContextFree( SSLContext_t * pSslContext )
+{
+    mbedtls_ssl_free( &( pSslContext->context ) );
+    mbedtls_x509_crt_free( &( pSslContext->rootCa ) );
+    mbedtls_x509_crt_free( &( pSslContext->clientCert ) );
+    mbedtls_pk_free( &( pSslContext->privKey ) );
+    mbedtls_entropy_free( &( pSslContext->entropyContext ) );
+    mbedtls_ctr_drbg_free( &( pSslContext->ctrDrgbContext ) );
+    mbedtls_ssl_config_free( &( pSslContext->config ) );
+}
+/*-----------------------------------------------------------*/
+
+static TlsTransportStatus_t tlsSetup( NetworkContext_t * pNetworkContext,
+                                      const char * pHostName,
+                                      const NetworkCredentials_t * pNetworkCredentials )
+{
+    TlsTransportStatus_t returnStatus = TLS_TRANSPORT_SUCCESS;
+    SSLContext_t * pSslContext = &( pNetworkContext->sslContext );
+    int32_t mbedtlsError = 0;
+
+    /* Initialize the mbed TLS context structures. */
+    mbedtls_ssl_config_init( &( pSslContext->config ) );
+    mbedtls_x509_crt_init( &( pSslContext->rootCa ) );
+    mbedtls_pk_init( &( pSslContext->privKey ) );
+    mbedtls_x509_crt_init( &( pSslContext->clientCert ) );
+    mbedtls_ssl_init( &( pSslContext->context ) );
+    mbedtls_entropy_init( &( pSslContext->entropyContext ) );
+    mbedtls_ctr_drbg_init( &( pSslContext->ctrDrgbContext ) );
+
+    /* Add a strong entropy source and seed the random number generator. */
+    mbedtlsError = mbedtls_entropy_add_source( &( pSslContext->entropyContext ),
+                                               entropyPoll,
+                                               NULL,
+                                               32,
+                                               MBEDTLS_ENTROPY_SOURCE_STRONG );
+
+    if( mbedtlsError == 0 )
+    {
+        mbedtlsError = mbedtls_ctr_drbg_seed( &( pSslContext->ctrDrgbContext ),
+                                              mbedtls_entropy_func,
+                                              &( pSslContext->entropyContext ),
+                                              NULL,
+                                              0 );
+    }
+
+    if( mbedtlsError != 0 )
+    {
+        LogError( ( "Failed to seed PRNG: mbedTLSError= %s : %s.",
+                    mbedtlsHighLevelCodeOrDefault( mbedtlsError ),
+                    mbedtlsLowLevelCodeOrDefault( mbedtlsError ) ) );
+        returnStatus = TLS_TRANSPORT_INTERNAL_ERROR;
+    }
+
+    if( returnStatus == TLS_TRANSPORT_SUCCESS )
+    {
+        mbedtlsError = mbedtls_ssl_config_defaults( &( pSslContext->config ),
+                                                    MBEDTLS_SSL_IS_CLIENT,
+                                                    MBEDTLS_SSL_TRANSPORT_STREAM,
+                                                    MBEDTLS_SSL_PRESET_DEFAULT );
+
+        if( mbedtlsError != 0 )
+        {
+            LogError( ( "Failed to set default SSL configuration: mbedTLSError= %s : %s.",
+                        mbedtlsHighLevelCodeOrDefault( mbedtlsError ),
+                        mbedtlsLowLevelCodeOrDefault( mbedtlsError ) ) );
+
+            /* Per mbed TLS docs, mbedtls_ssl_config_defaults only fails on memory allocation. */
+            returnStatus = TLS_TRANSPORT_INSUFFICIENT_MEMORY;
+        }
+    }
+
+    /* Set the credentials. */
+    if( returnStatus == TLS_TRANSPORT_SUCCESS )
+    {
+        pSslContext->certProfile = mbedtls_x509_crt_profile_default;
+        mbedtls_ssl_conf_authmode( &( pSslContext->config ), MBEDTLS_SSL_VERIFY_REQUIRED );
+        mbedtls_ssl_conf_rng( &( pSslContext->config ), mbedtls_ctr_drbg_random, &( pSslContext->ctrDrgbContext ) );
+        mbedtls_ssl_conf_cert_profile( &( pSslContext->config ), &( pSslContext->certProfile ) );
+
+        mbedtlsError = mbedtls_x509_crt_parse( &( pSslContext->rootCa ),
+                                               pNetworkCredentials->pRootCa,
+                                               pNetworkCredentials->rootCaSize );
+
+        if( mbedtlsError == 0 )
+        {
+            mbedtls_ssl_conf_ca_chain( &( pSslContext->config ), &( pSslContext->rootCa ), NULL );
+        }
+
+        if( ( mbedtlsError == 0 ) &&
+            ( pNetworkCredentials->pClientCert != NULL ) &&
+            ( pNetworkCredentials->pPrivateKey != NULL ) )
+        {
+            mbedtlsError = mbedtls_x509_crt_parse( &( pSslContext->clientCert ),
+                                                   pNetworkCredentials->pClientCert,
+                                                   pNetworkCredentials->clientCertSize );
+
+            if( mbedtlsError == 0 )
+            {
+                mbedtlsError = mbedtls_pk_parse_key( &( pSslContext->privKey ),
+                                                     pNetworkCredentials->pPrivateKey,
+                                                     pNetworkCredentials->privateKeySize,
+                                                     NULL,
+                                                     0 );
+            }
+
+            if( mbedtlsError == 0 )
+            {
+                mbedtlsError = mbedtls_ssl_conf_own_cert( &( pSslContext->config ),
+                                                          &( pSslContext->clientCert ),
+                                                          &( pSslContext->privKey ) );
+            }
+        }
+
+        if( mbedtlsError != 0 )
+        {
+            LogError( ( "Failed to set credentials: mbedTLSError= %s : %s.",
+                        mbedtlsHighLevelCodeOrDefault( mbedtlsError ),
+                        mbedtlsLowLevelCodeOrDefault( mbedtlsError ) ) );
+            returnStatus = TLS_TRANSPORT_INVALID_CREDENTIALS;
+        }
+    }
+
+    /* Optionally set ALPN protocols. */
+    if( ( returnStatus == TLS_TRANSPORT_SUCCESS ) && ( pNetworkCredentials->pAlpnProtos != NULL ) )
+    {
+        mbedtlsError = mbedtls_ssl_conf_alpn_protocols( &( pSslContext->config ),
+                                                        pNetworkCredentials->pAlpnProtos );
+
+        if( mbedtlsError != 0 )
+        {
+            LogError( ( "Failed to configure ALPN protocol in mbed TLS: mbedTLSError= %s : %s.",
+                        mbedtlsHighLevelCodeOrDefault( mbedtlsError ),
+                        mbedtlsLowLevelCodeOrDefault( mbedtlsError ) ) );
+        }
+    }
+
+    if( returnStatus == TLS_TRANSPORT_SUCCESS )
+    {
+        mbedtlsError = mbedtls_ssl_setup( &( pSslContext->context ), &( pSslContext->config ) );
+
+        if( mbedtlsError != 0 )
+        {
+            LogError( ( "Failed to set up mbed TLS SSL context: mbedTLSError= %s : %s.",
+                        mbedtlsHighLevelCodeOrDefault( mbedtlsError ),
+                        mbedtlsLowLevelCodeOrDefault( mbedtlsError ) ) );
+            returnStatus = TLS_TRANSPORT_INTERNAL_ERROR;
+        }
+    }
+
+    /* Optionally set SNI. */
+    if( ( returnStatus == TLS_TRANSPORT_SUCCESS ) && ( pNetworkCredentials->disableSni == pdFALSE ) )
+    {
+        mbedtlsError = mbedtls_ssl_set_hostname( &( pSslContext->context ), pHostName );
+
+        if( mbedtlsError != 0 )
+        {
+            LogError( ( "Failed to set server name: mbedTLSError= %s : %s.",
+                        mbedtlsHighLevelCodeOrDefault( mbedtlsError ),
+                        mbedtlsLowLevelCodeOrDefault( mbedtlsError ) ) );
+        }
+    }
+
+    if( returnStatus == TLS_TRANSPORT_SUCCESS )
+    {
+        mbedtls_ssl_set_bio( &( pSslContext->context ),
+                             pNetworkContext,
+                             socketSend,
+                             socketRecv,
+                             NULL );
+    }
+
+    return returnStatus;
+}
+/*-----------------------------------------------------------*/
+
+static TlsTransportStatus_t tlsHandshake( NetworkContext_t * pNetworkContext )
+{
+    TlsTransportStatus_t returnStatus = TLS_TRANSPORT_SUCCESS;
+    int32_t mbedtlsError = 0;
+    BaseType_t ready = pdTRUE;
+
+    do
+    {
+        mbedtlsError = mbedtls_ssl_handshake( &( pNetworkContext->sslContext.context ) );
+
+        /* Wait for the server's next flight rather than spinning. */
+        if( mbedtlsError == MBEDTLS_ERR_SSL_WANT_READ )
+        {
+            ready = Sockets_Posix_Wait( pNetworkContext->tcpSocket, POLLIN, pNetworkContext->receiveTimeoutMs );
+        }
+    } while( ( ready == pdTRUE ) &&
+             ( ( mbedtlsError == MBEDTLS_ERR_SSL_WANT_READ ) ||
+               ( mbedtlsError == MBEDTLS_ERR_SSL_WANT_WRITE ) ) );
+
+    if( mbedtlsError != 0 )
+    {
+        LogError( ( "Failed to perform TLS handshake: mbedTLSError= %s : %s.",
+                    mbedtlsHighLevelCodeOrDefault( mbedtlsError ),
+                    mbedtlsLowLevelCodeOrDefault( mbedtlsError ) ) );
+        returnStatus = TLS_TRANSPORT_HANDSHAKE_FAILED;
+    }
+    else
+    {
+        LogInfo( ( "(Network connection %p) TLS handshake successful.",
+                   pNetworkContext ) );
+    }
+
+    return returnStatus;
+}
+/*-----------------------------------------------------------*/
+
+TlsTransportStatus_t TLS_Posix_Connect( NetworkContext_t * pNetworkContext,
+                                        const char * pHostName,
+                                        uint16_t port,
+                                        const NetworkCredentials_t * pNetworkCredentials,
+                                        uint32_t receiveTimeoutMs,
+                                        uint32_t sendTimeoutMs )
+{
+    TlsTransportStatus_t returnStatus = TLS_TRANSPORT_SUCCESS;
+    BaseType_t socketStatus = 0;
+
+    if( ( pNetworkContext == NULL ) ||
+        ( pHostName == NULL ) ||
+        ( pNetworkCredentials == NULL ) )
+    {
+        LogError( ( "Invalid input parameter(s): Arguments cannot be NULL. pNetworkContext=%p, "
+                    "pHostName=%p, pNetworkCredentials=%p.",
+                    pNetworkContext,
+                    pHostName,
+                    pNetworkCredentials ) );
+        returnStatus = TLS_TRANSPORT_INVALID_PARAMETER;
+    }
+    else if( ( pNetworkCredentials->pRootCa == NULL ) )
+    {
+        LogError( ( "pRootCa cannot be NULL." ) );
+        returnStatus = TLS_TRANSPORT_INVALID_PARAMETER;
+    }
+    else
+    {
+        pNetworkContext->tcpSocket = -1;
+        pNetworkContext->receiveTimeoutMs = receiveTimeoutMs;
+        pNetworkContext->sendTimeoutMs = sendTimeoutMs;
+    }
+
+    /* Establish a TCP connection with the server. */
+    if( returnStatus == TLS_TRANSPORT_SUCCESS )
+    {
+        socketStatus = Sockets_Posix_Connect( &( pNetworkContext->tcpSocket ),
+                                              pHostName,
+                                              port,
+                                              sendTimeoutMs );
+
+        if( socketStatus != 0 )
+        {
+            LogError( ( "Failed to connect to %s with error %d.",
+                        pHostName,
+                        ( int ) socketStatus ) );
+            returnStatus = TLS_TRANSPORT_CONNECT_FAILURE;
+        }
+    }
+
+    /* Initialize TLS contexts and set credentials. */
+    if( returnStatus == TLS_TRANSPORT_SUCCESS )
+    {
+        returnStatus = tlsSetup( pNetworkContext, pHostName, pNetworkCredentials );
+
+        /* Perform TLS handshake. */
+        if( returnStatus == TLS_TRANSPORT_SUCCESS )
+        {
+            returnStatus = tlsHandshake( pNetworkContext );
+        }
+
+        /* Clean up on failure. */
+        if( returnStatus != TLS_TRANSPORT_SUCCESS )
+        {
+            sslContextFree( &( pNetworkContext->sslContext ) );
+            Sockets_Posix_Disconnect( pNetworkContext->tcpSocket );
+            pNetworkContext->tcpSocket = -1;
+        }
+    }
+
+    if( returnStatus == TLS_TRANSPORT_SUCCESS )
+    {
+        LogInfo( ( "(Network connection %p) Connection to %s established.",
+                   pNetworkContext,
+                   pHostName ) );
+    }
+
+    return returnStatus;
+}
+/*-----------------------------------------------------------*/
+
+void TLS_Posix_Disconnect( NetworkContext_t * pNetworkContext )
+{
+    BaseType_t tlsStatus = 0;
+
+    if( ( pNetworkContext != NULL ) && ( pNetworkContext->tcpSocket >= 0 ) )
+    {
+        /* Attempting to terminate TLS connection. */
+        tlsStatus = ( BaseType_t ) mbedtls_ssl_close_notify( &( pNetworkContext->sslContext.context ) );
+
+        /* Ignore the WANT_READ and WANT_WRITE return values. */
+        if( ( tlsStatus != ( BaseType_t ) MBEDTLS_ERR_SSL_WANT_READ ) &&
+            ( tlsStatus != ( BaseType_t ) MBEDTLS_ERR_SSL_WANT_WRITE ) &&
+            ( tlsStatus != 0 ) )
+        {
+            LogError( ( "(Network connection %p) Failed to send TLS close-notify: mbedTLSError= %s : %s.",
+                        pNetworkContext,
+                        mbedtlsHighLevelCodeOrDefault( tlsStatus ),
+                        mbedtlsLowLevelCodeOrDefault( tlsStatus ) ) );
+        }
+
+        /* Call socket shutdown function to close connection. */
+        Sockets_Posix_Disconnect( pNetworkContext->tcpSocket );
+        pNetworkContext->tcpSocket = -1;
+
+        /* Free mbed TLS contexts. */
+        sslContextFree( &( pNetworkContext->sslContext ) );
+    }
+}
+/*-----------------------------------------------------------*/
+
+int32_t TLS_Posix_recv( NetworkContext_t * pNetworkContext,
+                        void * pBuffer,
+                        size_t bytesToRecv )
+{
+    int32_t tlsStatus = 0;
+
+    tlsStatus = ( int32_t ) mbedtls_ssl_read( &( pNetworkContext->sslContext.context ),
+                                              pBuffer,
+                                              bytesToRecv );
+
+    /* As with the plaintext transport, only a read for the rest of a packet
+     * waits for the record carrying it. */
+    if( ( tlsStatus == MBEDTLS_ERR_SSL_WANT_READ ) &&
+        ( bytesToRecv > 1U ) &&
+        ( Sockets_Posix_Wait( pNetworkContext->tcpSocket, POLLIN, pNetworkContext->receiveTimeoutMs ) == pdTRUE ) )
+    {
+        tlsStatus = ( int32_t ) mbedtls_ssl_read( &( pNetworkContext->sslContext.context ),
+                                                  pBuffer,
+                                                  bytesToRecv );
+    }
+
+    if( ( tlsStatus == MBEDTLS_ERR_SSL_TIMEOUT ) ||
+        ( tlsStatus == MBEDTLS_ERR_SSL_WANT_READ ) ||
+        ( tlsStatus == MBEDTLS_ERR_SSL_WANT_WRITE ) )
+    {
+        /* Mark these set of errors as a timeout. The libraries may retry read
+         * on these errors. */
+        tlsStatus = 0;
+    }
+    else if( tlsStatus < 0 )
+    {
+        LogError( ( "Failed to read data: mbedTLSError= %s : %s.",
+                    mbedtlsHighLevelCodeOrDefault( tlsStatus ),
+                    mbedtlsLowLevelCodeOrDefault( tlsStatus ) ) );
+    }
+    else
+    {
+        /* Empty else marker. */
+    }
+
+    return tlsStatus;
+}
+/*-----------------------------------------------------------*/
+
+int32_t TLS_Posix_send( NetworkContext_t * pNetworkContext,
+                        const void * pBuffer,
+                        size_t bytesToSend )
+{
+    int32_t tlsStatus = 0;
+
+    tlsStatus = ( int32_t ) mbedtls_ssl_write( &( pNetworkContext->sslContext.context ),
+                                               pBuffer,
+                                               bytesToSend );
+
+    if( ( tlsStatus == MBEDTLS_ERR_SSL_TIMEOUT ) ||
+        ( tlsStatus == MBEDTLS_ERR_SSL_WANT_READ ) ||
+        ( tlsStatus == MBEDTLS_ERR_SSL_WANT_WRITE ) )
+    {
+        /* Mark these set of errors as a timeout. The libraries may retry send
+         * on these errors. */
+        tlsStatus = 0;
+    }
+    else if( tlsStatus < 0 )
+    {
+        LogError( ( "Failed to send data: mbedTLSError= %s : %s.",
+                    mbedtlsHighLevelCodeOrDefault( tlsStatus ),
+                    mbedtlsLowLevelCodeOrDefault( tlsStatus ) ) );
+    }
+    else
+    {
+        /* Empty else marker. */
+    }
+
+    return tlsStatus;
+}
+/*-----------------------------------------------------------*/
@@ -0,0 +1,282 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/* Standard includes. */
+#include <string.h>
+
+/* POSIX includes. */
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+/* FreeRTOS includes. */
+#include "FreeRTOS.h"
+
+/* Transport interface include. */
+#include "using_plaintext_posix.h"
+
+/**
+ * @brief Write the collected bytes followed by another buffer with one
+ * gathering send.
+ *
+ * @param[in] pNetworkContext The network context.
+ * @param[in] pBuffer The buffer to send after the collected bytes, or NULL.
+ * @param[in] bytesToSend Size of pBuffer.
+ *
+ * @return Number of bytes of pBuffer sent, or a negative value on error.
+ * The collected bytes that were sent are removed from the cork buffer.
+ */
+static int32_t sendWithCorked( NetworkContext_t * pNetworkContext,
+                               const void * pBuffer,
+                               size_t bytesToSend );
+
+/*-----------------------------------------------------------*/
+
+static int32_t sendWithCorked( NetworkContext_t * pNetworkContext,
+                               const void * pBuffer,
+                               size_t bytesToSend )
+{
+    struct iovec ioVec[ 2 ];
+    int32_t socketStatus;
+    size_t corkedSent;
+
+    ioVec[ 0 ].iov_base = pNetworkContext->pCorkBuffer;
+    ioVec[ 0 ].iov_len = pNetworkContext->corkedBytes;
+    ioVec[ 1 ].iov_base = ( void * ) pBuffer;
+    ioVec[ 1 ].iov_len = ( pBuffer != NULL ) ? bytesToSend : 0U;
+
+    socketStatus = Sockets_Posix_Send( pNetworkContext->tcpSocket,
+                                       ioVec,
+                                       2U,
+                                       pNetworkContext->sendTimeoutMs );
+
+    if( socketStatus >= 0 )
+    {
+        pNetworkContext->sendCalls++;
+        pNetworkContext->bytesWritten += ( uint32_t ) socketStatus;
+
+        /* Keep the collected bytes a send that timed out left behind. */
+        corkedSent = ( ( size_t ) socketStatus < pNetworkContext->corkedBytes ) ?
+                     ( size_t ) socketStatus : pNetworkContext->corkedBytes;
+        pNetworkContext->corkedBytes -= corkedSent;
+
+        if( ( pNetworkContext->corkedBytes > 0U ) && ( corkedSent > 0U ) )
+        {
+            ( void ) memmove( pNetworkContext->pCorkBuffer,
+                              &( pNetworkContext->pCorkBuffer[ corkedSent ] ),
+                              pNetworkContext->corkedBytes );
+        }
+
+        socketStatus -= ( int32_t ) corkedSent;
+    }
+    else
+    {
+        pNetworkContext->corkedBytes = 0U;
+    }
+
+    return socketStatus;
+}
+/*-----------------------------------------------------------*/
+
+PlaintextTransportStatus_t Plaintext_Posix_Connect( NetworkContext_t * pNetworkContext,
+                                                    const char * pHostName,
+                                                    uint16_t port,
+                                                    uint8_t * pCorkBuffer,
+                                                    size_t corkBufferSize,
+                                                    uint32_t receiveTimeoutMs,
+                                                    uint32_t sendTimeoutMs )
+{
+    PlaintextTransportStatus_t plaintextStatus = PLAINTEXT_TRANSPORT_SUCCESS;
+    BaseType_t socketStatus = 0;
+
+    if( ( pNetworkContext == NULL ) || ( pHostName == NULL ) )
+    {
+        LogError( ( "Invalid input parameter(s): Arguments cannot be NULL. pNetworkContext=%p, "
+                    "pHostName=%p.",
+                    pNetworkContext,
+                    pHostName ) );
+        plaintextStatus = PLAINTEXT_TRANSPORT_INVALID_PARAMETER;
+    }
+    else
+    {
+        /* Establish a TCP connection with the server. */
+        socketStatus = Sockets_Posix_Connect( &( pNetworkContext->tcpSocket ),
+                                              pHostName,
+                                              port,
+                                              sendTimeoutMs );
+
+        /* A non zero status is an error. */
+        if( socketStatus != 0 )
+        {
+            LogError( ( "Failed to connect to %s with error %d.",
+                        pHostName,
+                        ( int ) socketStatus ) );
+            plaintextStatus = PLAINTEXT_TRANSPORT_CONNECT_FAILURE;
+        }
+        else
+        {
+            pNetworkContext->receiveTimeoutMs = receiveTimeoutMs;
+            pNetworkContext->sendTimeoutMs = sendTimeoutMs;
+            pNetworkContext->pCorkBuffer = pCorkBuffer;
+            pNetworkContext->corkBufferSize = ( pCorkBuffer != NULL ) ? corkBufferSize : 0U;
+            pNetworkContext->corkedBytes = 0U;
+            pNetworkContext->sendCalls = 0U;
+            pNetworkContext->bytesWritten = 0U;
+        }
+    }
+
+    return plaintextStatus;
+}
+/*-----------------------------------------------------------*/
+
+PlaintextTransportStatus_t Plaintext_Posix_Disconnect( NetworkContext_t * pNetworkContext )
+{
+    PlaintextTransportStatus_t plaintextStatus = PLAINTEXT_TRANSPORT_SUCCESS;
+
+    if( pNetworkContext == NULL )
+    {
+        LogError( ( "pNetworkContext cannot be NULL." ) );
+        plaintextStatus = PLAINTEXT_TRANSPORT_INVALID_PARAMETER;
+    }
+    else if( pNetworkContext->tcpSocket < 0 )
+    {
+        LogError( ( "pNetworkContext->tcpSocket cannot be an invalid socket." ) );
+        plaintextStatus = PLAINTEXT_TRANSPORT_INVALID_PARAMETER;
+    }
+    else
+    {
+        /* Send what was collected, which is lost if it cannot be sent. */
+        ( void ) Plaintext_Posix_Flush( pNetworkContext );
+        pNetworkContext->corkedBytes = 0U;
+
+        LogInfo( ( "(Network connection %p) %u bytes sent in %u system calls.",
+                   pNetworkContext,
+                   ( unsigned int ) pNetworkContext->bytesWritten,
+                   ( unsigned int ) pNetworkContext->sendCalls ) );
+
+        /* Call socket disconnect function to close connection. */
+        Sockets_Posix_Disconnect( pNetworkContext->tcpSocket );
+        pNetworkContext->tcpSocket = -1;
+    }
+
+    return plaintextStatus;
+}
+/*-----------------------------------------------------------*/
+
+int32_t Plaintext_Posix_recv( NetworkContext_t * pNetworkContext,
+                              void * pBuffer,
+                              size_t bytesToRecv )
+{
+    int32_t socketStatus = 0;
+    ssize_t bytesReceived;
+
+    /* A packet written before this read may be waiting for its reply. */
+    if( pNetworkContext->corkedBytes > 0U )
+    {
+        socketStatus = Plaintext_Posix_Flush( pNetworkContext );
+    }
+
+    if( socketStatus >= 0 )
+    {
+        bytesReceived = recv( pNetworkContext->tcpSocket, pBuffer, bytesToRecv, MSG_DONTWAIT );
+
+        /* As with the FreeRTOS+TCP transport, a read of one byte may be a
+         * speculative read to find the start of a new packet, so only a read
+         * for the rest of a packet waits for data. */
+        if( ( bytesReceived < 0 ) &&
+            ( ( errno == EAGAIN ) || ( errno == EWOULDBLOCK ) ) &&
+            ( bytesToRecv > 1U ) &&
+            ( Sockets_Posix_Wait( pNetworkContext->tcpSocket, POLLIN, pNetworkContext->receiveTimeoutMs ) == pdTRUE ) )
+        {
+            bytesReceived = recv( pNetworkContext->tcpSocket, pBuffer, bytesToRecv, MSG_DONTWAIT );
+        }
+
+        if( bytesReceived > 0 )
+        {
+            socketStatus = ( int32_t ) bytesReceived;
+        }
+        else if( bytesReceived == 0 )
+        {
+            LogError( ( "The server closed the connection." ) );
+            socketStatus = -1;
+        }
+        else if( ( errno == EAGAIN ) || ( errno == EWOULDBLOCK ) || ( errno == EINTR ) )
+        {
+            socketStatus = 0;
+        }
+        else
+        {
+            LogError( ( "Failed to receive: errno=%d.", errno ) );
+            socketStatus = -1;
+        }
+    }
+
+    return socketStatus;
+}
+/*-----------------------------------------------------------*/
+
+int32_t Plaintext_Posix_send( NetworkContext_t * pNetworkContext,
+                              const void * pBuffer,
+                              size_t bytesToSend )
+{
+    int32_t socketStatus = 0;
+
+    if( bytesToSend <= ( pNetworkContext->corkBufferSize - pNetworkContext->corkedBytes ) )
+    {
+        ( void ) memcpy( &( pNetworkContext->pCorkBuffer[ pNetworkContext->corkedBytes ] ),
+                         pBuffer,
+                         bytesToSend );
+        pNetworkContext->corkedBytes += bytesToSend;
+        socketStatus = ( int32_t ) bytesToSend;
+    }
+    else
+    {
+        /* Send what was collected and the new data together, without copying
+         * the new data.  This is also how data is sent with no cork buffer. */
+        socketStatus = sendWithCorked( pNetworkContext, pBuffer, bytesToSend );
+
+        if( socketStatus < 0 )
+        {
+            LogError( ( "Failed to send %u bytes.", ( unsigned int ) bytesToSend ) );
+        }
+    }
+
+    return socketStatus;
+}
+/*-----------------------------------------------------------*/
+
+int32_t Plaintext_Posix_Flush( NetworkContext_t * pNetworkContext )
+{
+    int32_t socketStatus = 0;
+
+    if( pNetworkContext->corkedBytes > 0U )
+    {
+        socketStatus = sendWithCorked( pNetworkContext, NULL, 0U );
+    }
+
+    if( socketStatus >= 0 )
+    {
+        socketStatus = ( int32_t ) pNetworkContext->corkedBytes;
+    }
+
+    return socketStatus;
+}
+/*-----------------------------------------------------------*/
@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef USING_PLAINTEXT_POSIX_H
+#define USING_PLAINTEXT_POSIX_H
+
+/**************************************************/
+/******* DO NOT CHANGE the following order ********/
+/**************************************************/
+
+/* Logging related header files are required to be included in the following order:
+ * 1. Include the header file "logging_levels.h".
+ * 2. Define LIBRARY_LOG_NAME and  LIBRARY_LOG_LEVEL.
+ * 3. Include the header file "logging_stack.h".
+ */
+
+/* Include header that defines log levels. */
+#include "logging_levels.h"
+
+/* Logging configuration for the Sockets. */
+#ifndef LIBRARY_LOG_NAME
+    #define LIBRARY_LOG_NAME     "PlaintextTransport"
+#endif
+#ifndef LIBRARY_LOG_LEVEL
+    #define LIBRARY_LOG_LEVEL    LOG_ERROR
+#endif
+
+/* Prototype for the function used to print to console. */
+extern void vLoggingPrintf( const char * pcFormatString,
+                            ... );
+
+/* Map the SdkLog macro to the logging function. */
+#ifndef SdkLog
+    #define SdkLog( message )    vLoggingPrintf message
+#endif
+
+#include "logging_stack.h"
+
+/************ End of logging configuration ****************/
+
+/* POSIX sockets include. */
+#include "sockets_posix.h"
+
+/* Transport interface include. */
+#include "transport_interface.h"
+
+/**
+ * @brief Network context definition for native POSIX sockets.
+ */
+struct NetworkContext
+{
+    int tcpSocket;
+    uint32_t receiveTimeoutMs; /**< @brief Time to wait for the rest of a partly received packet. */
+    uint32_t sendTimeoutMs;    /**< @brief Time to wait for space to send into. */
+    uint8_t * pCorkBuffer;     /**< @brief Collects sent bytes until they are flushed, or NULL to send immediately. */
+    size_t corkBufferSize;     /**< @brief Size of #NetworkContext.pCorkBuffer. */
+    size_t corkedBytes;        /**< @brief Bytes in #NetworkContext.pCorkBuffer not yet written. */
+    uint32_t sendCalls;        /**< @brief System calls made to send data. */
+    uint32_t bytesWritten;     /**< @brief Bytes passed to those system calls. */
+};
+
+/**
+ * @brief Plain text transport Connect / Disconnect return status.
+ */
+typedef enum PlaintextTransportStatus
+{
+    PLAINTEXT_TRANSPORT_SUCCESS = 1,           /**< Function successfully completed. */
+    PLAINTEXT_TRANSPORT_INVALID_PARAMETER = 2, /**< At least one parameter was invalid. */
+    PLAINTEXT_TRANSPORT_CONNECT_FAILURE = 3    /**< Initial connection to the server failed. */
+} PlaintextTransportStatus_t;
+
+/**
+ * @brief Create a TCP connection with native POSIX sockets.
+ *
+ * @param[out] pNetworkContext Pointer to a network context to contain the
+ * initialized socket handle.
+ * @param[in] pHostName The hostname of the remote endpoint.
+ * @param[in] port The destination port.
+ * @param[in] pCorkBuffer Buffer the pieces of each MQTT packet are collected
+ * in until Plaintext_Posix_Flush(), or NULL to send each piece immediately.
+ * @param[in] corkBufferSize Size of pCorkBuffer.
+ * @param[in] receiveTimeoutMs Receive socket timeout.
+ * @param[in] sendTimeoutMs Send socket timeout.
+ *
+ * @return #PLAINTEXT_TRANSPORT_SUCCESS, #PLAINTEXT_TRANSPORT_INVALID_PARAMETER,
+ * or #PLAINTEXT_TRANSPORT_CONNECT_FAILURE.
+ */
+PlaintextTransportStatus_t Plaintext_Posix_Connect( NetworkContext_t * pNetworkContext,
+                                                    const char * pHostName,
+                                                    uint16_t port,
+                                                    uint8_t * pCorkBuffer,
+                                                    size_t corkBufferSize,
+                                                    uint32_t receiveTimeoutMs,
+                                                    uint32_t sendTimeoutMs );
+
+/**
+ * @brief Gracefully disconnect an established TCP connection.
+ *
+ * @param[in] pNetworkContext Network context containing the TCP socket handle.
+ *
+ * @return #PLAINTEXT_TRANSPORT_SUCCESS, or #PLAINTEXT_TRANSPORT_INVALID_PARAMETER.
+ */
+PlaintextTransportStatus_t Plaintext_Posix_Disconnect( NetworkContext_t * pNetworkContext );
+
+/**
+ * @brief Receives data from an established TCP connection.
+ *
+ * A request for one byte, made to find the start of the next packet, does not
+ * block.  Longer requests wait up to the receive timeout for the rest of a
+ * packet that is part way through arriving.
+ *
+ * @param[in] pNetworkContext The network context containing the TCP socket
+ * handle.
+ * @param[out] pBuffer Buffer to receive bytes into.
+ * @param[in] bytesToRecv Number of bytes to receive from the network.
+ *
+ * @return Number of bytes received if successful; negative value on error.
+ */
+int32_t Plaintext_Posix_recv( NetworkContext_t * pNetworkContext,
+                              void * pBuffer,
+                              size_t bytesToRecv );
+
+/**
+ * @brief Sends data over an established TCP connection.
+ *
+ * If a cork buffer was given the data is collected in it until
+ * Plaintext_Posix_Flush() is called or it fills.  Data that does not fit is
+ * written, together with the buffer's contents, by one gathering system call
+ * rather than being copied.
+ *
+ * @param[in] pNetworkContext The network context containing the TCP socket
+ * handle.
+ * @param[in] pBuffer Buffer containing the bytes to send.
+ * @param[in] bytesToSend Number of bytes to send from the buffer.
+ *
+ * @return Number of bytes sent on success; else a negative value.
+ */
+int32_t Plaintext_Posix_send( NetworkContext_t * pNetworkContext,
+                              const void * pBuffer,
+                              size_t bytesToSend );
+
+/**
+ * @brief Sends the data collected in the cork buffer.
+ *
+ * @param[in] pNetworkContext The network context.
+ *
+ * @return Number of bytes still waiting to be sent, which is 0 once they have
+ * all been sent; else a negative value.
+ */
+int32_t Plaintext_Posix_Flush( NetworkContext_t * pNetworkContext );
+
+#endif /* ifndef USING_PLAINTEXT_POSIX_H */
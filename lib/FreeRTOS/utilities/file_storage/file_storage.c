@@ -0,0 +1,241 @@
+/*
+ * FreeRTOS V202011.00
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://aws.amazon.com/freertos
+ *
+ */
+
+/**
+ * @file file_storage.c
+ * @brief Implements the file storage abstraction using the C standard library.
+ */
+
+/* Standard includes. */
+#include <stdio.h>
+
+/* File storage include. */
+#include "file_storage.h"
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Position a file ready for the next read or write.
+ *
+ * @note The C standard requires a seek between reads and writes on a file
+ * opened for update, so every access seeks first.
+ *
+ * @param[in] pxFile File to position.
+ * @param[in] xOffset Offset from the start of the file.
+ *
+ * @return pdTRUE if the file was positioned, otherwise pdFALSE.
+ */
+static BaseType_t prvSeek( FILE * pxFile,
+                           size_t xOffset );
+
+/*-----------------------------------------------------------*/
+
+static BaseType_t prvSeek( FILE * pxFile,
+                           size_t xOffset )
+{
+    return ( fseek( pxFile, ( long ) xOffset, SEEK_SET ) == 0 ) ? pdTRUE : pdFALSE;
+}
+
+/*-----------------------------------------------------------*/
+
+FileStorageHandle_t FileStorage_Open( const char * pcPath )
+{
+    FILE * pxFile = NULL;
+
+    if( pcPath != NULL )
+    {
+        /* "r+b" does not create the file, "w+b" would truncate it. */
+        pxFile = fopen( pcPath, "r+b" );
+
+        if( pxFile == NULL )
+        {
+            pxFile = fopen( pcPath, "w+b" );
+        }
+    }
+
+    return ( FileStorageHandle_t ) pxFile;
+}
+
+/*-----------------------------------------------------------*/
+
+void FileStorage_Close( FileStorageHandle_t xFile )
+{
+    if( xFile != NULL )
+    {
+        ( void ) fclose( ( FILE * ) xFile );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+size_t FileStorage_Size( FileStorageHandle_t xFile )
+{
+    long lSize = 0;
+
+    if( ( xFile != NULL ) && ( fseek( ( FILE * ) xFile, 0, SEEK_END ) == 0 ) )
+    {
+        lSize = ftell( ( FILE * ) xFile );
+    }
+
+    return ( lSize > 0 ) ? ( size_t ) lSize : 0U;
+}
+
+/*-----------------------------------------------------------*/
+
+BaseType_t FileStorage_Read( FileStorageHandle_t xFile,
+                             size_t xOffset,
+                             void * pvBuffer,
+                             size_t xLength )
+{
+    BaseType_t xReturn = pdFALSE;
+
+    if( ( xFile != NULL ) && ( pvBuffer != NULL ) && prvSeek( ( FILE * ) xFile, xOffset ) )
+    {
+        xReturn = ( fread( pvBuffer, 1, xLength, ( FILE * ) xFile ) == xLength ) ? pdTRUE : pdFALSE;
+    }
+
+    return xReturn;
+}
+
+/*-----------------------------------------------------------*/
+
+BaseType_t FileStorage_Write( FileStorageHandle_t xFile,
+                              size_t xOffset,
+                              const void * pvData,
+                              size_t xLength )
+{
+    BaseType_t xReturn = pdFALSE;
+
+    if( ( xFile != NULL ) && ( pvData != NULL ) && prvSeek( ( FILE * ) xFile, xOffset ) )
+    {
+        xReturn = ( fwrite( pvData, 1, xLength, ( FILE * ) xFile ) == xLength ) ? pdTRUE : pdFALSE;
+    }
+
+    return xReturn;
+}
+
+/*-----------------------------------------------------------*/
+
+BaseType_t FileStorage_Append( FileStorageHandle_t xFile,
+                               const void * pvData,
+                               size_t xLength,
+                               size_t * pxOffset )
+{
+    BaseType_t xReturn = pdFALSE;
+    size_t xOffset;
+
+    if( ( xFile != NULL ) && ( pvData != NULL ) )
+    {
+        /* FileStorage_Size() leaves the file positioned at its end. */
+        xOffset = FileStorage_Size( xFile );
+        xReturn = ( fwrite( pvData, 1, xLength, ( FILE * ) xFile ) == xLength ) ? pdTRUE : pdFALSE;
+
+        if( pxOffset != NULL )
+        {
+            *pxOffset = xOffset;
+        }
+    }
+
+    return xReturn;
+}
+
+/*-----------------------------------------------------------*/
+
+BaseType_t FileStorage_Sync( FileStorageHandle_t xFile )
+{
+    BaseType_t xReturn = pdFALSE;
+
+    /* fflush() hands the data to the operating system.  A port to a flash file
+     * system should also commit the data to the medium here. */
+    if( xFile != NULL )
+    {
+        xReturn = ( fflush( ( FILE * ) xFile ) == 0 ) ? pdTRUE : pdFALSE;
+    }
+
+    return xReturn;
+}
+
+/*-----------------------------------------------------------*/
+
+BaseType_t FileStorage_Remove( const char * pcPath )
+{
+    FILE * pxFile;
+    BaseType_t xReturn = pdTRUE;
+
+    if( remove( pcPath ) != 0 )
+    {
+        /* Only a failure if the file still exists. */
+        pxFile = fopen( pcPath, "rb" );
+
+        if( pxFile != NULL )
+        {
+            ( void ) fclose( pxFile );
+            xReturn = pdFALSE;
+        }
+    }
+
+    return xReturn;
+}
+
+/*-----------------------------------------------------------*/
+
+BaseType_t FileStorage_Replace( const char * pcFromPath,
+                                const char * pcToPath )
+{
+    /* rename() does not replace an existing file on Windows. */
+    ( void ) FileStorage_Remove( pcToPath );
+
+    return ( rename( pcFromPath, pcToPath ) == 0 ) ? pdTRUE : pdFALSE;
+}
+
+/*-----------------------------------------------------------*/
+
+uint32_t FileStorage_Crc32( uint32_t ulCrc,
+                            const void * pvData,
+                            size_t xLength )
+{
+    const uint8_t * pucData = ( const uint8_t * ) pvData;
+    size_t x;
+    uint32_t ulBit;
+
+    /* Bitwise rather than table driven to save the 1K table, as the records
+     * being checksummed are small. */
+    ulCrc = ~ulCrc;
+
+    for( x = 0; x < xLength; x++ )
+    {
+        ulCrc ^= pucData[ x ];
+
+        for( ulBit = 0; ulBit < 8U; ulBit++ )
+        {
+            ulCrc = ( ulCrc >> 1 ) ^ ( 0xEDB88320UL & ( 0UL - ( ulCrc & 1UL ) ) );
+        }
+    }
+
+    return ~ulCrc;
+}
+
+/*-----------------------------------------------------------*/
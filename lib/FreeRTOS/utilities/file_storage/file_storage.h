@@ -0,0 +1,167 @@
+/*
+ * FreeRTOS V202011.00
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://aws.amazon.com/freertos
+ *
+ */
+
+/**
+ * @file file_storage.h
+ * @brief A minimal file storage abstraction used to persist data that must
+ * survive a reset, along with a checksum used to detect torn or corrupted
+ * records.
+ *
+ * The implementation in file_storage.c uses the C standard library so it runs
+ * in both the Windows simulator and a Linux host build.  Ports to a target with
+ * a flash file system only need to reimplement these functions.
+ */
+#ifndef FILE_STORAGE_H
+#define FILE_STORAGE_H
+
+/* Standard includes. */
+#include <stddef.h>
+#include <stdint.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+
+/**
+ * @brief Handle of an open file.
+ */
+typedef void * FileStorageHandle_t;
+
+/**
+ * @brief Open a file for reading and writing, creating it if it does not exist.
+ *
+ * @param[in] pcPath Path of the file.
+ *
+ * @return Handle of the open file, or NULL if the file could not be opened.
+ */
+FileStorageHandle_t FileStorage_Open( const char * pcPath );
+
+/**
+ * @brief Close a file opened with FileStorage_Open().
+ *
+ * @param[in] xFile Handle of the file to close.
+ */
+void FileStorage_Close( FileStorageHandle_t xFile );
+
+/**
+ * @brief Obtain the size of a file.
+ *
+ * @param[in] xFile Handle of the file.
+ *
+ * @return The size of the file in bytes.
+ */
+size_t FileStorage_Size( FileStorageHandle_t xFile );
+
+/**
+ * @brief Read bytes from a file.
+ *
+ * @param[in] xFile Handle of the file.
+ * @param[in] xOffset Offset from the start of the file to read from.
+ * @param[out] pvBuffer Buffer into which the bytes are read.
+ * @param[in] xLength Number of bytes to read.
+ *
+ * @return pdTRUE if all xLength bytes were read, otherwise pdFALSE.
+ */
+BaseType_t FileStorage_Read( FileStorageHandle_t xFile,
+                             size_t xOffset,
+                             void * pvBuffer,
+                             size_t xLength );
+
+/**
+ * @brief Write bytes to a file, overwriting or extending its contents.
+ *
+ * @param[in] xFile Handle of the file.
+ * @param[in] xOffset Offset from the start of the file to write to.
+ * @param[in] pvData Bytes to write.
+ * @param[in] xLength Number of bytes to write.
+ *
+ * @return pdTRUE if all xLength bytes were written, otherwise pdFALSE.
+ */
+BaseType_t FileStorage_Write( FileStorageHandle_t xFile,
+                              size_t xOffset,
+                              const void * pvData,
+                              size_t xLength );
+
+/**
+ * @brief Append bytes to the end of a file.
+ *
+ * @param[in] xFile Handle of the file.
+ * @param[in] pvData Bytes to append.
+ * @param[in] xLength Number of bytes to append.
+ * @param[out] pxOffset Optional.  If not NULL, set to the offset at which the
+ * bytes were written.
+ *
+ * @return pdTRUE if all xLength bytes were written, otherwise pdFALSE.
+ */
+BaseType_t FileStorage_Append( FileStorageHandle_t xFile,
+                               const void * pvData,
+                               size_t xLength,
+                               size_t * pxOffset );
+
+/**
+ * @brief Flush buffered writes to the storage medium.
+ *
+ * @param[in] xFile Handle of the file.
+ *
+ * @return pdTRUE if the writes were flushed, otherwise pdFALSE.
+ */
+BaseType_t FileStorage_Sync( FileStorageHandle_t xFile );
+
+/**
+ * @brief Delete a file.  The file must not be open.
+ *
+ * @param[in] pcPath Path of the file.
+ *
+ * @return pdTRUE if the file was deleted or did not exist, otherwise pdFALSE.
+ */
+BaseType_t FileStorage_Remove( const char * pcPath );
+
+/**
+ * @brief Replace one file with another.  Neither file may be open.
+ *
+ * @param[in] pcFromPath Path of the file to rename.
+ * @param[in] pcToPath Path the file is renamed to, replacing any existing file.
+ *
+ * @return pdTRUE if the file was renamed, otherwise pdFALSE.
+ */
+BaseType_t FileStorage_Replace( const char * pcFromPath,
+                                const char * pcToPath );
+
+/**
+ * @brief Calculate, or continue calculating, the CRC-32 (IEEE 802.3) of some
+ * bytes.
+ *
+ * @param[in] ulCrc Zero to start a new calculation, or the value returned by a
+ * previous call to continue one.
+ * @param[in] pvData Bytes to include in the CRC.
+ * @param[in] xLength Number of bytes.
+ *
+ * @return The updated CRC.
+ */
+uint32_t FileStorage_Crc32( uint32_t ulCrc,
+                            const void * pvData,
+                            size_t xLength );
+
+#endif /* FILE_STORAGE_H */
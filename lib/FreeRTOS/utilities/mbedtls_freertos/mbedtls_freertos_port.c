@@ -25,20 +25,259 @@
  * @brief Implements mbed TLS platform functions for FreeRTOS.
  */
 
+/* Standard includes. */
+#include <string.h>
+
 /* FreeRTOS includes. */
 #include "FreeRTOS.h"
+#include "task.h"
 #include "FreeRTOS_Sockets.h"
 
 /* mbed TLS includes. */
 #include "mbedtls_config.h"
 #include "threading_alt.h"
+#include "mbedtls_freertos_port.h"
 #include "mbedtls/entropy.h"
 
 /*-----------------------------------------------------------*/
 
+/**
+ * @brief Header placed before each block carved from an arena.  The union
+ * keeps the block that follows it aligned for any type.
+ */
+typedef union ArenaBlockHeader
+{
+    size_t blockSize;  /**< @brief Usable size of the block. */
+    uint64_t alignment;
+    void * pAlignment;
+} ArenaBlockHeader_t;
+
+/**
+ * @brief Alignment of the blocks carved from an arena.
+ */
+#define ARENA_ALIGNMENT          ( sizeof( ArenaBlockHeader_t ) )
+
+/**
+ * @brief Index of the free list of blocks larger than the largest size class.
+ */
+#define ARENA_LARGE_LIST_INDEX    ( MBEDTLS_FREERTOS_ARENA_CLASS_COUNT )
+
+#if ( MBEDTLS_FREERTOS_ARENA_CLASS_COUNT < 1 )
+    #error MBEDTLS_FREERTOS_ARENA_CLASS_COUNT must be at least 1.
+#endif
+
+/**
+ * @brief Arenas initialized and not yet deinitialized.
+ */
+static MbedtlsArena_t * pArenaList = NULL;
+
+/**
+ * @brief Allocations taken from the FreeRTOS heap.
+ */
+static uint32_t heapAllocationCount = 0;
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Find the arena selected by the calling task.
+ *
+ * @note Must be called with the scheduler suspended.
+ *
+ * @return The arena, or NULL if the task has not selected one.
+ */
+static MbedtlsArena_t * selectedArena( void );
+
+/**
+ * @brief Find the arena a block was allocated from.
+ *
+ * @note Must be called with the scheduler suspended.
+ *
+ * @param[in] ptr The block.
+ *
+ * @return The arena, or NULL if the block came from the heap.
+ */
+static MbedtlsArena_t * owningArena( const void * ptr );
+
+/**
+ * @brief Get the size a request is rounded up to, and the free list blocks of
+ * that size are kept on.
+ *
+ * @param[in] size Size requested.
+ * @param[out] pListIndex Receives the index of the free list.
+ *
+ * @return The size of block to allocate.
+ */
+static size_t arenaBlockSize( size_t size,
+                              uint32_t * pListIndex );
+
+/**
+ * @brief Allocate a block from an arena, reusing a freed block if one fits.
+ *
+ * @note Must be called with the scheduler suspended.
+ *
+ * @param[in] pArena The arena.
+ * @param[in] size Size requested.
+ *
+ * @return The block, or NULL if the arena has no room.
+ */
+static void * arenaAlloc( MbedtlsArena_t * pArena,
+                          size_t size );
+
+/**
+ * @brief Return a block to the free list of the arena it came from.
+ *
+ * @note Must be called with the scheduler suspended.
+ *
+ * @param[in] pArena The arena.
+ * @param[in] ptr The block.
+ */
+static void arenaFree( MbedtlsArena_t * pArena,
+                       void * ptr );
+
+/*-----------------------------------------------------------*/
+
+static MbedtlsArena_t * selectedArena( void )
+{
+    MbedtlsArena_t * pArena = pArenaList;
+    TaskHandle_t currentTask = xTaskGetCurrentTaskHandle();
+
+    while( ( pArena != NULL ) && ( pArena->owner != currentTask ) )
+    {
+        pArena = pArena->pNext;
+    }
+
+    return pArena;
+}
+
+/*-----------------------------------------------------------*/
+
+static MbedtlsArena_t * owningArena( const void * ptr )
+{
+    MbedtlsArena_t * pArena = pArenaList;
+    uintptr_t address = ( uintptr_t ) ptr;
+
+    while( ( pArena != NULL ) &&
+           ( ( address < ( uintptr_t ) pArena->pBuffer ) ||
+             ( address >= ( ( uintptr_t ) pArena->pBuffer + pArena->bufferSize ) ) ) )
+    {
+        pArena = pArena->pNext;
+    }
+
+    return pArena;
+}
+
+/*-----------------------------------------------------------*/
+
+static size_t arenaBlockSize( size_t size,
+                              uint32_t * pListIndex )
+{
+    size_t blockSize = 16U;
+    uint32_t listIndex = 0U;
+
+    if( size <= MBEDTLS_FREERTOS_ARENA_MAX_CLASS_SIZE )
+    {
+        while( blockSize < size )
+        {
+            blockSize <<= 1;
+            listIndex++;
+        }
+    }
+    else
+    {
+        blockSize = ( size + ( ARENA_ALIGNMENT - 1U ) ) & ~( ARENA_ALIGNMENT - 1U );
+        listIndex = ARENA_LARGE_LIST_INDEX;
+    }
+
+    *pListIndex = listIndex;
+
+    return blockSize;
+}
+
+/*-----------------------------------------------------------*/
+
+static void * arenaAlloc( MbedtlsArena_t * pArena,
+                          size_t size )
+{
+    ArenaBlockHeader_t * pHeader = NULL;
+    void ** ppLink;
+    size_t blockSize;
+    uint32_t listIndex = 0U;
+
+    /* Guard against the rounding in arenaBlockSize() overflowing. */
+    if( size <= pArena->bufferSize )
+    {
+        blockSize = arenaBlockSize( size, &listIndex );
+        ppLink = &( pArena->pFreeLists[ listIndex ] );
+
+        /* Every block on a size class list is the same size, so the first is
+         * taken.  Large blocks vary in size, so the first that fits is taken.
+         * Freed blocks are linked through their first bytes. */
+        while( ( *ppLink != NULL ) && ( pHeader == NULL ) )
+        {
+            if( ( ( ArenaBlockHeader_t * ) *ppLink - 1 )->blockSize >= blockSize )
+            {
+                pHeader = ( ArenaBlockHeader_t * ) *ppLink - 1;
+                *ppLink = *( ( void ** ) *ppLink );
+            }
+            else
+            {
+                ppLink = ( void ** ) *ppLink;
+            }
+        }
+
+        /* Otherwise carve a new block from the unused end of the buffer. */
+        if( ( pHeader == NULL ) &&
+            ( ( pArena->bufferSize - pArena->stats.bytesCarved ) >= ( sizeof( ArenaBlockHeader_t ) + blockSize ) ) )
+        {
+            pHeader = ( ArenaBlockHeader_t * ) &( pArena->pBuffer[ pArena->stats.bytesCarved ] );
+            pHeader->blockSize = blockSize;
+            pArena->stats.bytesCarved += sizeof( ArenaBlockHeader_t ) + blockSize;
+        }
+    }
+
+    if( pHeader != NULL )
+    {
+        pArena->stats.arenaAllocations++;
+        pArena->stats.liveBlocks++;
+        pArena->stats.bytesInUse += pHeader->blockSize;
+
+        if( pArena->stats.bytesInUse > pArena->stats.peakBytesInUse )
+        {
+            pArena->stats.peakBytesInUse = pArena->stats.bytesInUse;
+        }
+
+        pHeader++;
+    }
+
+    return ( void * ) pHeader;
+}
+
+/*-----------------------------------------------------------*/
+
+static void arenaFree( MbedtlsArena_t * pArena,
+                       void * ptr )
+{
+    ArenaBlockHeader_t * pHeader = ( ArenaBlockHeader_t * ) ptr - 1;
+    uint32_t listIndex = 0U;
+
+    ( void ) arenaBlockSize( pHeader->blockSize, &listIndex );
+
+    *( ( void ** ) ptr ) = pArena->pFreeLists[ listIndex ];
+    pArena->pFreeLists[ listIndex ] = ptr;
+
+    configASSERT( pArena->stats.liveBlocks > 0U );
+    pArena->stats.liveBlocks--;
+    pArena->stats.bytesInUse -= pHeader->blockSize;
+}
+
+/*-----------------------------------------------------------*/
+
 /**
  * @brief Allocates memory for an array of members.
  *
+ * The memory comes from the arena selected by the calling task if there is
+ * one and it has room, otherwise from the FreeRTOS heap.
+ *
  * @param[in] nmemb Number of members that need to be allocated.
  * @param[in] size Size of each member.
  *
@@ -49,6 +288,7 @@ void * mbedtls_platform_calloc( size_t nmemb,
 {
     size_t totalSize = nmemb * size;
     void * pBuffer = NULL;
+    MbedtlsArena_t * pArena;
 
     /* Check that neither nmemb nor size were 0. */
     if( totalSize > 0 )
@@ -56,7 +296,31 @@ void * mbedtls_platform_calloc( size_t nmemb,
         /* Overflow check. */
         if( ( totalSize / size ) == nmemb )
         {
-            pBuffer = pvPortMalloc( totalSize );
+            vTaskSuspendAll();
+            {
+                pArena = selectedArena();
+
+                if( pArena != NULL )
+                {
+                    pBuffer = arenaAlloc( pArena, totalSize );
+
+                    if( pBuffer == NULL )
+                    {
+                        pArena->stats.heapAllocations++;
+                    }
+                }
+
+                if( pBuffer == NULL )
+                {
+                    heapAllocationCount++;
+                }
+            }
+            ( void ) xTaskResumeAll();
+
+            if( pBuffer == NULL )
+            {
+                pBuffer = pvPortMalloc( totalSize );
+            }
 
             if( pBuffer != NULL )
             {
@@ -77,7 +341,151 @@ void * mbedtls_platform_calloc( size_t nmemb,
  */
 void mbedtls_platform_free( void * ptr )
 {
-    vPortFree( ptr );
+    MbedtlsArena_t * pArena = NULL;
+
+    if( ptr != NULL )
+    {
+        vTaskSuspendAll();
+        {
+            pArena = owningArena( ptr );
+
+            if( pArena != NULL )
+            {
+                arenaFree( pArena, ptr );
+            }
+        }
+        ( void ) xTaskResumeAll();
+
+        if( pArena == NULL )
+        {
+            vPortFree( ptr );
+        }
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+void mbedtls_freertos_arena_init( MbedtlsArena_t * pArena,
+                                  uint8_t * pBuffer,
+                                  size_t bufferSize )
+{
+    size_t padding;
+
+    configASSERT( pArena != NULL );
+    configASSERT( pBuffer != NULL );
+
+    ( void ) memset( pArena, 0x00, sizeof( MbedtlsArena_t ) );
+
+    /* Align the first block. */
+    padding = ( ARENA_ALIGNMENT - ( ( uintptr_t ) pBuffer & ( ARENA_ALIGNMENT - 1U ) ) ) & ( ARENA_ALIGNMENT - 1U );
+
+    if( bufferSize > padding )
+    {
+        pArena->pBuffer = &( pBuffer[ padding ] );
+        pArena->bufferSize = bufferSize - padding;
+    }
+
+    vTaskSuspendAll();
+    {
+        pArena->pNext = pArenaList;
+        pArenaList = pArena;
+    }
+    ( void ) xTaskResumeAll();
+}
+
+/*-----------------------------------------------------------*/
+
+void mbedtls_freertos_arena_deinit( MbedtlsArena_t * pArena )
+{
+    MbedtlsArena_t ** ppLink = &pArenaList;
+
+    configASSERT( pArena != NULL );
+
+    /* Frees of blocks still in use would otherwise be passed to the heap. */
+    configASSERT( pArena->stats.liveBlocks == 0U );
+
+    vTaskSuspendAll();
+    {
+        while( ( *ppLink != NULL ) && ( *ppLink != pArena ) )
+        {
+            ppLink = &( ( *ppLink )->pNext );
+        }
+
+        if( *ppLink != NULL )
+        {
+            *ppLink = pArena->pNext;
+        }
+    }
+    ( void ) xTaskResumeAll();
+
+    ( void ) memset( pArena, 0x00, sizeof( MbedtlsArena_t ) );
+}
+
+/*-----------------------------------------------------------*/
+
+void mbedtls_freertos_arena_select( MbedtlsArena_t * pArena )
+{
+    MbedtlsArena_t * pSelected;
+
+    vTaskSuspendAll();
+    {
+        pSelected = selectedArena();
+
+        if( pSelected != NULL )
+        {
+            pSelected->owner = NULL;
+        }
+
+        if( pArena != NULL )
+        {
+            pArena->owner = xTaskGetCurrentTaskHandle();
+        }
+    }
+    ( void ) xTaskResumeAll();
+}
+
+/*-----------------------------------------------------------*/
+
+BaseType_t mbedtls_freertos_arena_reset( MbedtlsArena_t * pArena )
+{
+    BaseType_t reset = pdFALSE;
+
+    configASSERT( pArena != NULL );
+
+    vTaskSuspendAll();
+    {
+        if( pArena->stats.liveBlocks == 0U )
+        {
+            ( void ) memset( pArena->pFreeLists, 0x00, sizeof( pArena->pFreeLists ) );
+            ( void ) memset( &( pArena->stats ), 0x00, sizeof( pArena->stats ) );
+            reset = pdTRUE;
+        }
+    }
+    ( void ) xTaskResumeAll();
+
+    return reset;
+}
+
+/*-----------------------------------------------------------*/
+
+void mbedtls_freertos_arena_get_stats( const MbedtlsArena_t * pArena,
+                                       MbedtlsArenaStats_t * pStats )
+{
+    configASSERT( pArena != NULL );
+    configASSERT( pStats != NULL );
+
+    vTaskSuspendAll();
+    {
+        *pStats = pArena->stats;
+    }
+    ( void ) xTaskResumeAll();
+}
+
+/*-----------------------------------------------------------*/
+
+uint32_t mbedtls_freertos_heap_allocations( void )
+{
+    return heapAllocationCount;
 }
 
 /*-----------------------------------------------------------*/
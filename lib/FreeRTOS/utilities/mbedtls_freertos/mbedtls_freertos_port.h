@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file mbedtls_freertos_port.h
+ * @brief Memory arenas that serve the mbed TLS allocations of a connection.
+ *
+ * mbedtls_platform_calloc() takes each allocation from the FreeRTOS heap
+ * unless the calling task has selected an arena, in which case it is carved
+ * from the arena's buffer.  A handshake makes many short lived allocations,
+ * so serving them from a buffer owned by the connection keeps them from
+ * fragmenting the heap and from each taking the heap lock, and bounds the
+ * memory the handshake can use.
+ *
+ * Small allocations are rounded up to a power of two size class and freed
+ * blocks are kept on a list per class for reuse.  Allocations larger than
+ * #MBEDTLS_FREERTOS_ARENA_MAX_CLASS_SIZE, such as the record buffers, are
+ * carved at their exact size and reused by later allocations that fit.
+ * Space is only returned to the arena by mbedtls_freertos_arena_reset(), so
+ * an allocation that does not fit falls back to the heap.
+ */
+
+#ifndef MBEDTLS_FREERTOS_PORT_H_
+#define MBEDTLS_FREERTOS_PORT_H_
+
+/* Standard includes. */
+#include <stddef.h>
+#include <stdint.h>
+
+/* FreeRTOS includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/**
+ * @brief The number of power of two size classes, the smallest of which is
+ * 16 bytes.  Larger allocations are carved at their exact size.
+ */
+#ifndef MBEDTLS_FREERTOS_ARENA_CLASS_COUNT
+    #define MBEDTLS_FREERTOS_ARENA_CLASS_COUNT    ( 9U )
+#endif
+
+/**
+ * @brief The largest size class, 4096 bytes by default.
+ */
+#define MBEDTLS_FREERTOS_ARENA_MAX_CLASS_SIZE     ( 16U << ( MBEDTLS_FREERTOS_ARENA_CLASS_COUNT - 1U ) )
+
+/**
+ * @brief Counters describing how an arena has been used since it was last
+ * reset.
+ */
+typedef struct MbedtlsArenaStats
+{
+    uint32_t arenaAllocations; /**< @brief Allocations served from the arena. */
+    uint32_t heapAllocations;  /**< @brief Allocations that did not fit in the arena, so came from the heap. */
+    uint32_t liveBlocks;       /**< @brief Arena blocks allocated and not yet freed. */
+    size_t bytesInUse;         /**< @brief Bytes of arena blocks allocated and not yet freed. */
+    size_t peakBytesInUse;     /**< @brief The largest value #MbedtlsArenaStats_t.bytesInUse has reached. */
+    size_t bytesCarved;        /**< @brief Bytes of the buffer carved into blocks. */
+} MbedtlsArenaStats_t;
+
+/**
+ * @brief An arena.  The members are private to mbedtls_freertos_port.c.
+ */
+typedef struct MbedtlsArena
+{
+    uint8_t * pBuffer;                                           /**< @brief Start of the buffer blocks are carved from. */
+    size_t bufferSize;                                           /**< @brief Size of #MbedtlsArena_t.pBuffer. */
+    void * pFreeLists[ MBEDTLS_FREERTOS_ARENA_CLASS_COUNT + 1U ]; /**< @brief Freed blocks of each size class, then of large blocks. */
+    TaskHandle_t owner;                                          /**< @brief The task whose allocations are served, or NULL. */
+    MbedtlsArenaStats_t stats;                                   /**< @brief Usage counters. */
+    struct MbedtlsArena * pNext;                                 /**< @brief Next arena known to the port. */
+} MbedtlsArena_t;
+
+/**
+ * @brief Prepare an arena to serve allocations from a buffer.
+ *
+ * @param[out] pArena The arena to initialize.
+ * @param[in] pBuffer The buffer blocks are carved from.  It must remain valid
+ * until mbedtls_freertos_arena_deinit() is called.
+ * @param[in] bufferSize Size of @p pBuffer.
+ */
+void mbedtls_freertos_arena_init( MbedtlsArena_t * pArena,
+                                  uint8_t * pBuffer,
+                                  size_t bufferSize );
+
+/**
+ * @brief Stop using an arena.  Every block allocated from it must already
+ * have been freed.
+ *
+ * @param[in] pArena The arena.
+ */
+void mbedtls_freertos_arena_deinit( MbedtlsArena_t * pArena );
+
+/**
+ * @brief Serve the mbed TLS allocations made by the calling task from an
+ * arena, or from the heap if @p pArena is NULL.
+ *
+ * Blocks are returned to the arena they came from whichever task frees them.
+ *
+ * @param[in] pArena The arena, or NULL.
+ */
+void mbedtls_freertos_arena_select( MbedtlsArena_t * pArena );
+
+/**
+ * @brief Return the whole buffer to an arena and clear its counters, if no
+ * blocks allocated from it are still in use.
+ *
+ * @param[in] pArena The arena.
+ *
+ * @return pdTRUE if the arena was reset, pdFALSE if blocks are still in use.
+ */
+BaseType_t mbedtls_freertos_arena_reset( MbedtlsArena_t * pArena );
+
+/**
+ * @brief Get the counters of an arena.
+ *
+ * @param[in] pArena The arena.
+ * @param[out] pStats Receives the counters.
+ */
+void mbedtls_freertos_arena_get_stats( const MbedtlsArena_t * pArena,
+                                       MbedtlsArenaStats_t * pStats );
+
+/**
+ * @brief Get the number of mbed TLS allocations taken from the FreeRTOS heap
+ * since start up, including those made while an arena was selected.
+ *
+ * @return The number of heap allocations.
+ */
+uint32_t mbedtls_freertos_heap_allocations( void );
+
+#endif /* ifndef MBEDTLS_FREERTOS_PORT_H_ */
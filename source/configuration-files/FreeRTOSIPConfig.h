@@ -93,6 +93,12 @@ extern void vLoggingPrintf( const char * pcFormatString,
 #define ipconfigDNS_CACHE_ENTRIES                  ( 4 )
 #define ipconfigDNS_REQUEST_ATTEMPTS               ( 2 )
 
+/* Keep up to four addresses for each cached host name, which the sockets
+ * wrapper rotates through when connecting to one fails, and let it refresh
+ * cached addresses without blocking by resolving them with callbacks. */
+#define ipconfigDNS_CACHE_ADDRESSES_PER_ENTRY      ( 4 )
+#define ipconfigDNS_USE_CALLBACKS                  ( 1 )
+
 /* The IP stack executes it its own task (although any application task can make
  * use of its services through the published sockets API). ipconfigUDP_TASK_PRIORITY
  * sets the priority of the task that executes the IP stack.  The priority is a
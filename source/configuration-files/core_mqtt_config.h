@@ -109,4 +109,11 @@ extern void vLoggingPrintf( const char * pcFormatString,
  */
 #define MQTT_AGENT_NETWORK_BUFFER_SIZE    ( 5000 )
 
+/**
+ * @brief The number of MQTT_AGENT_NETWORK_BUFFER_SIZE buffers in the agent's
+ * network buffer pool.  One is used by the agent, the rest can be retained by
+ * incoming publish callbacks so publishes can be used without being copied.
+ */
+#define MQTT_AGENT_NUM_NETWORK_BUFFERS    ( 3 )
+
 #endif /* ifndef CORE_MQTT_CONFIG_H */
@@ -80,6 +80,24 @@ extern void vLoggingPrintf( const char * pcFormatString,
 #define democonfigCREATE_CODE_SIGNING_OTA_DEMO          1
 #define democonfigCODE_SIGNING_OTA_TASK_STACK_SIZE      ( configMINIMAL_STACK_SIZE )
 
+/* The following are off by default, so the demo runs as it always has.  Set
+ * each to 1 to turn the feature on; each one adds its own tasks or files, so
+ * check the stack and heap sizes after doing so. */
+
+/* Set to 1 to run the simple sub pub demo's incoming publish callbacks on the
+ * subscription dispatcher tasks instead of the MQTT agent task. */
+#define democonfigCREATE_SUBSCRIPTION_DISPATCHER        0
+#define democonfigSUBSCRIPTION_DISPATCHER_STACK_SIZE    ( configMINIMAL_STACK_SIZE )
+
+/* Set to 1 to store QoS1 publishes made while the MQTT agent is reconnecting in
+ * a file, and send them once it has reconnected. */
+#define democonfigCREATE_OUTBOX                         0
+#define democonfigOUTBOX_STACK_SIZE                     ( configMINIMAL_STACK_SIZE )
+
+/* Set to 1 to save unacknowledged QoS1 and QoS2 publishes to a journal file,
+ * and connect without a clean session, so they are resent after a reset. */
+#define democonfigCREATE_SESSION_STORE                  0
+
 
 /**
  * @brief The MQTT client identifier used in this example.  Each client identifier
@@ -125,6 +143,21 @@ extern void vLoggingPrintf( const char * pcFormatString,
  */
 //#define democonfigMQTT_BROKER_PORT ( 8883 )
 
+/**
+ * @brief A second MQTT broker endpoint, such as the same broker in another
+ * region or behind another load balancer, to fail over to.
+ *
+ * When defined, connections are made to whichever of the two endpoints
+ * accepts a TCP connection first.  The endpoint that connected most reliably
+ * and quickly is tried first, and the other is tried as well if it has not
+ * connected within FREERTOS_SOCKETS_WRAPPER_CONNECT_STAGGER_MS.  Both endpoints
+ * must present certificates signed by democonfigROOT_CA_PEM.  Only used if
+ * #democonfigUSE_TLS is 1.
+ *
+ * #define democonfigMQTT_BROKER_FALLBACK_ENDPOINT    "...insert here..."
+ * #define democonfigMQTT_BROKER_FALLBACK_PORT        ( 8883 )
+ */
+
 /**
  * @brief Server's root CA certificate.
  *
@@ -273,6 +306,72 @@ extern void vLoggingPrintf( const char * pcFormatString,
  */
 #define democonfigUSE_TLS                   1
 
+/**
+ * @brief Set to 1 to offer the TLS session negotiated by the previous
+ * connection when reconnecting, so the broker can resume it rather than
+ * perform a full handshake.  Only used if #democonfigUSE_TLS is 1.
+ */
+#define democonfigRESUME_TLS_SESSION        1
+
+/**
+ * @brief Define to also save the TLS session to this file, so it can be
+ * resumed after a reset.
+ *
+ *!!! The file holds the session's master secret, so must only be readable
+ *!!! by the device.
+ */
+/* #define democonfigTLS_SESSION_FILE_NAME    "tls_session.bin" */
+
+/**
+ * @brief Size, in bytes, of the buffer the mbed TLS allocations of the MQTT
+ * connection are served from while connecting, rather than the FreeRTOS heap.
+ * Set to 0 to allocate from the heap.  Allocations that do not fit fall back
+ * to the heap, and the peak usage is logged after each handshake so the size
+ * can be tuned.  Only used if #democonfigUSE_TLS is 1.
+ *
+ * Defaults to 0.  To use an arena, set a size such as ( 64U * 1024U ) and
+ * lower it to the logged peak plus a margin.
+ */
+#define democonfigTLS_ARENA_SIZE            ( 0U )
+
+/**
+ * @brief Size, in bytes, of the buffer the pieces of each MQTT packet are
+ * collected in so they are encrypted and sent as one TLS record.  Set to 0 to
+ * send each piece as it is written.  Only used if #democonfigUSE_TLS is 1.
+ *
+ * Defaults to 0.  A size such as ( 2048U ) sends most MQTT packets as a single
+ * record.
+ */
+#define democonfigTLS_CORK_BUFFER_SIZE      ( 0U )
+
+/**
+ * @brief The largest TLS record payload, in bytes, to negotiate with the
+ * broker: 512, 1024, 2048 or 4096, or 0 to not negotiate a limit, which
+ * allows 16384 byte records.  Only used if #democonfigUSE_TLS is 1.
+ *
+ * mbed TLS sizes its input and output buffers to the negotiated length once
+ * the handshake completes, so a smaller length saves RAM on each connection
+ * at the cost of splitting large MQTT packets into more records, each with
+ * its own header and MAC.  The figures below for one connection, with the
+ * MQTT agent's 5000 byte network buffer, are calculated rather than measured:
+ * each TLS buffer is taken as the fragment length plus about 300 bytes of
+ * record header, IV, MAC and padding, and there is one buffer per direction.
+ * Measure the heap on the target before relying on them.
+ *
+ * Length | TLS I/O buffers | Records per 5000 byte packet
+ * -------|-----------------|-----------------------------
+ *    512 |          1.6 KB | 10
+ *   1024 |          2.6 KB |  5
+ *   2048 |          4.6 KB |  3
+ *   4096 |          8.6 KB |  2
+ *      0 |         32.6 KB |  1
+ *
+ * The broker may ignore the request, in which case 16384 byte records are
+ * used.  Defaults to 0, so no limit is negotiated; set one of the lengths
+ * above to save RAM.
+ */
+#define democonfigTLS_MAX_FRAGMENT_LENGTH   ( 0U )
+
 /**
  * @brief Set the stack size of the main demo task.
  *
@@ -88,6 +88,8 @@
 #define MBEDTLS_SSL_PROTO_TLS1_2
 #define MBEDTLS_SSL_ALPN
 #define MBEDTLS_SSL_SERVER_NAME_INDICATION
+#define MBEDTLS_SSL_SESSION_TICKETS
+#define MBEDTLS_SSL_VARIABLE_BUFFER_LENGTH
 
 /* Check certificate key usage. */
 #define MBEDTLS_X509_CHECK_KEY_USAGE
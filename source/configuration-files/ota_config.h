@@ -114,8 +114,12 @@ extern void vLoggingPrintf( const char * pcFormatString,
  *  how many data blocks response is expected for each data requests.
  *  Please note that this must be set larger than zero.
  *
+ *  The demo's block window (ota_block_window.h) rewrites each request to ask for as many
+ *  blocks as fit its congestion window, so this is set to 1 to have the agent ask again
+ *  as each block arrives, keeping the window full.
+ *
  */
-#define otaconfigMAX_NUM_BLOCKS_REQUEST         4U
+#define otaconfigMAX_NUM_BLOCKS_REQUEST         1U
 
 /**
  * @brief The maximum number of requests allowed to send without a response before we abort.
@@ -130,9 +134,12 @@ extern void vLoggingPrintf( const char * pcFormatString,
  * @brief The number of data buffers reserved by the OTA agent.
  *
  * This configurations parameter sets the maximum number of static data buffers used by
- * the OTA agent for job and file data blocks received.
+ * the OTA agent for job and file data blocks received.  The demo's block window keeps no
+ * more blocks in flight than there are free buffers, less one kept for job messages, so
+ * this bounds the data received per round trip.  It must stay below the depth of the OTA
+ * agent's event queue.
  */
-#define otaconfigMAX_NUM_OTA_DATA_BUFFERS       5U
+#define otaconfigMAX_NUM_OTA_DATA_BUFFERS       16U
 
 /**
  * @brief How frequently the device will report its OTA progress to the cloud.
@@ -73,6 +73,7 @@
 
 /* MQTT agent include. */
 #include "freertos_mqtt_agent.h"
+#include "agent_buffer_pool.h"
 
 /* Exponential backoff retry include. */
 #include "backoff_algorithm.h"
@@ -80,6 +81,18 @@
 /* Subscription manager header include. */
 #include "subscription_manager.h"
 
+/* Subscription dispatcher header include. */
+#include "subscription_dispatcher.h"
+
+/* Outbox header include. */
+#include "outbox.h"
+
+/* Session store header include. */
+#include "session_store.h"
+
+/* File storage include. */
+#include "file_storage.h"
+
 
 /* Transport interface include. */
 #if defined( democonfigUSE_TLS ) && ( democonfigUSE_TLS == 1 )
@@ -115,6 +128,46 @@
     #error Please define democonfigCODE_SIGNING_OTA_TASK_STACK_SIZE in demo_config.h to set the stack size (in words, not bytes) for the task created by vStartOTACodeSigningDemo().
 #endif
 
+#ifndef democonfigCREATE_SUBSCRIPTION_DISPATCHER
+    #error Please define democonfigCREATE_SUBSCRIPTION_DISPATCHER to 1 or 0 in demo_config.h - determines if startSubscriptionDispatcher() gets called or not.
+#endif
+
+#if ( democonfigCREATE_SUBSCRIPTION_DISPATCHER != 0 ) && !defined( democonfigSUBSCRIPTION_DISPATCHER_STACK_SIZE )
+    #error Please define democonfigSUBSCRIPTION_DISPATCHER_STACK_SIZE in demo_config.h to set the stack size (in words, not bytes) for the tasks created by startSubscriptionDispatcher().
+#endif
+
+#ifndef democonfigCREATE_OUTBOX
+    #error Please define democonfigCREATE_OUTBOX to 1 or 0 in demo_config.h - determines if startOutbox() gets called or not.
+#endif
+
+#if ( democonfigCREATE_OUTBOX != 0 ) && !defined( democonfigOUTBOX_STACK_SIZE )
+    #error Please define democonfigOUTBOX_STACK_SIZE in demo_config.h to set the stack size (in words, not bytes) for the task created by startOutbox().
+#endif
+
+#if defined( democonfigUSE_TLS ) && ( democonfigUSE_TLS == 1 ) && !defined( democonfigRESUME_TLS_SESSION )
+    #error Please define democonfigRESUME_TLS_SESSION to 1 or 0 in demo_config.h - determines if TLS sessions are resumed when reconnecting.
+#endif
+
+#if defined( democonfigUSE_TLS ) && ( democonfigUSE_TLS == 1 ) && !defined( democonfigTLS_ARENA_SIZE )
+    #error Please define democonfigTLS_ARENA_SIZE in demo_config.h to set the size of the buffer mbed TLS allocations are served from, or 0 to use the heap.
+#endif
+
+#if defined( democonfigUSE_TLS ) && ( democonfigUSE_TLS == 1 ) && !defined( democonfigTLS_MAX_FRAGMENT_LENGTH )
+    #error Please define democonfigTLS_MAX_FRAGMENT_LENGTH in demo_config.h to set the largest TLS record to negotiate with the broker, or 0 to not negotiate.
+#endif
+
+#if defined( democonfigUSE_TLS ) && ( democonfigUSE_TLS == 1 ) && !defined( democonfigTLS_CORK_BUFFER_SIZE )
+    #error Please define democonfigTLS_CORK_BUFFER_SIZE in demo_config.h to set the size of the buffer MQTT packets are collected in before encryption, or 0 to send them unbuffered.
+#endif
+
+#if defined( democonfigMQTT_BROKER_FALLBACK_ENDPOINT ) && !defined( democonfigMQTT_BROKER_FALLBACK_PORT )
+    #define democonfigMQTT_BROKER_FALLBACK_PORT    democonfigMQTT_BROKER_PORT
+#endif
+
+#ifndef democonfigCREATE_SESSION_STORE
+    #error Please define democonfigCREATE_SESSION_STORE to 1 or 0 in demo_config.h - determines if loadMQTTSession() gets called or not.
+#endif
+
 /**
  * @brief Dimensions the buffer used to serialise and deserialise MQTT packets.
  * @note Specified in bytes.  Must be large enough to hold the maximum
@@ -168,6 +221,13 @@
  */
 #define mqttexampleTRANSPORT_SEND_RECV_TIMEOUT_MS    ( 750 )
 
+/**
+ * @brief Size of the buffer used to save the TLS session to a file.  Must be
+ * large enough for the serialized session, which includes the broker's
+ * certificate.
+ */
+#define mqttexampleTLS_SESSION_BUFFER_SIZE           ( 2048U )
+
 /**
  * @brief Used to convert times to/from ticks and milliseconds.
  */
@@ -209,7 +269,8 @@ static MQTTStatus_t prvMQTTInit( void );
 static MQTTStatus_t prvMQTTConnect( bool xCleanSession );
 
 /**
- * @brief Connect a TCP socket to the MQTT broker.
+ * @brief Connect a TCP socket to the MQTT broker, retrying with backoff until
+ * the connection succeeds or the retries are exhausted.
  *
  * @param[in] pxNetworkContext Network context.
  *
@@ -217,6 +278,15 @@ static MQTTStatus_t prvMQTTConnect( bool xCleanSession );
  */
 static BaseType_t prvSocketConnect( NetworkContext_t * pxNetworkContext );
 
+/**
+ * @brief Make a single attempt to connect a TCP socket to the MQTT broker.
+ *
+ * @param[in] pxNetworkContext Network context.
+ *
+ * @return `pdPASS` if connection succeeds, else `pdFAIL`.
+ */
+static BaseType_t prvSocketConnectAttempt( NetworkContext_t * pxNetworkContext );
+
 /**
  * @brief Disconnect a TCP connection.
  *
@@ -255,18 +325,20 @@ static void prvIncomingPublishCallback( MQTTAgentContext_t * pMqttAgentContext,
  * subscription list.
  *
  * This function will be invoked when this demo requests the broker to
- * reestablish the session and the broker cannot do so. This function will
- * enqueue commands to the MQTT Agent queue and will be processed once the
- * command loop starts.
+ * reestablish the session and the broker cannot do so. The subscriptions are
+ * sent immediately, with the QoS each was originally subscribed with, in as
+ * many SUBSCRIBE packets as the network buffer requires.  The SUBACKs are
+ * processed once the command loop starts, and publishes sent by the demo tasks
+ * are held back by the agent until every SUBACK has been received.
  *
- * @return `MQTTSuccess` if adding subscribes to the command queue succeeds, else
- * appropriate error code from MQTTAgent_Subscribe.
+ * @return `MQTTSuccess` if sending the subscribes succeeds, else appropriate
+ * error code from MQTTAgent_RestoreSubscriptions.
  * */
 static MQTTStatus_t prvHandleResubscribe( void );
 
 /**
- * @brief Passed into MQTTAgent_Subscribe() as the callback to execute when the
- * broker ACKs the SUBSCRIBE message. This callback implementation is used for
+ * @brief Passed into MQTTAgent_RestoreSubscriptions() as the callback to execute
+ * when the broker ACKs each SUBSCRIBE message. This callback implementation is used for
  * handling the completion of resubscribes. Any topic filter failed to resubscribe
  * will be removed from the subscription list.
  *
@@ -278,15 +350,51 @@ static MQTTStatus_t prvHandleResubscribe( void );
 static void prvSubscriptionCommandCallback( void * pxCommandContext,
                                             MQTTAgentReturnInfo_t * pxReturnInfo );
 
+/**
+ * @brief Called by the MQTT agent to make one attempt at re-establishing the TCP
+ * and MQTT connections after the connection is lost.
+ *
+ * @param[in] pxMqttAgentContext Agent context, unused as this demo only has one.
+ * @param[out] pulRetryDelayMs Set to the backoff delay before the next attempt if
+ * this attempt fails.
+ *
+ * @return `MQTTSuccess` if the connection was re-established, else an appropriate
+ * error code.
+ */
+static MQTTStatus_t prvReconnect( MQTTAgentContext_t * pxMqttAgentContext,
+                                  uint32_t * pulRetryDelayMs );
+
+/**
+ * @brief Called by the MQTT agent to close the TCP connection after the MQTT
+ * connection is lost or disconnected.
+ *
+ * @param[in] pxMqttAgentContext Agent context, unused as this demo only has one.
+ */
+static void prvDisconnect( MQTTAgentContext_t * pxMqttAgentContext );
+
+#if defined( democonfigUSE_TLS ) && ( democonfigUSE_TLS == 1 ) && ( democonfigTLS_CORK_BUFFER_SIZE > 0 )
+
+/**
+ * @brief Called by the MQTT agent after each command to send the packets
+ * collected in the TLS cork buffer.
+ *
+ * @param[in] pxMqttAgentContext Agent context, unused as this demo only has one.
+ *
+ * @return `MQTTSuccess` if the packets were sent, else `MQTTSendFailed`.
+ */
+    static MQTTStatus_t prvFlush( MQTTAgentContext_t * pxMqttAgentContext );
+#endif
+
 /**
  * @brief Task used to run the MQTT agent.  In this example the first task that
  * is created is responsible for creating all the other demo tasks.  Then,
  * rather than create prvMQTTAgentTask() as a separate task, it simply calls
  * prvMQTTAgentTask() to become the agent task itself.
  *
- * This task calls MQTTAgent_CommandLoop() in a loop, until MQTTAgent_Terminate()
- * is called. If an error occurs in the command loop, then it will reconnect the
- * TCP and MQTT connections.
+ * This task calls MQTTAgent_CommandLoop() until MQTTAgent_Disconnect() or
+ * MQTTAgent_Terminate() is called. If the connection is lost then the agent
+ * re-establishes the TCP and MQTT connections itself, using prvReconnect(),
+ * while continuing to accept commands from the other tasks.
  *
  * @param[in] pvParameters Parameters as passed at the time of task creation. Not
  * used in this example.
@@ -319,6 +427,31 @@ static uint32_t prvGetTimeMs( void );
  */
 static void prvConnectToMQTTBroker( void );
 
+#if defined( democonfigUSE_TLS ) && ( democonfigUSE_TLS == 1 )
+
+/**
+ * @brief Log the memory the mbed TLS allocations made while connecting used.
+ *
+ * @param[in] pxNetworkContext The network context of the new connection.
+ */
+    static void prvLogTlsMemoryUsage( const NetworkContext_t * pxNetworkContext );
+#endif
+
+#if defined( democonfigUSE_TLS ) && ( democonfigUSE_TLS == 1 ) && ( democonfigRESUME_TLS_SESSION == 1 )
+
+/**
+ * @brief Initialize the TLS session offered when connecting, restoring the
+ * session saved before a reset if democonfigTLS_SESSION_FILE_NAME is defined.
+ */
+    static void prvLoadTlsSession( void );
+
+/**
+ * @brief Log how the last TLS handshake completed, and save the session if
+ * democonfigTLS_SESSION_FILE_NAME is defined.
+ */
+    static void prvSaveTlsSession( void );
+#endif
+
 /*
  * Functions that start the tasks demonstrated by this project.
  */
@@ -351,10 +484,55 @@ static uint32_t ulGlobalEntryTimeMs;
 
 MQTTAgentContext_t xGlobalMqttAgentContext;
 
-static uint8_t xNetworkBuffer[ MQTT_AGENT_NETWORK_BUFFER_SIZE ];
-
 static AgentMessageContext_t xCommandQueue;
 
+/**
+ * @brief Backoff state used to space out the agent's reconnect attempts.
+ */
+static BackoffAlgorithmContext_t xReconnectBackoff;
+
+#if defined( democonfigUSE_TLS ) && ( democonfigUSE_TLS == 1 ) && ( democonfigRESUME_TLS_SESSION == 1 )
+
+/**
+ * @brief The TLS session negotiated by the last connection, offered to the
+ * broker when reconnecting.
+ */
+    static TlsSession_t xTlsSession;
+#endif
+
+#if defined( democonfigUSE_TLS ) && ( democonfigUSE_TLS == 1 ) && ( democonfigTLS_ARENA_SIZE > 0 )
+
+/**
+ * @brief The buffer the mbed TLS allocations of the connection are served
+ * from, reused by each connection.
+ */
+    static uint8_t ucTlsArena[ democonfigTLS_ARENA_SIZE ];
+#endif
+
+#if defined( democonfigUSE_TLS ) && ( democonfigUSE_TLS == 1 ) && ( democonfigTLS_CORK_BUFFER_SIZE > 0 )
+
+/**
+ * @brief The buffer the pieces of each MQTT packet are collected in before
+ * they are encrypted.
+ */
+    static uint8_t ucTlsCorkBuffer[ democonfigTLS_CORK_BUFFER_SIZE ];
+#endif
+
+#if defined( democonfigUSE_TLS ) && ( democonfigUSE_TLS == 1 )
+
+/**
+ * @brief The broker endpoints, with the record of how connecting to each has
+ * gone, kept across reconnections.
+ */
+    static SocketsEndpoint_t xBrokerEndpoints[] =
+    {
+        { democonfigMQTT_BROKER_ENDPOINT,          democonfigMQTT_BROKER_PORT,          0U, 0U },
+        #ifdef democonfigMQTT_BROKER_FALLBACK_ENDPOINT
+            { democonfigMQTT_BROKER_FALLBACK_ENDPOINT, democonfigMQTT_BROKER_FALLBACK_PORT, 0U, 0U },
+        #endif
+    };
+#endif
+
 /**
  * @brief The global array of subscription elements.
  *
@@ -390,10 +568,15 @@ static MQTTStatus_t prvMQTTInit( void )
 {
     TransportInterface_t xTransport;
     MQTTStatus_t xReturn;
-    MQTTFixedBuffer_t xFixedBuffer = { .pBuffer = xNetworkBuffer, .size = MQTT_AGENT_NETWORK_BUFFER_SIZE };
+    MQTTFixedBuffer_t xFixedBuffer = { .pBuffer = NULL, .size = MQTT_AGENT_NETWORK_BUFFER_SIZE };
     static uint8_t staticQueueStorageArea[ MQTT_AGENT_COMMAND_QUEUE_LENGTH * sizeof( Command_t * ) ];
     static StaticQueue_t staticQueueStructure;
 
+    /* The network buffer comes from the agent's pool so incoming publish
+     * callbacks can retain it rather than copy the publish out of it. */
+    xFixedBuffer.pBuffer = Agent_GetNetworkBuffer();
+    configASSERT( xFixedBuffer.pBuffer != NULL );
+
     LogDebug( ( "Creating command queue." ) );
     xCommandQueue.queue = xQueueCreateStatic( MQTT_AGENT_COMMAND_QUEUE_LENGTH,
                                               sizeof( Command_t * ),
@@ -509,57 +692,52 @@ static MQTTStatus_t prvHandleResubscribe( void )
     uint32_t ulIndex = 0U;
     uint16_t usNumSubscriptions = 0U;
 
-    /* These variables need to stay in scope until command completes. */
-    static MQTTAgentSubscribeArgs_t xSubArgs = { 0 };
+    /* This variable needs to stay in scope until every SUBACK is received. */
     static MQTTSubscribeInfo_t xSubInfo[ SUBSCRIPTION_MANAGER_MAX_SUBSCRIPTIONS ] = { 0 };
-    static CommandInfo_t xCommandParams = { 0 };
 
-    /* Loop through each subscription in the subscription list and add a subscribe
-     * command to the command queue. */
-    for( ulIndex = 0U; ulIndex < SUBSCRIPTION_MANAGER_MAX_SUBSCRIPTIONS; ulIndex++ )
+    /* Called from the reconnect function while the command loop runs, so an
+     * earlier restore may still be using xSubInfo.  Fail the reconnect, which
+     * is retried, rather than change the subscriptions under it. */
+    if( MQTTAgent_IsRestoringSubscriptions( &xGlobalMqttAgentContext ) == true )
     {
-        /* Check if there is a subscription in the subscription list. This demo
-         * doesn't check for duplicate subscriptions. */
-        if( xGlobalSubscriptionList[ ulIndex ].usFilterStringLength != 0 )
+        LogWarn( ( "Subscriptions from the last connection are still being restored." ) );
+        xResult = MQTTIllegalState;
+    }
+    else
+    {
+        /* Loop through each subscription in the subscription list and add it
+         * to the set of subscriptions to restore. */
+        for( ulIndex = 0U; ulIndex < SUBSCRIPTION_MANAGER_MAX_SUBSCRIPTIONS; ulIndex++ )
         {
-            xSubInfo[ usNumSubscriptions ].pTopicFilter = xGlobalSubscriptionList[ ulIndex ].pcSubscriptionFilterString;
-            xSubInfo[ usNumSubscriptions ].topicFilterLength = xGlobalSubscriptionList[ ulIndex ].usFilterStringLength;
-
-            /* QoS1 is used for all the subscriptions in this demo. */
-            xSubInfo[ usNumSubscriptions ].qos = MQTTQoS1;
+            /* Check if there is a subscription in the subscription list. This
+             * demo doesn't check for duplicate subscriptions. */
+            if( xGlobalSubscriptionList[ ulIndex ].usFilterStringLength != 0 )
+            {
+                xSubInfo[ usNumSubscriptions ].pTopicFilter = xGlobalSubscriptionList[ ulIndex ].pcSubscriptionFilterString;
+                xSubInfo[ usNumSubscriptions ].topicFilterLength = xGlobalSubscriptionList[ ulIndex ].usFilterStringLength;
+                xSubInfo[ usNumSubscriptions ].qos = xGlobalSubscriptionList[ ulIndex ].xRequestedQoS;
 
-            usNumSubscriptions++;
+                LogInfo( ( "Resubscribe to the topic %.*s will be attempted.",
+                           xSubInfo[ usNumSubscriptions ].topicFilterLength,
+                           xSubInfo[ usNumSubscriptions ].pTopicFilter ) );
 
-            LogInfo( ( "Resubscribe to the topic %.*s will be attempted.",
-                       xSubInfo[ usNumSubscriptions ].topicFilterLength,
-                       xSubInfo[ usNumSubscriptions ].pTopicFilter ) );
+                usNumSubscriptions++;
+            }
         }
-    }
-
-    if( usNumSubscriptions > 0U )
-    {
-        xSubArgs.pSubscribeInfo = xSubInfo;
-        xSubArgs.numSubscriptions = usNumSubscriptions;
 
-        /* The block time can be 0 as the command loop is not running at this point. */
-        xCommandParams.blockTimeMs = 0U;
-        xCommandParams.cmdCompleteCallback = prvSubscriptionCommandCallback;
-        xCommandParams.pCmdCompleteCallbackContext = ( void * ) &xSubArgs;
+        /* Sends the subscribes without waiting for the SUBACKs, which are
+         * processed by the command loop.  Succeeds if there is nothing to be
+         * subscribed. */
+        xResult = MQTTAgent_RestoreSubscriptions( &xGlobalMqttAgentContext,
+                                                  xSubInfo,
+                                                  usNumSubscriptions,
+                                                  prvSubscriptionCommandCallback );
 
-        /* Enqueue subscribe to the command queue. These commands will be processed only
-         * when command loop starts. */
-        xResult = MQTTAgent_Subscribe( &xGlobalMqttAgentContext, &xSubArgs, &xCommandParams );
-    }
-    else
-    {
-        /* Mark the resubscribe as success if there is nothing to be subscribed. */
-        xResult = MQTTSuccess;
-    }
-
-    if( xResult != MQTTSuccess )
-    {
-        LogError( ( "Failed to enqueue the MQTT subscribe command. xResult=%s.",
-                    MQTT_Status_strerror( xResult ) ) );
+        if( xResult != MQTTSuccess )
+        {
+            LogError( ( "Failed to send the MQTT subscribe packets. xResult=%s.",
+                        MQTT_Status_strerror( xResult ) ) );
+        }
     }
 
     return xResult;
@@ -607,11 +785,58 @@ static BaseType_t prvSocketConnect( NetworkContext_t * pxNetworkContext )
     BackoffAlgorithmStatus_t xBackoffAlgStatus = BackoffAlgorithmSuccess;
     BackoffAlgorithmContext_t xReconnectParams = { 0 };
     uint16_t usNextRetryBackOff = 0U;
+
+    /* We will use a retry mechanism with an exponential backoff mechanism and
+     * jitter.  That is done to prevent a fleet of IoT devices all trying to
+     * reconnect at exactly the same time should they become disconnected at
+     * the same time. We initialize reconnect attempts and interval here. */
+    BackoffAlgorithm_InitializeParams( &xReconnectParams,
+                                       RETRY_BACKOFF_BASE_MS,
+                                       RETRY_MAX_BACKOFF_DELAY_MS,
+                                       RETRY_MAX_ATTEMPTS );
+
+    /* Attempt to connect to MQTT broker. If connection fails, retry after a
+     * timeout. Timeout value will exponentially increase until the maximum
+     * number of attempts are reached.
+     */
+    do
+    {
+        xConnected = prvSocketConnectAttempt( pxNetworkContext );
+
+        if( !xConnected )
+        {
+            /* Get back-off value (in milliseconds) for the next connection retry. */
+            xBackoffAlgStatus = BackoffAlgorithm_GetNextBackoff( &xReconnectParams, uxRand(), &usNextRetryBackOff );
+
+            if( xBackoffAlgStatus == BackoffAlgorithmSuccess )
+            {
+                LogWarn( ( "Connection to the broker failed. "
+                           "Retrying connection in %hu ms.",
+                           usNextRetryBackOff ) );
+                vTaskDelay( pdMS_TO_TICKS( usNextRetryBackOff ) );
+            }
+        }
+
+        if( xBackoffAlgStatus == BackoffAlgorithmRetriesExhausted )
+        {
+            LogError( ( "Connection to the broker failed, all attempts exhausted." ) );
+        }
+    } while( ( xConnected != pdPASS ) && ( xBackoffAlgStatus == BackoffAlgorithmSuccess ) );
+
+    return xConnected;
+}
+
+/*-----------------------------------------------------------*/
+
+static BaseType_t prvSocketConnectAttempt( NetworkContext_t * pxNetworkContext )
+{
+    BaseType_t xConnected = pdFAIL;
     const TickType_t xTransportTimeout = 0UL;
 
     #if defined( democonfigUSE_TLS ) && ( democonfigUSE_TLS == 1 )
         TlsTransportStatus_t xNetworkStatus = TLS_TRANSPORT_CONNECT_FAILURE;
         NetworkCredentials_t xNetworkCredentials = { 0 };
+        size_t xEndpointIndex = 0;
 
         #ifdef democonfigUSE_AWS_IOT_CORE_BROKER
 
@@ -639,70 +864,70 @@ static BaseType_t prvSocketConnect( NetworkContext_t * pxNetworkContext )
             xNetworkCredentials.privateKeySize = sizeof( democonfigCLIENT_PRIVATE_KEY_PEM );
         #endif
         xNetworkCredentials.disableSni = democonfigDISABLE_SNI;
-    #else /* if defined( democonfigUSE_TLS ) && ( democonfigUSE_TLS == 1 ) */
-        PlaintextTransportStatus_t xNetworkStatus = PLAINTEXT_TRANSPORT_CONNECT_FAILURE;
-    #endif /* if defined( democonfigUSE_TLS ) && ( democonfigUSE_TLS == 1 ) */
+        xNetworkCredentials.maxFragmentLength = democonfigTLS_MAX_FRAGMENT_LENGTH;
 
-    /* We will use a retry mechanism with an exponential backoff mechanism and
-     * jitter.  That is done to prevent a fleet of IoT devices all trying to
-     * reconnect at exactly the same time should they become disconnected at
-     * the same time. We initialize reconnect attempts and interval here. */
-    BackoffAlgorithm_InitializeParams( &xReconnectParams,
-                                       RETRY_BACKOFF_BASE_MS,
-                                       RETRY_MAX_BACKOFF_DELAY_MS,
-                                       RETRY_MAX_ATTEMPTS );
-
-    /* Attempt to connect to MQTT broker. If connection fails, retry after a
-     * timeout. Timeout value will exponentially increase until the maximum
-     * number of attempts are reached.
-     */
-    do
-    {
-        /* Establish a TCP connection with the MQTT broker. This example connects to
-         * the MQTT broker as specified in democonfigMQTT_BROKER_ENDPOINT and
-         * democonfigMQTT_BROKER_PORT at the top of this file. */
-        #if defined( democonfigUSE_TLS ) && ( democonfigUSE_TLS == 1 )
-            LogInfo( ( "Creating a TLS connection to %s:%d.",
-                       democonfigMQTT_BROKER_ENDPOINT,
-                       democonfigMQTT_BROKER_PORT ) );
-            xNetworkStatus = TLS_FreeRTOS_Connect( pxNetworkContext,
-                                                   democonfigMQTT_BROKER_ENDPOINT,
-                                                   democonfigMQTT_BROKER_PORT,
-                                                   &xNetworkCredentials,
-                                                   mqttexampleTRANSPORT_SEND_RECV_TIMEOUT_MS,
-                                                   mqttexampleTRANSPORT_SEND_RECV_TIMEOUT_MS );
-            xConnected = ( xNetworkStatus == TLS_TRANSPORT_SUCCESS ) ? pdPASS : pdFAIL;
-        #else /* if defined( democonfigUSE_TLS ) && ( democonfigUSE_TLS == 1 ) */
-            LogInfo( ( "Creating a TCP connection to %s:%d.",
-                       democonfigMQTT_BROKER_ENDPOINT,
-                       democonfigMQTT_BROKER_PORT ) );
-            xNetworkStatus = Plaintext_FreeRTOS_Connect( pxNetworkContext,
-                                                         democonfigMQTT_BROKER_ENDPOINT,
-                                                         democonfigMQTT_BROKER_PORT,
-                                                         mqttexampleTRANSPORT_SEND_RECV_TIMEOUT_MS,
-                                                         mqttexampleTRANSPORT_SEND_RECV_TIMEOUT_MS );
-            xConnected = ( xNetworkStatus == PLAINTEXT_TRANSPORT_SUCCESS ) ? pdPASS : pdFAIL;
-        #endif /* if defined( democonfigUSE_TLS ) && ( democonfigUSE_TLS == 1 ) */
+        #if ( democonfigRESUME_TLS_SESSION == 1 )
+            xNetworkCredentials.pSession = &xTlsSession;
+        #endif
 
-        if( !xConnected )
-        {
-            /* Get back-off value (in milliseconds) for the next connection retry. */
-            xBackoffAlgStatus = BackoffAlgorithm_GetNextBackoff( &xReconnectParams, uxRand(), &usNextRetryBackOff );
+        #if ( democonfigTLS_ARENA_SIZE > 0 )
+            xNetworkCredentials.pArenaBuffer = ucTlsArena;
+            xNetworkCredentials.arenaBufferSize = sizeof( ucTlsArena );
+        #endif
 
-            if( xBackoffAlgStatus == BackoffAlgorithmSuccess )
-            {
-                LogWarn( ( "Connection to the broker failed. "
-                           "Retrying connection in %hu ms.",
-                           usNextRetryBackOff ) );
-                vTaskDelay( pdMS_TO_TICKS( usNextRetryBackOff ) );
-            }
-        }
+        #if ( democonfigTLS_CORK_BUFFER_SIZE > 0 )
+            xNetworkCredentials.pCorkBuffer = ucTlsCorkBuffer;
+            xNetworkCredentials.corkBufferSize = sizeof( ucTlsCorkBuffer );
+        #endif
+    #else /* if defined( democonfigUSE_TLS ) && ( democonfigUSE_TLS == 1 ) */
+        PlaintextTransportStatus_t xNetworkStatus = PLAINTEXT_TRANSPORT_CONNECT_FAILURE;
+    #endif /* if defined( democonfigUSE_TLS ) && ( democonfigUSE_TLS == 1 ) */
 
-        if( xBackoffAlgStatus == BackoffAlgorithmRetriesExhausted )
+    /* Establish a TCP connection with the MQTT broker. This example connects to
+     * the MQTT broker as specified in democonfigMQTT_BROKER_ENDPOINT and
+     * democonfigMQTT_BROKER_PORT at the top of this file, or to whichever of it
+     * and democonfigMQTT_BROKER_FALLBACK_ENDPOINT answers first. */
+    #if defined( democonfigUSE_TLS ) && ( democonfigUSE_TLS == 1 )
+        LogInfo( ( "Creating a TLS connection to %s:%d.",
+                   democonfigMQTT_BROKER_ENDPOINT,
+                   democonfigMQTT_BROKER_PORT ) );
+        #ifdef democonfigMQTT_BROKER_FALLBACK_ENDPOINT
+            LogInfo( ( "Falling back to %s:%d.",
+                       democonfigMQTT_BROKER_FALLBACK_ENDPOINT,
+                       democonfigMQTT_BROKER_FALLBACK_PORT ) );
+        #endif
+        xNetworkStatus = TLS_FreeRTOS_ConnectEndpoints( pxNetworkContext,
+                                                        xBrokerEndpoints,
+                                                        sizeof( xBrokerEndpoints ) / sizeof( xBrokerEndpoints[ 0 ] ),
+                                                        &xNetworkCredentials,
+                                                        mqttexampleTRANSPORT_SEND_RECV_TIMEOUT_MS,
+                                                        mqttexampleTRANSPORT_SEND_RECV_TIMEOUT_MS,
+                                                        &xEndpointIndex );
+        xConnected = ( xNetworkStatus == TLS_TRANSPORT_SUCCESS ) ? pdPASS : pdFAIL;
+
+        if( xConnected == pdPASS )
         {
-            LogError( ( "Connection to the broker failed, all attempts exhausted." ) );
+            LogInfo( ( "Connected to %s:%d, which takes %u ms to connect to on average.",
+                       xBrokerEndpoints[ xEndpointIndex ].pHostName,
+                       xBrokerEndpoints[ xEndpointIndex ].port,
+                       ( unsigned int ) xBrokerEndpoints[ xEndpointIndex ].latencyMs ) );
+            prvLogTlsMemoryUsage( pxNetworkContext );
+
+            #if ( democonfigRESUME_TLS_SESSION == 1 )
+                prvSaveTlsSession();
+            #endif
         }
-    } while( ( xConnected != pdPASS ) && ( xBackoffAlgStatus == BackoffAlgorithmSuccess ) );
+    #else /* if defined( democonfigUSE_TLS ) && ( democonfigUSE_TLS == 1 ) */
+        LogInfo( ( "Creating a TCP connection to %s:%d.",
+                   democonfigMQTT_BROKER_ENDPOINT,
+                   democonfigMQTT_BROKER_PORT ) );
+        xNetworkStatus = Plaintext_FreeRTOS_Connect( pxNetworkContext,
+                                                     democonfigMQTT_BROKER_ENDPOINT,
+                                                     democonfigMQTT_BROKER_PORT,
+                                                     mqttexampleTRANSPORT_SEND_RECV_TIMEOUT_MS,
+                                                     mqttexampleTRANSPORT_SEND_RECV_TIMEOUT_MS );
+        xConnected = ( xNetworkStatus == PLAINTEXT_TRANSPORT_SUCCESS ) ? pdPASS : pdFAIL;
+    #endif /* if defined( democonfigUSE_TLS ) && ( democonfigUSE_TLS == 1 ) */
 
     /* Set the socket wakeup callback and ensure the read block time. */
     if( xConnected )
@@ -798,59 +1023,122 @@ static void prvIncomingPublishCallback( MQTTAgentContext_t * pMqttAgentContext,
 
 /*-----------------------------------------------------------*/
 
-static void prvMQTTAgentTask( void * pvParameters )
+static MQTTStatus_t prvReconnect( MQTTAgentContext_t * pxMqttAgentContext,
+                                  uint32_t * pulRetryDelayMs )
 {
-    BaseType_t xNetworkResult = pdFAIL;
-    MQTTStatus_t xMQTTStatus = MQTTSuccess, xConnectStatus = MQTTSuccess;
-    MQTTContext_t * pMqttContext = &( xGlobalMqttAgentContext.mqttContext );
+    MQTTStatus_t xResult = MQTTSendFailed;
+    BackoffAlgorithmStatus_t xBackoffAlgStatus;
+    uint16_t usNextRetryBackOff = RETRY_MAX_BACKOFF_DELAY_MS;
 
-    ( void ) pvParameters;
+    ( void ) pxMqttAgentContext;
 
-    do
+    if( prvSocketConnectAttempt( &xNetworkContext ) == pdPASS )
     {
-        /* MQTTAgent_CommandLoop() is effectively the agent implementation.  It
-         * will manage the MQTT protocol until such time that an error occurs,
-         * which could be a disconnect.  If an error occurs the MQTT context on
-         * which the error happened is returned so there can be an attempt to
-         * clean up and reconnect however the application writer prefers. */
-        xMQTTStatus = MQTTAgent_CommandLoop( &xGlobalMqttAgentContext );
-
-        /* Success is returned for disconnect or termination. The socket should
-         * be disconnected. */
-        if( xMQTTStatus == MQTTSuccess )
+        /* MQTT Connect with a persistent session.  This also resends unacknowledged
+         * publishes or restores the subscriptions, as necessary. */
+        xResult = prvMQTTConnect( false );
+
+        if( xResult != MQTTSuccess )
         {
-            /* MQTT Disconnect. Disconnect the socket. */
-            xNetworkResult = prvSocketDisconnect( &xNetworkContext );
+            ( void ) prvSocketDisconnect( &xNetworkContext );
         }
-        /* Error. */
-        else
+    }
+
+    if( xResult == MQTTSuccess )
+    {
+        #if ( democonfigCREATE_CODE_SIGNING_OTA_DEMO == 1 )
+            {
+                vResumeOTACodeSigningDemo();
+            }
+        #endif
+    }
+    else
+    {
+        /* Get back-off value (in milliseconds) for the next connection retry.
+         * Keep retrying at the maximum delay once the retries are exhausted, as
+         * the other tasks rely on the connection being restored eventually. */
+        xBackoffAlgStatus = BackoffAlgorithm_GetNextBackoff( &xReconnectBackoff, uxRand(), &usNextRetryBackOff );
+
+        if( xBackoffAlgStatus == BackoffAlgorithmRetriesExhausted )
         {
-            #if ( democonfigCREATE_CODE_SIGNING_OTA_DEMO == 1 )
-                {
-                    vSuspendOTACodeSigningDemo();
-                }
-            #endif
+            usNextRetryBackOff = RETRY_MAX_BACKOFF_DELAY_MS;
+        }
 
-            /* Reconnect TCP. */
-            xNetworkResult = prvSocketDisconnect( &xNetworkContext );
-            configASSERT( xNetworkResult == pdPASS );
-            xNetworkResult = prvSocketConnect( &xNetworkContext );
-            configASSERT( xNetworkResult == pdPASS );
-            pMqttContext->connectStatus = MQTTNotConnected;
-            /* MQTT Connect with a persistent session. */
-            xConnectStatus = prvMQTTConnect( false );
-            configASSERT( xConnectStatus == MQTTSuccess );
-
-            #if ( democonfigCREATE_CODE_SIGNING_OTA_DEMO == 1 )
-                {
-                    if( xMQTTStatus == MQTTSuccess )
-                    {
-                        vResumeOTACodeSigningDemo();
-                    }
-                }
-            #endif
+        *pulRetryDelayMs = usNextRetryBackOff;
+    }
+
+    return xResult;
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvDisconnect( MQTTAgentContext_t * pxMqttAgentContext )
+{
+    ( void ) pxMqttAgentContext;
+
+    #if ( democonfigCREATE_CODE_SIGNING_OTA_DEMO == 1 )
+        {
+            vSuspendOTACodeSigningDemo();
         }
-    } while( xMQTTStatus != MQTTSuccess );
+    #endif
+
+    ( void ) prvSocketDisconnect( &xNetworkContext );
+
+    /* Space out the reconnect attempts that follow a lost connection. */
+    BackoffAlgorithm_InitializeParams( &xReconnectBackoff,
+                                       RETRY_BACKOFF_BASE_MS,
+                                       RETRY_MAX_BACKOFF_DELAY_MS,
+                                       RETRY_MAX_ATTEMPTS );
+}
+
+/*-----------------------------------------------------------*/
+
+#if defined( democonfigUSE_TLS ) && ( democonfigUSE_TLS == 1 ) && ( democonfigTLS_CORK_BUFFER_SIZE > 0 )
+
+    static MQTTStatus_t prvFlush( MQTTAgentContext_t * pxMqttAgentContext )
+    {
+        ( void ) pxMqttAgentContext;
+
+        /* A flush that times out leaves the bytes to be sent by the next one,
+         * so only an error is a failure. */
+        return ( TLS_FreeRTOS_Flush( &xNetworkContext ) < 0 ) ? MQTTSendFailed : MQTTSuccess;
+    }
+#endif /* if defined( democonfigUSE_TLS ) && ( democonfigUSE_TLS == 1 ) && ( democonfigTLS_CORK_BUFFER_SIZE > 0 ) */
+
+/*-----------------------------------------------------------*/
+
+static void prvMQTTAgentTask( void * pvParameters )
+{
+    MQTTStatus_t xMQTTStatus = MQTTSuccess;
+    const MQTTAgentConnectionInterface_t xConnectionInterface =
+    {
+        .reconnect  = prvReconnect,
+        .disconnect = prvDisconnect,
+        #if defined( democonfigUSE_TLS ) && ( democonfigUSE_TLS == 1 ) && ( democonfigTLS_CORK_BUFFER_SIZE > 0 )
+            .flush  = prvFlush
+        #else
+            .flush  = NULL
+        #endif
+    };
+
+    ( void ) pvParameters;
+
+    /* Let the agent re-establish the connection itself if it is lost, so it
+     * can keep accepting commands from the other tasks while it does so. */
+    xMQTTStatus = MQTTAgent_SetConnectionInterface( &xGlobalMqttAgentContext, &xConnectionInterface );
+    configASSERT( xMQTTStatus == MQTTSuccess );
+
+    /* MQTTAgent_CommandLoop() is effectively the agent implementation.  It
+     * will manage the MQTT protocol, including reconnecting, until such time
+     * that a disconnect or terminate command is received. */
+    xMQTTStatus = MQTTAgent_CommandLoop( &xGlobalMqttAgentContext );
+
+    /* The agent closes the socket after a disconnect, but not if the command
+     * loop was terminated while still connected. */
+    if( MQTTAgent_GetConnectionState( &xGlobalMqttAgentContext ) != MQTTAgentStateDisconnected )
+    {
+        ( void ) prvSocketDisconnect( &xNetworkContext );
+    }
 }
 
 /*-----------------------------------------------------------*/
@@ -860,6 +1148,10 @@ static void prvConnectToMQTTBroker( void )
     BaseType_t xNetworkStatus = pdFAIL;
     MQTTStatus_t xMQTTStatus;
 
+    #if defined( democonfigUSE_TLS ) && ( democonfigUSE_TLS == 1 ) && ( democonfigRESUME_TLS_SESSION == 1 )
+        prvLoadTlsSession();
+    #endif
+
     /* Connect a TCP socket to the broker. */
     xNetworkStatus = prvSocketConnect( &xNetworkContext );
     configASSERT( xNetworkStatus == pdPASS );
@@ -868,12 +1160,120 @@ static void prvConnectToMQTTBroker( void )
     xMQTTStatus = prvMQTTInit();
     configASSERT( xMQTTStatus == MQTTSuccess );
 
-    /* Form an MQTT connection without a persistent session. */
-    xMQTTStatus = prvMQTTConnect( true );
+    #if ( democonfigCREATE_SESSION_STORE == 1 )
+        {
+            /* Reload the publishes left unacknowledged by a reset, then form an
+             * MQTT connection with a persistent session so the broker's copy
+             * of the session can be resumed. */
+            ( void ) loadMQTTSession( &xGlobalMqttAgentContext );
+            xMQTTStatus = prvMQTTConnect( false );
+        }
+    #else
+        {
+            /* Form an MQTT connection without a persistent session. */
+            xMQTTStatus = prvMQTTConnect( true );
+        }
+    #endif
     configASSERT( xMQTTStatus == MQTTSuccess );
 }
 /*-----------------------------------------------------------*/
 
+#if defined( democonfigUSE_TLS ) && ( democonfigUSE_TLS == 1 )
+
+    static void prvLogTlsMemoryUsage( const NetworkContext_t * pxNetworkContext )
+    {
+        MbedtlsArenaStats_t xArenaStats;
+        uint32_t ulHeapAllocations = 0;
+
+        TLS_FreeRTOS_GetMemoryStats( pxNetworkContext, &xArenaStats, &ulHeapAllocations );
+
+        /* With democonfigTLS_ARENA_SIZE set to 0 every allocation is a heap
+         * allocation, which gives the figures to compare against. */
+        LogInfo( ( "TLS connect made %u mbed TLS allocations from the arena and %u from the heap. "
+                   "Arena peak usage %u of %u bytes.",
+                   ( unsigned int ) xArenaStats.arenaAllocations,
+                   ( unsigned int ) ulHeapAllocations,
+                   ( unsigned int ) xArenaStats.peakBytesInUse,
+                   ( unsigned int ) democonfigTLS_ARENA_SIZE ) );
+    }
+#endif /* if defined( democonfigUSE_TLS ) && ( democonfigUSE_TLS == 1 ) */
+
+/*-----------------------------------------------------------*/
+
+#if defined( democonfigUSE_TLS ) && ( democonfigUSE_TLS == 1 ) && ( democonfigRESUME_TLS_SESSION == 1 )
+
+    static void prvLoadTlsSession( void )
+    {
+        TLS_FreeRTOS_InitSession( &xTlsSession );
+
+        #ifdef democonfigTLS_SESSION_FILE_NAME
+            {
+                static uint8_t ucSessionBuffer[ mqttexampleTLS_SESSION_BUFFER_SIZE ];
+                FileStorageHandle_t xFile;
+                size_t xLength;
+
+                xFile = FileStorage_Open( democonfigTLS_SESSION_FILE_NAME );
+
+                if( xFile != NULL )
+                {
+                    xLength = FileStorage_Size( xFile );
+
+                    /* An empty file means no session has been saved yet. */
+                    if( ( xLength > 0U ) &&
+                        ( xLength <= sizeof( ucSessionBuffer ) ) &&
+                        ( FileStorage_Read( xFile, 0U, ucSessionBuffer, xLength ) == pdTRUE ) &&
+                        ( TLS_FreeRTOS_LoadSession( &xTlsSession, ucSessionBuffer, xLength ) == TLS_TRANSPORT_SUCCESS ) )
+                    {
+                        LogInfo( ( "Restored the TLS session saved before the reset." ) );
+                    }
+
+                    FileStorage_Close( xFile );
+                }
+            }
+        #endif /* ifdef democonfigTLS_SESSION_FILE_NAME */
+    }
+
+/*-----------------------------------------------------------*/
+
+    static void prvSaveTlsSession( void )
+    {
+        LogInfo( ( "TLS handshake took %u ms. %u full and %u resumed handshakes so far.",
+                   ( unsigned int ) xTlsSession.lastHandshakeTimeMs,
+                   ( unsigned int ) xTlsSession.fullHandshakes,
+                   ( unsigned int ) xTlsSession.resumedHandshakes ) );
+
+        #ifdef democonfigTLS_SESSION_FILE_NAME
+            {
+                static uint8_t ucSessionBuffer[ mqttexampleTLS_SESSION_BUFFER_SIZE ];
+                FileStorageHandle_t xFile;
+                size_t xLength = 0;
+
+                /* Failing to save the session only means the first connection
+                 * after a reset performs a full handshake. */
+                if( TLS_FreeRTOS_SaveSession( &xTlsSession, ucSessionBuffer, sizeof( ucSessionBuffer ), &xLength ) == TLS_TRANSPORT_SUCCESS )
+                {
+                    ( void ) FileStorage_Remove( democonfigTLS_SESSION_FILE_NAME );
+                    xFile = FileStorage_Open( democonfigTLS_SESSION_FILE_NAME );
+
+                    if( xFile != NULL )
+                    {
+                        if( ( FileStorage_Write( xFile, 0U, ucSessionBuffer, xLength ) != pdTRUE ) ||
+                            ( FileStorage_Sync( xFile ) != pdTRUE ) )
+                        {
+                            LogWarn( ( "Failed to save the TLS session." ) );
+                        }
+
+                        FileStorage_Close( xFile );
+                    }
+                }
+            }
+        #endif /* ifdef democonfigTLS_SESSION_FILE_NAME */
+    }
+
+#endif /* if defined( democonfigUSE_TLS ) && ( democonfigUSE_TLS == 1 ) && ( democonfigRESUME_TLS_SESSION == 1 ) */
+
+/*-----------------------------------------------------------*/
+
 static void prvConnectAndCreateDemoTasks( void * pvParameters )
 {
     ( void ) pvParameters;
@@ -885,6 +1285,29 @@ static void prvConnectAndCreateDemoTasks( void * pvParameters )
      * same. */
     prvConnectToMQTTBroker();
 
+    /* The dispatcher tasks must exist before any demo task subscribes with
+     * dispatchIncomingPublishCallback(). */
+    #if ( democonfigCREATE_SUBSCRIPTION_DISPATCHER == 1 )
+        {
+            if( startSubscriptionDispatcher( democonfigSUBSCRIPTION_DISPATCHER_STACK_SIZE,
+                                             tskIDLE_PRIORITY + 1 ) == false )
+            {
+                configASSERT( 0 );
+            }
+        }
+    #endif
+
+    /* Publishes left in the outbox by a previous run are sent once the outbox
+     * task starts. */
+    #if ( democonfigCREATE_OUTBOX == 1 )
+        {
+            if( startOutbox( democonfigOUTBOX_STACK_SIZE, tskIDLE_PRIORITY ) == false )
+            {
+                configASSERT( 0 );
+            }
+        }
+    #endif
+
     /* Selectively create demo tasks as per the compile time constant settings. */
     #if ( democonfigCREATE_LARGE_MESSAGE_SUB_PUB_TASK == 1 )
         {
@@ -37,6 +37,12 @@
  * it waits for the published data to be published back to it from the MQTT
  * broker - checking that the received data matches the transmitted data
  * exactly.
+ *
+ * The subscription is registered in mailbox mode, so the MQTT agent task only
+ * places each incoming publish into a mailbox owned by this demo, and the demo
+ * task checks the data at its own pace.  The mailbox holds on to the agent's
+ * network buffer rather than copying the large payload whenever the agent has
+ * a spare network buffer to move to.
  */
 
 /* Standard includes. */
@@ -62,6 +68,9 @@
 /* Subscription manager header include. */
 #include "subscription_manager.h"
 
+/* Subscription mailbox header include. */
+#include "subscription_mailbox.h"
+
 /**
  * @brief This demo uses task notifications to signal tasks from MQTT callback
  * functions.  mqttexampleMS_TO_WAIT_FOR_NOTIFICATION defines the time, in ticks,
@@ -89,6 +98,13 @@
 #define mqttexamplePROTOCOL_OVERHEAD                      ( 50 )
 #define mqttexampleMAX_PAYLOAD_LENGTH                     ( MQTT_AGENT_NETWORK_BUFFER_SIZE - mqttexamplePROTOCOL_OVERHEAD )
 
+/**
+ * @brief The number of incoming publishes the demo's mailbox can hold, and the
+ * size of each.  Each slot holds both the topic and the payload of a publish.
+ */
+#define mqttexampleMAILBOX_SLOTS                          ( 2U )
+#define mqttexampleMAILBOX_SLOT_SIZE                      ( mqttexampleMAX_PAYLOAD_LENGTH + 32U )
+
 /*-----------------------------------------------------------*/
 
 /**
@@ -119,22 +135,6 @@ struct CommandContext
 static void prvSubscribeCommandCallback( void * pxCommandContext,
                                          MQTTAgentReturnInfo_t * pxReturnInfo );
 
-/**
- * @brief Passed into MQTTAgent_Subscribe() as the callback to execute when
- * there is an incoming publish on the topic being subscribed to.  Its
- * implementation copies the incoming MQTT message payload into a buffer so the
- * task can validate the received data matches the outgoing data (the task
- * subscribes to the same topic that it publishes to, so any outgoing data on
- * that topic is also received back from the MQTT broker).
- *
- * See https://freertos.org/mqtt/mqtt-agent-demo.html#example_mqtt_api_call
- *
- * @param[in] pxSubscriptionContext Context of the initial command.
- * @param[in] pxCommandContext Context of the initial command.
- */
-static void prvIncomingPublishCallback( void * pxSubscriptionContext,
-                                        MQTTPublishInfo_t * pxPublishInfo );
-
 /**
  * @brief Called by the task to wait for a notification from a callback function
  * after the task first executes either MQTTAgent_Publish()* or
@@ -167,12 +167,11 @@ static void prvCreateMQTTPayload( char * pcBuffer,
  * results in all outgoing publishes being published back to the task
  * (effectively echoed back).
  *
- * @param[in] pcReceivedPublishPayload The buffer into which the callback that
- * executes on reception of incoming publish messages will write the payload
- * from the incoming message.  This is stored in the callback context so it can
- * be accessed from within the callback function.
+ * @param[in] pxMailbox The mailbox into which incoming publish messages are
+ * copied.  This is stored in the callback context so it can be registered with
+ * the subscription manager once the subscription is acknowledged.
  */
-static void prvSubscribeToTopic( char * pcReceivedPublishPayload );
+static void prvSubscribeToTopic( SubscriptionMailbox_t * pxMailbox );
 
 /**
  * @brief The function that implements the task demonstrated by this file.
@@ -215,13 +214,14 @@ static void prvSubscribeCommandCallback( void * pxCommandContext,
      * subscribed by this demo. */
     if( pxReturnInfo->returnCode == MQTTSuccess )
     {
-        /* Add subscription so that incoming publishes are routed to the application
-         * callback. */
+        /* Add subscription so that incoming publishes are copied into the
+         * demo task's mailbox. */
         xSubscriptionAdded = addSubscription( ( SubscriptionElement_t * ) xGlobalMqttAgentContext.pIncomingCallbackContext,
                                               pcTopicFilter,
                                               ( uint16_t ) strlen( pcTopicFilter ),
-                                              prvIncomingPublishCallback,
-                                              pxApplicationDefinedContext );
+                                              MQTTQoS1,
+                                              mailboxIncomingPublishCallback,
+                                              pxApplicationDefinedContext->pvTag );
 
         if( xSubscriptionAdded == false )
         {
@@ -236,26 +236,6 @@ static void prvSubscribeCommandCallback( void * pxCommandContext,
 
 /*-----------------------------------------------------------*/
 
-static void prvIncomingPublishCallback( void * pxSubscriptionContext,
-                                        MQTTPublishInfo_t * pxPublishInfo )
-{
-    CommandContext_t * pxApplicationDefinedContext = ( CommandContext_t * ) pxSubscriptionContext;
-
-    /* Check the incoming message will fit in the buffer before writing it to
-     * buffer so the demo task can check the data received from the topic
-     * matches the data previously written to the same topic. */
-    configASSERT( pxPublishInfo->payloadLength <= mqttexampleMAX_PAYLOAD_LENGTH );
-    memcpy( pxApplicationDefinedContext->pvTag,
-            ( void * ) pxPublishInfo->pPayload,
-            pxPublishInfo->payloadLength );
-
-    /* Send a notification to the task in case it is waiting for this incoming
-     * message. */
-    xTaskNotifyGive( pxApplicationDefinedContext->xTaskToNotify );
-}
-
-/*-----------------------------------------------------------*/
-
 static uint32_t prvWaitForCommandAcknowledgment( void )
 {
     uint32_t ulReturn;
@@ -291,7 +271,7 @@ static void prvCreateMQTTPayload( char * pcBuffer,
 
 /*-----------------------------------------------------------*/
 
-static void prvSubscribeToTopic( char * pcReceivedPublishPayload )
+static void prvSubscribeToTopic( SubscriptionMailbox_t * pxMailbox )
 {
     MQTTAgentSubscribeArgs_t xSubscribeArgs;
     MQTTSubscribeInfo_t xSubscribeInfo;
@@ -305,7 +285,7 @@ static void prvSubscribeToTopic( char * pcReceivedPublishPayload )
     /* Record the handle of this task in the context that will be used within
     * the callbacks so the callbacks can send a notification to this task. */
     xApplicationDefinedContext.xTaskToNotify = xTaskGetCurrentTaskHandle();
-    xApplicationDefinedContext.pvTag = ( void * ) pcReceivedPublishPayload;
+    xApplicationDefinedContext.pvTag = ( void * ) pxMailbox;
 
     /* Ensure the return status is not accidentally MQTTSuccess already. */
     xApplicationDefinedContext.xReturnStatus = MQTTBadParameter;
@@ -357,21 +337,36 @@ static void prvSubscribeToTopic( char * pcReceivedPublishPayload )
 static void prvLargeMessageSubscribePublishTask( void * pvParameters )
 {
     static char pcMaxPayloadMessage[ mqttexampleMAX_PAYLOAD_LENGTH ];
-    static char pcReceivedPublishPayload[ mqttexampleMAX_PAYLOAD_LENGTH ];
+    static uint8_t ucMailboxSlots[ mqttexampleMAILBOX_SLOTS * mqttexampleMAILBOX_SLOT_SIZE ];
+    static SubscriptionMailboxMessage_t xMailboxMessages[ mqttexampleMAILBOX_SLOTS ];
+    static SubscriptionMailbox_t xMailbox;
+    SubscriptionMailboxMessage_t * pxReceivedMessage;
     MQTTPublishInfo_t xPublishInfo = { 0 };
     BaseType_t x;
     MQTTStatus_t xCommandAdded;
-    uint32_t ulNotificationValue;
+    bool xMailboxCreated;
     CommandInfo_t xCommandParams = { 0 };
 
     ( void ) pvParameters;
 
     prvCreateMQTTPayload( pcMaxPayloadMessage, mqttexampleMAX_PAYLOAD_LENGTH );
 
+    /* Create the mailbox into which the MQTT agent task copies publishes
+     * echoed back from the broker.  Only the most recent echoes are of
+     * interest, so older ones are dropped if this task falls behind. */
+    xMailboxCreated = initSubscriptionMailbox( &xMailbox,
+                                               xMailboxMessages,
+                                               ucMailboxSlots,
+                                               mqttexampleMAILBOX_SLOTS,
+                                               mqttexampleMAILBOX_SLOT_SIZE,
+                                               eMailboxDropOldest,
+                                               0U );
+    configASSERT( xMailboxCreated == true );
+
     /* Subscribe to the topic that this task will also publish to so all
      * outgoing publishes to that topic are published back to this task
      * effectively echoed back to this task). */
-    prvSubscribeToTopic( pcReceivedPublishPayload );
+    prvSubscribeToTopic( &xMailbox );
 
     /* Prepare the publish message. */
     memset( ( void * ) &xPublishInfo, 0x00, sizeof( xPublishInfo ) );
@@ -383,15 +378,11 @@ static void prvLargeMessageSubscribePublishTask( void * pvParameters )
 
     for( ; ; )
     {
-        /* Clear out the buffer used to receive incoming publishes.  The
-         * prvIncomingPublishCallback() callback writes to this buffer. */
-        memset( pcReceivedPublishPayload, 0x00, sizeof( pcReceivedPublishPayload ) );
-
         /* Publish to the topic to which this task is also subscribed to
          * receive an echo back.  Note the command callback is left NULL so this
          * task will not be notified of when the PUBLISH ack is received - instead
-         * it just waits for a notification from prvSubscribeCommandCallback() that
-         * the incoming publish (the message being echoed back) has been received. */
+         * it just waits for the incoming publish (the message being echoed back)
+         * to arrive in its mailbox. */
         LogInfo( ( "Sending large publish request to agent with message on topic \"%s\"",
                    pcTopicFilter ) );
         xCommandParams.blockTimeMs = mqttexampleMAX_COMMAND_SEND_BLOCK_TIME_MS;
@@ -403,19 +394,24 @@ static void prvLargeMessageSubscribePublishTask( void * pvParameters )
         /* Ensure the messages was sent to the MQTT agent task. */
         configASSERT( xCommandAdded == MQTTSuccess );
 
-        /* Wait for the publish back to this task.  prvSubscribeCommandCallback()
-         * will notify this task. */
-        ulNotificationValue = ulTaskNotifyTake( pdFALSE, mqttexampleMS_TO_WAIT_FOR_NOTIFICATION );
+        /* Wait for the publish back to this task.  The MQTT agent task copies
+         * it into the mailbox. */
+        x = 1;
+        pxReceivedMessage = receiveFromMailbox( &xMailbox, pdMS_TO_TICKS( mqttexampleMS_TO_WAIT_FOR_NOTIFICATION ) );
+        configASSERT( pxReceivedMessage != NULL );
 
-        /* Only expect a single notification from the callback that executes
-         * when the incoming publish (the message being echoed back) is
-         * received. */
-        configASSERT( ulNotificationValue == 1 );
+        /* Check the echoed payload matches the data that was published by this
+         * task, then hand the mailbox slot back for reuse. */
+        if( pxReceivedMessage != NULL )
+        {
+            if( pxReceivedMessage->xPublishInfo.payloadLength == mqttexampleMAX_PAYLOAD_LENGTH )
+            {
+                x = memcmp( pcMaxPayloadMessage, pxReceivedMessage->xPublishInfo.pPayload, mqttexampleMAX_PAYLOAD_LENGTH );
+            }
+
+            releaseMailboxMessage( &xMailbox, pxReceivedMessage );
+        }
 
-        /* prvSubscribeCommandCallback() should have copied the payload form
-         * the incoming MQTT publish to receivedEchoPayload.  Check this matches
-         * the data that was published by this task. */
-        x = memcmp( pcMaxPayloadMessage, pcReceivedPublishPayload, mqttexampleMAX_PAYLOAD_LENGTH );
         configASSERT( x == 0 );
 
         if( x == 0 )
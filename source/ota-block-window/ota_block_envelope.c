@@ -0,0 +1,413 @@
+/*
+ * FreeRTOS V202011.00
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://aws.amazon.com/freertos
+ *
+ */
+
+/**
+ * @file ota_block_envelope.c
+ * @brief Implements the decoding of OTA stream block messages.
+ *
+ * The specialized parser reads the head of each data item, its major type and
+ * argument, straight from the message.  It takes the map's length from its
+ * head, then for each entry a one character text key and an integer or byte
+ * string value, and stops at the end of the message.  Anything else, such as
+ * an indefinite length item, a 64 bit argument, an unknown or repeated key, a
+ * missing field or bytes after the map, sends the message to the general
+ * parser, which decides whether it is a block.  The specialized parser never
+ * accepts a message the general parser would reject, nor decodes one to
+ * different fields.
+ */
+
+/* Standard includes. */
+#include <string.h>
+
+/* OTA configuration include. */
+#include "ota_config.h"
+
+/* Block envelope include. */
+#include "ota_block_envelope.h"
+
+/* CBOR include. */
+#include "cbor.h"
+
+/**
+ * @brief CBOR major types, the top three bits of the first byte of an item.
+ */
+#define otaBlockEnvelopeMAJOR_UNSIGNED       ( 0U )
+#define otaBlockEnvelopeMAJOR_NEGATIVE       ( 1U )
+#define otaBlockEnvelopeMAJOR_BYTE_STRING    ( 2U )
+#define otaBlockEnvelopeMAJOR_TEXT_STRING    ( 3U )
+#define otaBlockEnvelopeMAJOR_MAP            ( 5U )
+
+/**
+ * @brief Values of the low five bits of the first byte of an item, which are
+ * the argument itself below otaBlockEnvelopeARGUMENT_1_BYTE, or the size of the
+ * argument that follows.
+ */
+#define otaBlockEnvelopeARGUMENT_1_BYTE      ( 24U )
+#define otaBlockEnvelopeARGUMENT_2_BYTES     ( 25U )
+#define otaBlockEnvelopeARGUMENT_4_BYTES     ( 26U )
+
+/**
+ * @brief Most entries in a block message the specialized parser reads, one for
+ * each key it knows.
+ */
+#define otaBlockEnvelopeMAX_ENTRIES          ( 4U )
+
+/**
+ * @brief Bits recording the keys found in a block message.
+ */
+#define otaBlockEnvelopeFOUND_FILE_ID        ( 1U << 0 )
+#define otaBlockEnvelopeFOUND_BLOCK_ID       ( 1U << 1 )
+#define otaBlockEnvelopeFOUND_BLOCK_SIZE     ( 1U << 2 )
+#define otaBlockEnvelopeFOUND_PAYLOAD        ( 1U << 3 )
+
+/**
+ * @brief The keys every block message holds.
+ */
+#define otaBlockEnvelopeFOUND_REQUIRED \
+    ( otaBlockEnvelopeFOUND_FILE_ID | otaBlockEnvelopeFOUND_BLOCK_ID | otaBlockEnvelopeFOUND_PAYLOAD )
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Read the head of a data item.
+ *
+ * @param[in,out] ppucNext The next byte of the message, advanced past the head.
+ * @param[in] pucEnd The end of the message.
+ * @param[out] pucMajorType Set to the item's major type.
+ * @param[out] pulArgument Set to the item's argument.
+ *
+ * @return `true` if the head was read, or `false` if it runs past the end of
+ * the message or has an argument the specialized parser does not read.
+ */
+static bool prvReadHead( const uint8_t ** ppucNext,
+                         const uint8_t * pucEnd,
+                         uint8_t * pucMajorType,
+                         uint32_t * pulArgument );
+
+/**
+ * @brief Read an integer value that fits in 32 bits.
+ *
+ * @param[in,out] ppucNext The next byte of the message, advanced past the value.
+ * @param[in] pucEnd The end of the message.
+ * @param[out] plValue Set to the value.
+ *
+ * @return `true` if the value was read, otherwise `false`.
+ */
+static bool prvReadInt32( const uint8_t ** ppucNext,
+                          const uint8_t * pucEnd,
+                          int32_t * plValue );
+
+/**
+ * @brief Decode a block message with the specialized parser.
+ *
+ * @param[in] pucMessage The CBOR encoded block message.
+ * @param[in] xMessageLength Length of pucMessage.
+ * @param[out] pxEnvelope Set to the decoded fields.
+ *
+ * @return `true` if the message was decoded, or `false` if it must be decoded
+ * by the general parser.
+ */
+static bool prvDecodeSpecialized( const uint8_t * pucMessage,
+                                  size_t xMessageLength,
+                                  OtaBlockEnvelope_t * pxEnvelope );
+
+/**
+ * @brief Check the decoded fields of a block message.
+ *
+ * @param[in] pxEnvelope The decoded fields.
+ *
+ * @return `true` if the fields are those of a block, otherwise `false`.
+ */
+static bool prvIsBlock( const OtaBlockEnvelope_t * pxEnvelope );
+
+/*-----------------------------------------------------------*/
+
+static bool prvReadHead( const uint8_t ** ppucNext,
+                         const uint8_t * pucEnd,
+                         uint8_t * pucMajorType,
+                         uint32_t * pulArgument )
+{
+    const uint8_t * pucNext = *ppucNext;
+    uint8_t ucInfo;
+    size_t xArgumentSize = 0U;
+    bool xRead = false;
+
+    if( pucNext < pucEnd )
+    {
+        *pucMajorType = ( uint8_t ) ( *pucNext >> 5 );
+        ucInfo = ( uint8_t ) ( *pucNext & 0x1FU );
+        pucNext++;
+
+        if( ucInfo < otaBlockEnvelopeARGUMENT_1_BYTE )
+        {
+            *pulArgument = ucInfo;
+            xRead = true;
+        }
+        else if( ucInfo <= otaBlockEnvelopeARGUMENT_4_BYTES )
+        {
+            /* 1, 2 or 4 bytes, in network order.  Eight byte arguments and
+             * indefinite lengths are left to the general parser. */
+            xArgumentSize = ( size_t ) 1U << ( ucInfo - otaBlockEnvelopeARGUMENT_1_BYTE );
+
+            if( ( size_t ) ( pucEnd - pucNext ) >= xArgumentSize )
+            {
+                *pulArgument = 0U;
+
+                while( xArgumentSize > 0U )
+                {
+                    *pulArgument = ( *pulArgument << 8 ) | *pucNext;
+                    pucNext++;
+                    xArgumentSize--;
+                }
+
+                xRead = true;
+            }
+        }
+        else
+        {
+            /* Not read by the specialized parser. */
+        }
+    }
+
+    *ppucNext = pucNext;
+
+    return xRead;
+}
+/*-----------------------------------------------------------*/
+
+static bool prvReadInt32( const uint8_t ** ppucNext,
+                          const uint8_t * pucEnd,
+                          int32_t * plValue )
+{
+    uint8_t ucMajorType = 0U;
+    uint32_t ulArgument = 0U;
+    bool xRead = false;
+
+    if( ( prvReadHead( ppucNext, pucEnd, &ucMajorType, &ulArgument ) == true ) &&
+        ( ulArgument <= ( uint32_t ) INT32_MAX ) )
+    {
+        if( ucMajorType == otaBlockEnvelopeMAJOR_UNSIGNED )
+        {
+            *plValue = ( int32_t ) ulArgument;
+            xRead = true;
+        }
+        else if( ucMajorType == otaBlockEnvelopeMAJOR_NEGATIVE )
+        {
+            /* A negative integer's argument is -1 minus its value. */
+            *plValue = -1 - ( int32_t ) ulArgument;
+            xRead = true;
+        }
+        else
+        {
+            /* Not an integer. */
+        }
+    }
+
+    return xRead;
+}
+/*-----------------------------------------------------------*/
+
+static bool prvDecodeSpecialized( const uint8_t * pucMessage,
+                                  size_t xMessageLength,
+                                  OtaBlockEnvelope_t * pxEnvelope )
+{
+    const uint8_t * pucNext = pucMessage;
+    const uint8_t * pucEnd = pucMessage + xMessageLength;
+    uint8_t ucMajorType = 0U, ucKey;
+    uint32_t ulEntries = 0U, ulArgument = 0U, ulFound = 0U, ulKeyFound;
+    int32_t lBlockSize = 0;
+    bool xDecoded;
+
+    xDecoded = ( prvReadHead( &pucNext, pucEnd, &ucMajorType, &ulEntries ) == true ) &&
+               ( ucMajorType == otaBlockEnvelopeMAJOR_MAP ) &&
+               ( ulEntries <= otaBlockEnvelopeMAX_ENTRIES );
+
+    while( ( xDecoded == true ) && ( ulEntries > 0U ) )
+    {
+        /* Every key is a text string of one character, which is all that is
+         * compared. */
+        xDecoded = ( prvReadHead( &pucNext, pucEnd, &ucMajorType, &ulArgument ) == true ) &&
+                   ( ucMajorType == otaBlockEnvelopeMAJOR_TEXT_STRING ) &&
+                   ( ulArgument == 1U ) &&
+                   ( pucNext < pucEnd );
+
+        if( xDecoded == false )
+        {
+            break;
+        }
+
+        ucKey = *pucNext;
+        pucNext++;
+
+        switch( ucKey )
+        {
+            case 'f':
+                ulKeyFound = otaBlockEnvelopeFOUND_FILE_ID;
+                xDecoded = prvReadInt32( &pucNext, pucEnd, &pxEnvelope->lFileId );
+                break;
+
+            case 'i':
+                ulKeyFound = otaBlockEnvelopeFOUND_BLOCK_ID;
+                xDecoded = prvReadInt32( &pucNext, pucEnd, &pxEnvelope->lBlockId );
+                break;
+
+            case 'l':
+                /* Not used, but must be an integer. */
+                ulKeyFound = otaBlockEnvelopeFOUND_BLOCK_SIZE;
+                xDecoded = prvReadInt32( &pucNext, pucEnd, &lBlockSize );
+                break;
+
+            case 'p':
+                ulKeyFound = otaBlockEnvelopeFOUND_PAYLOAD;
+                xDecoded = ( prvReadHead( &pucNext, pucEnd, &ucMajorType, &ulArgument ) == true ) &&
+                           ( ucMajorType == otaBlockEnvelopeMAJOR_BYTE_STRING ) &&
+                           ( ( size_t ) ( pucEnd - pucNext ) >= ulArgument );
+
+                if( xDecoded == true )
+                {
+                    pxEnvelope->pucPayload = pucNext;
+                    pxEnvelope->xPayloadLength = ulArgument;
+                    pucNext += ulArgument;
+                }
+
+                break;
+
+            default:
+                /* An unknown key, left to the general parser to skip. */
+                ulKeyFound = 0U;
+                xDecoded = false;
+                break;
+        }
+
+        /* The general parser takes the first of repeated keys, which is not
+         * worth tracking here. */
+        if( ( ulFound & ulKeyFound ) != 0U )
+        {
+            xDecoded = false;
+        }
+
+        ulFound |= ulKeyFound;
+        ulEntries--;
+    }
+
+    return( ( xDecoded == true ) &&
+            ( ( ulFound & otaBlockEnvelopeFOUND_REQUIRED ) == otaBlockEnvelopeFOUND_REQUIRED ) &&
+            ( pucNext == pucEnd ) );
+}
+/*-----------------------------------------------------------*/
+
+static bool prvIsBlock( const OtaBlockEnvelope_t * pxEnvelope )
+{
+    return( ( pxEnvelope->lBlockId >= 0 ) &&
+            ( pxEnvelope->xPayloadLength <= otaconfigFILE_BLOCK_SIZE ) );
+}
+/*-----------------------------------------------------------*/
+
+bool decodeOtaBlockEnvelope( const uint8_t * pucMessage,
+                             size_t xMessageLength,
+                             OtaBlockEnvelope_t * pxEnvelope )
+{
+    bool xDecoded;
+
+    if( prvDecodeSpecialized( pucMessage, xMessageLength, pxEnvelope ) == true )
+    {
+        xDecoded = prvIsBlock( pxEnvelope );
+    }
+    else
+    {
+        xDecoded = decodeOtaBlockEnvelopeGeneric( pucMessage, xMessageLength, pxEnvelope );
+    }
+
+    return xDecoded;
+}
+/*-----------------------------------------------------------*/
+
+bool decodeOtaBlockEnvelopeGeneric( const uint8_t * pucMessage,
+                                    size_t xMessageLength,
+                                    OtaBlockEnvelope_t * pxEnvelope )
+{
+    CborParser xParser;
+    CborValue xMap, xValue;
+    CborError xError;
+    int lValue = -1;
+
+    xError = cbor_parser_init( pucMessage, xMessageLength, 0, &xParser, &xMap );
+
+    if( ( xError == CborNoError ) && ( cbor_value_is_map( &xMap ) == false ) )
+    {
+        xError = CborErrorIllegalType;
+    }
+
+    /* File and block IDs. */
+    if( xError == CborNoError )
+    {
+        xError = cbor_value_map_find_value( &xMap, "f", &xValue );
+    }
+
+    if( ( xError == CborNoError ) && ( cbor_value_is_integer( &xValue ) == true ) )
+    {
+        xError = cbor_value_get_int( &xValue, &lValue );
+        pxEnvelope->lFileId = ( int32_t ) lValue;
+        xError |= cbor_value_map_find_value( &xMap, "i", &xValue );
+    }
+    else
+    {
+        xError = CborErrorIllegalType;
+    }
+
+    if( ( xError == CborNoError ) && ( cbor_value_is_integer( &xValue ) == true ) )
+    {
+        xError = cbor_value_get_int( &xValue, &lValue );
+        pxEnvelope->lBlockId = ( int32_t ) lValue;
+        xError |= cbor_value_map_find_value( &xMap, "p", &xValue );
+    }
+    else
+    {
+        xError = CborErrorIllegalType;
+    }
+
+    /* The data of a definite length byte string follows its header, so is
+     * found by stepping back its length from the value after it. */
+    if( ( xError == CborNoError ) &&
+        ( cbor_value_is_byte_string( &xValue ) == true ) &&
+        ( cbor_value_is_length_known( &xValue ) == true ) )
+    {
+        xError = cbor_value_get_string_length( &xValue, &pxEnvelope->xPayloadLength );
+        xError |= cbor_value_advance( &xValue );
+    }
+    else
+    {
+        xError = CborErrorIllegalType;
+    }
+
+    if( xError == CborNoError )
+    {
+        pxEnvelope->pucPayload = cbor_value_get_next_byte( &xValue ) - pxEnvelope->xPayloadLength;
+    }
+
+    return( ( xError == CborNoError ) && prvIsBlock( pxEnvelope ) );
+}
+/*-----------------------------------------------------------*/
@@ -0,0 +1,90 @@
+/*
+ * FreeRTOS V202011.00
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://aws.amazon.com/freertos
+ *
+ */
+
+/**
+ * @file ota_block_envelope.h
+ * @brief Decodes the fields of an OTA stream block message where the message
+ * lies.
+ *
+ * A block message is a CBOR map of the file ID ("f"), the block ID ("i"), the
+ * block size ("l") and the block's data ("p").  The streaming service always
+ * sends these keys, so the message is decoded by a parser specialized for them
+ * that walks it once, start to end.  A message it does not recognize, such as
+ * one with other keys or encodings the service does not use, is decoded again
+ * by the general CBOR parser, so the two accept the same messages.
+ */
+#ifndef OTA_BLOCK_ENVELOPE_H
+#define OTA_BLOCK_ENVELOPE_H
+
+/* Standard includes. */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief The fields of a stream block message, decoded where the message lies.
+ */
+typedef struct OtaBlockEnvelope
+{
+    int32_t lFileId;            /**< File ID the block belongs to. */
+    int32_t lBlockId;           /**< Index of the block in the file. */
+    const uint8_t * pucPayload; /**< The block's data, pointing into the message rather than a copy. */
+    size_t xPayloadLength;      /**< Length of the block's data. */
+} OtaBlockEnvelope_t;
+
+/**
+ * @brief Decode the envelope of a stream block message without copying the
+ * block's data, so it can be decoded where it lies in the MQTT agent's network
+ * buffer.
+ *
+ * @param[in] pucMessage The CBOR encoded block message.
+ * @param[in] xMessageLength Length of pucMessage.
+ * @param[out] pxEnvelope Set to the decoded fields.
+ *
+ * @return `true` if the message is a well formed block, otherwise `false`.
+ */
+bool decodeOtaBlockEnvelope( const uint8_t * pucMessage,
+                             size_t xMessageLength,
+                             OtaBlockEnvelope_t * pxEnvelope );
+
+/**
+ * @brief Decode the envelope of a stream block message with the general CBOR
+ * parser only.
+ *
+ * decodeOtaBlockEnvelope() falls back to this for messages its specialized
+ * parser does not recognize.  It is exposed so the two can be compared.
+ *
+ * @param[in] pucMessage The CBOR encoded block message.
+ * @param[in] xMessageLength Length of pucMessage.
+ * @param[out] pxEnvelope Set to the decoded fields.
+ *
+ * @return `true` if the message is a well formed block, otherwise `false`.
+ */
+bool decodeOtaBlockEnvelopeGeneric( const uint8_t * pucMessage,
+                                    size_t xMessageLength,
+                                    OtaBlockEnvelope_t * pxEnvelope );
+
+#endif /* OTA_BLOCK_ENVELOPE_H */
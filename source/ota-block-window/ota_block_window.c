@@ -0,0 +1,989 @@
+/*
+ * FreeRTOS V202011.00
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://aws.amazon.com/freertos
+ *
+ */
+
+/**
+ * @file ota_block_window.c
+ * @brief Implements the OTA block window.
+ *
+ * A stream request is a CBOR map holding a client token ("c"), the file ID
+ * ("f"), the block size ("l"), the block offset ("o"), a bitmap of the blocks
+ * still needed ("b") and the number of blocks to send ("n").  The streaming
+ * service sends the first "n" blocks whose bits are set.  The window clears
+ * the bits of the blocks already in flight, or received and still queued for
+ * the agent, and sets "n" to the space left in the window, so each request
+ * asks only for new blocks.
+ *
+ * The round trip time of each block is measured from the request that asked
+ * for it to its arrival, except for blocks that were requested more than once,
+ * whose samples are ambiguous.  The retransmission timeout is derived from the
+ * smoothed round trip time and its variation as in RFC 6298.  The window grows
+ * by a block for each block received until it reaches the slow start
+ * threshold, then by a block per window.  When blocks are lost the threshold
+ * and the window are halved, at most once per window of blocks.
+ *
+ * The MQTT agent task never takes the window's mutex, so it never waits on
+ * the OTA agent task while that prepares a request.  It sets the received bit
+ * of each block with an atomic OR, and queues the block's arrival time on a
+ * bounded queue that takes one compare and swap per block.  The OTA agent task
+ * takes the arrivals off the queue, to measure round trip times and grow the
+ * window, when it next prepares a request.
+ */
+
+/**************************************************/
+/******* DO NOT CHANGE the following order ********/
+/**************************************************/
+
+/* Include header that defines log levels. */
+#include "logging_levels.h"
+
+/* Logging configuration for the block window. */
+#ifndef LIBRARY_LOG_NAME
+    #define LIBRARY_LOG_NAME     "OtaBlockWindow"
+#endif
+#ifndef LIBRARY_LOG_LEVEL
+    #define LIBRARY_LOG_LEVEL    LOG_INFO
+#endif
+
+/* Prototype for the function used to print to console. */
+extern void vLoggingPrintf( const char * pcFormatString,
+                            ... );
+
+/* Map the SdkLog macro to the logging function. */
+#ifndef SdkLog
+    #define SdkLog( message )    vLoggingPrintf message
+#endif
+
+#include "logging_stack.h"
+
+/* Standard includes. */
+#include <string.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+#include "atomic.h"
+
+/* Block window header include. */
+#include "ota_block_window.h"
+
+/* CBOR include. */
+#include "cbor.h"
+
+/**
+ * @brief The congestion window and slow start threshold are held in 256ths of
+ * a block, so the window can grow by a fraction of a block per block received.
+ */
+#define otaBlockWindowSCALE_SHIFT         ( 8U )
+#define otaBlockWindowONE_BLOCK           ( 1UL << otaBlockWindowSCALE_SHIFT )
+
+/**
+ * @brief Smallest slow start threshold set when blocks are lost.
+ */
+#define otaBlockWindowMIN_THRESHOLD       ( 2UL * otaBlockWindowONE_BLOCK )
+
+/**
+ * @brief Number of blocks that can be tracked by the received and requested
+ * bitmaps.
+ */
+#define otaBlockWindowMAX_FILE_BLOCKS     ( OTA_MAX_BLOCK_BITMAP_SIZE * 8U )
+
+/**
+ * @brief Number of 32 bit words in the received bitmap.
+ */
+#define otaBlockWindowRECEIVED_WORDS      ( ( otaBlockWindowMAX_FILE_BLOCKS + 31U ) / 32U )
+
+/**
+ * @brief Number of block arrivals that can wait for the OTA agent task.  A
+ * power of two, so positions stay in step with slots when they wrap, and more
+ * than the blocks that can be in flight.
+ */
+#define otaBlockWindowARRIVAL_SLOTS       ( 64U )
+
+#if ( otaBlockWindowARRIVAL_SLOTS < OTA_BLOCK_WINDOW_MAX_BLOCKS )
+    #error OTA_BLOCK_WINDOW_MAX_BLOCKS cannot exceed the number of arrival slots.
+#endif
+
+/**
+ * @brief Length of the longest client token that is copied from a request.
+ */
+#define otaBlockWindowMAX_TOKEN_LENGTH    ( 16U )
+
+/**
+ * @brief A block that has been requested and not yet received or lost.
+ */
+typedef struct OtaBlockInFlight
+{
+    uint32_t ulBlockId;   /**< Index of the block in the file. */
+    uint32_t ulRequest;   /**< Number of the request that asked for the block. */
+    TickType_t xSentTime; /**< Time the request was sent. */
+    bool xIsRepeat;       /**< The block was requested before, so its round trip time is ambiguous. */
+} OtaBlockInFlight_t;
+
+/**
+ * @brief A block that has arrived, queued by the MQTT agent task for the OTA
+ * agent task.
+ *
+ * @note The slot at position p of the queue may be written when its sequence
+ * is p, and read once its sequence is p + 1.  Reading it sets its sequence to
+ * p + otaBlockWindowARRIVAL_SLOTS, where the next writer expects it.
+ */
+typedef struct OtaBlockArrival
+{
+    uint32_t ulSequence; /**< Position at which the slot is next written or read. */
+    uint32_t ulBlockId;  /**< Index of the block in the file. */
+    TickType_t xTime;    /**< Time the block arrived. */
+} OtaBlockArrival_t;
+
+/**
+ * @brief The fields of a stream request.
+ */
+typedef struct OtaStreamRequest
+{
+    char cToken[ otaBlockWindowMAX_TOKEN_LENGTH ];
+    size_t xTokenLength;
+    int64_t llFileId;
+    int64_t llBlockSize;
+    int64_t llBlockOffset;
+    int64_t llBlockCount;
+    uint8_t ucBitmap[ OTA_MAX_BLOCK_BITMAP_SIZE ];
+    size_t xBitmapLength;
+} OtaStreamRequest_t;
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Decode a stream request.
+ *
+ * @param[in] pucRequest The CBOR encoded request.
+ * @param[in] xRequestLength Length of pucRequest.
+ * @param[out] pxRequest Structure the fields are decoded into.
+ *
+ * @return pdTRUE if the request held exactly the expected fields, otherwise
+ * pdFALSE.
+ */
+static BaseType_t prvDecodeRequest( const uint8_t * pucRequest,
+                                    size_t xRequestLength,
+                                    OtaStreamRequest_t * pxRequest );
+
+/**
+ * @brief Encode a stream request, with its fields in the order the OTA agent
+ * encodes them.
+ *
+ * @param[in] pxRequest The fields to encode.
+ * @param[out] pucOut Buffer to encode the request into.
+ * @param[in] xOutSize Size of pucOut.
+ * @param[out] pxOutLength Set to the length of the encoded request.
+ *
+ * @return pdTRUE if the request was encoded, otherwise pdFALSE.
+ */
+static BaseType_t prvEncodeRequest( const OtaStreamRequest_t * pxRequest,
+                                    uint8_t * pucOut,
+                                    size_t xOutSize,
+                                    size_t * pxOutLength );
+
+/**
+ * @brief Remove the block at an index in the list of blocks in flight.
+ */
+static void prvRemoveInFlight( uint32_t ulIndex );
+
+/**
+ * @brief Remove the blocks that have not been received within the
+ * retransmission timeout, reducing the window if any are lost.
+ *
+ * @param[in] xNow The current time.
+ */
+static void prvExpireInFlight( TickType_t xNow );
+
+/**
+ * @brief Update the smoothed round trip time and retransmission timeout with
+ * a round trip time sample.
+ *
+ * @param[in] ulSampleMs The measured round trip time.
+ */
+static void prvUpdateRtt( uint32_t ulSampleMs );
+
+/**
+ * @brief Clear the state of the window, holding the mutex.
+ */
+static void prvReset( void );
+
+/**
+ * @brief Clear the received bitmap.  The MQTT agent task may set bits while
+ * it is cleared, so each word is cleared atomically.
+ */
+static void prvClearReceived( void );
+
+/**
+ * @brief Queue the arrival of a block for the OTA agent task.  Called by the
+ * MQTT agent task.
+ *
+ * @param[in] ulBlockId Index of the block in the file.
+ * @param[in] xTime Time the block arrived.
+ *
+ * @return `true` if the arrival was queued, or `false` if the queue is full.
+ */
+static bool prvQueueArrival( uint32_t ulBlockId,
+                             TickType_t xTime );
+
+/**
+ * @brief Take the queued arrivals off the queue, holding the mutex.
+ *
+ * @param[in] xRecord Whether to update the blocks in flight and the window
+ * from the arrivals, or only discard them.
+ */
+static void prvTakeArrivals( bool xRecord );
+
+/**
+ * @brief Update the blocks in flight and the window for a block that has
+ * arrived, holding the mutex.
+ *
+ * @param[in] ulBlockId Index of the block in the file.
+ * @param[in] xTime Time the block arrived.
+ */
+static void prvRecordArrival( uint32_t ulBlockId,
+                              TickType_t xTime );
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Guards the state below that is only used by the OTA agent task to
+ * prepare requests, and by the tasks that reset the window or read its
+ * counters.  The MQTT agent task does not take it.
+ */
+static SemaphoreHandle_t xWindowMutex = NULL;
+
+/**
+ * @brief The blocks in flight, in no particular order.
+ */
+static OtaBlockInFlight_t xInFlight[ OTA_BLOCK_WINDOW_MAX_BLOCKS ];
+static uint32_t ulInFlightCount = 0;
+
+/**
+ * @brief Bitmap of the blocks of the current file that have been requested at
+ * least once.  Bit (i % 8) of byte (i / 8) represents block i, as in the
+ * request bitmap.
+ */
+static uint8_t ucRequested[ OTA_MAX_BLOCK_BITMAP_SIZE ];
+
+/**
+ * @brief Bitmap of the blocks of the current file that have been received,
+ * set by the MQTT agent task.  Bit (i % 32) of word (i / 32) represents block
+ * i.
+ */
+static uint32_t ulReceived[ otaBlockWindowRECEIVED_WORDS ];
+
+/**
+ * @brief The file ID of the last request, so the window is reset if the agent
+ * moves on to another file without a new file being created.  Read by the MQTT
+ * agent task, so held in a single word.
+ */
+static volatile int32_t lCurrentFileId = -1;
+
+/**
+ * @brief The queue of block arrivals.  The MQTT agent task advances
+ * ulArrivalHead to write, and the OTA agent task, holding the mutex, advances
+ * ulArrivalTail to read.
+ */
+static OtaBlockArrival_t xArrivals[ otaBlockWindowARRIVAL_SLOTS ];
+static uint32_t ulArrivalHead = 0;
+static uint32_t ulArrivalTail = 0;
+
+/**
+ * @brief Blocks not needed by the agent, counted by the MQTT agent task.
+ */
+static uint32_t ulBlocksDiscarded = 0;
+
+/**
+ * @brief Congestion window and slow start threshold, in 256ths of a block.
+ */
+static uint32_t ulWindow = 0;
+static uint32_t ulThreshold = 0;
+
+/**
+ * @brief Round trip time estimates, in milliseconds.
+ */
+static uint32_t ulSmoothedRttMs = 0;
+static uint32_t ulRttVarianceMs = 0;
+static uint32_t ulRtoMs = OTA_BLOCK_WINDOW_INITIAL_RTO_MS;
+static bool xHaveRtt = false;
+
+/**
+ * @brief Number of the last request sent, and of the last request sent
+ * before the window was reduced.  Losses of blocks asked for by requests up to
+ * ulRecoveryRequest do not reduce the window again.
+ */
+static uint32_t ulRequestNumber = 0;
+static uint32_t ulRecoveryRequest = 0;
+
+/**
+ * @brief Counters reported by getOtaBlockWindowStats().
+ */
+static OtaBlockWindowStats_t xStats;
+
+/*-----------------------------------------------------------*/
+
+static BaseType_t prvDecodeRequest( const uint8_t * pucRequest,
+                                    size_t xRequestLength,
+                                    OtaStreamRequest_t * pxRequest )
+{
+    CborParser xParser;
+    CborValue xMap, xField;
+    CborError xError;
+    char cKey[ 2 ];
+    size_t xKeyLength, xMapLength = 0;
+    int64_t * pllValue;
+    uint32_t ulFieldsSeen = 0;
+
+    xError = cbor_parser_init( pucRequest, xRequestLength, 0, &xParser, &xMap );
+
+    if( ( xError == CborNoError ) && ( cbor_value_is_map( &xMap ) == true ) )
+    {
+        xError = cbor_value_get_map_length( &xMap, &xMapLength );
+    }
+    else
+    {
+        xError = CborErrorIllegalType;
+    }
+
+    if( xError == CborNoError )
+    {
+        xError = cbor_value_enter_container( &xMap, &xField );
+    }
+
+    while( ( xError == CborNoError ) && ( cbor_value_at_end( &xField ) == false ) )
+    {
+        xKeyLength = sizeof( cKey );
+
+        if( cbor_value_is_text_string( &xField ) == true )
+        {
+            xError = cbor_value_copy_text_string( &xField, cKey, &xKeyLength, &xField );
+        }
+        else
+        {
+            xError = CborErrorIllegalType;
+        }
+
+        /* Every key is a single character. */
+        if( ( xError == CborNoError ) && ( xKeyLength != 1U ) )
+        {
+            xError = CborErrorUnknownType;
+        }
+
+        if( xError != CborNoError )
+        {
+            /* Leave the loop. */
+        }
+        else if( cKey[ 0 ] == 'c' )
+        {
+            xKeyLength = sizeof( pxRequest->cToken );
+            xError = cbor_value_is_text_string( &xField ) ?
+                     cbor_value_copy_text_string( &xField, pxRequest->cToken, &xKeyLength, &xField ) :
+                     CborErrorIllegalType;
+            pxRequest->xTokenLength = xKeyLength;
+            ulFieldsSeen |= 1U;
+        }
+        else if( cKey[ 0 ] == 'b' )
+        {
+            pxRequest->xBitmapLength = sizeof( pxRequest->ucBitmap );
+            xError = cbor_value_is_byte_string( &xField ) ?
+                     cbor_value_copy_byte_string( &xField, pxRequest->ucBitmap, &pxRequest->xBitmapLength, &xField ) :
+                     CborErrorIllegalType;
+            ulFieldsSeen |= 2U;
+        }
+        else
+        {
+            switch( cKey[ 0 ] )
+            {
+                case 'f':
+                    pllValue = &pxRequest->llFileId;
+                    ulFieldsSeen |= 4U;
+                    break;
+
+                case 'l':
+                    pllValue = &pxRequest->llBlockSize;
+                    ulFieldsSeen |= 8U;
+                    break;
+
+                case 'o':
+                    pllValue = &pxRequest->llBlockOffset;
+                    ulFieldsSeen |= 16U;
+                    break;
+
+                case 'n':
+                    pllValue = &pxRequest->llBlockCount;
+                    ulFieldsSeen |= 32U;
+                    break;
+
+                default:
+                    pllValue = NULL;
+                    break;
+            }
+
+            if( ( pllValue == NULL ) || ( cbor_value_is_integer( &xField ) == false ) )
+            {
+                xError = CborErrorUnknownType;
+            }
+            else
+            {
+                xError = cbor_value_get_int64( &xField, pllValue );
+
+                if( xError == CborNoError )
+                {
+                    xError = cbor_value_advance_fixed( &xField );
+                }
+            }
+        }
+    }
+
+    return ( ( xError == CborNoError ) &&
+             ( xMapLength == 6U ) &&
+             ( ulFieldsSeen == 63U ) &&
+             ( pxRequest->llBlockOffset >= 0 ) ) ? pdTRUE : pdFALSE;
+}
+/*-----------------------------------------------------------*/
+
+static BaseType_t prvEncodeRequest( const OtaStreamRequest_t * pxRequest,
+                                    uint8_t * pucOut,
+                                    size_t xOutSize,
+                                    size_t * pxOutLength )
+{
+    CborEncoder xEncoder, xMapEncoder;
+    CborError xError;
+
+    cbor_encoder_init( &xEncoder, pucOut, xOutSize, 0 );
+    xError = cbor_encoder_create_map( &xEncoder, &xMapEncoder, 6 );
+
+    xError |= cbor_encode_text_stringz( &xMapEncoder, "c" );
+    xError |= cbor_encode_text_string( &xMapEncoder, pxRequest->cToken, pxRequest->xTokenLength );
+    xError |= cbor_encode_text_stringz( &xMapEncoder, "f" );
+    xError |= cbor_encode_int( &xMapEncoder, pxRequest->llFileId );
+    xError |= cbor_encode_text_stringz( &xMapEncoder, "l" );
+    xError |= cbor_encode_int( &xMapEncoder, pxRequest->llBlockSize );
+    xError |= cbor_encode_text_stringz( &xMapEncoder, "o" );
+    xError |= cbor_encode_int( &xMapEncoder, pxRequest->llBlockOffset );
+    xError |= cbor_encode_text_stringz( &xMapEncoder, "b" );
+    xError |= cbor_encode_byte_string( &xMapEncoder, pxRequest->ucBitmap, pxRequest->xBitmapLength );
+    xError |= cbor_encode_text_stringz( &xMapEncoder, "n" );
+    xError |= cbor_encode_int( &xMapEncoder, pxRequest->llBlockCount );
+
+    xError |= cbor_encoder_close_container_checked( &xEncoder, &xMapEncoder );
+
+    if( xError == CborNoError )
+    {
+        *pxOutLength = cbor_encoder_get_buffer_size( &xEncoder, pucOut );
+    }
+
+    return ( xError == CborNoError ) ? pdTRUE : pdFALSE;
+}
+/*-----------------------------------------------------------*/
+
+static void prvRemoveInFlight( uint32_t ulIndex )
+{
+    ulInFlightCount--;
+    xInFlight[ ulIndex ] = xInFlight[ ulInFlightCount ];
+}
+/*-----------------------------------------------------------*/
+
+static void prvExpireInFlight( TickType_t xNow )
+{
+    uint32_t ulIndex = 0, ulLost = 0;
+    bool xReduce = false;
+
+    while( ulIndex < ulInFlightCount )
+    {
+        if( ( xNow - xInFlight[ ulIndex ].xSentTime ) >= pdMS_TO_TICKS( ulRtoMs ) )
+        {
+            /* Only a loss from a request sent after the last reduction shows
+             * the reduced window is still too large. */
+            if( xInFlight[ ulIndex ].ulRequest > ulRecoveryRequest )
+            {
+                xReduce = true;
+            }
+
+            prvRemoveInFlight( ulIndex );
+            ulLost++;
+        }
+        else
+        {
+            ulIndex++;
+        }
+    }
+
+    xStats.ulBlocksLost += ulLost;
+
+    if( ulLost > 0U )
+    {
+        /* Back off the timeout until a new round trip time is measured. */
+        ulRtoMs = ( ( ulRtoMs * 2U ) < OTA_BLOCK_WINDOW_MAX_RTO_MS ) ? ( ulRtoMs * 2U ) : OTA_BLOCK_WINDOW_MAX_RTO_MS;
+    }
+
+    if( xReduce == true )
+    {
+        ulThreshold = ( ( ulWindow / 2U ) > otaBlockWindowMIN_THRESHOLD ) ? ( ulWindow / 2U ) : otaBlockWindowMIN_THRESHOLD;
+        ulWindow = ulThreshold;
+        ulRecoveryRequest = ulRequestNumber;
+
+        LogInfo( ( "%u blocks lost, window reduced to %u blocks, RTO %u ms.",
+                   ( unsigned ) ulLost,
+                   ( unsigned ) ( ulWindow >> otaBlockWindowSCALE_SHIFT ),
+                   ( unsigned ) ulRtoMs ) );
+    }
+}
+/*-----------------------------------------------------------*/
+
+static void prvUpdateRtt( uint32_t ulSampleMs )
+{
+    uint32_t ulDeviation;
+
+    if( xHaveRtt == false )
+    {
+        ulSmoothedRttMs = ulSampleMs;
+        ulRttVarianceMs = ulSampleMs / 2U;
+        xHaveRtt = true;
+    }
+    else
+    {
+        ulDeviation = ( ulSmoothedRttMs > ulSampleMs ) ? ( ulSmoothedRttMs - ulSampleMs ) : ( ulSampleMs - ulSmoothedRttMs );
+        ulRttVarianceMs = ( ( 3U * ulRttVarianceMs ) + ulDeviation ) / 4U;
+        ulSmoothedRttMs = ( ( 7U * ulSmoothedRttMs ) + ulSampleMs ) / 8U;
+    }
+
+    ulRtoMs = ulSmoothedRttMs + ( 4U * ulRttVarianceMs );
+
+    if( ulRtoMs < OTA_BLOCK_WINDOW_MIN_RTO_MS )
+    {
+        ulRtoMs = OTA_BLOCK_WINDOW_MIN_RTO_MS;
+    }
+    else if( ulRtoMs > OTA_BLOCK_WINDOW_MAX_RTO_MS )
+    {
+        ulRtoMs = OTA_BLOCK_WINDOW_MAX_RTO_MS;
+    }
+    else
+    {
+        /* Within limits. */
+    }
+}
+/*-----------------------------------------------------------*/
+
+static void prvReset( void )
+{
+    /* Arrivals queued before the reset belong to the last file. */
+    prvTakeArrivals( false );
+
+    ulInFlightCount = 0;
+    memset( ucRequested, 0x00, sizeof( ucRequested ) );
+    prvClearReceived();
+    lCurrentFileId = -1;
+    ulWindow = OTA_BLOCK_WINDOW_INITIAL_BLOCKS << otaBlockWindowSCALE_SHIFT;
+    ulThreshold = OTA_BLOCK_WINDOW_MAX_BLOCKS << otaBlockWindowSCALE_SHIFT;
+    ulSmoothedRttMs = 0;
+    ulRttVarianceMs = 0;
+    ulRtoMs = OTA_BLOCK_WINDOW_INITIAL_RTO_MS;
+    xHaveRtt = false;
+    ulRequestNumber = 0;
+    ulRecoveryRequest = 0;
+    memset( &xStats, 0x00, sizeof( xStats ) );
+    ( void ) Atomic_AND_u32( &ulBlocksDiscarded, 0U );
+}
+/*-----------------------------------------------------------*/
+
+static void prvClearReceived( void )
+{
+    uint32_t ulWord;
+
+    for( ulWord = 0; ulWord < otaBlockWindowRECEIVED_WORDS; ulWord++ )
+    {
+        ( void ) Atomic_AND_u32( &( ulReceived[ ulWord ] ), 0U );
+    }
+}
+/*-----------------------------------------------------------*/
+
+static bool prvQueueArrival( uint32_t ulBlockId,
+                             TickType_t xTime )
+{
+    OtaBlockArrival_t * pxSlot;
+    uint32_t ulPosition;
+    int32_t lLag;
+    bool xQueued = false, xFull = false;
+
+    /* Claim the slot at the head, unless the OTA agent task has not yet read
+     * it, in which case the queue is full.  Another writer may claim it first,
+     * when the head is read again. */
+    do
+    {
+        ulPosition = ulArrivalHead;
+        pxSlot = &( xArrivals[ ulPosition % otaBlockWindowARRIVAL_SLOTS ] );
+        lLag = ( int32_t ) ( pxSlot->ulSequence - ulPosition );
+
+        if( lLag < 0 )
+        {
+            xFull = true;
+        }
+        else if( ( lLag == 0 ) &&
+                 ( Atomic_CompareAndSwap_u32( &ulArrivalHead, ulPosition + 1U, ulPosition ) == ATOMIC_COMPARE_AND_SWAP_SUCCESS ) )
+        {
+            xQueued = true;
+        }
+        else
+        {
+            /* The head moved on, try again. */
+        }
+    } while( ( xQueued == false ) && ( xFull == false ) );
+
+    if( xQueued == true )
+    {
+        pxSlot->ulBlockId = ulBlockId;
+        pxSlot->xTime = xTime;
+
+        /* Publish the slot to the reader after its contents. */
+        ( void ) Atomic_CompareAndSwap_u32( &( pxSlot->ulSequence ), ulPosition + 1U, ulPosition );
+    }
+
+    return xQueued;
+}
+/*-----------------------------------------------------------*/
+
+static void prvTakeArrivals( bool xRecord )
+{
+    OtaBlockArrival_t * pxSlot = &( xArrivals[ ulArrivalTail % otaBlockWindowARRIVAL_SLOTS ] );
+
+    while( pxSlot->ulSequence == ( ulArrivalTail + 1U ) )
+    {
+        if( xRecord == true )
+        {
+            prvRecordArrival( pxSlot->ulBlockId, pxSlot->xTime );
+        }
+
+        /* Hand the slot back to the writers. */
+        ( void ) Atomic_CompareAndSwap_u32( &( pxSlot->ulSequence ),
+                                            ulArrivalTail + otaBlockWindowARRIVAL_SLOTS,
+                                            ulArrivalTail + 1U );
+        ulArrivalTail++;
+        pxSlot = &( xArrivals[ ulArrivalTail % otaBlockWindowARRIVAL_SLOTS ] );
+    }
+}
+/*-----------------------------------------------------------*/
+
+static void prvRecordArrival( uint32_t ulBlockId,
+                              TickType_t xTime )
+{
+    uint32_t ulIndex;
+
+    for( ulIndex = 0; ulIndex < ulInFlightCount; ulIndex++ )
+    {
+        if( xInFlight[ ulIndex ].ulBlockId == ulBlockId )
+        {
+            break;
+        }
+    }
+
+    /* A block not in flight arrived after it was counted as lost, so says
+     * nothing about the current state of the path. */
+    if( ulIndex < ulInFlightCount )
+    {
+        if( xInFlight[ ulIndex ].xIsRepeat == false )
+        {
+            prvUpdateRtt( ( uint32_t ) ( xTime - xInFlight[ ulIndex ].xSentTime ) * portTICK_PERIOD_MS );
+        }
+
+        prvRemoveInFlight( ulIndex );
+        xStats.ulBlocksReceived++;
+
+        if( ulWindow < ulThreshold )
+        {
+            /* Slow start. */
+            ulWindow += otaBlockWindowONE_BLOCK;
+        }
+        else
+        {
+            /* Congestion avoidance. */
+            ulWindow += ( otaBlockWindowONE_BLOCK * otaBlockWindowONE_BLOCK ) / ulWindow;
+        }
+
+        if( ulWindow > ( OTA_BLOCK_WINDOW_MAX_BLOCKS << otaBlockWindowSCALE_SHIFT ) )
+        {
+            ulWindow = OTA_BLOCK_WINDOW_MAX_BLOCKS << otaBlockWindowSCALE_SHIFT;
+        }
+    }
+}
+/*-----------------------------------------------------------*/
+
+bool initOtaBlockWindow( void )
+{
+    uint32_t ulSlot;
+
+    if( xWindowMutex == NULL )
+    {
+        /* Each slot of the arrival queue is first written at its own index. */
+        for( ulSlot = 0; ulSlot < otaBlockWindowARRIVAL_SLOTS; ulSlot++ )
+        {
+            xArrivals[ ulSlot ].ulSequence = ulSlot;
+        }
+
+        xWindowMutex = xSemaphoreCreateMutex();
+    }
+
+    if( xWindowMutex != NULL )
+    {
+        resetOtaBlockWindow();
+    }
+
+    return( xWindowMutex != NULL );
+}
+/*-----------------------------------------------------------*/
+
+void resetOtaBlockWindow( void )
+{
+    if( xSemaphoreTake( xWindowMutex, portMAX_DELAY ) == pdTRUE )
+    {
+        prvReset();
+        ( void ) xSemaphoreGive( xWindowMutex );
+    }
+}
+/*-----------------------------------------------------------*/
+
+OtaBlockWindowAction_t prepareOtaBlockRequest( const uint8_t * pucRequest,
+                                               size_t xRequestLength,
+                                               UBaseType_t uxFreeBuffers,
+                                               uint8_t * pucOut,
+                                               size_t xOutSize,
+                                               size_t * pxOutLength )
+{
+    /* Only called from the OTA agent task, so need not be on the stack. */
+    static OtaStreamRequest_t xRequest;
+    OtaBlockWindowAction_t xAction = eOtaBlockWindowPassThrough;
+    TickType_t xNow = xTaskGetTickCount();
+    uint32_t ulIndex, ulBit, ulBlockId, ulLimit, ulToRequest, ulRequested = 0;
+    bool xAnyNeeded = false;
+
+    if( ( prvDecodeRequest( pucRequest, xRequestLength, &xRequest ) == pdTRUE ) &&
+        ( xSemaphoreTake( xWindowMutex, portMAX_DELAY ) == pdTRUE ) )
+    {
+        if( xRequest.llFileId != ( int64_t ) lCurrentFileId )
+        {
+            prvReset();
+            lCurrentFileId = ( int32_t ) xRequest.llFileId;
+        }
+
+        /* Take in the blocks that arrived before expiring the others. */
+        prvTakeArrivals( true );
+        prvExpireInFlight( xNow );
+
+        /* Blocks the agent no longer needs have arrived, and blocks whose
+         * received bit is set have arrived, even if their arrival was not
+         * queued. */
+        ulIndex = 0;
+
+        while( ulIndex < ulInFlightCount )
+        {
+            ulBlockId = xInFlight[ ulIndex ].ulBlockId;
+            ulBit = ulBlockId - ( uint32_t ) xRequest.llBlockOffset;
+
+            if( ( ulBit >= ( xRequest.xBitmapLength * 8U ) ) ||
+                ( ( xRequest.ucBitmap[ ulBit / 8U ] & ( 1U << ( ulBit % 8U ) ) ) == 0U ) ||
+                ( ( ulBlockId < otaBlockWindowMAX_FILE_BLOCKS ) &&
+                  ( ( ulReceived[ ulBlockId / 32U ] & ( 1UL << ( ulBlockId % 32U ) ) ) != 0U ) ) )
+            {
+                prvRemoveInFlight( ulIndex );
+            }
+            else
+            {
+                ulIndex++;
+            }
+        }
+
+        /* Size the window, leaving room in the event buffers for every block
+         * in flight to arrive at once. */
+        ulLimit = ulWindow >> otaBlockWindowSCALE_SHIFT;
+        ulLimit = ( ulLimit < OTA_BLOCK_WINDOW_MAX_BLOCKS ) ? ulLimit : OTA_BLOCK_WINDOW_MAX_BLOCKS;
+
+        if( uxFreeBuffers <= OTA_BLOCK_WINDOW_RESERVED_BUFFERS )
+        {
+            ulLimit = 0;
+        }
+        else if( ( uxFreeBuffers - OTA_BLOCK_WINDOW_RESERVED_BUFFERS ) < ulLimit )
+        {
+            ulLimit = ( uint32_t ) ( uxFreeBuffers - OTA_BLOCK_WINDOW_RESERVED_BUFFERS );
+        }
+        else
+        {
+            /* The window fits in the free buffers. */
+        }
+
+        /* The agent only asks again once a block arrives or its request timer
+         * expires, so always keep a block in flight. */
+        if( ( ulLimit == 0U ) && ( ulInFlightCount == 0U ) )
+        {
+            ulLimit = 1U;
+        }
+
+        ulToRequest = ( ulLimit > ulInFlightCount ) ? ( ulLimit - ulInFlightCount ) : 0U;
+
+        /* Ask for the first blocks the agent needs that are not in flight or
+         * already received and waiting to be processed. */
+        for( ulBit = 0; ulBit < ( xRequest.xBitmapLength * 8U ); ulBit++ )
+        {
+            ulBlockId = ulBit + ( uint32_t ) xRequest.llBlockOffset;
+
+            if( ( xRequest.ucBitmap[ ulBit / 8U ] & ( 1U << ( ulBit % 8U ) ) ) != 0U )
+            {
+                xAnyNeeded = true;
+
+                for( ulIndex = 0; ulIndex < ulInFlightCount; ulIndex++ )
+                {
+                    if( xInFlight[ ulIndex ].ulBlockId == ulBlockId )
+                    {
+                        break;
+                    }
+                }
+
+                if( ( ulIndex < ulInFlightCount ) ||
+                    ( ( ulBlockId < otaBlockWindowMAX_FILE_BLOCKS ) &&
+                      ( ( ulReceived[ ulBlockId / 32U ] & ( 1UL << ( ulBlockId % 32U ) ) ) != 0U ) ) ||
+                    ( ulRequested >= ulToRequest ) )
+                {
+                    xRequest.ucBitmap[ ulBit / 8U ] &= ( uint8_t ) ~( 1U << ( ulBit % 8U ) );
+                }
+                else
+                {
+                    xInFlight[ ulInFlightCount ].ulBlockId = ulBlockId;
+                    xInFlight[ ulInFlightCount ].ulRequest = ulRequestNumber + 1U;
+                    xInFlight[ ulInFlightCount ].xSentTime = xNow;
+                    xInFlight[ ulInFlightCount ].xIsRepeat = true;
+
+                    if( ulBlockId < otaBlockWindowMAX_FILE_BLOCKS )
+                    {
+                        xInFlight[ ulInFlightCount ].xIsRepeat = ( ( ucRequested[ ulBlockId / 8U ] & ( 1U << ( ulBlockId % 8U ) ) ) != 0U );
+                        ucRequested[ ulBlockId / 8U ] |= ( uint8_t ) ( 1U << ( ulBlockId % 8U ) );
+                    }
+
+                    ulInFlightCount++;
+                    ulRequested++;
+                }
+            }
+        }
+
+        if( ulRequested > 0U )
+        {
+            ulRequestNumber++;
+            xRequest.llBlockCount = ( int64_t ) ulRequested;
+
+            if( prvEncodeRequest( &xRequest, pucOut, xOutSize, pxOutLength ) == pdTRUE )
+            {
+                xAction = eOtaBlockWindowSend;
+                xStats.ulRequestsSent++;
+                xStats.ulBlocksRequested += ulRequested;
+            }
+            else
+            {
+                /* Forget the blocks just added, as they will not be asked for. */
+                ulInFlightCount -= ulRequested;
+                LogError( ( "Failed to encode a stream request." ) );
+            }
+        }
+        else if( ( xAnyNeeded == true ) && ( ulInFlightCount == 0U ) )
+        {
+            /* Every block the agent needs was recorded as received, so some
+             * must have been dropped after they arrived.  Ask for them again. */
+            LogWarn( ( "Received blocks were not processed, requesting them again." ) );
+            prvClearReceived();
+        }
+        else
+        {
+            xAction = eOtaBlockWindowSkip;
+            xStats.ulRequestsSkipped++;
+        }
+
+        ( void ) xSemaphoreGive( xWindowMutex );
+    }
+
+    return xAction;
+}
+/*-----------------------------------------------------------*/
+
+bool isOtaBlockNeeded( const OtaBlockEnvelope_t * pxEnvelope )
+{
+    const int32_t lFileId = lCurrentFileId;
+    const uint32_t ulBlockId = ( uint32_t ) pxEnvelope->lBlockId;
+    bool xNeeded = true;
+
+    if( ( lFileId >= 0 ) && ( pxEnvelope->lFileId != lFileId ) )
+    {
+        xNeeded = false;
+    }
+    else if( ( ulBlockId < otaBlockWindowMAX_FILE_BLOCKS ) &&
+             ( ( ulReceived[ ulBlockId / 32U ] & ( 1UL << ( ulBlockId % 32U ) ) ) != 0U ) )
+    {
+        xNeeded = false;
+    }
+    else
+    {
+        /* Not yet received. */
+    }
+
+    if( xNeeded == false )
+    {
+        ( void ) Atomic_Increment_u32( &ulBlocksDiscarded );
+    }
+
+    return xNeeded;
+}
+/*-----------------------------------------------------------*/
+
+void recordOtaBlockReceived( const OtaBlockEnvelope_t * pxEnvelope )
+{
+    const uint32_t ulBlockId = ( uint32_t ) pxEnvelope->lBlockId;
+
+    if( pxEnvelope->lBlockId >= 0 )
+    {
+        if( ulBlockId < otaBlockWindowMAX_FILE_BLOCKS )
+        {
+            ( void ) Atomic_OR_u32( &( ulReceived[ ulBlockId / 32U ] ), 1UL << ( ulBlockId % 32U ) );
+        }
+
+        /* If the queue is full the block is still taken off the blocks in
+         * flight by its received bit, but gives no round trip time sample. */
+        ( void ) prvQueueArrival( ulBlockId, xTaskGetTickCount() );
+    }
+}
+/*-----------------------------------------------------------*/
+
+void getOtaBlockWindowStats( OtaBlockWindowStats_t * pxStats )
+{
+    if( xSemaphoreTake( xWindowMutex, portMAX_DELAY ) == pdTRUE )
+    {
+        prvTakeArrivals( true );
+        *pxStats = xStats;
+        pxStats->ulBlocksDiscarded = ulBlocksDiscarded;
+        pxStats->ulWindowBlocks = ulWindow >> otaBlockWindowSCALE_SHIFT;
+        pxStats->ulInFlight = ulInFlightCount;
+        pxStats->ulSmoothedRttMs = ulSmoothedRttMs;
+        pxStats->ulRtoMs = ulRtoMs;
+        ( void ) xSemaphoreGive( xWindowMutex );
+    }
+}
+/*-----------------------------------------------------------*/
@@ -0,0 +1,194 @@
+/*
+ * FreeRTOS V202011.00
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://aws.amazon.com/freertos
+ *
+ */
+
+/**
+ * @file ota_block_window.h
+ * @brief Sizes the number of OTA file blocks requested from the streaming
+ * service from the measured block round trip time and loss.
+ *
+ * The OTA agent asks for a fixed number of blocks at a time, so at most that
+ * many blocks are in flight per round trip.  The block window sits between the
+ * agent and the broker.  It tracks the blocks in flight, removes them from the
+ * bitmap of each new request so they are not sent twice, and sets the number
+ * of blocks requested so the blocks in flight fill a congestion window.  The
+ * window grows as blocks arrive and is halved when a block is not received
+ * within the retransmission timeout, in the manner of TCP.  It is also capped
+ * by the number of free OTA event buffers, as a block that arrives when none
+ * is free is dropped.
+ */
+#ifndef OTA_BLOCK_WINDOW_H
+#define OTA_BLOCK_WINDOW_H
+
+/* Standard includes. */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+
+/* OTA configuration and library includes. */
+#include "ota_config.h"
+#include "ota.h"
+
+/* Block envelope include. */
+#include "ota_block_envelope.h"
+
+/**
+ * @brief Maximum number of blocks that can be in flight at once.
+ */
+#ifndef OTA_BLOCK_WINDOW_MAX_BLOCKS
+    #define OTA_BLOCK_WINDOW_MAX_BLOCKS    32U
+#endif
+
+/**
+ * @brief Size of the congestion window, in blocks, when a file is started.
+ */
+#ifndef OTA_BLOCK_WINDOW_INITIAL_BLOCKS
+    #define OTA_BLOCK_WINDOW_INITIAL_BLOCKS    2U
+#endif
+
+/**
+ * @brief Number of OTA event buffers kept free for job messages, so they are
+ * not dropped by a burst of blocks.
+ */
+#ifndef OTA_BLOCK_WINDOW_RESERVED_BUFFERS
+    #define OTA_BLOCK_WINDOW_RESERVED_BUFFERS    1U
+#endif
+
+/**
+ * @brief Retransmission timeout used until the round trip time is measured,
+ * and its lower and upper limits.  The lower limit is the one second
+ * recommended by RFC 6298, so blocks queued behind others on a slow link are
+ * not taken to be lost.
+ */
+#ifndef OTA_BLOCK_WINDOW_INITIAL_RTO_MS
+    #define OTA_BLOCK_WINDOW_INITIAL_RTO_MS    2000U
+#endif
+#ifndef OTA_BLOCK_WINDOW_MIN_RTO_MS
+    #define OTA_BLOCK_WINDOW_MIN_RTO_MS    1000U
+#endif
+#ifndef OTA_BLOCK_WINDOW_MAX_RTO_MS
+    #define OTA_BLOCK_WINDOW_MAX_RTO_MS    otaconfigFILE_REQUEST_WAIT_MS
+#endif
+
+/**
+ * @brief Size of a buffer large enough for any request prepared by
+ * prepareOtaBlockRequest().
+ */
+#define OTA_BLOCK_WINDOW_REQUEST_SIZE    ( OTA_MAX_BLOCK_BITMAP_SIZE + 64U )
+
+/**
+ * @brief What to do with a request prepared by prepareOtaBlockRequest().
+ */
+typedef enum OtaBlockWindowAction
+{
+    eOtaBlockWindowSend = 0,   /**< Send the prepared request in place of the agent's. */
+    eOtaBlockWindowSkip,       /**< The window is full, so send nothing. */
+    eOtaBlockWindowPassThrough /**< The request was not understood, so send the agent's request unchanged. */
+} OtaBlockWindowAction_t;
+
+/**
+ * @brief Counters describing the block window.
+ */
+typedef struct OtaBlockWindowStats
+{
+    uint32_t ulWindowBlocks;    /**< Current congestion window, in blocks. */
+    uint32_t ulInFlight;        /**< Blocks requested and not yet received or lost. */
+    uint32_t ulSmoothedRttMs;   /**< Smoothed block round trip time. */
+    uint32_t ulRtoMs;           /**< Current retransmission timeout. */
+    uint32_t ulRequestsSent;    /**< Requests sent for the current file. */
+    uint32_t ulRequestsSkipped; /**< Requests not sent because the window was full. */
+    uint32_t ulBlocksRequested; /**< Blocks requested, including those requested again. */
+    uint32_t ulBlocksReceived;  /**< Requested blocks received. */
+    uint32_t ulBlocksLost;      /**< Blocks not received within the retransmission timeout. */
+    uint32_t ulBlocksDiscarded; /**< Blocks not needed by the agent, discarded before being copied. */
+} OtaBlockWindowStats_t;
+
+/**
+ * @brief Create the block window's mutex.  Must be called once, before any
+ * other function.
+ *
+ * @return `true` if the block window was initialized, otherwise `false`.
+ */
+bool initOtaBlockWindow( void );
+
+/**
+ * @brief Forget the blocks in flight and the measurements of the last file.
+ * Call when a new file is created for reception.
+ */
+void resetOtaBlockWindow( void );
+
+/**
+ * @brief Prepare the stream request to send in place of one made by the OTA
+ * agent.
+ *
+ * @param[in] pucRequest The CBOR encoded request made by the agent.
+ * @param[in] xRequestLength Length of pucRequest.
+ * @param[in] uxFreeBuffers Number of OTA event buffers currently free.
+ * @param[out] pucOut Buffer the request to send is written to, of at least
+ * OTA_BLOCK_WINDOW_REQUEST_SIZE bytes.
+ * @param[in] xOutSize Size of pucOut.
+ * @param[out] pxOutLength Set to the length of the request in pucOut.
+ *
+ * @return Whether to send the prepared request, nothing, or the agent's
+ * request.
+ */
+OtaBlockWindowAction_t prepareOtaBlockRequest( const uint8_t * pucRequest,
+                                               size_t xRequestLength,
+                                               UBaseType_t uxFreeBuffers,
+                                               uint8_t * pucOut,
+                                               size_t xOutSize,
+                                               size_t * pxOutLength );
+
+/**
+ * @brief Query whether the OTA agent needs a block.
+ *
+ * A block is not needed if it belongs to a file other than the one being
+ * requested, or was already received and queued for the agent, as happens
+ * when a block thought lost arrives after it was requested again.
+ *
+ * @param[in] pxEnvelope The decoded block.
+ *
+ * @return `false` if the block can be discarded, otherwise `true`.
+ */
+bool isOtaBlockNeeded( const OtaBlockEnvelope_t * pxEnvelope );
+
+/**
+ * @brief Record that a block has been received and queued for the OTA agent.
+ *
+ * @param[in] pxEnvelope The decoded block.
+ */
+void recordOtaBlockReceived( const OtaBlockEnvelope_t * pxEnvelope );
+
+/**
+ * @brief Obtain a copy of the block window counters.
+ *
+ * @param[out] pxStats Structure into which the counters are copied.
+ */
+void getOtaBlockWindowStats( OtaBlockWindowStats_t * pxStats );
+
+#endif /* OTA_BLOCK_WINDOW_H */
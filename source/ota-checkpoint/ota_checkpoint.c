@@ -0,0 +1,370 @@
+/*
+ * FreeRTOS V202011.00
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://aws.amazon.com/freertos
+ *
+ */
+
+
+/**
+ * @file ota_checkpoint.c
+ * @brief Implements the OTA download checkpoint.
+ *
+ * The checkpoint file holds a single record, rewritten whole each time by
+ * writing a new file and replacing the old one, so a reset part way through a
+ * save leaves the previous checkpoint in place.
+ */
+
+/**************************************************/
+/******* DO NOT CHANGE the following order ********/
+/**************************************************/
+
+/* Include header that defines log levels. */
+#include "logging_levels.h"
+
+/* Logging configuration for the checkpoint. */
+#ifndef LIBRARY_LOG_NAME
+    #define LIBRARY_LOG_NAME     "OtaCheckpoint"
+#endif
+#ifndef LIBRARY_LOG_LEVEL
+    #define LIBRARY_LOG_LEVEL    LOG_INFO
+#endif
+
+/* Prototype for the function used to print to console. */
+extern void vLoggingPrintf( const char * pcFormatString,
+                            ... );
+
+/* Map the SdkLog macro to the logging function. */
+#ifndef SdkLog
+    #define SdkLog( message )    vLoggingPrintf message
+#endif
+
+#include "logging_stack.h"
+
+/* Standard includes. */
+#include <string.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+
+/* Checkpoint header include. */
+#include "ota_checkpoint.h"
+
+/* OTA PAL include. */
+#include "ota_pal.h"
+
+/* File storage include. */
+#include "file_storage.h"
+
+/**
+ * @brief Value of the first two bytes of the record.
+ */
+#define otaCheckpointMAGIC            ( ( uint16_t ) 0x4F43U )
+
+/**
+ * @brief Size of the record header: magic (2), stream name length (2), file ID
+ * (4), file size (4) and CRC-32 (4), all little endian.  The header is followed
+ * by the stream name, then the bitmap of the blocks still needed, whose length
+ * follows from the file size.  The CRC covers the first 12 bytes of the header,
+ * then the stream name and bitmap.
+ */
+#define otaCheckpointHEADER_SIZE      ( 16U )
+#define otaCheckpointCRC_OFFSET       ( 12U )
+
+/**
+ * @brief Path of the file a new checkpoint is written to before it replaces
+ * the old one.
+ */
+#define otaCheckpointNEW_FILE_NAME    OTA_CHECKPOINT_FILE_NAME ".tmp"
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Write a little endian value.
+ */
+static void prvWrite16( uint8_t * pucDest,
+                        uint16_t usValue );
+static void prvWrite32( uint8_t * pucDest,
+                        uint32_t ulValue );
+
+/**
+ * @brief Read a little endian value.
+ */
+static uint16_t prvRead16( const uint8_t * pucSource );
+static uint32_t prvRead32( const uint8_t * pucSource );
+
+/**
+ * @brief Obtain the number of blocks in a file, and the length of its bitmap.
+ *
+ * @param[in] pxFileContext The file.
+ * @param[out] pxBitmapLength Set to the length of the file's bitmap.
+ *
+ * @return The number of blocks.
+ */
+static uint32_t prvBlockCount( const OtaFileContext_t * pxFileContext,
+                               size_t * pxBitmapLength );
+
+/**
+ * @brief Commit the receive file to disk and save its checkpoint.
+ *
+ * @param[in] pxFileContext The file being received.
+ */
+static void prvSave( OtaFileContext_t * pxFileContext );
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief The file being received, recorded so the checkpoint can be saved
+ * when the agent is suspended.
+ */
+static OtaFileContext_t * pxCheckpointFile = NULL;
+
+/**
+ * @brief Blocks written since the last checkpoint.
+ */
+static uint32_t ulBlocksSinceSave = 0;
+
+/**
+ * @brief Buffer the record is built in and read into.
+ */
+static uint8_t ucRecord[ otaCheckpointHEADER_SIZE + OTA_CHECKPOINT_MAX_STREAM_NAME_LENGTH + OTA_MAX_BLOCK_BITMAP_SIZE ];
+
+/*-----------------------------------------------------------*/
+
+static void prvWrite16( uint8_t * pucDest,
+                        uint16_t usValue )
+{
+    pucDest[ 0 ] = ( uint8_t ) usValue;
+    pucDest[ 1 ] = ( uint8_t ) ( usValue >> 8 );
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvWrite32( uint8_t * pucDest,
+                        uint32_t ulValue )
+{
+    prvWrite16( pucDest, ( uint16_t ) ulValue );
+    prvWrite16( &( pucDest[ 2 ] ), ( uint16_t ) ( ulValue >> 16 ) );
+}
+
+/*-----------------------------------------------------------*/
+
+static uint16_t prvRead16( const uint8_t * pucSource )
+{
+    return ( uint16_t ) ( pucSource[ 0 ] | ( ( uint16_t ) pucSource[ 1 ] << 8 ) );
+}
+
+/*-----------------------------------------------------------*/
+
+static uint32_t prvRead32( const uint8_t * pucSource )
+{
+    return ( uint32_t ) prvRead16( pucSource ) | ( ( uint32_t ) prvRead16( &( pucSource[ 2 ] ) ) << 16 );
+}
+
+/*-----------------------------------------------------------*/
+
+static uint32_t prvBlockCount( const OtaFileContext_t * pxFileContext,
+                               size_t * pxBitmapLength )
+{
+    uint32_t ulBlockCount = ( pxFileContext->fileSize + otaconfigFILE_BLOCK_SIZE - 1UL ) >> otaconfigLOG2_FILE_BLOCK_SIZE;
+
+    *pxBitmapLength = ( size_t ) ( ( ulBlockCount + 7UL ) / 8UL );
+
+    return ulBlockCount;
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvSave( OtaFileContext_t * pxFileContext )
+{
+    FileStorageHandle_t xFile;
+    size_t xNameLength, xBitmapLength, xLength;
+    uint32_t ulCrc;
+    BaseType_t xSaved = pdFALSE;
+
+    ( void ) prvBlockCount( pxFileContext, &xBitmapLength );
+    xNameLength = ( pxFileContext->pStreamName != NULL ) ? strlen( ( const char * ) pxFileContext->pStreamName ) : 0U;
+
+    /* Only blocks on disk may be recorded as received.  The agent clears a
+     * block's bit once it is written, so every block whose bit is clear now is
+     * committed by this. */
+    if( ( xNameLength <= OTA_CHECKPOINT_MAX_STREAM_NAME_LENGTH ) &&
+        ( xBitmapLength <= OTA_MAX_BLOCK_BITMAP_SIZE ) &&
+        ( pxFileContext->pRxBlockBitmap != NULL ) &&
+        ( OTA_PAL_MAIN_ERR( otaPal_SyncFile( pxFileContext ) ) == OtaPalSuccess ) )
+    {
+        prvWrite16( ucRecord, otaCheckpointMAGIC );
+        prvWrite16( &( ucRecord[ 2 ] ), ( uint16_t ) xNameLength );
+        prvWrite32( &( ucRecord[ 4 ] ), pxFileContext->serverFileID );
+        prvWrite32( &( ucRecord[ 8 ] ), pxFileContext->fileSize );
+        memcpy( &( ucRecord[ otaCheckpointHEADER_SIZE ] ), pxFileContext->pStreamName, xNameLength );
+        memcpy( &( ucRecord[ otaCheckpointHEADER_SIZE + xNameLength ] ), pxFileContext->pRxBlockBitmap, xBitmapLength );
+        xLength = otaCheckpointHEADER_SIZE + xNameLength + xBitmapLength;
+
+        ulCrc = FileStorage_Crc32( 0U, ucRecord, otaCheckpointCRC_OFFSET );
+        ulCrc = FileStorage_Crc32( ulCrc, &( ucRecord[ otaCheckpointHEADER_SIZE ] ), xLength - otaCheckpointHEADER_SIZE );
+        prvWrite32( &( ucRecord[ otaCheckpointCRC_OFFSET ] ), ulCrc );
+
+        ( void ) FileStorage_Remove( otaCheckpointNEW_FILE_NAME );
+        xFile = FileStorage_Open( otaCheckpointNEW_FILE_NAME );
+
+        if( xFile != NULL )
+        {
+            xSaved = FileStorage_Write( xFile, 0U, ucRecord, xLength ) &&
+                     FileStorage_Sync( xFile );
+            FileStorage_Close( xFile );
+            xSaved = xSaved && FileStorage_Replace( otaCheckpointNEW_FILE_NAME, OTA_CHECKPOINT_FILE_NAME );
+        }
+    }
+
+    if( xSaved == pdTRUE )
+    {
+        LogDebug( ( "Saved checkpoint, %u blocks remaining.", ( unsigned ) pxFileContext->blocksRemaining ) );
+    }
+    else
+    {
+        LogWarn( ( "Failed to save a checkpoint of the OTA file." ) );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+bool resumeOtaCheckpoint( OtaFileContext_t * pxFileContext )
+{
+    static uint8_t ucAgentBitmap[ OTA_MAX_BLOCK_BITMAP_SIZE ];
+    FileStorageHandle_t xFile;
+    size_t xFileSize = 0U, xNameLength, xBitmapLength;
+    uint32_t ulBlockCount, ulBlock, ulRemaining = 0UL, ulAgentRemaining;
+    const uint8_t * pucBitmap;
+    bool xResumed = false;
+
+    pxCheckpointFile = pxFileContext;
+    ulBlocksSinceSave = 0UL;
+    ulBlockCount = prvBlockCount( pxFileContext, &xBitmapLength );
+    xNameLength = ( pxFileContext->pStreamName != NULL ) ? strlen( ( const char * ) pxFileContext->pStreamName ) : 0U;
+
+    xFile = FileStorage_Open( OTA_CHECKPOINT_FILE_NAME );
+
+    if( xFile != NULL )
+    {
+        xFileSize = FileStorage_Size( xFile );
+
+        /* Read only a record of the expected length for this file. */
+        xResumed = ( xBitmapLength <= OTA_MAX_BLOCK_BITMAP_SIZE ) &&
+                   ( xNameLength <= OTA_CHECKPOINT_MAX_STREAM_NAME_LENGTH ) &&
+                   ( pxFileContext->pRxBlockBitmap != NULL ) &&
+                   ( xFileSize == ( otaCheckpointHEADER_SIZE + xNameLength + xBitmapLength ) ) &&
+                   ( FileStorage_Read( xFile, 0U, ucRecord, xFileSize ) == pdTRUE );
+        FileStorage_Close( xFile );
+    }
+
+    if( xResumed == true )
+    {
+        xResumed = ( prvRead16( ucRecord ) == otaCheckpointMAGIC ) &&
+                   ( prvRead16( &( ucRecord[ 2 ] ) ) == xNameLength ) &&
+                   ( prvRead32( &( ucRecord[ 4 ] ) ) == pxFileContext->serverFileID ) &&
+                   ( prvRead32( &( ucRecord[ 8 ] ) ) == pxFileContext->fileSize ) &&
+                   ( memcmp( &( ucRecord[ otaCheckpointHEADER_SIZE ] ), pxFileContext->pStreamName, xNameLength ) == 0 ) &&
+                   ( prvRead32( &( ucRecord[ otaCheckpointCRC_OFFSET ] ) ) ==
+                     FileStorage_Crc32( FileStorage_Crc32( 0U, ucRecord, otaCheckpointCRC_OFFSET ),
+                                        &( ucRecord[ otaCheckpointHEADER_SIZE ] ),
+                                        xFileSize - otaCheckpointHEADER_SIZE ) );
+    }
+
+    if( xResumed == true )
+    {
+        /* Keep the agent's bitmap, to put back if the file cannot be reopened. */
+        memcpy( ucAgentBitmap, pxFileContext->pRxBlockBitmap, xBitmapLength );
+        ulAgentRemaining = pxFileContext->blocksRemaining;
+        pucBitmap = &( ucRecord[ otaCheckpointHEADER_SIZE + xNameLength ] );
+
+        for( ulBlock = 0; ulBlock < xBitmapLength; ulBlock++ )
+        {
+            pxFileContext->pRxBlockBitmap[ ulBlock ] &= pucBitmap[ ulBlock ];
+        }
+
+        for( ulBlock = 0; ulBlock < ulBlockCount; ulBlock++ )
+        {
+            if( ( pxFileContext->pRxBlockBitmap[ ulBlock / 8U ] & ( 1U << ( ulBlock % 8U ) ) ) != 0U )
+            {
+                ulRemaining++;
+            }
+        }
+
+        pxFileContext->blocksRemaining = ulRemaining;
+
+        if( OTA_PAL_MAIN_ERR( otaPal_ResumeFileForRx( pxFileContext ) ) == OtaPalSuccess )
+        {
+            LogInfo( ( "Resumed file %u of stream %s, %u of %u blocks remaining.",
+                       ( unsigned ) pxFileContext->serverFileID,
+                       ( const char * ) pxFileContext->pStreamName,
+                       ( unsigned ) ulRemaining,
+                       ( unsigned ) ulBlockCount ) );
+        }
+        else
+        {
+            memcpy( pxFileContext->pRxBlockBitmap, ucAgentBitmap, xBitmapLength );
+            pxFileContext->blocksRemaining = ulAgentRemaining;
+            xResumed = false;
+        }
+    }
+
+    return xResumed;
+}
+
+/*-----------------------------------------------------------*/
+
+void recordOtaCheckpointBlock( OtaFileContext_t * pxFileContext )
+{
+    pxCheckpointFile = pxFileContext;
+    ulBlocksSinceSave++;
+
+    if( ulBlocksSinceSave >= OTA_CHECKPOINT_INTERVAL_BLOCKS )
+    {
+        prvSave( pxFileContext );
+        ulBlocksSinceSave = 0UL;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+void saveOtaCheckpoint( void )
+{
+    if( ( pxCheckpointFile != NULL ) && ( pxCheckpointFile->pFile != NULL ) && ( ulBlocksSinceSave > 0UL ) )
+    {
+        prvSave( pxCheckpointFile );
+        ulBlocksSinceSave = 0UL;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+void clearOtaCheckpoint( void )
+{
+    pxCheckpointFile = NULL;
+    ulBlocksSinceSave = 0UL;
+
+    if( FileStorage_Remove( OTA_CHECKPOINT_FILE_NAME ) == pdFALSE )
+    {
+        LogWarn( ( "Failed to delete the OTA checkpoint." ) );
+    }
+}
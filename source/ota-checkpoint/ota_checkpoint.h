@@ -0,0 +1,110 @@
+/*
+ * FreeRTOS V202011.00
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://aws.amazon.com/freertos
+ *
+ */
+
+
+/**
+ * @file ota_checkpoint.h
+ * @brief Saves which blocks of an OTA file have been received, so a download
+ * interrupted by a reset resumes where it stopped rather than starting again.
+ *
+ * Every OTA_CHECKPOINT_INTERVAL_BLOCKS blocks written, the blocks written so
+ * far are committed to disk through the OTA PAL, then the stream name, file ID
+ * and size, and the agent's bitmap of the blocks still needed are saved to a
+ * checkpoint file.  When the agent next creates the same file, the checkpoint
+ * is loaded into the agent's bitmap and the receive file is reopened rather
+ * than truncated, so only the missing blocks are requested.
+ */
+#ifndef OTA_CHECKPOINT_H
+#define OTA_CHECKPOINT_H
+
+/* Standard includes. */
+#include <stdbool.h>
+#include <stdint.h>
+
+/* OTA configuration and library includes. */
+#include "ota_config.h"
+#include "ota.h"
+
+/**
+ * @brief Path of the checkpoint file.
+ */
+#ifndef OTA_CHECKPOINT_FILE_NAME
+    #define OTA_CHECKPOINT_FILE_NAME    "ota_checkpoint.bin"
+#endif
+
+/**
+ * @brief Number of blocks written between checkpoints.  Each checkpoint
+ * commits the receive file to disk, so a smaller interval loses fewer blocks
+ * to a reset at the cost of more writes.
+ */
+#ifndef OTA_CHECKPOINT_INTERVAL_BLOCKS
+    #define OTA_CHECKPOINT_INTERVAL_BLOCKS    32U
+#endif
+
+/**
+ * @brief Length of the longest stream name that is saved.  Files received
+ * from a stream with a longer name are not checkpointed.
+ */
+#ifndef OTA_CHECKPOINT_MAX_STREAM_NAME_LENGTH
+    #define OTA_CHECKPOINT_MAX_STREAM_NAME_LENGTH    64U
+#endif
+
+/**
+ * @brief Resume receiving a file from its checkpoint, if there is one.
+ *
+ * Call in place of otaPal_CreateFileForRx() when the agent creates a file.  If
+ * the checkpoint is of the same stream, file ID and size, the blocks it records
+ * as received are cleared from the agent's bitmap and the receive file is
+ * reopened with otaPal_ResumeFileForRx().
+ *
+ * @param[in] pxFileContext The file the agent is about to receive.
+ *
+ * @return `true` if the file was resumed, otherwise `false`, in which case the
+ * file context is unchanged and the file must be created.
+ */
+bool resumeOtaCheckpoint( OtaFileContext_t * pxFileContext );
+
+/**
+ * @brief Count a block written to the receive file, saving a checkpoint once
+ * OTA_CHECKPOINT_INTERVAL_BLOCKS have been written since the last.
+ *
+ * @param[in] pxFileContext The file the block was written to.
+ */
+void recordOtaCheckpointBlock( OtaFileContext_t * pxFileContext );
+
+/**
+ * @brief Save a checkpoint of the file being received now.  Must only be called
+ * while the agent is not processing blocks, such as when it is suspended.
+ */
+void saveOtaCheckpoint( void );
+
+/**
+ * @brief Delete the checkpoint, once the file it records has been closed or
+ * aborted.
+ */
+void clearOtaCheckpoint( void );
+
+#endif /* OTA_CHECKPOINT_H */
@@ -50,6 +50,7 @@
 #include "FreeRTOS.h"
 #include "task.h"
 #include "semphr.h"
+#include "atomic.h"
 
 #include "ota_config.h"
 #include "demo_config.h"
@@ -74,12 +75,25 @@
 /* Include platform abstraction header. */
 #include "ota_pal.h"
 
+/* Include the block window that sizes the stream requests. */
+#include "ota_block_window.h"
+
+/* Include the checkpoint that lets an interrupted download resume. */
+#include "ota_checkpoint.h"
+
 /*------------- Demo configurations -------------------------*/
 
 #ifndef democonfigCLIENT_IDENTIFIER
     #error "Please define the democonfigCLIENT_IDENTIFIER with the thing name for which OTA is performed"
 #endif
 
+/**
+ * @brief The end of the topic stream requests are published to, which is
+ * $aws/things/<thingName>/streams/<streamName>/get/cbor.
+ */
+#define otaexampleSTREAM_REQUEST_SUFFIX           "/get/cbor"
+#define otaexampleSTREAM_REQUEST_SUFFIX_LENGTH    ( ( uint16_t ) ( sizeof( otaexampleSTREAM_REQUEST_SUFFIX ) - 1U ) )
+
 /**
  * @brief The maximum size of the file paths used in the demo.
  */
@@ -110,11 +124,6 @@
  */
 #define OTA_TOPIC_PREFIX                   "$aws/things/"
 
-/**
- * @brief The length of topic prefix string #OTA_TOPIC_PREFIX
- */
-#define OTA_TOPIC_PREFIX_LENGTH            ( ( uint16_t ) ( sizeof( OTA_TOPIC_PREFIX ) - 1U ) )
-
 /**
  * @brief The sub string used to match jobs topics.
  */
@@ -251,13 +260,21 @@ static OtaMqttStatus_t prvMQTTUnsubscribe( const char * pTopicFilter,
 static void prvSubscriptionCommandCallback( void * pxCommandContext,
                                             MQTTAgentReturnInfo_t * pxReturnInfo );
 
+/**
+ * @brief Link every OTA event buffer into the free list.  Must be called
+ * before any buffer is fetched.
+ */
+static void prvOTAEventBufferInit( void );
+
 /**
  * @brief Fetch an unused OTA event buffer from the pool.
  *
  * Demo uses a simple statically allocated array of fixed size event buffers. The
  * number of event buffers is configured by the param otaconfigMAX_NUM_OTA_DATA_BUFFERS
  * within ota_config.h. This function is used to fetch a free buffer from the pool for processing
- * by the OTA agent task. It uses a mutex for thread safe access to the pool.
+ * by the OTA agent task. It pops the head of a lock free list, so takes the same
+ * time however many buffers are configured, and the MQTT agent task never waits
+ * for the OTA agent task to free a buffer.
  *
  * @return A pointer to an unusued buffer. NULL if there are no buffers available.
  */
@@ -269,13 +286,70 @@ static OtaEventData_t * prvOTAEventBufferGet( void );
  * OTA demo uses a statically allocated array of fixed size event buffers . The
  * number of event buffers is configured by the param otaconfigMAX_NUM_OTA_DATA_BUFFERS
  * within ota_config.h. The function is used by the OTA application callback to free a buffer,
- * after OTA agent has completed processing with the event. The access to the pool is made thread safe
- * using a mutex.
+ * after OTA agent has completed processing with the event. The buffer is pushed
+ * onto the head of the lock free list.
  *
  * @param[in] pxBuffer Pointer to the buffer to be freed.
  */
 static void prvOTAEventBufferFree( OtaEventData_t * const pxBuffer );
 
+/**
+ * @brief Count the unused OTA event buffers in the pool.
+ *
+ * Used to cap the number of blocks requested at once, as a block that arrives
+ * when no buffer is free is dropped.
+ *
+ * @return The number of unused buffers.
+ */
+static UBaseType_t prvOTAEventBufferFreeCount( void );
+
+/**
+ * @brief Create the file an update is received into.
+ *
+ * Resets the block window, so the blocks of the new file are requested with
+ * no assumptions carried over from the last.  If a checkpoint of the file was
+ * saved before a reset the download resumes from it, otherwise the OTA PAL
+ * creates the file.
+ *
+ * @param[in] C OTA file context of the file to create.
+ * @return The status returned by otaPal_CreateFileForRx(), or success if the
+ * file was resumed.
+ */
+static OtaPalStatus_t prvCreateFileForRx( OtaFileContext_t * const C );
+
+/**
+ * @brief Write a block through the OTA PAL, saving a checkpoint of the file
+ * every OTA_CHECKPOINT_INTERVAL_BLOCKS blocks.
+ *
+ * @param[in] C OTA file context of the file being received.
+ * @param[in] ulOffset Byte offset of the block in the file.
+ * @param[in] pData The block.
+ * @param[in] ulBlockSize Length of the block.
+ * @return The value returned by otaPal_WriteBlock().
+ */
+static int16_t prvWriteBlock( OtaFileContext_t * const C,
+                              uint32_t ulOffset,
+                              uint8_t * const pData,
+                              uint32_t ulBlockSize );
+
+/**
+ * @brief Close the received file through the OTA PAL, then delete its
+ * checkpoint.
+ *
+ * @param[in] C OTA file context of the file to close.
+ * @return The status returned by otaPal_CloseFile().
+ */
+static OtaPalStatus_t prvCloseFile( OtaFileContext_t * const C );
+
+/**
+ * @brief Abort receiving a file through the OTA PAL, deleting its checkpoint
+ * if the file was open.
+ *
+ * @param[in] C OTA file context of the file to abort.
+ * @return The status returned by otaPal_Abort().
+ */
+static OtaPalStatus_t prvAbort( OtaFileContext_t * const C );
+
 /**
  * @brief The function which runs the OTA agent task.
  *
@@ -368,10 +442,37 @@ static uint8_t bitmap[ OTA_MAX_BLOCK_BITMAP_SIZE ];
  */
 static OtaEventData_t eventBuffer[ otaconfigMAX_NUM_OTA_DATA_BUFFERS ] = { 0 };
 
-/*
- * @brief Mutex used to manage thread safe access of OTA event buffers.
+/**
+ * @brief Marks the end of the free list of OTA event buffers.
+ */
+#define otaexampleEVENT_BUFFER_NONE    ( 0xFFFFUL )
+
+/**
+ * @brief Head of the free list of OTA event buffers.  The low 16 bits are the
+ * index of the first free buffer, and the high 16 bits a tag incremented by
+ * every change, so a compare and swap fails if the head was popped and pushed
+ * back between reading it and swapping it.
  */
-static SemaphoreHandle_t xBufferSemaphore;
+static volatile uint32_t ulEventBufferFreeHead = otaexampleEVENT_BUFFER_NONE;
+
+/**
+ * @brief Index of the buffer after each free buffer in the free list.
+ */
+static uint16_t usEventBufferNext[ otaconfigMAX_NUM_OTA_DATA_BUFFERS ];
+
+/**
+ * @brief Number of free OTA event buffers, the most ever in use at once, and
+ * the number of times a buffer was wanted when none was free.
+ */
+static volatile uint32_t ulEventBuffersFree = 0;
+static volatile uint32_t ulEventBuffersPeak = 0;
+static volatile uint32_t ulEventBuffersExhausted = 0;
+
+/**
+ * @brief Buffer the block window writes each stream request into.  Only the
+ * OTA agent task publishes stream requests.
+ */
+static uint8_t ucStreamRequest[ OTA_BLOCK_WINDOW_REQUEST_SIZE ];
 
 /**
  * @brief Static handle used for MQTT agent context.
@@ -418,151 +519,209 @@ const AppVersion32_t appFirmwareVersion =
 };
 
 /**
- * @brief The static callbacks for the topic filter types.
+ * @brief The exact start of the topic filters the OTA agent subscribes to for
+ * a type of message, and the callback for that type.
+ */
+typedef struct OtaTopicType
+{
+    const char * pcFilterPrefix;
+    uint16_t usFilterPrefixLength;
+    IncomingPubCallback_t xCallback;
+} OtaTopicType_t;
+
+/**
+ * @brief The start of the topic filters of a type of OTA message.
+ */
+#define otaexampleTOPIC_FILTER_PREFIX( type )    OTA_TOPIC_PREFIX democonfigCLIENT_IDENTIFIER "/" type "/"
+
+/**
+ * @brief Define the entry of #xOtaTopicTypes for a type of OTA message.
+ */
+#define otaexampleTOPIC_TYPE( type, callback ) \
+    { otaexampleTOPIC_FILTER_PREFIX( type ), ( uint16_t ) ( sizeof( otaexampleTOPIC_FILTER_PREFIX( type ) ) - 1U ), callback }
+
+/**
+ * @brief The topic filter prefixes of each type of OTA message, indexed by
+ * #OtaMessageType_t.  The thing name is part of each prefix, put in place when
+ * the demo is compiled, so a filter is classified with one memcmp() per type
+ * rather than by splitting it into fields and comparing each.  Filters are
+ * only classified when subscribing.  Incoming publishes are matched by the
+ * subscription manager, which finds a repeated topic in its interned topic
+ * table by hash and a single memcmp() of the topic name.
  */
-static IncomingPubCallback_t otaMessageCallback[ OtaNumOfMessageType ] = { prvProcessIncomingJobMessage, prvProcessIncomingData };
+static const OtaTopicType_t xOtaTopicTypes[ OtaNumOfMessageType ] =
+{
+    otaexampleTOPIC_TYPE( OTA_TOPIC_JOBS, prvProcessIncomingJobMessage ),
+    otaexampleTOPIC_TYPE( OTA_TOPIC_STREAM, prvProcessIncomingData )
+};
 /*-----------------------------------------------------------*/
 
-static void prvOTAEventBufferFree( OtaEventData_t * const pxBuffer )
+static void prvOTAEventBufferInit( void )
 {
-    if( xSemaphoreTake( xBufferSemaphore, portMAX_DELAY ) == pdTRUE )
+    uint32_t ulIndex;
+
+    configASSERT( otaconfigMAX_NUM_OTA_DATA_BUFFERS < otaexampleEVENT_BUFFER_NONE );
+
+    memset( eventBuffer, 0x00, sizeof( eventBuffer ) );
+
+    for( ulIndex = 0; ulIndex < otaconfigMAX_NUM_OTA_DATA_BUFFERS; ulIndex++ )
     {
-        pxBuffer->bufferUsed = false;
-        ( void ) xSemaphoreGive( xBufferSemaphore );
+        usEventBufferNext[ ulIndex ] = ( uint16_t ) ( ulIndex + 1U );
     }
-    else
+
+    usEventBufferNext[ otaconfigMAX_NUM_OTA_DATA_BUFFERS - 1U ] = ( uint16_t ) otaexampleEVENT_BUFFER_NONE;
+    ulEventBufferFreeHead = 0U;
+    ulEventBuffersFree = otaconfigMAX_NUM_OTA_DATA_BUFFERS;
+    ulEventBuffersPeak = 0U;
+    ulEventBuffersExhausted = 0U;
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvOTAEventBufferFree( OtaEventData_t * const pxBuffer )
+{
+    uint32_t ulIndex = ( uint32_t ) ( pxBuffer - eventBuffer );
+    uint32_t ulHead;
+
+    configASSERT( ulIndex < otaconfigMAX_NUM_OTA_DATA_BUFFERS );
+
+    pxBuffer->bufferUsed = false;
+
+    do
     {
-        LogError( ( "Failed to get buffer semaphore." ) );
-    }
+        ulHead = ulEventBufferFreeHead;
+        usEventBufferNext[ ulIndex ] = ( uint16_t ) ( ulHead & otaexampleEVENT_BUFFER_NONE );
+    } while( Atomic_CompareAndSwap_u32( &ulEventBufferFreeHead,
+                                        ( ulHead & ~otaexampleEVENT_BUFFER_NONE ) + 0x10000UL + ulIndex,
+                                        ulHead ) != ATOMIC_COMPARE_AND_SWAP_SUCCESS );
+
+    ( void ) Atomic_Increment_u32( &ulEventBuffersFree );
 }
 
 /*-----------------------------------------------------------*/
 
 static OtaEventData_t * prvOTAEventBufferGet( void )
 {
-    uint32_t ulIndex = 0;
     OtaEventData_t * pFreeBuffer = NULL;
+    uint32_t ulHead, ulIndex, ulInUse, ulPeak;
 
-    if( xSemaphoreTake( xBufferSemaphore, portMAX_DELAY ) == pdTRUE )
+    do
     {
-        for( ulIndex = 0; ulIndex < otaconfigMAX_NUM_OTA_DATA_BUFFERS; ulIndex++ )
-        {
-            if( eventBuffer[ ulIndex ].bufferUsed == false )
-            {
-                eventBuffer[ ulIndex ].bufferUsed = true;
-                pFreeBuffer = &eventBuffer[ ulIndex ];
-                break;
-            }
-        }
+        ulHead = ulEventBufferFreeHead;
+        ulIndex = ulHead & otaexampleEVENT_BUFFER_NONE;
+    } while( ( ulIndex != otaexampleEVENT_BUFFER_NONE ) &&
+             ( Atomic_CompareAndSwap_u32( &ulEventBufferFreeHead,
+                                          ( ulHead & ~otaexampleEVENT_BUFFER_NONE ) + 0x10000UL + usEventBufferNext[ ulIndex ],
+                                          ulHead ) != ATOMIC_COMPARE_AND_SWAP_SUCCESS ) );
+
+    if( ulIndex != otaexampleEVENT_BUFFER_NONE )
+    {
+        pFreeBuffer = &eventBuffer[ ulIndex ];
+        pFreeBuffer->bufferUsed = true;
+
+        ulInUse = otaconfigMAX_NUM_OTA_DATA_BUFFERS - ( Atomic_Decrement_u32( &ulEventBuffersFree ) - 1U );
 
-        ( void ) xSemaphoreGive( xBufferSemaphore );
+        do
+        {
+            ulPeak = ulEventBuffersPeak;
+        } while( ( ulInUse > ulPeak ) &&
+                 ( Atomic_CompareAndSwap_u32( &ulEventBuffersPeak, ulInUse, ulPeak ) != ATOMIC_COMPARE_AND_SWAP_SUCCESS ) );
     }
     else
     {
-        LogError( ( "Failed to get buffer semaphore." ) );
+        ( void ) Atomic_Increment_u32( &ulEventBuffersExhausted );
     }
 
     return pFreeBuffer;
 }
 
 /*-----------------------------------------------------------*/
-static void prvOTAAgentTask( void * pvParam )
+
+static UBaseType_t prvOTAEventBufferFreeCount( void )
 {
-    OTA_EventProcessingTask( pvParam );
-    vTaskDelete( NULL );
+    return ( UBaseType_t ) ulEventBuffersFree;
 }
 
 /*-----------------------------------------------------------*/
-static OtaMessageType_t getOtaMessageType( const char * pTopicFilter,
-                                           uint16_t topicFilterLength )
+
+static OtaPalStatus_t prvCreateFileForRx( OtaFileContext_t * const C )
 {
-    int retStatus = EXIT_FAILURE;
+    OtaPalStatus_t xStatus = OTA_PAL_COMBINE_ERR( OtaPalSuccess, 0 );
 
-    uint16_t stringIndex = 0U, fieldLength = 0U, i = 0U;
-    OtaMessageType_t retMesageType = OtaNumOfMessageType;
+    resetOtaBlockWindow();
 
-    /* Lookup table for OTA message string. */
-    static const char * const pOtaMessageStrings[ OtaNumOfMessageType ] =
+    if( resumeOtaCheckpoint( C ) == false )
     {
-        OTA_TOPIC_JOBS,
-        OTA_TOPIC_STREAM
-    };
+        xStatus = otaPal_CreateFileForRx( C );
+    }
 
-    /* Check topic prefix is valid.*/
-    if( strncmp( pTopicFilter, OTA_TOPIC_PREFIX, ( size_t ) OTA_TOPIC_PREFIX_LENGTH ) == 0 )
-    {
-        stringIndex = OTA_TOPIC_PREFIX_LENGTH;
+    return xStatus;
+}
 
-        retStatus = EXIT_SUCCESS;
-    }
+/*-----------------------------------------------------------*/
+
+static int16_t prvWriteBlock( OtaFileContext_t * const C,
+                              uint32_t ulOffset,
+                              uint8_t * const pData,
+                              uint32_t ulBlockSize )
+{
+    int16_t sResult = otaPal_WriteBlock( C, ulOffset, pData, ulBlockSize );
 
-    /* Check if thing name is valid.*/
-    if( retStatus == EXIT_SUCCESS )
+    if( sResult > 0 )
     {
-        retStatus = EXIT_FAILURE;
+        recordOtaCheckpointBlock( C );
+    }
 
-        /* Extract the thing name.*/
-        for( ; stringIndex < topicFilterLength; stringIndex++ )
-        {
-            if( pTopicFilter[ stringIndex ] == ( char ) '/' )
-            {
-                break;
-            }
-            else
-            {
-                fieldLength++;
-            }
-        }
+    return sResult;
+}
 
-        if( fieldLength > 0 )
-        {
-            /* Check thing name.*/
-            if( strncmp( &pTopicFilter[ stringIndex - fieldLength ],
-                         democonfigCLIENT_IDENTIFIER,
-                         ( size_t ) ( fieldLength ) ) == 0 )
-            {
-                stringIndex++;
+/*-----------------------------------------------------------*/
 
-                retStatus = EXIT_SUCCESS;
-            }
-        }
-    }
+static OtaPalStatus_t prvCloseFile( OtaFileContext_t * const C )
+{
+    OtaPalStatus_t xStatus = otaPal_CloseFile( C );
 
-    /* Check the message type from topic.*/
-    if( retStatus == EXIT_SUCCESS )
+    /* Whether or not the file was valid, it is not resumed. */
+    clearOtaCheckpoint();
+
+    return xStatus;
+}
+
+/*-----------------------------------------------------------*/
+
+static OtaPalStatus_t prvAbort( OtaFileContext_t * const C )
+{
+    /* The agent also aborts when no file is open, which must not delete the
+     * checkpoint of a file it is yet to resume. */
+    if( ( C != NULL ) && ( C->pFile != NULL ) )
     {
-        fieldLength = 0;
+        clearOtaCheckpoint();
+    }
 
-        /* Extract the topic type.*/
-        for( ; stringIndex < topicFilterLength; stringIndex++ )
-        {
-            if( pTopicFilter[ stringIndex ] == ( char ) '/' )
-            {
-                break;
-            }
-            else
-            {
-                fieldLength++;
-            }
-        }
+    return otaPal_Abort( C );
+}
 
-        if( fieldLength > 0 )
-        {
-            for( i = 0; i < OtaNumOfMessageType; i++ )
-            {
-                /* check thing name.*/
-                if( strncmp( &pTopicFilter[ stringIndex - fieldLength ],
-                             pOtaMessageStrings[ i ],
-                             ( size_t ) ( fieldLength ) ) == 0 )
-                {
-                    break;
-                }
-            }
+/*-----------------------------------------------------------*/
+static void prvOTAAgentTask( void * pvParam )
+{
+    OTA_EventProcessingTask( pvParam );
+    vTaskDelete( NULL );
+}
 
-            if( i < OtaNumOfMessageType )
-            {
-                retMesageType = i;
-            }
+/*-----------------------------------------------------------*/
+static OtaMessageType_t getOtaMessageType( const char * pTopicFilter,
+                                           uint16_t topicFilterLength )
+{
+    OtaMessageType_t retMesageType;
+
+    for( retMesageType = OtaMessageTypeJob; retMesageType < OtaNumOfMessageType; retMesageType++ )
+    {
+        if( ( topicFilterLength >= xOtaTopicTypes[ retMesageType ].usFilterPrefixLength ) &&
+            ( memcmp( pTopicFilter,
+                      xOtaTopicTypes[ retMesageType ].pcFilterPrefix,
+                      xOtaTopicTypes[ retMesageType ].usFilterPrefixLength ) == 0 ) )
+        {
+            break;
         }
     }
 
@@ -691,29 +850,56 @@ static void prvProcessIncomingData( void * pxSubscriptionContext,
 
     ( void ) pxSubscriptionContext;
 
-    OtaEventData_t * pData;
+    OtaEventData_t * pData = NULL;
     OtaEventMsg_t eventMsg = { 0 };
+    OtaBlockEnvelope_t xEnvelope;
+    bool xDecoded;
 
     LogDebug( ( "Received OTA image block, size %d.\n\n", pPublishInfo->payloadLength ) );
 
     configASSERT( pPublishInfo->payloadLength <= OTA_DATA_BLOCK_SIZE );
 
-    pData = prvOTAEventBufferGet();
+    /* Decode the block where it lies in the MQTT agent's network buffer, so a
+     * block the OTA agent does not need is dropped without taking an event
+     * buffer or being copied.  A block that cannot be decoded is left for the
+     * OTA agent to reject. */
+    xDecoded = decodeOtaBlockEnvelope( pPublishInfo->pPayload,
+                                       pPublishInfo->payloadLength,
+                                       &xEnvelope );
+
+    if( ( xDecoded == true ) && ( isOtaBlockNeeded( &xEnvelope ) == false ) )
+    {
+        LogDebug( ( "Dropped block %d of file %d, which is not needed.",
+                    ( int ) xEnvelope.lBlockId,
+                    ( int ) xEnvelope.lFileId ) );
+    }
+    else
+    {
+        pData = prvOTAEventBufferGet();
+
+        if( pData == NULL )
+        {
+            LogError( ( "Error: No OTA data buffers available.\r\n" ) );
+        }
+    }
 
     if( pData != NULL )
     {
         memcpy( pData->data, pPublishInfo->pPayload, pPublishInfo->payloadLength );
         pData->dataLength = pPublishInfo->payloadLength;
+
+        /* Record the block before the agent can ask for the next ones. */
+        if( xDecoded == true )
+        {
+            recordOtaBlockReceived( &xEnvelope );
+        }
+
         eventMsg.eventId = OtaAgentEventReceivedFileBlock;
         eventMsg.pEventData = pData;
 
         /* Send job document received event. */
         OTA_SignalEvent( &eventMsg );
     }
-    else
-    {
-        LogError( ( "Error: No OTA data buffers available.\r\n" ) );
-    }
 }
 
 /*-----------------------------------------------------------*/
@@ -788,6 +974,7 @@ static void prvSubscriptionCommandCallback( void * pxCommandContext,
             xSubscriptionAdded = addSubscription( ( SubscriptionElement_t * ) xGlobalMqttAgentContext.pIncomingCallbackContext,
                                                   pxSubscriptionInfo->pxSubscribeArgs->pSubscribeInfo->pTopicFilter,
                                                   pxSubscriptionInfo->pxSubscribeArgs->pSubscribeInfo->topicFilterLength,
+                                                  pxSubscriptionInfo->pxSubscribeArgs->pSubscribeInfo->qos,
                                                   pxSubscriptionInfo->pxIncomingPublishCallback,
                                                   NULL );
 
@@ -892,7 +1079,7 @@ static OtaMqttStatus_t prvMQTTSubscribe( const char * pTopicFilter,
     /* Send SUBSCRIBE packet. */
     mqttStatus = prvSubscribeToTopic( ucQoS,
                                       pTopicFilter,
-                                      otaMessageCallback[ otaMessageType ] );
+                                      xOtaTopicTypes[ otaMessageType ].xCallback );
 
     if( mqttStatus != MQTTSuccess )
     {
@@ -926,6 +1113,8 @@ static OtaMqttStatus_t prvMQTTPublish( const char * const pacTopic,
     TaskHandle_t xTaskHandle;
     uint32_t ulNotifiedValue;
     CommandInfo_t xCommandParams = { 0 };
+    OtaBlockWindowAction_t xWindowAction = eOtaBlockWindowPassThrough;
+    size_t xRequestLength = 0;
 
     publishInfo.pTopicName = pacTopic;
     publishInfo.topicNameLength = topicLen;
@@ -933,30 +1122,60 @@ static OtaMqttStatus_t prvMQTTPublish( const char * const pacTopic,
     publishInfo.pPayload = pMsg;
     publishInfo.payloadLength = msgSize;
 
-    xTaskHandle = xTaskGetCurrentTaskHandle();
-    xTaskNotifyStateClear( NULL );
+    /* Let the block window decide which blocks a stream request asks for. */
+    if( ( topicLen > otaexampleSTREAM_REQUEST_SUFFIX_LENGTH ) &&
+        ( strncmp( &pacTopic[ topicLen - otaexampleSTREAM_REQUEST_SUFFIX_LENGTH ],
+                   otaexampleSTREAM_REQUEST_SUFFIX,
+                   otaexampleSTREAM_REQUEST_SUFFIX_LENGTH ) == 0 ) )
+    {
+        xWindowAction = prepareOtaBlockRequest( ( const uint8_t * ) pMsg,
+                                                msgSize,
+                                                prvOTAEventBufferFreeCount(),
+                                                ucStreamRequest,
+                                                sizeof( ucStreamRequest ),
+                                                &xRequestLength );
+
+        if( xWindowAction == eOtaBlockWindowSend )
+        {
+            publishInfo.pPayload = ucStreamRequest;
+            publishInfo.payloadLength = xRequestLength;
+        }
+    }
 
-    xCommandParams.blockTimeMs = otaexampleMQTT_TIMEOUT_MS;
-    xCommandParams.cmdCompleteCallback = prvCommandCallback;
-    xCommandParams.pCmdCompleteCallbackContext = ( void * ) xTaskHandle;
+    if( xWindowAction == eOtaBlockWindowSkip )
+    {
+        /* The window is full.  The blocks in flight will prompt the agent to
+         * ask again as they arrive. */
+        LogDebug( ( "Block window full, stream request not sent." ) );
+        mqttStatus = MQTTSuccess;
+    }
+    else
+    {
+        xTaskHandle = xTaskGetCurrentTaskHandle();
+        xTaskNotifyStateClear( NULL );
 
-    mqttStatus = MQTTAgent_Publish( &xGlobalMqttAgentContext,
-                                    &publishInfo,
-                                    &xCommandParams );
+        xCommandParams.blockTimeMs = otaexampleMQTT_TIMEOUT_MS;
+        xCommandParams.cmdCompleteCallback = prvCommandCallback;
+        xCommandParams.pCmdCompleteCallbackContext = ( void * ) xTaskHandle;
 
-    /* Wait for command to complete so MQTTSubscribeInfo_t remains in scope for the
-     * duration of the command. */
-    if( mqttStatus == MQTTSuccess )
-    {
-        result = xTaskNotifyWait( 0, otaexampleMAX_UINT32, &ulNotifiedValue, pdMS_TO_TICKS( otaexampleMQTT_TIMEOUT_MS ) );
+        mqttStatus = MQTTAgent_Publish( &xGlobalMqttAgentContext,
+                                        &publishInfo,
+                                        &xCommandParams );
 
-        if( result != pdTRUE )
+        /* Wait for command to complete so MQTTSubscribeInfo_t remains in scope for the
+         * duration of the command. */
+        if( mqttStatus == MQTTSuccess )
         {
-            mqttStatus = MQTTSendFailed;
-        }
-        else
-        {
-            mqttStatus = ( MQTTStatus_t ) ( ulNotifiedValue );
+            result = xTaskNotifyWait( 0, otaexampleMAX_UINT32, &ulNotifiedValue, pdMS_TO_TICKS( otaexampleMQTT_TIMEOUT_MS ) );
+
+            if( result != pdTRUE )
+            {
+                mqttStatus = MQTTSendFailed;
+            }
+            else
+            {
+                mqttStatus = ( MQTTStatus_t ) ( ulNotifiedValue );
+            }
         }
     }
 
@@ -967,9 +1186,12 @@ static OtaMqttStatus_t prvMQTTPublish( const char * const pacTopic,
     }
     else
     {
-        LogInfo( ( "Sent PUBLISH packet to broker %.*s to broker.\n\n",
-                   topicLen,
-                   pacTopic ) );
+        if( xWindowAction != eOtaBlockWindowSkip )
+        {
+            LogInfo( ( "Sent PUBLISH packet to broker %.*s to broker.\n\n",
+                       topicLen,
+                       pacTopic ) );
+        }
 
         otaRet = OtaMqttSuccess;
     }
@@ -1097,12 +1319,12 @@ static void setOtaInterfaces( OtaInterfaces_t * pOtaInterfaces )
     /* Initialize the OTA library PAL Interface.*/
     pOtaInterfaces->pal.getPlatformImageState = otaPal_GetPlatformImageState;
     pOtaInterfaces->pal.setPlatformImageState = otaPal_SetPlatformImageState;
-    pOtaInterfaces->pal.writeBlock = otaPal_WriteBlock;
+    pOtaInterfaces->pal.writeBlock = prvWriteBlock;
     pOtaInterfaces->pal.activate = otaPal_ActivateNewImage;
-    pOtaInterfaces->pal.closeFile = otaPal_CloseFile;
+    pOtaInterfaces->pal.closeFile = prvCloseFile;
     pOtaInterfaces->pal.reset = otaPal_ResetDevice;
-    pOtaInterfaces->pal.abort = otaPal_Abort;
-    pOtaInterfaces->pal.createFile = otaPal_CreateFileForRx;
+    pOtaInterfaces->pal.abort = prvAbort;
+    pOtaInterfaces->pal.createFile = prvCreateFileForRx;
 }
 
 static void prvOTADemoTask( void * pvParam )
@@ -1123,6 +1345,9 @@ static void prvOTADemoTask( void * pvParam )
     /* OTA library packet statistics per job.*/
     OtaAgentStatistics_t otaStatistics = { 0 };
 
+    /* Block window statistics for the current file.*/
+    OtaBlockWindowStats_t xWindowStats = { 0 };
+
     /* OTA Agent state returned from calling OTA_GetAgentState.*/
     OtaState_t state = OtaAgentStateStopped;
 
@@ -1135,17 +1360,15 @@ static void prvOTADemoTask( void * pvParam )
                appFirmwareVersion.u.x.build ) );
     /****************************** Init OTA Library. ******************************/
 
-    xBufferSemaphore = xSemaphoreCreateMutex();
+    prvOTAEventBufferInit();
 
-    if( xBufferSemaphore == NULL )
+    if( initOtaBlockWindow() == false )
     {
         xResult = pdFAIL;
     }
 
     if( xResult == pdPASS )
     {
-        memset( eventBuffer, 0x00, sizeof( eventBuffer ) );
-
         if( ( otaRet = OTA_Init( &otaBuffer,
                                  &otaInterfaces,
                                  ( const uint8_t * ) ( democonfigCLIENT_IDENTIFIER ),
@@ -1190,6 +1413,20 @@ static void prvOTADemoTask( void * pvParam )
                        otaStatistics.otaPacketsProcessed,
                        otaStatistics.otaPacketsDropped ) );
 
+            getOtaBlockWindowStats( &xWindowStats );
+            LogInfo( ( " Window: %u blocks   In flight: %u   RTT: %u ms   RTO: %u ms   Requested: %u   Lost: %u   Discarded: %u",
+                       xWindowStats.ulWindowBlocks,
+                       xWindowStats.ulInFlight,
+                       xWindowStats.ulSmoothedRttMs,
+                       xWindowStats.ulRtoMs,
+                       xWindowStats.ulBlocksRequested,
+                       xWindowStats.ulBlocksLost,
+                       xWindowStats.ulBlocksDiscarded ) );
+            LogInfo( ( " Event buffers free: %u   Peak in use: %u   Exhausted: %u",
+                       ( unsigned int ) ulEventBuffersFree,
+                       ( unsigned int ) ulEventBuffersPeak,
+                       ( unsigned int ) ulEventBuffersExhausted ) );
+
             vTaskDelay( pdMS_TO_TICKS( otaexampleTASK_DELAY_MS ) );
         }
     }
@@ -1229,6 +1466,13 @@ void vSuspendOTACodeSigningDemo( void )
         {
             vTaskDelay( pdMS_TO_TICKS( otaexampleTASK_DELAY_MS ) );
         }
+
+        /* The agent is not processing blocks, so the file can be saved.  A
+         * reset while suspended then loses none of the blocks received. */
+        if( OTA_GetState() == OtaAgentStateSuspended )
+        {
+            saveOtaCheckpoint();
+        }
     }
 }
 
@@ -0,0 +1,927 @@
+/*
+ * FreeRTOS V202011.00
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://aws.amazon.com/freertos
+ *
+ */
+
+/**
+ * @file outbox.c
+ * @brief Implements the persistent store-and-forward outbox.
+ *
+ * The log file is a sequence of records, each a fixed size header followed by
+ * the topic and payload of one publish.  The header holds a CRC-32 of the
+ * record, so a record torn by a reset part way through a write is detected and
+ * discarded.  Records are only ever appended.  The checkpoint file holds two
+ * slots, written alternately, each holding a sequence number, the offset of the
+ * oldest unacknowledged record and a CRC-32, so a torn checkpoint write leaves
+ * the previous checkpoint intact.  Once enough of the log has been acknowledged
+ * the unacknowledged records are copied to a new log, which replaces the old.
+ */
+
+/**************************************************/
+/******* DO NOT CHANGE the following order ********/
+/**************************************************/
+
+/* Include header that defines log levels. */
+#include "logging_levels.h"
+
+/* Logging configuration for the outbox. */
+#ifndef LIBRARY_LOG_NAME
+    #define LIBRARY_LOG_NAME     "Outbox"
+#endif
+#ifndef LIBRARY_LOG_LEVEL
+    #define LIBRARY_LOG_LEVEL    LOG_INFO
+#endif
+
+/* Prototype for the function used to print to console. */
+extern void vLoggingPrintf( const char * pcFormatString,
+                            ... );
+
+/* Map the SdkLog macro to the logging function. */
+#ifndef SdkLog
+    #define SdkLog( message )    vLoggingPrintf message
+#endif
+
+#include "logging_stack.h"
+
+/* Standard includes. */
+#include <string.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+
+/* Outbox header include. */
+#include "outbox.h"
+
+/* MQTT agent include. */
+#include "freertos_mqtt_agent.h"
+
+/* File storage include. */
+#include "file_storage.h"
+
+/**
+ * @brief Value of the first two bytes of every record.
+ */
+#define outboxRECORD_MAGIC            ( ( uint16_t ) 0x4F42U )
+
+/**
+ * @brief Size of a record header: magic (2), QoS (1), retain (1), topic length
+ * (2), payload length (4) and CRC-32 (4), all little endian.  The CRC covers
+ * the first 10 bytes of the header, then the topic and payload.
+ */
+#define outboxHEADER_SIZE             ( 14U )
+#define outboxHEADER_CRC_OFFSET       ( 10U )
+
+/**
+ * @brief Size of a checkpoint slot: sequence number (4), offset (4) and
+ * CRC-32 (4) of the first 8 bytes, all little endian.
+ */
+#define outboxCHECKPOINT_SIZE         ( 12U )
+#define outboxCHECKPOINT_CRC_OFFSET   ( 8U )
+
+/**
+ * @brief Path of the log written during compaction.
+ */
+#define outboxCOMPACT_FILE_NAME       OUTBOX_LOG_FILE_NAME ".tmp"
+
+/**
+ * @brief Time the outbox task waits for a publish to be stored or acknowledged
+ * before checking the state of the MQTT connection again.
+ */
+#define outboxPOLL_INTERVAL_MS        ( 1000U )
+
+/**
+ * @brief Time between sends that achieves OUTBOX_DRAIN_RATE_PER_SECOND.
+ */
+#define outboxSEND_INTERVAL_TICKS     ( pdMS_TO_TICKS( 1000U / OUTBOX_DRAIN_RATE_PER_SECOND ) )
+
+/**
+ * @brief State of a slot holding a record being sent.
+ */
+typedef enum OutboxSlotState
+{
+    eSlotPending = 0, /**< The record has been read from the log and is waiting to be sent. */
+    eSlotSent,        /**< The record has been sent and is waiting for its PUBACK. */
+    eSlotAcked        /**< The record has been acknowledged and can be retired. */
+} OutboxSlotState_t;
+
+/**
+ * @brief A record read from the log to be sent.  Slots are used in the order
+ * the records appear in the log.
+ */
+typedef struct OutboxSlot
+{
+    MQTTPublishInfo_t xPublishInfo;          /**< The publish, referencing ucData. */
+    size_t xOffset;                          /**< Offset of the record in the log. */
+    size_t xLength;                          /**< Length of the record, including its header. */
+    volatile OutboxSlotState_t eState;       /**< Updated by the MQTT agent task when the publish completes. */
+    uint8_t ucData[ OUTBOX_MAX_RECORD_SIZE ]; /**< Holds the topic followed by the payload. */
+} OutboxSlot_t;
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Store a 16-bit or 32-bit value in little endian byte order.
+ */
+static void prvWrite16( uint8_t * pucDest,
+                        uint16_t usValue );
+static void prvWrite32( uint8_t * pucDest,
+                        uint32_t ulValue );
+
+/**
+ * @brief Load a 16-bit or 32-bit value stored in little endian byte order.
+ */
+static uint16_t prvRead16( const uint8_t * pucSource );
+static uint32_t prvRead32( const uint8_t * pucSource );
+
+/**
+ * @brief Read and validate the record at an offset in a log.
+ *
+ * @param[in] xFile Log to read from.
+ * @param[in] xOffset Offset of the record.
+ * @param[in] xEndOffset Offset of the end of the valid data in the log.
+ * @param[out] pxSlot Slot into which the record is read.
+ *
+ * @return pdTRUE if a complete record with a valid CRC was read, otherwise
+ * pdFALSE.
+ */
+static BaseType_t prvReadRecord( FileStorageHandle_t xFile,
+                                 size_t xOffset,
+                                 size_t xEndOffset,
+                                 OutboxSlot_t * pxSlot );
+
+/**
+ * @brief Append a record to a log.
+ *
+ * @param[in] xFile Log to append to.
+ * @param[in] pxPublishInfo Publish to store in the record.
+ * @param[out] pxEndOffset Set to the offset of the end of the record.
+ *
+ * @return pdTRUE if the record was written, otherwise pdFALSE.
+ */
+static BaseType_t prvWriteRecord( FileStorageHandle_t xFile,
+                                  const MQTTPublishInfo_t * pxPublishInfo,
+                                  size_t * pxEndOffset );
+
+/**
+ * @brief Load the most recent valid checkpoint.
+ */
+static void prvLoadCheckpoint( void );
+
+/**
+ * @brief Record the offset of the oldest unacknowledged record.
+ *
+ * @param[in] xAckedOffset Offset to record.
+ *
+ * @return pdTRUE if the checkpoint was written, otherwise pdFALSE.
+ */
+static BaseType_t prvWriteCheckpoint( size_t xAckedOffset );
+
+/**
+ * @brief Copy the unacknowledged records to a new log that replaces the current
+ * one.  Must only be called when no records are being sent.
+ *
+ * @return pdTRUE if the log was compacted, otherwise pdFALSE.
+ */
+static BaseType_t prvCompactLog( void );
+
+/**
+ * @brief Retire acknowledged records from the front of the in-flight slots and
+ * advance the checkpoint past them.
+ */
+static void prvRetireAckedRecords( void );
+
+/**
+ * @brief Read records into free slots and send pending records, no faster than
+ * OUTBOX_DRAIN_RATE_PER_SECOND.
+ *
+ * @return The maximum time to wait before calling this function again.
+ */
+static TickType_t prvSendRecords( void );
+
+/**
+ * @brief Called by the MQTT agent when a stored publish completes.
+ *
+ * @param[in] pvCommandContext The slot holding the publish.
+ * @param[in] pxReturnInfo The result of the publish.
+ */
+static void prvPublishCommandCallback( void * pvCommandContext,
+                                       MQTTAgentReturnInfo_t * pxReturnInfo );
+
+/**
+ * @brief Task that sends stored publishes while the MQTT agent is connected.
+ *
+ * @param[in] pvParameters Not used.
+ */
+static void prvOutboxTask( void * pvParameters );
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief The MQTT agent used to send stored publishes.
+ */
+extern MQTTAgentContext_t xGlobalMqttAgentContext;
+
+/**
+ * @brief Slots holding records being sent, and the index and number of those
+ * in use.  Only accessed by the outbox task, other than eState.
+ */
+static OutboxSlot_t xSlots[ OUTBOX_BATCH_SIZE ];
+static UBaseType_t uxFirstSlot = 0, uxSlotsInUse = 0;
+
+/**
+ * @brief The open log and checkpoint files.
+ */
+static FileStorageHandle_t xLogFile = NULL, xCheckpointFile = NULL;
+
+/**
+ * @brief Offsets of the oldest unacknowledged record, the next record to read
+ * into a slot, and the end of the valid records in the log.
+ */
+static size_t xAckedOffset = 0, xReadOffset = 0, xEndOffset = 0;
+
+/**
+ * @brief Sequence number of the last checkpoint written.
+ */
+static uint32_t ulCheckpointSequence = 0;
+
+/**
+ * @brief Set if a failed append left a partial record at the end of the log,
+ * which must be removed by compaction before any more records are appended.
+ */
+static BaseType_t xLogDamaged = pdFALSE;
+
+/**
+ * @brief Serializes access to the files, and the offsets, between the outbox
+ * task and tasks calling appendToOutbox().
+ */
+static SemaphoreHandle_t xFileMutex = NULL;
+
+/**
+ * @brief Handle of the outbox task, notified when there is work to do.
+ */
+static TaskHandle_t xOutboxTaskHandle = NULL;
+
+/**
+ * @brief Time at which the next record can be sent.
+ */
+static TickType_t xNextSendTime = 0;
+
+/**
+ * @brief Time at which the current drain of the outbox started, or 0 if the
+ * outbox is not being drained, along with the records and bytes acknowledged.
+ */
+static TickType_t xDrainStartTime = 0;
+static uint32_t ulDrainCount = 0, ulDrainBytes = 0;
+
+/**
+ * @brief Counters returned by getOutboxStats().
+ */
+static OutboxStats_t xStats = { 0 };
+
+/*-----------------------------------------------------------*/
+
+static void prvWrite16( uint8_t * pucDest,
+                        uint16_t usValue )
+{
+    pucDest[ 0 ] = ( uint8_t ) usValue;
+    pucDest[ 1 ] = ( uint8_t ) ( usValue >> 8 );
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvWrite32( uint8_t * pucDest,
+                        uint32_t ulValue )
+{
+    prvWrite16( pucDest, ( uint16_t ) ulValue );
+    prvWrite16( &( pucDest[ 2 ] ), ( uint16_t ) ( ulValue >> 16 ) );
+}
+
+/*-----------------------------------------------------------*/
+
+static uint16_t prvRead16( const uint8_t * pucSource )
+{
+    return ( uint16_t ) ( pucSource[ 0 ] | ( ( uint16_t ) pucSource[ 1 ] << 8 ) );
+}
+
+/*-----------------------------------------------------------*/
+
+static uint32_t prvRead32( const uint8_t * pucSource )
+{
+    return ( uint32_t ) prvRead16( pucSource ) | ( ( uint32_t ) prvRead16( &( pucSource[ 2 ] ) ) << 16 );
+}
+
+/*-----------------------------------------------------------*/
+
+static BaseType_t prvReadRecord( FileStorageHandle_t xFile,
+                                 size_t xOffset,
+                                 size_t xEndOffset,
+                                 OutboxSlot_t * pxSlot )
+{
+    uint8_t ucHeader[ outboxHEADER_SIZE ];
+    uint16_t usTopicLength = 0;
+    uint32_t ulPayloadLength = 0, ulCrc;
+    BaseType_t xValid = pdFALSE;
+
+    if( ( ( xEndOffset - xOffset ) >= outboxHEADER_SIZE ) &&
+        ( FileStorage_Read( xFile, xOffset, ucHeader, outboxHEADER_SIZE ) == pdTRUE ) &&
+        ( prvRead16( ucHeader ) == outboxRECORD_MAGIC ) )
+    {
+        usTopicLength = prvRead16( &( ucHeader[ 4 ] ) );
+        ulPayloadLength = prvRead32( &( ucHeader[ 6 ] ) );
+
+        /* Check the lengths before using them, as they are not yet known to
+         * be valid. */
+        xValid = ( ( ( size_t ) usTopicLength + ulPayloadLength ) <= OUTBOX_MAX_RECORD_SIZE ) &&
+                 ( ( xEndOffset - xOffset - outboxHEADER_SIZE ) >= ( ( size_t ) usTopicLength + ulPayloadLength ) ) &&
+                 ( ucHeader[ 2 ] <= ( uint8_t ) MQTTQoS2 );
+    }
+
+    if( xValid == pdTRUE )
+    {
+        xValid = FileStorage_Read( xFile,
+                                   xOffset + outboxHEADER_SIZE,
+                                   pxSlot->ucData,
+                                   ( size_t ) usTopicLength + ulPayloadLength );
+    }
+
+    if( xValid == pdTRUE )
+    {
+        ulCrc = FileStorage_Crc32( 0U, ucHeader, outboxHEADER_CRC_OFFSET );
+        ulCrc = FileStorage_Crc32( ulCrc, pxSlot->ucData, ( size_t ) usTopicLength + ulPayloadLength );
+        xValid = ( ulCrc == prvRead32( &( ucHeader[ outboxHEADER_CRC_OFFSET ] ) ) ) ? pdTRUE : pdFALSE;
+    }
+
+    if( xValid == pdTRUE )
+    {
+        /* Stored publishes are always sent at QoS1, as a record can only be
+         * retired once it is known to have been received. */
+        memset( &( pxSlot->xPublishInfo ), 0x00, sizeof( MQTTPublishInfo_t ) );
+        pxSlot->xPublishInfo.qos = MQTTQoS1;
+        pxSlot->xPublishInfo.retain = ( ucHeader[ 3 ] != 0U );
+        pxSlot->xPublishInfo.pTopicName = ( const char * ) pxSlot->ucData;
+        pxSlot->xPublishInfo.topicNameLength = usTopicLength;
+        pxSlot->xPublishInfo.pPayload = &( pxSlot->ucData[ usTopicLength ] );
+        pxSlot->xPublishInfo.payloadLength = ulPayloadLength;
+        pxSlot->xOffset = xOffset;
+        pxSlot->xLength = outboxHEADER_SIZE + ( size_t ) usTopicLength + ulPayloadLength;
+        pxSlot->eState = eSlotPending;
+    }
+
+    return xValid;
+}
+
+/*-----------------------------------------------------------*/
+
+static BaseType_t prvWriteRecord( FileStorageHandle_t xFile,
+                                  const MQTTPublishInfo_t * pxPublishInfo,
+                                  size_t * pxEndOffset )
+{
+    uint8_t ucHeader[ outboxHEADER_SIZE ];
+    uint32_t ulCrc;
+    size_t xOffset = 0;
+    BaseType_t xWritten;
+
+    prvWrite16( ucHeader, outboxRECORD_MAGIC );
+    ucHeader[ 2 ] = ( uint8_t ) pxPublishInfo->qos;
+    ucHeader[ 3 ] = ( pxPublishInfo->retain ) ? 1U : 0U;
+    prvWrite16( &( ucHeader[ 4 ] ), pxPublishInfo->topicNameLength );
+    prvWrite32( &( ucHeader[ 6 ] ), ( uint32_t ) pxPublishInfo->payloadLength );
+
+    ulCrc = FileStorage_Crc32( 0U, ucHeader, outboxHEADER_CRC_OFFSET );
+    ulCrc = FileStorage_Crc32( ulCrc, pxPublishInfo->pTopicName, pxPublishInfo->topicNameLength );
+    ulCrc = FileStorage_Crc32( ulCrc, pxPublishInfo->pPayload, pxPublishInfo->payloadLength );
+    prvWrite32( &( ucHeader[ outboxHEADER_CRC_OFFSET ] ), ulCrc );
+
+    /* The record is only valid once every part has been written, as the CRC
+     * covers all of it. */
+    xWritten = FileStorage_Append( xFile, ucHeader, outboxHEADER_SIZE, &xOffset ) &&
+               FileStorage_Append( xFile, pxPublishInfo->pTopicName, pxPublishInfo->topicNameLength, NULL ) &&
+               ( ( pxPublishInfo->payloadLength == 0U ) ||
+                 FileStorage_Append( xFile, pxPublishInfo->pPayload, pxPublishInfo->payloadLength, NULL ) );
+
+    if( xWritten == pdTRUE )
+    {
+        *pxEndOffset = xOffset + outboxHEADER_SIZE + pxPublishInfo->topicNameLength + pxPublishInfo->payloadLength;
+    }
+
+    return xWritten;
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvLoadCheckpoint( void )
+{
+    uint8_t ucCheckpoint[ outboxCHECKPOINT_SIZE ];
+    uint32_t ulSequence;
+    BaseType_t xFound = pdFALSE;
+    size_t xSlot;
+
+    for( xSlot = 0; xSlot < 2U; xSlot++ )
+    {
+        if( ( FileStorage_Read( xCheckpointFile, xSlot * outboxCHECKPOINT_SIZE, ucCheckpoint, outboxCHECKPOINT_SIZE ) == pdTRUE ) &&
+            ( FileStorage_Crc32( 0U, ucCheckpoint, outboxCHECKPOINT_CRC_OFFSET ) == prvRead32( &( ucCheckpoint[ outboxCHECKPOINT_CRC_OFFSET ] ) ) ) )
+        {
+            ulSequence = prvRead32( ucCheckpoint );
+
+            /* Use the most recent of the two slots. */
+            if( ( xFound == pdFALSE ) || ( ( int32_t ) ( ulSequence - ulCheckpointSequence ) > 0 ) )
+            {
+                ulCheckpointSequence = ulSequence;
+                xAckedOffset = ( size_t ) prvRead32( &( ucCheckpoint[ 4 ] ) );
+                xFound = pdTRUE;
+            }
+        }
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static BaseType_t prvWriteCheckpoint( size_t xOffset )
+{
+    uint8_t ucCheckpoint[ outboxCHECKPOINT_SIZE ];
+    BaseType_t xWritten;
+
+    /* Overwrite the older of the two slots, so a torn write leaves the more
+     * recent checkpoint intact. */
+    ulCheckpointSequence++;
+    prvWrite32( ucCheckpoint, ulCheckpointSequence );
+    prvWrite32( &( ucCheckpoint[ 4 ] ), ( uint32_t ) xOffset );
+    prvWrite32( &( ucCheckpoint[ outboxCHECKPOINT_CRC_OFFSET ] ),
+                FileStorage_Crc32( 0U, ucCheckpoint, outboxCHECKPOINT_CRC_OFFSET ) );
+
+    xWritten = FileStorage_Write( xCheckpointFile,
+                                  ( ulCheckpointSequence & 1UL ) * outboxCHECKPOINT_SIZE,
+                                  ucCheckpoint,
+                                  outboxCHECKPOINT_SIZE ) &&
+               FileStorage_Sync( xCheckpointFile );
+
+    if( xWritten != pdTRUE )
+    {
+        LogError( ( "Failed to write the outbox checkpoint." ) );
+    }
+
+    return xWritten;
+}
+
+/*-----------------------------------------------------------*/
+
+static BaseType_t prvCompactLog( void )
+{
+    FileStorageHandle_t xNewFile;
+    OutboxSlot_t * pxScratch = &( xSlots[ 0 ] );
+    size_t xOffset = xAckedOffset, xNewEndOffset = 0;
+    BaseType_t xCompacted = pdFALSE;
+
+    configASSERT( uxSlotsInUse == 0U );
+
+    ( void ) FileStorage_Remove( outboxCOMPACT_FILE_NAME );
+    xNewFile = FileStorage_Open( outboxCOMPACT_FILE_NAME );
+
+    if( xNewFile != NULL )
+    {
+        xCompacted = pdTRUE;
+
+        /* Copy the unacknowledged records, using the first slot as a buffer
+         * as no records are being sent. */
+        while( ( xOffset < xEndOffset ) && ( xCompacted == pdTRUE ) )
+        {
+            if( prvReadRecord( xLogFile, xOffset, xEndOffset, pxScratch ) == pdTRUE )
+            {
+                xCompacted = prvWriteRecord( xNewFile, &( pxScratch->xPublishInfo ), &xNewEndOffset );
+                xOffset += pxScratch->xLength;
+            }
+            else
+            {
+                /* Nothing after a corrupt record can be trusted. */
+                LogWarn( ( "Discarding corrupt outbox records from offset %u.", ( unsigned int ) xOffset ) );
+                taskENTER_CRITICAL();
+                {
+                    xStats.ulDiscarded++;
+                }
+                taskEXIT_CRITICAL();
+                break;
+            }
+        }
+
+        xCompacted = xCompacted && FileStorage_Sync( xNewFile );
+        FileStorage_Close( xNewFile );
+    }
+
+    /* Reset the checkpoint before replacing the log.  A reset in between then
+     * results in the old log being sent again from its start, which is
+     * acceptable for QoS1, rather than records being skipped. */
+    if( xCompacted == pdTRUE )
+    {
+        xCompacted = prvWriteCheckpoint( 0U );
+    }
+
+    if( xCompacted == pdTRUE )
+    {
+        FileStorage_Close( xLogFile );
+        xCompacted = FileStorage_Replace( outboxCOMPACT_FILE_NAME, OUTBOX_LOG_FILE_NAME );
+        xLogFile = FileStorage_Open( OUTBOX_LOG_FILE_NAME );
+        configASSERT( xLogFile != NULL );
+    }
+
+    if( xCompacted == pdTRUE )
+    {
+        xAckedOffset = 0U;
+        xReadOffset = 0U;
+        xEndOffset = xNewEndOffset;
+        xLogDamaged = pdFALSE;
+        taskENTER_CRITICAL();
+        {
+            xStats.ulCompactions++;
+        }
+        taskEXIT_CRITICAL();
+    }
+    else
+    {
+        LogError( ( "Failed to compact the outbox log." ) );
+    }
+
+    return xCompacted;
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvRetireAckedRecords( void )
+{
+    OutboxSlot_t * pxSlot;
+    size_t xNewAckedOffset = xAckedOffset;
+    TickType_t xDrainTime;
+
+    /* Records can be acknowledged out of order, but the checkpoint can only
+     * advance past a contiguous run of acknowledged records. */
+    while( ( uxSlotsInUse > 0U ) && ( xSlots[ uxFirstSlot ].eState == eSlotAcked ) )
+    {
+        pxSlot = &( xSlots[ uxFirstSlot ] );
+        xNewAckedOffset = pxSlot->xOffset + pxSlot->xLength;
+        ulDrainCount++;
+        ulDrainBytes += ( uint32_t ) pxSlot->xLength;
+        taskENTER_CRITICAL();
+        {
+            xStats.ulAcked++;
+        }
+        taskEXIT_CRITICAL();
+
+        uxFirstSlot = ( uxFirstSlot + 1U ) % OUTBOX_BATCH_SIZE;
+        uxSlotsInUse--;
+    }
+
+    if( xNewAckedOffset != xAckedOffset )
+    {
+        ( void ) xSemaphoreTake( xFileMutex, portMAX_DELAY );
+        {
+            /* If the checkpoint cannot be written the records are sent again
+             * after a reset, which is acceptable for QoS1. */
+            ( void ) prvWriteCheckpoint( xNewAckedOffset );
+            xAckedOffset = xNewAckedOffset;
+
+            /* Report how quickly the backlog drained once it is empty. */
+            if( ( xAckedOffset == xEndOffset ) && ( xDrainStartTime != 0U ) )
+            {
+                xDrainTime = xTaskGetTickCount() - xDrainStartTime;
+                taskENTER_CRITICAL();
+                {
+                    xStats.ulLastDrainCount = ulDrainCount;
+                    xStats.ulLastDrainBytes = ulDrainBytes;
+                    xStats.ulLastDrainTimeMs = ( uint32_t ) ( xDrainTime * portTICK_PERIOD_MS );
+                }
+                taskEXIT_CRITICAL();
+                LogInfo( ( "Outbox drained %u records (%u bytes) in %u ms.",
+                           ( unsigned int ) ulDrainCount,
+                           ( unsigned int ) ulDrainBytes,
+                           ( unsigned int ) xStats.ulLastDrainTimeMs ) );
+                xDrainStartTime = 0U;
+            }
+        }
+        ( void ) xSemaphoreGive( xFileMutex );
+    }
+
+    /* Compaction copies records through the first slot, so can only be done
+     * when no records are being sent. */
+    if( ( uxSlotsInUse == 0U ) &&
+        ( ( xAckedOffset >= OUTBOX_COMPACT_THRESHOLD ) || ( xLogDamaged == pdTRUE ) ) )
+    {
+        ( void ) xSemaphoreTake( xFileMutex, portMAX_DELAY );
+        ( void ) prvCompactLog();
+        ( void ) xSemaphoreGive( xFileMutex );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static TickType_t prvSendRecords( void )
+{
+    OutboxSlot_t * pxSlot;
+    UBaseType_t uxSlot, uxIndex;
+    TickType_t xTimeNow, xWaitTime = pdMS_TO_TICKS( outboxPOLL_INTERVAL_MS );
+    CommandInfo_t xCommandParams = { 0 };
+    BaseType_t xRecordRead;
+
+    /* Fill the free slots with the next records from the log. */
+    ( void ) xSemaphoreTake( xFileMutex, portMAX_DELAY );
+    {
+        while( ( uxSlotsInUse < OUTBOX_BATCH_SIZE ) && ( xReadOffset < xEndOffset ) )
+        {
+            uxSlot = ( uxFirstSlot + uxSlotsInUse ) % OUTBOX_BATCH_SIZE;
+            xRecordRead = prvReadRecord( xLogFile, xReadOffset, xEndOffset, &( xSlots[ uxSlot ] ) );
+
+            if( xRecordRead != pdTRUE )
+            {
+                /* Nothing after a corrupt record can be trusted.  Stop reading,
+                 * and remove the corrupt records once the slots are empty. */
+                LogWarn( ( "Corrupt outbox record at offset %u.", ( unsigned int ) xReadOffset ) );
+                taskENTER_CRITICAL();
+                {
+                    xStats.ulDiscarded++;
+                }
+                taskEXIT_CRITICAL();
+                xEndOffset = xReadOffset;
+                xLogDamaged = pdTRUE;
+                break;
+            }
+
+            xReadOffset += xSlots[ uxSlot ].xLength;
+            uxSlotsInUse++;
+        }
+    }
+    ( void ) xSemaphoreGive( xFileMutex );
+
+    xCommandParams.blockTimeMs = 0U;
+    xCommandParams.cmdCompleteCallback = prvPublishCommandCallback;
+
+    /* Send pending records in log order, no faster than the drain rate. */
+    for( uxIndex = 0; uxIndex < uxSlotsInUse; uxIndex++ )
+    {
+        pxSlot = &( xSlots[ ( uxFirstSlot + uxIndex ) % OUTBOX_BATCH_SIZE ] );
+
+        if( pxSlot->eState != eSlotPending )
+        {
+            continue;
+        }
+
+        xTimeNow = xTaskGetTickCount();
+
+        if( ( int32_t ) ( xNextSendTime - xTimeNow ) > 0 )
+        {
+            xWaitTime = xNextSendTime - xTimeNow;
+            break;
+        }
+
+        /* Set before sending as the MQTT agent can complete the publish before
+         * MQTTAgent_Publish() returns. */
+        pxSlot->eState = eSlotSent;
+        xCommandParams.pCmdCompleteCallbackContext = ( CommandContext_t * ) pxSlot;
+
+        if( MQTTAgent_Publish( &xGlobalMqttAgentContext, &( pxSlot->xPublishInfo ), &xCommandParams ) != MQTTSuccess )
+        {
+            /* The agent's queue or pending ACK list is full, try again later. */
+            pxSlot->eState = eSlotPending;
+            xWaitTime = outboxSEND_INTERVAL_TICKS;
+            break;
+        }
+
+        if( xDrainStartTime == 0U )
+        {
+            xDrainStartTime = xTimeNow;
+            ulDrainCount = 0U;
+            ulDrainBytes = 0U;
+        }
+
+        taskENTER_CRITICAL();
+        {
+            xStats.ulSent++;
+        }
+        taskEXIT_CRITICAL();
+        xNextSendTime = xTimeNow + outboxSEND_INTERVAL_TICKS;
+    }
+
+    return xWaitTime;
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvPublishCommandCallback( void * pvCommandContext,
+                                       MQTTAgentReturnInfo_t * pxReturnInfo )
+{
+    OutboxSlot_t * pxSlot = ( OutboxSlot_t * ) pvCommandContext;
+
+    /* A publish fails if the session is lost while waiting for its PUBACK, in
+     * which case it is sent again. */
+    if( pxReturnInfo->returnCode == MQTTSuccess )
+    {
+        pxSlot->eState = eSlotAcked;
+    }
+    else
+    {
+        pxSlot->eState = eSlotPending;
+
+        /* Called from the MQTT agent task, which must not wait for the file
+         * mutex, so the counter is updated in the same critical section as
+         * the others rather than under the mutex. */
+        taskENTER_CRITICAL();
+        {
+            xStats.ulResent++;
+        }
+        taskEXIT_CRITICAL();
+    }
+
+    xTaskNotifyGive( xOutboxTaskHandle );
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvOutboxTask( void * pvParameters )
+{
+    TickType_t xWaitTime = 0;
+
+    ( void ) pvParameters;
+
+    for( ; ; )
+    {
+        /* Woken when a publish is stored or completes. */
+        ( void ) ulTaskNotifyTake( pdTRUE, xWaitTime );
+
+        prvRetireAckedRecords();
+
+        if( MQTTAgent_GetConnectionState( &xGlobalMqttAgentContext ) == MQTTAgentStateConnected )
+        {
+            xWaitTime = prvSendRecords();
+        }
+        else
+        {
+            xWaitTime = pdMS_TO_TICKS( outboxPOLL_INTERVAL_MS );
+        }
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+bool startOutbox( configSTACK_DEPTH_TYPE uxStackSize,
+                  UBaseType_t uxPriority )
+{
+    bool xReturnStatus = false;
+    size_t xOffset, xFileSize;
+    uint32_t ulRecords = 0;
+
+    xFileMutex = xSemaphoreCreateMutex();
+    xLogFile = FileStorage_Open( OUTBOX_LOG_FILE_NAME );
+    xCheckpointFile = FileStorage_Open( OUTBOX_CHECKPOINT_FILE_NAME );
+
+    if( ( xFileMutex != NULL ) && ( xLogFile != NULL ) && ( xCheckpointFile != NULL ) )
+    {
+        prvLoadCheckpoint();
+        xFileSize = FileStorage_Size( xLogFile );
+
+        if( xAckedOffset > xFileSize )
+        {
+            LogWarn( ( "Outbox checkpoint is beyond the end of the log, sending the whole log." ) );
+            xAckedOffset = 0U;
+        }
+
+        /* Find the end of the valid records, which is not the end of the file
+         * if a reset interrupted an append.  The first slot is used as a
+         * buffer as no records are being sent yet. */
+        xOffset = xAckedOffset;
+
+        while( prvReadRecord( xLogFile, xOffset, xFileSize, &( xSlots[ 0 ] ) ) == pdTRUE )
+        {
+            xOffset += xSlots[ 0 ].xLength;
+            ulRecords++;
+        }
+
+        xReadOffset = xAckedOffset;
+        xEndOffset = xOffset;
+
+        if( xEndOffset != xFileSize )
+        {
+            LogWarn( ( "Outbox log has %u bytes of incomplete or corrupt records at its end.",
+                       ( unsigned int ) ( xFileSize - xEndOffset ) ) );
+            taskENTER_CRITICAL();
+            {
+                xStats.ulDiscarded++;
+            }
+            taskEXIT_CRITICAL();
+            xLogDamaged = pdTRUE;
+        }
+
+        /* New records are appended to the end of the file, so any damaged data
+         * must be removed first. */
+        if( ( xLogDamaged == pdTRUE ) || ( xAckedOffset >= OUTBOX_COMPACT_THRESHOLD ) )
+        {
+            ( void ) prvCompactLog();
+        }
+
+        LogInfo( ( "Outbox holds %u unsent records.", ( unsigned int ) ulRecords ) );
+
+        xReturnStatus = ( xTaskCreate( prvOutboxTask,
+                                       "Outbox",
+                                       uxStackSize,
+                                       NULL,
+                                       uxPriority,
+                                       &xOutboxTaskHandle ) == pdPASS );
+    }
+    else
+    {
+        LogError( ( "Failed to open the outbox files." ) );
+    }
+
+    return xReturnStatus;
+}
+
+/*-----------------------------------------------------------*/
+
+bool appendToOutbox( const MQTTPublishInfo_t * pxPublishInfo )
+{
+    bool xReturnStatus = false;
+    size_t xNewEndOffset = 0;
+
+    if( ( pxPublishInfo == NULL ) ||
+        ( pxPublishInfo->pTopicName == NULL ) ||
+        ( ( pxPublishInfo->pPayload == NULL ) && ( pxPublishInfo->payloadLength > 0U ) ) ||
+        ( ( ( size_t ) pxPublishInfo->topicNameLength + pxPublishInfo->payloadLength ) > OUTBOX_MAX_RECORD_SIZE ) )
+    {
+        LogError( ( "Publish cannot be stored in the outbox." ) );
+    }
+    else if( xOutboxTaskHandle == NULL )
+    {
+        LogError( ( "Outbox has not been started." ) );
+    }
+    else
+    {
+        ( void ) xSemaphoreTake( xFileMutex, portMAX_DELAY );
+        {
+            /* A partial record must be removed before anything else is
+             * appended, otherwise records after it cannot be found. */
+            if( xLogDamaged == pdFALSE )
+            {
+                if( ( prvWriteRecord( xLogFile, pxPublishInfo, &xNewEndOffset ) == pdTRUE ) &&
+                    ( FileStorage_Sync( xLogFile ) == pdTRUE ) )
+                {
+                    xEndOffset = xNewEndOffset;
+                    taskENTER_CRITICAL();
+                    {
+                        xStats.ulAppended++;
+                    }
+                    taskEXIT_CRITICAL();
+                    xReturnStatus = true;
+                }
+                else
+                {
+                    LogError( ( "Failed to append to the outbox log." ) );
+                    xLogDamaged = pdTRUE;
+                }
+            }
+            else
+            {
+                LogWarn( ( "Outbox log has a partial record that has not yet been removed, refusing to append." ) );
+            }
+        }
+        ( void ) xSemaphoreGive( xFileMutex );
+
+        xTaskNotifyGive( xOutboxTaskHandle );
+    }
+
+    return xReturnStatus;
+}
+
+/*-----------------------------------------------------------*/
+
+void getOutboxStats( OutboxStats_t * pxStats )
+{
+    configASSERT( pxStats != NULL );
+
+    taskENTER_CRITICAL();
+    {
+        *pxStats = xStats;
+        pxStats->ulBacklogBytes = ( uint32_t ) ( xEndOffset - xAckedOffset );
+    }
+    taskEXIT_CRITICAL();
+}
+
+/*-----------------------------------------------------------*/
@@ -0,0 +1,146 @@
+/*
+ * FreeRTOS V202011.00
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://aws.amazon.com/freertos
+ *
+ */
+
+/**
+ * @file outbox.h
+ * @brief A persistent store-and-forward outbox for QoS1 publishes made while
+ * the MQTT connection is down.
+ *
+ * Publishes are appended to a log file as checksummed records, then sent by
+ * the outbox task, at a configurable rate, once the MQTT agent is connected.
+ * A record is only retired once its PUBACK is received, at which point the
+ * offset of the oldest unacknowledged record is written to a checkpoint file.
+ * Records therefore survive an outage of any length, and a reset, and are sent
+ * at least once.
+ */
+#ifndef OUTBOX_H
+#define OUTBOX_H
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/* core MQTT include. */
+#include "core_mqtt.h"
+
+/**
+ * @brief Path of the log file holding the publish records.
+ */
+#ifndef OUTBOX_LOG_FILE_NAME
+    #define OUTBOX_LOG_FILE_NAME    "outbox.log"
+#endif
+
+/**
+ * @brief Path of the file holding the offset of the oldest unacknowledged
+ * record.
+ */
+#ifndef OUTBOX_CHECKPOINT_FILE_NAME
+    #define OUTBOX_CHECKPOINT_FILE_NAME    "outbox.ckpt"
+#endif
+
+/**
+ * @brief Maximum combined length of the topic and payload of a publish that
+ * can be stored in the outbox.
+ */
+#ifndef OUTBOX_MAX_RECORD_SIZE
+    #define OUTBOX_MAX_RECORD_SIZE    512U
+#endif
+
+/**
+ * @brief Number of stored publishes that can be waiting for a PUBACK at once.
+ * Each requires a buffer of OUTBOX_MAX_RECORD_SIZE bytes, and a free entry in
+ * the MQTT agent's pending ACK list.
+ */
+#ifndef OUTBOX_BATCH_SIZE
+    #define OUTBOX_BATCH_SIZE    4U
+#endif
+
+/**
+ * @brief Maximum number of stored publishes sent per second, so draining a large
+ * backlog does not starve the application's own traffic.
+ */
+#ifndef OUTBOX_DRAIN_RATE_PER_SECOND
+    #define OUTBOX_DRAIN_RATE_PER_SECOND    20U
+#endif
+
+/**
+ * @brief Number of bytes of acknowledged records the log may contain before
+ * it is compacted.  Compaction copies the unacknowledged records to a new log.
+ */
+#ifndef OUTBOX_COMPACT_THRESHOLD
+    #define OUTBOX_COMPACT_THRESHOLD    16384U
+#endif
+
+/**
+ * @brief Counters describing the work done by the outbox.
+ */
+typedef struct OutboxStats
+{
+    uint32_t ulAppended;        /**< Publishes stored by appendToOutbox(). */
+    uint32_t ulSent;            /**< Stored publishes sent, including resends. */
+    uint32_t ulAcked;           /**< Stored publishes acknowledged and retired. */
+    uint32_t ulResent;          /**< Stored publishes sent again after a failure or lost session. */
+    uint32_t ulDiscarded;       /**< Records discarded because they were corrupt. */
+    uint32_t ulCompactions;     /**< Number of times the log was compacted. */
+    uint32_t ulBacklogBytes;    /**< Bytes of records not yet acknowledged. */
+    uint32_t ulLastDrainCount;  /**< Records acknowledged during the last complete drain of the outbox. */
+    uint32_t ulLastDrainBytes;  /**< Record bytes acknowledged during the last complete drain. */
+    uint32_t ulLastDrainTimeMs; /**< Time taken by the last complete drain, from first send to last PUBACK. */
+} OutboxStats_t;
+
+/**
+ * @brief Open the outbox files, recovering any records stored before a reset,
+ * and create the task that sends stored publishes.  Must be called once, before
+ * appendToOutbox().
+ *
+ * @param[in] uxStackSize Stack size of the outbox task, in words.
+ * @param[in] uxPriority Priority of the outbox task.
+ *
+ * @return `true` if the outbox was started, otherwise `false`.
+ */
+bool startOutbox( configSTACK_DEPTH_TYPE uxStackSize,
+                  UBaseType_t uxPriority );
+
+/**
+ * @brief Store a publish in the outbox.  It is sent at QoS1 once the MQTT
+ * agent is connected, regardless of the QoS in pxPublishInfo.
+ *
+ * The topic and payload are copied, so do not need to remain in scope.
+ *
+ * @param[in] pxPublishInfo The publish to store.
+ *
+ * @return `true` if the publish was written to the log, otherwise `false`.
+ */
+bool appendToOutbox( const MQTTPublishInfo_t * pxPublishInfo );
+
+/**
+ * @brief Obtain a copy of the outbox counters.
+ *
+ * @param[out] pxStats Structure into which the counters are copied.
+ */
+void getOutboxStats( OutboxStats_t * pxStats );
+
+#endif /* OUTBOX_H */
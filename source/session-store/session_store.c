@@ -0,0 +1,693 @@
+/*
+ * FreeRTOS V202011.00
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://aws.amazon.com/freertos
+ *
+ */
+
+/**
+ * @file session_store.c
+ * @brief Implements the journal holding the MQTT agent's session.
+ *
+ * The journal is a sequence of records, each a fixed size header followed, for
+ * a sent publish, by the publish's topic and payload.  The header holds a
+ * CRC-32 of the record, so replaying the journal stops at a record torn by a
+ * reset part way through a write.  Every record also holds the packet ID the
+ * agent will use next, so the last valid record gives the value to restore.
+ */
+
+/**************************************************/
+/******* DO NOT CHANGE the following order ********/
+/**************************************************/
+
+/* Include header that defines log levels. */
+#include "logging_levels.h"
+
+/* Logging configuration for the session store. */
+#ifndef LIBRARY_LOG_NAME
+    #define LIBRARY_LOG_NAME     "SessionStore"
+#endif
+#ifndef LIBRARY_LOG_LEVEL
+    #define LIBRARY_LOG_LEVEL    LOG_INFO
+#endif
+
+/* Prototype for the function used to print to console. */
+extern void vLoggingPrintf( const char * pcFormatString,
+                            ... );
+
+/* Map the SdkLog macro to the logging function. */
+#ifndef SdkLog
+    #define SdkLog( message )    vLoggingPrintf message
+#endif
+
+#include "logging_stack.h"
+
+/* Standard includes. */
+#include <string.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+
+/* Session store header include. */
+#include "session_store.h"
+
+/* File storage include. */
+#include "file_storage.h"
+
+#if ( SESSION_STORE_MAX_PUBLISHES > MQTT_STATE_ARRAY_MAX_COUNT )
+    #error SESSION_STORE_MAX_PUBLISHES must not exceed MQTT_STATE_ARRAY_MAX_COUNT.
+#endif
+
+/**
+ * @brief Value of the first two bytes of every record.
+ */
+#define sessionstoreRECORD_MAGIC        ( ( uint16_t ) 0x534AU )
+
+/**
+ * @brief Record types.  A RESET record discards every publish saved before it.
+ */
+#define sessionstoreRECORD_SENT         ( 1U )
+#define sessionstoreRECORD_ACKED        ( 2U )
+#define sessionstoreRECORD_RESET        ( 3U )
+
+/**
+ * @brief Size of a record header: magic (2), type (1), flags (1), packet ID
+ * (2), next packet ID (2), topic length (2), payload length (2) and CRC-32 (4),
+ * all little endian.  The flags hold the QoS in bits 0 and 1, and the retain
+ * flag in bit 2.  The CRC covers the first 12 bytes of the header, then the
+ * topic and payload.
+ */
+#define sessionstoreHEADER_SIZE         ( 16U )
+#define sessionstoreHEADER_CRC_OFFSET   ( 12U )
+#define sessionstoreFLAG_QOS_MASK       ( 0x03U )
+#define sessionstoreFLAG_RETAIN         ( 0x04U )
+
+/**
+ * @brief Path of the journal written during compaction.
+ */
+#define sessionstoreCOMPACT_FILE_NAME   SESSION_STORE_FILE_NAME ".tmp"
+
+/**
+ * @brief The decoded header of a record.
+ */
+typedef struct JournalRecord
+{
+    uint8_t ucType;
+    uint8_t ucFlags;
+    uint16_t usPacketId;
+    uint16_t usNextPacketId;
+    uint16_t usTopicLength;
+    uint16_t usPayloadLength;
+    size_t xLength; /**< Length of the record, including its header. */
+} JournalRecord_t;
+
+/**
+ * @brief Location in the journal of the record of an unacknowledged publish.
+ */
+typedef struct SessionEntry
+{
+    uint16_t usPacketId; /**< MQTT_PACKET_ID_INVALID if the entry is not in use. */
+    size_t xOffset;
+    size_t xLength;
+} SessionEntry_t;
+
+/**
+ * @brief A publish read from the journal, to be resent by the MQTT agent.
+ */
+typedef struct LoadedPublish
+{
+    MQTTPublishInfo_t xPublishInfo;
+    uint8_t ucData[ SESSION_STORE_MAX_PUBLISH_SIZE ]; /**< Holds the topic followed by the payload. */
+} LoadedPublish_t;
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Store a 16-bit or 32-bit value in little endian byte order.
+ */
+static void prvWrite16( uint8_t * pucDest,
+                        uint16_t usValue );
+static void prvWrite32( uint8_t * pucDest,
+                        uint32_t ulValue );
+
+/**
+ * @brief Load a 16-bit or 32-bit value stored in little endian byte order.
+ */
+static uint16_t prvRead16( const uint8_t * pucSource );
+static uint32_t prvRead32( const uint8_t * pucSource );
+
+/**
+ * @brief Read and validate the record at an offset in the journal.
+ *
+ * @param[in] xOffset Offset of the record.
+ * @param[out] pxRecord The decoded header of the record.
+ * @param[out] pucData Buffer of SESSION_STORE_MAX_PUBLISH_SIZE bytes into which
+ * the topic and payload are read.
+ *
+ * @return pdTRUE if a complete record with a valid CRC was read, otherwise
+ * pdFALSE.
+ */
+static BaseType_t prvReadRecord( size_t xOffset,
+                                 JournalRecord_t * pxRecord,
+                                 uint8_t * pucData );
+
+/**
+ * @brief Append a record to the journal, and flush it to storage.
+ *
+ * @param[in] ucType The record type.
+ * @param[in] usPacketId The packet ID of the publish the record describes.
+ * @param[in] pxPublishInfo For a sent publish, the publish, otherwise NULL.
+ * @param[out] pxOffset Set to the offset at which the record was written.
+ *
+ * @return pdTRUE if the record was written, otherwise pdFALSE.
+ */
+static BaseType_t prvAppendRecord( uint8_t ucType,
+                                   uint16_t usPacketId,
+                                   const MQTTPublishInfo_t * pxPublishInfo,
+                                   size_t * pxOffset );
+
+/**
+ * @brief Rewrite the journal with only the records of unacknowledged publishes.
+ *
+ * @return pdTRUE if the journal was rewritten, otherwise pdFALSE, in which case
+ * the old journal is still in use.
+ */
+static BaseType_t prvCompactJournal( void );
+
+/**
+ * @brief Find the entry for a packet ID.  Passing MQTT_PACKET_ID_INVALID finds
+ * a free entry.
+ *
+ * @return The entry, or NULL if none was found.
+ */
+static SessionEntry_t * prvFindEntry( uint16_t usPacketId );
+
+/**
+ * @brief Called by the MQTT agent each time the session changes.  See
+ * MQTTAgentSessionChangeFunc_t.
+ */
+static void prvSessionChangeCallback( MQTTAgentContext_t * pxMqttAgentContext,
+                                      MQTTAgentSessionEvent_t xEvent,
+                                      uint16_t usPacketId,
+                                      const MQTTPublishInfo_t * pxPublishInfo );
+
+/**
+ * @brief Called by the MQTT agent when a publish loaded from the journal
+ * completes.
+ *
+ * @param[in] pvCommandContext The publish's MQTTAgentSessionPublish_t.
+ * @param[in] pxReturnInfo The result of the publish.
+ */
+static void prvLoadedPublishCallback( void * pvCommandContext,
+                                      MQTTAgentReturnInfo_t * pxReturnInfo );
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief The open journal, and the offset of the end of its valid records.
+ */
+static FileStorageHandle_t xJournal = NULL;
+static size_t xJournalSize = 0;
+
+/**
+ * @brief The packet ID the agent will use next, written to every record.
+ */
+static uint16_t usNextPacketId = MQTT_PACKET_ID_INVALID;
+
+/**
+ * @brief The unacknowledged publishes saved in the journal.  Only accessed by
+ * the MQTT agent task once the session is loaded.
+ */
+static SessionEntry_t xEntries[ SESSION_STORE_MAX_PUBLISHES ];
+
+/**
+ * @brief The publishes loaded into the agent.  Must remain in scope until
+ * each completes.
+ */
+static LoadedPublish_t xLoadedPublishes[ SESSION_STORE_MAX_PUBLISHES ];
+static MQTTAgentSessionPublish_t xSessionPublishes[ SESSION_STORE_MAX_PUBLISHES ];
+
+/**
+ * @brief Buffer used to read records, and to copy them during compaction.
+ */
+static uint8_t ucRecordBuffer[ sessionstoreHEADER_SIZE + SESSION_STORE_MAX_PUBLISH_SIZE ];
+
+/*-----------------------------------------------------------*/
+
+static void prvWrite16( uint8_t * pucDest,
+                        uint16_t usValue )
+{
+    pucDest[ 0 ] = ( uint8_t ) usValue;
+    pucDest[ 1 ] = ( uint8_t ) ( usValue >> 8 );
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvWrite32( uint8_t * pucDest,
+                        uint32_t ulValue )
+{
+    prvWrite16( pucDest, ( uint16_t ) ulValue );
+    prvWrite16( &( pucDest[ 2 ] ), ( uint16_t ) ( ulValue >> 16 ) );
+}
+
+/*-----------------------------------------------------------*/
+
+static uint16_t prvRead16( const uint8_t * pucSource )
+{
+    return ( uint16_t ) ( pucSource[ 0 ] | ( ( uint16_t ) pucSource[ 1 ] << 8 ) );
+}
+
+/*-----------------------------------------------------------*/
+
+static uint32_t prvRead32( const uint8_t * pucSource )
+{
+    return ( uint32_t ) prvRead16( pucSource ) | ( ( uint32_t ) prvRead16( &( pucSource[ 2 ] ) ) << 16 );
+}
+
+/*-----------------------------------------------------------*/
+
+static BaseType_t prvReadRecord( size_t xOffset,
+                                 JournalRecord_t * pxRecord,
+                                 uint8_t * pucData )
+{
+    uint8_t ucHeader[ sessionstoreHEADER_SIZE ];
+    size_t xDataLength = 0;
+    uint32_t ulCrc;
+    BaseType_t xValid = pdFALSE;
+
+    if( ( ( xJournalSize - xOffset ) >= sessionstoreHEADER_SIZE ) &&
+        ( FileStorage_Read( xJournal, xOffset, ucHeader, sessionstoreHEADER_SIZE ) == pdTRUE ) &&
+        ( prvRead16( ucHeader ) == sessionstoreRECORD_MAGIC ) )
+    {
+        pxRecord->ucType = ucHeader[ 2 ];
+        pxRecord->ucFlags = ucHeader[ 3 ];
+        pxRecord->usPacketId = prvRead16( &( ucHeader[ 4 ] ) );
+        pxRecord->usNextPacketId = prvRead16( &( ucHeader[ 6 ] ) );
+        pxRecord->usTopicLength = prvRead16( &( ucHeader[ 8 ] ) );
+        pxRecord->usPayloadLength = prvRead16( &( ucHeader[ 10 ] ) );
+        xDataLength = ( size_t ) pxRecord->usTopicLength + pxRecord->usPayloadLength;
+
+        /* Check the lengths before using them, as they are not yet known to
+         * be valid. */
+        xValid = ( xDataLength <= SESSION_STORE_MAX_PUBLISH_SIZE ) &&
+                 ( ( xJournalSize - xOffset - sessionstoreHEADER_SIZE ) >= xDataLength );
+    }
+
+    if( ( xValid == pdTRUE ) && ( xDataLength > 0U ) )
+    {
+        xValid = FileStorage_Read( xJournal, xOffset + sessionstoreHEADER_SIZE, pucData, xDataLength );
+    }
+
+    if( xValid == pdTRUE )
+    {
+        ulCrc = FileStorage_Crc32( 0U, ucHeader, sessionstoreHEADER_CRC_OFFSET );
+        ulCrc = FileStorage_Crc32( ulCrc, pucData, xDataLength );
+        xValid = ( ulCrc == prvRead32( &( ucHeader[ sessionstoreHEADER_CRC_OFFSET ] ) ) ) ? pdTRUE : pdFALSE;
+        pxRecord->xLength = sessionstoreHEADER_SIZE + xDataLength;
+    }
+
+    return xValid;
+}
+
+/*-----------------------------------------------------------*/
+
+static BaseType_t prvAppendRecord( uint8_t ucType,
+                                   uint16_t usPacketId,
+                                   const MQTTPublishInfo_t * pxPublishInfo,
+                                   size_t * pxOffset )
+{
+    uint8_t * pucRecord = ucRecordBuffer;
+    uint16_t usTopicLength = 0, usPayloadLength = 0;
+    uint32_t ulCrc;
+    BaseType_t xWritten;
+
+    if( pxPublishInfo != NULL )
+    {
+        usTopicLength = pxPublishInfo->topicNameLength;
+        usPayloadLength = ( uint16_t ) pxPublishInfo->payloadLength;
+        memcpy( &( pucRecord[ sessionstoreHEADER_SIZE ] ), pxPublishInfo->pTopicName, usTopicLength );
+        memcpy( &( pucRecord[ sessionstoreHEADER_SIZE + usTopicLength ] ), pxPublishInfo->pPayload, usPayloadLength );
+    }
+
+    /* Build the whole record before writing it, so it is written with a single
+     * call. */
+    prvWrite16( pucRecord, sessionstoreRECORD_MAGIC );
+    pucRecord[ 2 ] = ucType;
+    pucRecord[ 3 ] = ( pxPublishInfo == NULL ) ? 0U :
+                     ( uint8_t ) ( ( ( uint8_t ) pxPublishInfo->qos & sessionstoreFLAG_QOS_MASK ) |
+                                   ( pxPublishInfo->retain ? sessionstoreFLAG_RETAIN : 0U ) );
+    prvWrite16( &( pucRecord[ 4 ] ), usPacketId );
+    prvWrite16( &( pucRecord[ 6 ] ), usNextPacketId );
+    prvWrite16( &( pucRecord[ 8 ] ), usTopicLength );
+    prvWrite16( &( pucRecord[ 10 ] ), usPayloadLength );
+
+    ulCrc = FileStorage_Crc32( 0U, pucRecord, sessionstoreHEADER_CRC_OFFSET );
+    ulCrc = FileStorage_Crc32( ulCrc, &( pucRecord[ sessionstoreHEADER_SIZE ] ), ( size_t ) usTopicLength + usPayloadLength );
+    prvWrite32( &( pucRecord[ sessionstoreHEADER_CRC_OFFSET ] ), ulCrc );
+
+    xWritten = FileStorage_Append( xJournal,
+                                   pucRecord,
+                                   sessionstoreHEADER_SIZE + ( size_t ) usTopicLength + usPayloadLength,
+                                   pxOffset ) &&
+               FileStorage_Sync( xJournal );
+
+    if( xWritten == pdTRUE )
+    {
+        xJournalSize = *pxOffset + sessionstoreHEADER_SIZE + ( size_t ) usTopicLength + usPayloadLength;
+    }
+    else
+    {
+        LogError( ( "Failed to append to the session journal." ) );
+    }
+
+    return xWritten;
+}
+
+/*-----------------------------------------------------------*/
+
+static BaseType_t prvCompactJournal( void )
+{
+    FileStorageHandle_t xNewJournal, xOldJournal = xJournal;
+    size_t xOldJournalSize = xJournalSize, xNewOffsets[ SESSION_STORE_MAX_PUBLISHES ];
+    size_t xIndex, xOffset = 0;
+    BaseType_t xCompacted = pdFALSE;
+
+    ( void ) FileStorage_Remove( sessionstoreCOMPACT_FILE_NAME );
+    xNewJournal = FileStorage_Open( sessionstoreCOMPACT_FILE_NAME );
+
+    if( xNewJournal != NULL )
+    {
+        /* Start the new journal with a RESET record, so it holds the next
+         * packet ID even if no publishes are unacknowledged. */
+        xJournal = xNewJournal;
+        xCompacted = prvAppendRecord( sessionstoreRECORD_RESET, MQTT_PACKET_ID_INVALID, NULL, &xOffset );
+        xJournal = xOldJournal;
+
+        /* Copy the records of the unacknowledged publishes unchanged. */
+        for( xIndex = 0; ( xIndex < SESSION_STORE_MAX_PUBLISHES ) && ( xCompacted == pdTRUE ); xIndex++ )
+        {
+            if( xEntries[ xIndex ].usPacketId != MQTT_PACKET_ID_INVALID )
+            {
+                xCompacted = FileStorage_Read( xJournal, xEntries[ xIndex ].xOffset, ucRecordBuffer, xEntries[ xIndex ].xLength ) &&
+                             FileStorage_Append( xNewJournal, ucRecordBuffer, xEntries[ xIndex ].xLength, &( xNewOffsets[ xIndex ] ) );
+            }
+        }
+
+        xCompacted = xCompacted && FileStorage_Sync( xNewJournal );
+        xOffset = FileStorage_Size( xNewJournal );
+        FileStorage_Close( xNewJournal );
+    }
+
+    /* The old journal remains valid until it is replaced, so a reset during
+     * compaction loses nothing. */
+    if( xCompacted == pdTRUE )
+    {
+        FileStorage_Close( xJournal );
+        xCompacted = FileStorage_Replace( sessionstoreCOMPACT_FILE_NAME, SESSION_STORE_FILE_NAME );
+        xJournal = FileStorage_Open( SESSION_STORE_FILE_NAME );
+        configASSERT( xJournal != NULL );
+    }
+
+    if( xCompacted == pdTRUE )
+    {
+        xJournalSize = xOffset;
+
+        for( xIndex = 0; xIndex < SESSION_STORE_MAX_PUBLISHES; xIndex++ )
+        {
+            if( xEntries[ xIndex ].usPacketId != MQTT_PACKET_ID_INVALID )
+            {
+                xEntries[ xIndex ].xOffset = xNewOffsets[ xIndex ];
+            }
+        }
+
+        LogDebug( ( "Compacted the session journal from %u to %u bytes.",
+                    ( unsigned int ) xOldJournalSize,
+                    ( unsigned int ) xJournalSize ) );
+    }
+    else
+    {
+        /* Appending the RESET record moved the end of the journal. */
+        xJournalSize = xOldJournalSize;
+        LogError( ( "Failed to compact the session journal." ) );
+    }
+
+    return xCompacted;
+}
+
+/*-----------------------------------------------------------*/
+
+static SessionEntry_t * prvFindEntry( uint16_t usPacketId )
+{
+    SessionEntry_t * pxEntry = NULL;
+    size_t xIndex;
+
+    for( xIndex = 0; xIndex < SESSION_STORE_MAX_PUBLISHES; xIndex++ )
+    {
+        if( xEntries[ xIndex ].usPacketId == usPacketId )
+        {
+            pxEntry = &( xEntries[ xIndex ] );
+            break;
+        }
+    }
+
+    return pxEntry;
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvSessionChangeCallback( MQTTAgentContext_t * pxMqttAgentContext,
+                                      MQTTAgentSessionEvent_t xEvent,
+                                      uint16_t usPacketId,
+                                      const MQTTPublishInfo_t * pxPublishInfo )
+{
+    SessionEntry_t * pxEntry;
+    size_t xOffset = 0;
+
+    usNextPacketId = pxMqttAgentContext->mqttContext.nextPacketId;
+
+    switch( xEvent )
+    {
+        case MQTTAgentSessionPublishSent:
+            pxEntry = prvFindEntry( MQTT_PACKET_ID_INVALID );
+
+            if( ( pxEntry == NULL ) ||
+                ( ( ( size_t ) pxPublishInfo->topicNameLength + pxPublishInfo->payloadLength ) > SESSION_STORE_MAX_PUBLISH_SIZE ) )
+            {
+                LogWarn( ( "Publish with packet ID %u not saved, it will be lost if the device resets.", usPacketId ) );
+            }
+            else if( prvAppendRecord( sessionstoreRECORD_SENT, usPacketId, pxPublishInfo, &xOffset ) == pdTRUE )
+            {
+                pxEntry->usPacketId = usPacketId;
+                pxEntry->xOffset = xOffset;
+                pxEntry->xLength = xJournalSize - xOffset;
+            }
+
+            break;
+
+        case MQTTAgentSessionPublishAcked:
+            pxEntry = prvFindEntry( usPacketId );
+
+            /* Publishes that were not saved do not need to be removed. */
+            if( pxEntry != NULL )
+            {
+                /* If the record cannot be written, the publish is sent again
+                 * after a reset, which the broker treats as a duplicate. */
+                ( void ) prvAppendRecord( sessionstoreRECORD_ACKED, usPacketId, NULL, &xOffset );
+                pxEntry->usPacketId = MQTT_PACKET_ID_INVALID;
+            }
+
+            break;
+
+        case MQTTAgentSessionCleared:
+            ( void ) prvAppendRecord( sessionstoreRECORD_RESET, MQTT_PACKET_ID_INVALID, NULL, &xOffset );
+            memset( xEntries, 0x00, sizeof( xEntries ) );
+            break;
+
+        default:
+            break;
+    }
+
+    if( xJournalSize > SESSION_STORE_COMPACT_THRESHOLD )
+    {
+        ( void ) prvCompactJournal();
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvLoadedPublishCallback( void * pvCommandContext,
+                                      MQTTAgentReturnInfo_t * pxReturnInfo )
+{
+    MQTTAgentSessionPublish_t * pxSessionPublish = ( MQTTAgentSessionPublish_t * ) pvCommandContext;
+
+    if( pxReturnInfo->returnCode == MQTTSuccess )
+    {
+        LogInfo( ( "Publish with packet ID %u saved before the reset was acknowledged.",
+                   pxSessionPublish->packetId ) );
+    }
+    else
+    {
+        LogWarn( ( "Publish with packet ID %u saved before the reset was lost with the broker's session.",
+                   pxSessionPublish->packetId ) );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+bool loadMQTTSession( MQTTAgentContext_t * pxMqttAgentContext )
+{
+    JournalRecord_t xRecord;
+    SessionEntry_t * pxEntry;
+    LoadedPublish_t * pxLoaded;
+    MQTTStatus_t xResult;
+    size_t xIndex, xOffset = 0, xFileSize, xNumPublishes = 0;
+
+    configASSERT( pxMqttAgentContext != NULL );
+
+    xJournal = FileStorage_Open( SESSION_STORE_FILE_NAME );
+
+    /* An empty journal means either there is no saved session, or a reset
+     * interrupted compaction after the old journal was removed, in which case
+     * the compacted journal is complete. */
+    if( ( xJournal != NULL ) && ( FileStorage_Size( xJournal ) == 0U ) )
+    {
+        FileStorage_Close( xJournal );
+        ( void ) FileStorage_Replace( sessionstoreCOMPACT_FILE_NAME, SESSION_STORE_FILE_NAME );
+        xJournal = FileStorage_Open( SESSION_STORE_FILE_NAME );
+    }
+
+    if( xJournal == NULL )
+    {
+        LogError( ( "Failed to open the session journal, the session will not be saved." ) );
+        return false;
+    }
+
+    /* Replay the journal to find the publishes that were not acknowledged. */
+    xFileSize = FileStorage_Size( xJournal );
+    xJournalSize = xFileSize;
+
+    while( prvReadRecord( xOffset, &xRecord, ucRecordBuffer ) == pdTRUE )
+    {
+        if( xRecord.ucType == sessionstoreRECORD_SENT )
+        {
+            pxEntry = prvFindEntry( MQTT_PACKET_ID_INVALID );
+
+            if( pxEntry != NULL )
+            {
+                pxEntry->usPacketId = xRecord.usPacketId;
+                pxEntry->xOffset = xOffset;
+                pxEntry->xLength = xRecord.xLength;
+            }
+        }
+        else if( xRecord.ucType == sessionstoreRECORD_ACKED )
+        {
+            pxEntry = prvFindEntry( xRecord.usPacketId );
+
+            if( pxEntry != NULL )
+            {
+                pxEntry->usPacketId = MQTT_PACKET_ID_INVALID;
+            }
+        }
+        else
+        {
+            memset( xEntries, 0x00, sizeof( xEntries ) );
+        }
+
+        usNextPacketId = xRecord.usNextPacketId;
+        xOffset += xRecord.xLength;
+    }
+
+    /* Records after a torn or corrupt record cannot be trusted, and are
+     * removed by the compaction below. */
+    if( xOffset != xFileSize )
+    {
+        LogWarn( ( "Session journal has %u bytes of incomplete or corrupt records at its end.",
+                   ( unsigned int ) ( xFileSize - xOffset ) ) );
+    }
+
+    xJournalSize = xOffset;
+
+    /* Read the publishes into buffers that remain in scope until each is
+     * acknowledged. */
+    for( xIndex = 0; xIndex < SESSION_STORE_MAX_PUBLISHES; xIndex++ )
+    {
+        pxEntry = &( xEntries[ xIndex ] );
+        pxLoaded = &( xLoadedPublishes[ xNumPublishes ] );
+
+        if( ( pxEntry->usPacketId != MQTT_PACKET_ID_INVALID ) &&
+            ( prvReadRecord( pxEntry->xOffset, &xRecord, pxLoaded->ucData ) == pdTRUE ) )
+        {
+            memset( &( pxLoaded->xPublishInfo ), 0x00, sizeof( MQTTPublishInfo_t ) );
+            pxLoaded->xPublishInfo.qos = ( MQTTQoS_t ) ( xRecord.ucFlags & sessionstoreFLAG_QOS_MASK );
+            pxLoaded->xPublishInfo.retain = ( ( xRecord.ucFlags & sessionstoreFLAG_RETAIN ) != 0U );
+            pxLoaded->xPublishInfo.pTopicName = ( const char * ) pxLoaded->ucData;
+            pxLoaded->xPublishInfo.topicNameLength = xRecord.usTopicLength;
+            pxLoaded->xPublishInfo.pPayload = &( pxLoaded->ucData[ xRecord.usTopicLength ] );
+            pxLoaded->xPublishInfo.payloadLength = xRecord.usPayloadLength;
+
+            xSessionPublishes[ xNumPublishes ].packetId = pxEntry->usPacketId;
+            xSessionPublishes[ xNumPublishes ].pPublishInfo = &( pxLoaded->xPublishInfo );
+            xNumPublishes++;
+        }
+    }
+
+    /* Drop the acknowledged publishes, and any damaged records, before new
+     * records are appended.  Records appended after damaged ones would be
+     * lost when the journal is next replayed, so the journal cannot be used
+     * if the damaged records remain.  It is left as it is for the next start
+     * to compact. */
+    if( ( prvCompactJournal() == pdFALSE ) && ( xOffset != xFileSize ) )
+    {
+        LogError( ( "Failed to remove the damaged records from the session journal, the session will not be saved." ) );
+        FileStorage_Close( xJournal );
+        xJournal = NULL;
+        memset( xEntries, 0x00, sizeof( xEntries ) );
+        return false;
+    }
+
+    xResult = MQTTAgent_LoadSession( pxMqttAgentContext,
+                                     xSessionPublishes,
+                                     xNumPublishes,
+                                     usNextPacketId,
+                                     prvLoadedPublishCallback );
+
+    if( xResult == MQTTSuccess )
+    {
+        LogInfo( ( "Loaded %u unacknowledged publishes from the session journal.",
+                   ( unsigned int ) xNumPublishes ) );
+    }
+    else
+    {
+        /* The agent does not know about the publishes so will never report
+         * them as acknowledged.  Discard them. */
+        LogError( ( "Failed to load the saved session. xResult=%s.",
+                    MQTT_Status_strerror( xResult ) ) );
+        ( void ) prvAppendRecord( sessionstoreRECORD_RESET, MQTT_PACKET_ID_INVALID, NULL, &xOffset );
+        memset( xEntries, 0x00, sizeof( xEntries ) );
+    }
+
+    ( void ) MQTTAgent_SetSessionChangeCallback( pxMqttAgentContext, prvSessionChangeCallback );
+
+    return true;
+}
+
+/*-----------------------------------------------------------*/
@@ -0,0 +1,95 @@
+/*
+ * FreeRTOS V202011.00
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://aws.amazon.com/freertos
+ *
+ */
+
+/**
+ * @file session_store.h
+ * @brief Saves the in-flight state of the MQTT agent's session to a journal
+ * file, so unacknowledged publishes can be resumed after a reset.
+ *
+ * Each time the agent sends or receives the acknowledgment for a QoS 1 or 2
+ * publish a small checksummed record is appended to the journal, rather than
+ * the whole session being rewritten.  At start up the journal is replayed to
+ * rebuild the set of unacknowledged publishes, which are then loaded into the
+ * agent with MQTTAgent_LoadSession() so MQTTAgent_ResumeSession() can resend
+ * them if the broker still holds the session.
+ */
+#ifndef SESSION_STORE_H
+#define SESSION_STORE_H
+
+/* MQTT agent include. */
+#include "freertos_mqtt_agent.h"
+
+/**
+ * @brief Path of the journal file.
+ */
+#ifndef SESSION_STORE_FILE_NAME
+    #define SESSION_STORE_FILE_NAME    "session.jnl"
+#endif
+
+/**
+ * @brief Maximum number of unacknowledged publishes saved.  Must not exceed
+ * MQTT_STATE_ARRAY_MAX_COUNT.  Publishes sent while this many are already
+ * saved are not saved, so are lost if the device resets before they are
+ * acknowledged.
+ */
+#ifndef SESSION_STORE_MAX_PUBLISHES
+    #define SESSION_STORE_MAX_PUBLISHES    8U
+#endif
+
+/**
+ * @brief Maximum combined length of the topic and payload of a publish that is
+ * saved.  Each saved publish requires a buffer of this size when the session is
+ * loaded.
+ */
+#ifndef SESSION_STORE_MAX_PUBLISH_SIZE
+    #define SESSION_STORE_MAX_PUBLISH_SIZE    256U
+#endif
+
+/**
+ * @brief Size the journal may grow to before it is compacted.  Compaction
+ * rewrites the journal with only the records of unacknowledged publishes.
+ */
+#ifndef SESSION_STORE_COMPACT_THRESHOLD
+    #define SESSION_STORE_COMPACT_THRESHOLD    8192U
+#endif
+
+/**
+ * @brief Load the session saved in the journal into an MQTT agent, then save
+ * every subsequent change to the session.
+ *
+ * @note Must be called after MQTTAgent_Init() and before the agent connects.
+ * The agent should then connect without a clean session, and call
+ * MQTTAgent_ResumeSession().
+ *
+ * @param[in] pxMqttAgentContext The MQTT agent whose session is saved.
+ *
+ * @return `true` if the journal was opened, otherwise `false`, in which case
+ * the session is neither loaded nor saved.  The journal cannot be used if it
+ * has damaged records that could not be removed.
+ */
+bool loadMQTTSession( MQTTAgentContext_t * pxMqttAgentContext );
+
+#endif /* SESSION_STORE_H */
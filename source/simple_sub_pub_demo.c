@@ -63,6 +63,12 @@
 /* Subscription manager header include. */
 #include "subscription_manager.h"
 
+/* Subscription dispatcher header include. */
+#include "subscription_dispatcher.h"
+
+/* Outbox header include. */
+#include "outbox.h"
+
 /**
  * @brief This demo uses task notifications to signal tasks from MQTT callback
  * functions.  mqttexampleMS_TO_WAIT_FOR_NOTIFICATION defines the time, in ticks,
@@ -86,6 +92,12 @@
  */
 #define mqttexamplePUBLISH_COUNT                          ( 0xffffffffUL )
 
+/**
+ * @brief Number of publishes made by the first task between each log of the
+ * subscription manager's dispatch counters.
+ */
+#define mqttexampleDISPATCH_STATS_INTERVAL                ( 20UL )
+
 /**
  * @brief The maximum amount of time in milliseconds to wait for the commands
  * to be posted to the MQTT agent should the MQTT agent's command queue be full.
@@ -189,6 +201,12 @@ static bool prvSubscribeToTopic( MQTTQoS_t xQoS,
  */
 static void prvSimpleSubscribePublishTask( void * pvParameters );
 
+/**
+ * @brief Log the counters describing the cost of dispatching incoming
+ * publishes, and the work done by the subscription dispatcher if it is used.
+ */
+static void prvLogDispatchStats( void );
+
 /*-----------------------------------------------------------*/
 
 /**
@@ -197,6 +215,20 @@ static void prvSimpleSubscribePublishTask( void * pvParameters );
  */
 extern MQTTAgentContext_t xGlobalMqttAgentContext;
 
+#if ( democonfigCREATE_SUBSCRIPTION_DISPATCHER == 1 )
+
+/**
+ * @brief Routes incoming publishes to prvIncomingPublishCallback() via the
+ * subscription dispatcher tasks, rather than calling it from the MQTT agent
+ * task.
+ */
+    static const DispatchTarget_t xDispatchTarget =
+    {
+        .pxIncomingPublishCallback        = prvIncomingPublishCallback,
+        .pvIncomingPublishCallbackContext = NULL
+    };
+#endif
+
 /*-----------------------------------------------------------*/
 
 /**
@@ -278,11 +310,21 @@ static void prvSubscribeCommandCallback( void * pxCommandContext,
     {
         /* Add subscription so that incoming publishes are routed to the application
          * callback. */
-        xSubscriptionAdded = addSubscription( ( SubscriptionElement_t * ) xGlobalMqttAgentContext.pIncomingCallbackContext,
-                                              pxSubscribeArgs->pSubscribeInfo->pTopicFilter,
-                                              pxSubscribeArgs->pSubscribeInfo->topicFilterLength,
-                                              prvIncomingPublishCallback,
-                                              NULL );
+        #if ( democonfigCREATE_SUBSCRIPTION_DISPATCHER == 1 )
+            xSubscriptionAdded = addSubscription( ( SubscriptionElement_t * ) xGlobalMqttAgentContext.pIncomingCallbackContext,
+                                                  pxSubscribeArgs->pSubscribeInfo->pTopicFilter,
+                                                  pxSubscribeArgs->pSubscribeInfo->topicFilterLength,
+                                                  pxSubscribeArgs->pSubscribeInfo->qos,
+                                                  dispatchIncomingPublishCallback,
+                                                  ( void * ) &xDispatchTarget );
+        #else
+            xSubscriptionAdded = addSubscription( ( SubscriptionElement_t * ) xGlobalMqttAgentContext.pIncomingCallbackContext,
+                                                  pxSubscribeArgs->pSubscribeInfo->pTopicFilter,
+                                                  pxSubscribeArgs->pSubscribeInfo->topicFilterLength,
+                                                  pxSubscribeArgs->pSubscribeInfo->qos,
+                                                  prvIncomingPublishCallback,
+                                                  NULL );
+        #endif
 
         if( xSubscriptionAdded == false )
         {
@@ -317,7 +359,9 @@ static BaseType_t prvWaitForCommandAcknowledgment( uint32_t * pulNotifiedValue )
 static void prvIncomingPublishCallback( void * pvIncomingPublishCallbackContext,
                                         MQTTPublishInfo_t * pxPublishInfo )
 {
-    static char cTerminatedString[ mqttexampleSTRING_BUFFER_LENGTH ];
+    /* Not static as this callback may execute in more than one dispatcher
+     * task at once. */
+    char cTerminatedString[ mqttexampleSTRING_BUFFER_LENGTH ];
 
     ( void ) pvIncomingPublishCallbackContext;
 
@@ -437,6 +481,7 @@ static void prvSimpleSubscribePublishTask( void * pvParameters )
     TickType_t xTicksToDelay;
     CommandInfo_t xCommandParams = { 0 };
     char * pcTopicBuffer = topicBuf[ ulTaskNumber ];
+    uint16_t usTopicId;
 
     /* Have different tasks use different QoS.  0 and 1.  2 can also be used
      * if supported by the broker. */
@@ -457,10 +502,19 @@ static void prvSimpleSubscribePublishTask( void * pvParameters )
     /* Configure the publish operation. */
     memset( ( void * ) &xPublishInfo, 0x00, sizeof( xPublishInfo ) );
     xPublishInfo.qos = xQoS;
-    xPublishInfo.pTopicName = pcTopicBuffer;
-    xPublishInfo.topicNameLength = ( uint16_t ) strlen( pcTopicBuffer );
     xPublishInfo.pPayload = payloadBuf;
 
+    /* Intern the topic, so the publishes the broker sends back on it are
+     * dispatched from the interned topic table rather than matched against
+     * each subscription filter, and publish from the interned copy. */
+    usTopicId = internTopic( pcTopicBuffer, ( uint16_t ) strlen( pcTopicBuffer ) );
+
+    if( getInternedTopic( usTopicId, &( xPublishInfo.pTopicName ), &( xPublishInfo.topicNameLength ), NULL ) == false )
+    {
+        xPublishInfo.pTopicName = pcTopicBuffer;
+        xPublishInfo.topicNameLength = ( uint16_t ) strlen( pcTopicBuffer );
+    }
+
     /* Store the handler to this task in the command context so the callback
      * that executes when the command is acknowledged can send a notification
      * back to this task. */
@@ -489,6 +543,25 @@ static void prvSimpleSubscribePublishTask( void * pvParameters )
          * is acknowledged. */
         xCommandContext.ulNotificationValue = ulValueToNotify;
 
+        /* While the agent is reconnecting, store QoS1 publishes so they are
+         * sent once it has reconnected, rather than waiting for the connection
+         * here. */
+        #if ( democonfigCREATE_OUTBOX == 1 )
+            {
+                if( ( xQoS == MQTTQoS1 ) &&
+                    ( MQTTAgent_GetConnectionState( &xGlobalMqttAgentContext ) == MQTTAgentStateReconnecting ) )
+                {
+                    if( appendToOutbox( &xPublishInfo ) == true )
+                    {
+                        LogInfo( ( "Stored message \"%s\" in the outbox while reconnecting.", payloadBuf ) );
+                    }
+
+                    vTaskDelay( pdMS_TO_TICKS( mqttexampleDELAY_BETWEEN_PUBLISH_OPERATIONS_MS ) );
+                    continue;
+                }
+            }
+        #endif
+
         LogInfo( ( "Sending publish request to agent with message \"%s\" on topic \"%s\"",
                    payloadBuf,
                    pcTopicBuffer ) );
@@ -511,15 +584,22 @@ static void prvSimpleSubscribePublishTask( void * pvParameters )
 
         /* The value by the callback that executed when the publish was acked
          * came from the context passed into MQTTAgent_Publish() above, so
-         * should match the value set in the context above. */
-        configASSERT( ulNotification == ulValueToNotify );
-
+         * should match the value set in the context above.  It does not if the
+         * wait timed out, which is expected while the agent is reconnecting,
+         * as publishes are held back until the connection is restored, so the
+         * publish is skipped rather than treated as a failure. */
         if( ulNotification == ulValueToNotify )
         {
             LogInfo( ( "Received ack from publishing to topic %s. Sleeping for %d ms.",
                        pcTopicBuffer,
                        mqttexampleDELAY_BETWEEN_PUBLISH_OPERATIONS_MS ) );
         }
+        else if( MQTTAgent_GetConnectionState( &xGlobalMqttAgentContext ) != MQTTAgentStateConnected )
+        {
+            LogWarn( ( "Publish %d to topic %s did not complete while the agent was reconnecting, skipping it.",
+                       ulValueToNotify,
+                       pcTopicBuffer ) );
+        }
         else
         {
             LogInfo( ( "Error - Timed out or didn't receive ack from publishing to topic %s Sleeping for %d ms.",
@@ -527,6 +607,11 @@ static void prvSimpleSubscribePublishTask( void * pvParameters )
                        mqttexampleDELAY_BETWEEN_PUBLISH_OPERATIONS_MS ) );
         }
 
+        if( ( ulTaskNumber == 0UL ) && ( ( ulValueToNotify % mqttexampleDISPATCH_STATS_INTERVAL ) == 0UL ) )
+        {
+            prvLogDispatchStats();
+        }
+
         /* Add a little randomness into the delay so the tasks don't remain
          * in lockstep. */
         xTicksToDelay = pdMS_TO_TICKS( mqttexampleDELAY_BETWEEN_PUBLISH_OPERATIONS_MS ) +
@@ -537,3 +622,43 @@ static void prvSimpleSubscribePublishTask( void * pvParameters )
     /* Delete the task if it is complete. */
     vTaskDelete( NULL );
 }
+
+/*-----------------------------------------------------------*/
+
+static void prvLogDispatchStats( void )
+{
+    SubscriptionManagerStats_t xStats;
+
+    getSubscriptionManagerStats( &xStats );
+
+    LogInfo( ( "Dispatched %u publishes, %u from interned topics and %u matched against each filter, "
+               "making %u filter matches and comparing %u topic and filter bytes.",
+               ( unsigned int ) xStats.ulDispatches,
+               ( unsigned int ) xStats.ulInternedTopicHits,
+               ( unsigned int ) xStats.ulInternedTopicMisses,
+               ( unsigned int ) xStats.ulFilterMatches,
+               ( unsigned int ) xStats.ulBytesCompared ) );
+
+    #if ( democonfigCREATE_SUBSCRIPTION_DISPATCHER == 1 )
+        {
+            SubscriptionDispatcherStats_t xDispatcherStats;
+            UBaseType_t uxWorker;
+
+            getSubscriptionDispatcherStats( &xDispatcherStats );
+
+            LogInfo( ( "Dispatcher handed over %u publishes, %u in a retained network buffer, "
+                       "and dropped %u with no free work item and %u too large to copy.",
+                       ( unsigned int ) xDispatcherStats.ulDispatched,
+                       ( unsigned int ) xDispatcherStats.ulRetained,
+                       ( unsigned int ) xDispatcherStats.ulDropped,
+                       ( unsigned int ) xDispatcherStats.ulOversized ) );
+
+            for( uxWorker = 0; uxWorker < SUBSCRIPTION_DISPATCHER_NUM_WORKERS; uxWorker++ )
+            {
+                LogInfo( ( "Dispatcher task %u processed %u publishes.",
+                           ( unsigned int ) uxWorker,
+                           ( unsigned int ) xDispatcherStats.ulProcessed[ uxWorker ] ) );
+            }
+        }
+    #endif /* if ( democonfigCREATE_SUBSCRIPTION_DISPATCHER == 1 ) */
+}
@@ -0,0 +1,274 @@
+/*
+ * FreeRTOS V202011.00
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://aws.amazon.com/freertos
+ *
+ */
+
+/**
+ * @file subscription_dispatcher.c
+ * @brief Runs incoming publish callbacks on a pool of tasks so CPU heavy
+ * callbacks do not hold up the MQTT agent task, or each other.
+ *
+ * The MQTT agent task copies each publish into a work item taken from a fixed
+ * pool, then posts the work item to the queue of the dispatcher task selected
+ * by hashing the publish's topic.  Each dispatcher task invokes the callback
+ * and returns the work item to the pool.  A publish too large to copy is
+ * instead handed over in the MQTT agent's network buffer, which is retained
+ * until the callback returns.
+ */
+
+/* Standard includes. */
+#include <string.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+
+/* Dispatcher header include. */
+#include "subscription_dispatcher.h"
+
+/* MQTT agent network buffer pool include. */
+#include "agent_buffer_pool.h"
+
+/**
+ * @brief A publish waiting to be, or being, processed by a dispatcher task.
+ */
+typedef struct DispatchWorkItem
+{
+    MQTTPublishInfo_t xPublishInfo;
+    const DispatchTarget_t * pxTarget;
+    const void * pvRetainedBuffer;                              /**< Pointer into the retained network buffer, or NULL if the publish was copied. */
+    uint8_t ucData[ SUBSCRIPTION_DISPATCHER_MAX_PUBLISH_SIZE ]; /**< Holds the topic followed by the payload. */
+} DispatchWorkItem_t;
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Select the dispatcher task that handles a topic.
+ *
+ * @param[in] pcTopicName Topic name of the publish.
+ * @param[in] usTopicNameLength Length of the topic name.
+ *
+ * @return Index of the dispatcher task.
+ */
+static UBaseType_t prvSelectWorker( const char * pcTopicName,
+                                    uint16_t usTopicNameLength );
+
+/**
+ * @brief The function that implements each dispatcher task.
+ *
+ * @param[in] pvParameters Index of the dispatcher task.
+ */
+static void prvDispatcherTask( void * pvParameters );
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief The pool of work items, and the queue holding those that are free.
+ */
+static DispatchWorkItem_t xWorkItems[ SUBSCRIPTION_DISPATCHER_NUM_WORK_ITEMS ];
+static QueueHandle_t xFreeWorkItems = NULL;
+
+/**
+ * @brief The queue of work items for each dispatcher task.  Each can hold
+ * every work item so posting to it never fails.
+ */
+static QueueHandle_t xWorkerQueues[ SUBSCRIPTION_DISPATCHER_NUM_WORKERS ];
+
+static SubscriptionDispatcherStats_t xStats = { 0 };
+
+/*-----------------------------------------------------------*/
+
+bool startSubscriptionDispatcher( configSTACK_DEPTH_TYPE uxStackSize,
+                                  UBaseType_t uxPriority )
+{
+    bool xReturnStatus = true;
+    UBaseType_t uxIndex;
+    DispatchWorkItem_t * pxWorkItem;
+
+    configASSERT( xFreeWorkItems == NULL );
+
+    xFreeWorkItems = xQueueCreate( SUBSCRIPTION_DISPATCHER_NUM_WORK_ITEMS, sizeof( DispatchWorkItem_t * ) );
+
+    if( xFreeWorkItems == NULL )
+    {
+        xReturnStatus = false;
+    }
+    else
+    {
+        for( uxIndex = 0U; uxIndex < SUBSCRIPTION_DISPATCHER_NUM_WORK_ITEMS; uxIndex++ )
+        {
+            pxWorkItem = &( xWorkItems[ uxIndex ] );
+            ( void ) xQueueSendToBack( xFreeWorkItems, &pxWorkItem, 0U );
+        }
+    }
+
+    for( uxIndex = 0U; ( uxIndex < SUBSCRIPTION_DISPATCHER_NUM_WORKERS ) && ( xReturnStatus == true ); uxIndex++ )
+    {
+        xWorkerQueues[ uxIndex ] = xQueueCreate( SUBSCRIPTION_DISPATCHER_NUM_WORK_ITEMS, sizeof( DispatchWorkItem_t * ) );
+
+        if( ( xWorkerQueues[ uxIndex ] == NULL ) ||
+            ( xTaskCreate( prvDispatcherTask,
+                           "SubDispatch",
+                           uxStackSize,
+                           ( void * ) uxIndex,
+                           uxPriority,
+                           NULL ) != pdPASS ) )
+        {
+            xReturnStatus = false;
+        }
+    }
+
+    if( xReturnStatus == false )
+    {
+        LogError( ( "Failed to start the subscription dispatcher." ) );
+    }
+
+    return xReturnStatus;
+}
+
+/*-----------------------------------------------------------*/
+
+static UBaseType_t prvSelectWorker( const char * pcTopicName,
+                                    uint16_t usTopicNameLength )
+{
+    /* The hash spreads topics evenly across the dispatcher tasks. */
+    return ( UBaseType_t ) ( hashTopicName( pcTopicName, usTopicNameLength ) % SUBSCRIPTION_DISPATCHER_NUM_WORKERS );
+}
+
+/*-----------------------------------------------------------*/
+
+void dispatchIncomingPublishCallback( void * pvDispatchTarget,
+                                      MQTTPublishInfo_t * pxPublishInfo )
+{
+    const DispatchTarget_t * pxTarget = ( const DispatchTarget_t * ) pvDispatchTarget;
+    DispatchWorkItem_t * pxWorkItem = NULL;
+    size_t xRequiredSize;
+    bool xRetained = false;
+
+    configASSERT( pxTarget != NULL );
+    configASSERT( pxPublishInfo != NULL );
+    configASSERT( xFreeWorkItems != NULL );
+
+    xRequiredSize = ( size_t ) pxPublishInfo->topicNameLength + pxPublishInfo->payloadLength;
+
+    /* Copying a small publish is cheaper than retaining a whole network
+     * buffer, and leaves the pool's few buffers for publishes too large to
+     * copy. */
+    if( xRequiredSize > SUBSCRIPTION_DISPATCHER_MAX_PUBLISH_SIZE )
+    {
+        xRetained = Agent_RetainNetworkBuffer( pxPublishInfo->pTopicName );
+    }
+
+    if( ( xRetained == false ) && ( xRequiredSize > SUBSCRIPTION_DISPATCHER_MAX_PUBLISH_SIZE ) )
+    {
+        xStats.ulOversized++;
+        LogError( ( "Dropping publish on topic %.*s as its %u bytes exceed SUBSCRIPTION_DISPATCHER_MAX_PUBLISH_SIZE.",
+                    ( int ) pxPublishInfo->topicNameLength,
+                    pxPublishInfo->pTopicName,
+                    ( unsigned int ) xRequiredSize ) );
+    }
+    else if( xQueueReceive( xFreeWorkItems, &pxWorkItem, SUBSCRIPTION_DISPATCHER_MAX_WAIT_TICKS ) != pdPASS )
+    {
+        xStats.ulDropped++;
+        LogWarn( ( "No free work item, dropping publish on topic %.*s.",
+                   ( int ) pxPublishInfo->topicNameLength,
+                   pxPublishInfo->pTopicName ) );
+
+        if( xRetained == true )
+        {
+            ( void ) Agent_ReleaseNetworkBuffer( pxPublishInfo->pTopicName );
+        }
+    }
+    else if( xRetained == true )
+    {
+        /* The work item now owns the reference to the network buffer. */
+        pxWorkItem->xPublishInfo = *pxPublishInfo;
+        pxWorkItem->pxTarget = pxTarget;
+        pxWorkItem->pvRetainedBuffer = pxPublishInfo->pTopicName;
+        xStats.ulRetained++;
+    }
+    else
+    {
+        /* The publish info points into the network buffer, which is reused as
+         * soon as this callback returns, so copy the topic and payload. */
+        pxWorkItem->xPublishInfo = *pxPublishInfo;
+        pxWorkItem->pxTarget = pxTarget;
+        pxWorkItem->pvRetainedBuffer = NULL;
+        memcpy( pxWorkItem->ucData, pxPublishInfo->pTopicName, pxPublishInfo->topicNameLength );
+        memcpy( &( pxWorkItem->ucData[ pxPublishInfo->topicNameLength ] ),
+                pxPublishInfo->pPayload,
+                pxPublishInfo->payloadLength );
+        pxWorkItem->xPublishInfo.pTopicName = ( const char * ) pxWorkItem->ucData;
+        pxWorkItem->xPublishInfo.pPayload = &( pxWorkItem->ucData[ pxPublishInfo->topicNameLength ] );
+    }
+
+    if( pxWorkItem != NULL )
+    {
+        ( void ) xQueueSendToBack( xWorkerQueues[ prvSelectWorker( pxPublishInfo->pTopicName, pxPublishInfo->topicNameLength ) ],
+                                   &pxWorkItem,
+                                   0U );
+        xStats.ulDispatched++;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvDispatcherTask( void * pvParameters )
+{
+    const UBaseType_t uxWorker = ( UBaseType_t ) pvParameters;
+    DispatchWorkItem_t * pxWorkItem;
+
+    for( ; ; )
+    {
+        if( xQueueReceive( xWorkerQueues[ uxWorker ], &pxWorkItem, portMAX_DELAY ) == pdPASS )
+        {
+            pxWorkItem->pxTarget->pxIncomingPublishCallback( pxWorkItem->pxTarget->pvIncomingPublishCallbackContext,
+                                                             &( pxWorkItem->xPublishInfo ) );
+            xStats.ulProcessed[ uxWorker ]++;
+
+            if( pxWorkItem->pvRetainedBuffer != NULL )
+            {
+                ( void ) Agent_ReleaseNetworkBuffer( pxWorkItem->pvRetainedBuffer );
+                pxWorkItem->pvRetainedBuffer = NULL;
+            }
+
+            ( void ) xQueueSendToBack( xFreeWorkItems, &pxWorkItem, 0U );
+        }
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+void getSubscriptionDispatcherStats( SubscriptionDispatcherStats_t * pxStats )
+{
+    if( pxStats != NULL )
+    {
+        taskENTER_CRITICAL();
+        {
+            *pxStats = xStats;
+        }
+        taskEXIT_CRITICAL();
+    }
+}
@@ -0,0 +1,134 @@
+/*
+ * FreeRTOS V202011.00
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://aws.amazon.com/freertos
+ *
+ */
+
+/**
+ * @file subscription_dispatcher.h
+ * @brief A pool of tasks that run incoming publish callbacks on behalf of the
+ * MQTT agent task.
+ */
+#ifndef SUBSCRIPTION_DISPATCHER_H
+#define SUBSCRIPTION_DISPATCHER_H
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/* Subscription manager header include. */
+#include "subscription_manager.h"
+
+/**
+ * @brief Number of dispatcher tasks.  Publishes on any one topic are always
+ * handled by the same task, so are processed in the order they were received.
+ */
+#ifndef SUBSCRIPTION_DISPATCHER_NUM_WORKERS
+    #define SUBSCRIPTION_DISPATCHER_NUM_WORKERS    2U
+#endif
+
+/**
+ * @brief Number of publishes that can be waiting for, or being processed by,
+ * the dispatcher tasks at any one time.
+ */
+#ifndef SUBSCRIPTION_DISPATCHER_NUM_WORK_ITEMS
+    #define SUBSCRIPTION_DISPATCHER_NUM_WORK_ITEMS    8U
+#endif
+
+/**
+ * @brief Maximum combined length of the topic and payload of a publish that
+ * is copied into a work item.  Longer publishes are handed over in the MQTT
+ * agent's network buffer, or dropped if it cannot be retained - see
+ * Agent_RetainNetworkBuffer().
+ */
+#ifndef SUBSCRIPTION_DISPATCHER_MAX_PUBLISH_SIZE
+    #define SUBSCRIPTION_DISPATCHER_MAX_PUBLISH_SIZE    512U
+#endif
+
+/**
+ * @brief Maximum time, in ticks, the MQTT agent task waits for a free work item
+ * when all are in use before dropping the publish.
+ */
+#ifndef SUBSCRIPTION_DISPATCHER_MAX_WAIT_TICKS
+    #define SUBSCRIPTION_DISPATCHER_MAX_WAIT_TICKS    0U
+#endif
+
+/**
+ * @brief The callback a dispatcher task invokes for a publish, and the context
+ * to pass to it.
+ *
+ * @note Must remain in scope for as long as the subscription exists.
+ */
+typedef struct DispatchTarget
+{
+    IncomingPubCallback_t pxIncomingPublishCallback;
+    void * pvIncomingPublishCallbackContext;
+} DispatchTarget_t;
+
+/**
+ * @brief Counters describing the work done by the dispatcher.
+ */
+typedef struct SubscriptionDispatcherStats
+{
+    uint32_t ulDispatched;                                        /**< Publishes handed to a dispatcher task. */
+    uint32_t ulRetained;                                          /**< Publishes handed over without being copied. */
+    uint32_t ulDropped;                                           /**< Publishes dropped as no work item was free. */
+    uint32_t ulOversized;                                         /**< Publishes dropped as they exceeded SUBSCRIPTION_DISPATCHER_MAX_PUBLISH_SIZE. */
+    uint32_t ulProcessed[ SUBSCRIPTION_DISPATCHER_NUM_WORKERS ];  /**< Publishes processed by each dispatcher task. */
+} SubscriptionDispatcherStats_t;
+
+/**
+ * @brief Create the dispatcher tasks.  Must be called once, before any
+ * subscription using dispatchIncomingPublishCallback() is added.
+ *
+ * @param[in] uxStackSize Stack size of each dispatcher task, in words.
+ * @param[in] uxPriority Priority of the dispatcher tasks.
+ *
+ * @return `true` if the dispatcher was started, otherwise `false`.
+ */
+bool startSubscriptionDispatcher( configSTACK_DEPTH_TYPE uxStackSize,
+                                  UBaseType_t uxPriority );
+
+/**
+ * @brief Incoming publish callback that copies the publish into a work item
+ * and queues it to a dispatcher task, which then invokes the callback given in
+ * the DispatchTarget_t.
+ *
+ * Pass this to addSubscription() as the callback, with a DispatchTarget_t as
+ * the callback context, to have a subscription's callback run on a dispatcher
+ * task instead of the MQTT agent task.
+ *
+ * @param[in] pvDispatchTarget The DispatchTarget_t for the subscription.
+ * @param[in] pxPublishInfo Deserialized publish information.
+ */
+void dispatchIncomingPublishCallback( void * pvDispatchTarget,
+                                      MQTTPublishInfo_t * pxPublishInfo );
+
+/**
+ * @brief Obtain a copy of the dispatcher counters.
+ *
+ * @param[out] pxStats Structure into which the counters are copied.
+ */
+void getSubscriptionDispatcherStats( SubscriptionDispatcherStats_t * pxStats );
+
+#endif /* SUBSCRIPTION_DISPATCHER_H */
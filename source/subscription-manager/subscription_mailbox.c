@@ -0,0 +1,295 @@
+/*
+ * FreeRTOS V202011.00
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://aws.amazon.com/freertos
+ *
+ */
+
+/**
+ * @file subscription_mailbox.c
+ * @brief Bounded mailboxes that decouple the MQTT agent task from the tasks
+ * consuming incoming publishes.
+ *
+ * Each mailbox owns a fixed number of equally sized slots.  The slots move
+ * between two queues - one holding free slots and one holding slots that
+ * contain a publish.  The MQTT agent task takes a free slot, copies the publish
+ * into it and posts it to the filled queue.  The subscribing task receives from
+ * the filled queue and, once done, posts the slot back to the free queue.  A
+ * slot held by the subscribing task is in neither queue, so it is never
+ * overwritten by the drop oldest policy.
+ *
+ * Where possible the MQTT agent's network buffer is retained instead of the
+ * publish being copied, in which case the slot is not used.
+ */
+
+/* Standard includes. */
+#include <string.h>
+
+/* Mailbox header include. */
+#include "subscription_mailbox.h"
+
+/* MQTT agent network buffer pool include. */
+#include "agent_buffer_pool.h"
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Drop the reference a message holds to a network buffer, if any.
+ *
+ * @param[in] pxMessage The message.
+ */
+static void prvReleaseRetainedBuffer( SubscriptionMailboxMessage_t * pxMessage );
+
+/**
+ * @brief Obtain a slot into which to copy an incoming publish, applying the
+ * mailbox's policy if the mailbox is full.
+ *
+ * @param[in] pxMailbox The mailbox.
+ *
+ * @return A message with a free slot, or NULL if the publish is to be dropped.
+ */
+static SubscriptionMailboxMessage_t * prvGetFreeMessage( SubscriptionMailbox_t * pxMailbox );
+
+/*-----------------------------------------------------------*/
+
+bool initSubscriptionMailbox( SubscriptionMailbox_t * pxMailbox,
+                              SubscriptionMailboxMessage_t * pxMessages,
+                              uint8_t * pucSlotStorage,
+                              UBaseType_t uxSlotCount,
+                              size_t xSlotSize,
+                              SubscriptionMailboxPolicy_t xPolicy,
+                              TickType_t xBlockTimeTicks )
+{
+    bool xReturnStatus = false;
+    UBaseType_t uxIndex;
+    SubscriptionMailboxMessage_t * pxMessage;
+
+    if( ( pxMailbox == NULL ) ||
+        ( pxMessages == NULL ) ||
+        ( pucSlotStorage == NULL ) ||
+        ( uxSlotCount < 2U ) ||
+        ( xSlotSize == 0U ) )
+    {
+        LogError( ( "Invalid parameter. pxMailbox=%p, pxMessages=%p, pucSlotStorage=%p,"
+                    " uxSlotCount=%u, xSlotSize=%u.",
+                    pxMailbox,
+                    pxMessages,
+                    pucSlotStorage,
+                    ( unsigned int ) uxSlotCount,
+                    ( unsigned int ) xSlotSize ) );
+    }
+    else
+    {
+        memset( pxMailbox, 0x00, sizeof( SubscriptionMailbox_t ) );
+        pxMailbox->pxMessages = pxMessages;
+        pxMailbox->pucSlotStorage = pucSlotStorage;
+        pxMailbox->uxSlotCount = uxSlotCount;
+        pxMailbox->xSlotSize = xSlotSize;
+        pxMailbox->xPolicy = xPolicy;
+        pxMailbox->xBlockTimeTicks = xBlockTimeTicks;
+
+        /* The queues hold pointers to messages, not the messages themselves,
+         * so the publishes are only ever copied once - by the agent task. */
+        pxMailbox->xFreeMessages = xQueueCreate( uxSlotCount, sizeof( SubscriptionMailboxMessage_t * ) );
+        pxMailbox->xFilledMessages = xQueueCreate( uxSlotCount, sizeof( SubscriptionMailboxMessage_t * ) );
+
+        if( ( pxMailbox->xFreeMessages != NULL ) && ( pxMailbox->xFilledMessages != NULL ) )
+        {
+            for( uxIndex = 0U; uxIndex < uxSlotCount; uxIndex++ )
+            {
+                pxMessage = &( pxMessages[ uxIndex ] );
+                memset( pxMessage, 0x00, sizeof( SubscriptionMailboxMessage_t ) );
+                pxMessage->pucSlot = &( pucSlotStorage[ uxIndex * xSlotSize ] );
+                ( void ) xQueueSendToBack( pxMailbox->xFreeMessages, &pxMessage, 0U );
+            }
+
+            xReturnStatus = true;
+        }
+        else
+        {
+            LogError( ( "Failed to create the queues for a subscription mailbox." ) );
+        }
+    }
+
+    return xReturnStatus;
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvReleaseRetainedBuffer( SubscriptionMailboxMessage_t * pxMessage )
+{
+    if( pxMessage->pvRetainedBuffer != NULL )
+    {
+        ( void ) Agent_ReleaseNetworkBuffer( pxMessage->pvRetainedBuffer );
+        pxMessage->pvRetainedBuffer = NULL;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static SubscriptionMailboxMessage_t * prvGetFreeMessage( SubscriptionMailbox_t * pxMailbox )
+{
+    SubscriptionMailboxMessage_t * pxMessage = NULL;
+
+    if( xQueueReceive( pxMailbox->xFreeMessages, &pxMessage, 0U ) != pdPASS )
+    {
+        switch( pxMailbox->xPolicy )
+        {
+            case eMailboxDropOldest:
+
+                /* Reclaim the slot of the oldest publish the subscribing task
+                 * has not yet received.  If the subscribing task received it
+                 * in the meantime then it will have freed another slot. */
+                if( xQueueReceive( pxMailbox->xFilledMessages, &pxMessage, 0U ) == pdPASS )
+                {
+                    prvReleaseRetainedBuffer( pxMessage );
+                    pxMailbox->ulDropped++;
+                }
+                else if( xQueueReceive( pxMailbox->xFreeMessages, &pxMessage, 0U ) != pdPASS )
+                {
+                    pxMessage = NULL;
+                }
+
+                break;
+
+            case eMailboxBlock:
+
+                if( xQueueReceive( pxMailbox->xFreeMessages, &pxMessage, pxMailbox->xBlockTimeTicks ) != pdPASS )
+                {
+                    pxMessage = NULL;
+                }
+
+                break;
+
+            case eMailboxDropNewest:
+            default:
+                pxMessage = NULL;
+                break;
+        }
+    }
+
+    return pxMessage;
+}
+
+/*-----------------------------------------------------------*/
+
+void mailboxIncomingPublishCallback( void * pvMailbox,
+                                     MQTTPublishInfo_t * pxPublishInfo )
+{
+    SubscriptionMailbox_t * pxMailbox = ( SubscriptionMailbox_t * ) pvMailbox;
+    SubscriptionMailboxMessage_t * pxMessage;
+    size_t xRequiredSize;
+    bool xRetained;
+
+    configASSERT( pxMailbox != NULL );
+    configASSERT( pxPublishInfo != NULL );
+
+    xRequiredSize = ( size_t ) pxPublishInfo->topicNameLength + pxPublishInfo->payloadLength;
+
+    /* Holding on to the network buffer avoids the copy, but is only possible
+     * while the agent has a spare buffer to receive into. */
+    xRetained = Agent_RetainNetworkBuffer( pxPublishInfo->pTopicName );
+
+    if( ( xRetained == false ) && ( xRequiredSize > pxMailbox->xSlotSize ) )
+    {
+        pxMailbox->ulOversized++;
+        LogError( ( "Dropping publish on topic %.*s as its %u bytes do not fit in a mailbox slot.",
+                    ( int ) pxPublishInfo->topicNameLength,
+                    pxPublishInfo->pTopicName,
+                    ( unsigned int ) xRequiredSize ) );
+    }
+    else
+    {
+        pxMessage = prvGetFreeMessage( pxMailbox );
+
+        if( pxMessage == NULL )
+        {
+            pxMailbox->ulDropped++;
+            LogWarn( ( "Mailbox full, dropping publish on topic %.*s.",
+                       ( int ) pxPublishInfo->topicNameLength,
+                       pxPublishInfo->pTopicName ) );
+        }
+        else if( xRetained == true )
+        {
+            /* The message now owns the reference to the network buffer. */
+            pxMessage->xPublishInfo = *pxPublishInfo;
+            pxMessage->pvRetainedBuffer = pxPublishInfo->pTopicName;
+            xRetained = false;
+            pxMailbox->ulRetained++;
+        }
+        else
+        {
+            /* The topic name goes at the start of the slot and the payload
+             * directly after it. */
+            pxMessage->xPublishInfo = *pxPublishInfo;
+            memcpy( pxMessage->pucSlot, pxPublishInfo->pTopicName, pxPublishInfo->topicNameLength );
+            memcpy( &( pxMessage->pucSlot[ pxPublishInfo->topicNameLength ] ),
+                    pxPublishInfo->pPayload,
+                    pxPublishInfo->payloadLength );
+            pxMessage->xPublishInfo.pTopicName = ( const char * ) pxMessage->pucSlot;
+            pxMessage->xPublishInfo.pPayload = &( pxMessage->pucSlot[ pxPublishInfo->topicNameLength ] );
+        }
+
+        if( pxMessage != NULL )
+        {
+            /* There is always space as there are only as many messages as
+             * the queue can hold. */
+            ( void ) xQueueSendToBack( pxMailbox->xFilledMessages, &pxMessage, 0U );
+            pxMailbox->ulDelivered++;
+        }
+    }
+
+    /* Don't hold the network buffer if the publish was dropped. */
+    if( xRetained == true )
+    {
+        ( void ) Agent_ReleaseNetworkBuffer( pxPublishInfo->pTopicName );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+SubscriptionMailboxMessage_t * receiveFromMailbox( SubscriptionMailbox_t * pxMailbox,
+                                                   TickType_t xTicksToWait )
+{
+    SubscriptionMailboxMessage_t * pxMessage = NULL;
+
+    configASSERT( pxMailbox != NULL );
+
+    if( xQueueReceive( pxMailbox->xFilledMessages, &pxMessage, xTicksToWait ) != pdPASS )
+    {
+        pxMessage = NULL;
+    }
+
+    return pxMessage;
+}
+
+/*-----------------------------------------------------------*/
+
+void releaseMailboxMessage( SubscriptionMailbox_t * pxMailbox,
+                            SubscriptionMailboxMessage_t * pxMessage )
+{
+    configASSERT( pxMailbox != NULL );
+    configASSERT( pxMessage != NULL );
+
+    prvReleaseRetainedBuffer( pxMessage );
+    ( void ) xQueueSendToBack( pxMailbox->xFreeMessages, &pxMessage, 0U );
+}
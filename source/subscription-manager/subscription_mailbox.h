@@ -0,0 +1,154 @@
+/*
+ * FreeRTOS V202011.00
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://aws.amazon.com/freertos
+ *
+ */
+
+/**
+ * @file subscription_mailbox.h
+ * @brief A bounded mailbox into which incoming publishes are copied so they can
+ * be processed by the subscribing task rather than by the MQTT agent task.
+ */
+#ifndef SUBSCRIPTION_MAILBOX_H
+#define SUBSCRIPTION_MAILBOX_H
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "queue.h"
+
+/* Subscription manager header include. */
+#include "subscription_manager.h"
+
+/**
+ * @brief What the MQTT agent task does with an incoming publish when the
+ * mailbox it is destined for is full.
+ */
+typedef enum SubscriptionMailboxPolicy
+{
+    eMailboxDropOldest = 0, /**< Discard the oldest publish not yet received by the subscribing task. */
+    eMailboxDropNewest,     /**< Discard the incoming publish. */
+    eMailboxBlock           /**< Wait for the subscribing task to release a message, then discard the incoming publish if it does not. */
+} SubscriptionMailboxPolicy_t;
+
+/**
+ * @brief A publish held in a mailbox.
+ *
+ * @note xPublishInfo.pTopicName and xPublishInfo.pPayload point either into
+ * the slot the publish was copied into or, if the MQTT agent's network buffer
+ * could be retained, into that network buffer.  Either way they remain valid
+ * until the message is passed to releaseMailboxMessage().
+ */
+typedef struct SubscriptionMailboxMessage
+{
+    MQTTPublishInfo_t xPublishInfo;
+    uint8_t * pucSlot;
+    const void * pvRetainedBuffer; /**< Pointer into the retained network buffer, or NULL if the publish was copied. */
+} SubscriptionMailboxMessage_t;
+
+/**
+ * @brief A mailbox.  All the memory used by the mailbox other than its queues
+ * is provided by the application, so the members should only be accessed
+ * through the functions below - other than the counters, which can be read at
+ * any time.
+ */
+typedef struct SubscriptionMailbox
+{
+    QueueHandle_t xFreeMessages;            /**< Messages whose slots are free to receive a publish. */
+    QueueHandle_t xFilledMessages;          /**< Messages waiting to be received, oldest first. */
+    SubscriptionMailboxMessage_t * pxMessages;
+    uint8_t * pucSlotStorage;
+    size_t xSlotSize;
+    UBaseType_t uxSlotCount;
+    SubscriptionMailboxPolicy_t xPolicy;
+    TickType_t xBlockTimeTicks;
+    uint32_t ulDelivered;                   /**< Publishes placed in the mailbox. */
+    uint32_t ulRetained;                    /**< Publishes placed in the mailbox without being copied. */
+    uint32_t ulDropped;                     /**< Publishes discarded because the mailbox was full. */
+    uint32_t ulOversized;                   /**< Publishes discarded because they did not fit in a slot. */
+} SubscriptionMailbox_t;
+
+/**
+ * @brief Initialise a mailbox.
+ *
+ * @param[out] pxMailbox The mailbox to initialise.
+ * @param[in] pxMessages Array of uxSlotCount message structures.
+ * @param[in] pucSlotStorage Buffer of ( uxSlotCount * xSlotSize ) bytes into
+ * which publishes are copied.
+ * @param[in] uxSlotCount Number of publishes the mailbox can hold, which must
+ * be at least two so a publish can be received while the subscribing task
+ * still holds the previous one.
+ * @param[in] xSlotSize Size of each slot.  A publish needs room for both its
+ * topic name and its payload, unless it can be held in the MQTT agent's
+ * network buffer - see Agent_RetainNetworkBuffer().
+ * @param[in] xPolicy What to do with a publish when the mailbox is full.
+ * @param[in] xBlockTimeTicks Maximum time the MQTT agent task waits for a free
+ * slot when xPolicy is eMailboxBlock.  The agent cannot do anything else while
+ * it waits, so keep this short.  Ignored for other policies.
+ *
+ * @return `true` if the mailbox was initialised, `false` if a parameter was
+ * invalid or the queues could not be created.
+ */
+bool initSubscriptionMailbox( SubscriptionMailbox_t * pxMailbox,
+                              SubscriptionMailboxMessage_t * pxMessages,
+                              uint8_t * pucSlotStorage,
+                              UBaseType_t uxSlotCount,
+                              size_t xSlotSize,
+                              SubscriptionMailboxPolicy_t xPolicy,
+                              TickType_t xBlockTimeTicks );
+
+/**
+ * @brief Incoming publish callback that copies the publish into a mailbox.
+ *
+ * Pass this to addSubscription() as the callback, with the mailbox as the
+ * callback context, to put a subscription in mailbox mode.
+ *
+ * @param[in] pvMailbox The SubscriptionMailbox_t to copy the publish into.
+ * @param[in] pxPublishInfo Deserialized publish information.
+ */
+void mailboxIncomingPublishCallback( void * pvMailbox,
+                                     MQTTPublishInfo_t * pxPublishInfo );
+
+/**
+ * @brief Receive the oldest publish from a mailbox.
+ *
+ * @param[in] pxMailbox The mailbox to receive from.
+ * @param[in] xTicksToWait Maximum time to wait for a publish to arrive.
+ *
+ * @return The message, which must be returned to the mailbox by passing it to
+ * releaseMailboxMessage() once it has been processed, or NULL if no publish
+ * arrived in time.
+ */
+SubscriptionMailboxMessage_t * receiveFromMailbox( SubscriptionMailbox_t * pxMailbox,
+                                                   TickType_t xTicksToWait );
+
+/**
+ * @brief Return a message obtained from receiveFromMailbox() to the mailbox so
+ * its slot can be reused.
+ *
+ * @param[in] pxMailbox The mailbox the message was received from.
+ * @param[in] pxMessage The message to release.
+ */
+void releaseMailboxMessage( SubscriptionMailbox_t * pxMailbox,
+                            SubscriptionMailboxMessage_t * pxMessage );
+
+#endif /* SUBSCRIPTION_MAILBOX_H */
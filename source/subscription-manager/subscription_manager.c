@@ -32,13 +32,260 @@
 /* Standard includes. */
 #include <string.h>
 
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
 /* Subscription manager header include. */
 #include "subscription_manager.h"
 
+/**
+ * @brief Number of bytes used by MQTT to encode the length of a string.
+ */
+#define subscriptionENCODED_LENGTH_BYTES    ( 2U )
+
+/**
+ * @brief An entry in the table of interned topics.
+ *
+ * @note The topic is stored in its MQTT encoded form - a two byte big endian
+ * length followed by the topic itself - so it can be reused as is by anything
+ * that serializes the topic.  An entry is unused if ucEncodedTopic holds a zero
+ * length.
+ */
+typedef struct InternedTopic
+{
+    uint32_t ulHash;                                   /**< Hash of the topic name, checked before comparing the name itself. */
+    uint32_t ulMatchMask;                              /**< Bit N is set if subscription N of pxOwnerList matches the topic. */
+    uint32_t ulGeneration;                             /**< Value of ulSubscriptionGeneration when ulMatchMask was calculated. */
+    const SubscriptionElement_t * pxOwnerList;         /**< Subscription list ulMatchMask was calculated for, or NULL if never calculated. */
+    bool xPinned;                                      /**< True if interned by internTopic(), so must not be recycled. */
+    uint8_t ucEncodedTopic[ subscriptionENCODED_LENGTH_BYTES + SUBSCRIPTION_MANAGER_MAX_INTERNED_TOPIC_LENGTH ];
+} InternedTopic_t;
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Search the interned topic table for a topic name.
+ *
+ * @note Must be called from within a critical section.
+ *
+ * @param[in] ulHash Hash of the topic name, as returned by hashTopicName().
+ * @param[in] pcTopicName Topic name to search for.
+ * @param[in] usTopicNameLength Length of the topic name.
+ *
+ * @return Index of the matching entry, or SUBSCRIPTION_MANAGER_MAX_INTERNED_TOPICS
+ * if the topic is not interned.
+ */
+static size_t prvFindInternedTopic( uint32_t ulHash,
+                                    const char * pcTopicName,
+                                    uint16_t usTopicNameLength );
+
+/**
+ * @brief Add a topic name to the interned topic table, recycling an entry that
+ * was not interned by internTopic() if the table is full.
+ *
+ * @note Must be called from within a critical section.
+ *
+ * @param[in] ulHash Hash of the topic name, as returned by hashTopicName().
+ * @param[in] pcTopicName Topic name to add.
+ * @param[in] usTopicNameLength Length of the topic name.  Must not exceed
+ * SUBSCRIPTION_MANAGER_MAX_INTERNED_TOPIC_LENGTH.
+ * @param[in] xPinned Whether the entry may be recycled later.
+ *
+ * @return Index of the new entry, or SUBSCRIPTION_MANAGER_MAX_INTERNED_TOPICS
+ * if no entry was available.
+ */
+static size_t prvInsertInternedTopic( uint32_t ulHash,
+                                      const char * pcTopicName,
+                                      uint16_t usTopicNameLength,
+                                      bool xPinned );
+
+/**
+ * @brief Match a topic name against every filter in a subscription list.
+ *
+ * @param[in] pxSubscriptionList The subscription list to match against.
+ * @param[in] pcTopicName Topic name of the incoming publish.
+ * @param[in] usTopicNameLength Length of the topic name.
+ *
+ * @return A mask in which bit N is set if subscription N matches the topic.
+ */
+static uint32_t prvMatchSubscriptions( const SubscriptionElement_t * pxSubscriptionList,
+                                       const char * pcTopicName,
+                                       uint16_t usTopicNameLength );
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief The table of interned topics.  The ID of a topic is its index in this
+ * table plus one, so an ID of zero is never valid.
+ *
+ * @note Publishing tasks may intern topics while the MQTT agent task is
+ * dispatching incoming publishes, so the table is only accessed from within
+ * critical sections.
+ */
+static InternedTopic_t xInternedTopics[ SUBSCRIPTION_MANAGER_MAX_INTERNED_TOPICS ];
+
+/**
+ * @brief Index of the next entry to consider for recycling when the interned
+ * topic table is full.
+ */
+static size_t xNextTopicToRecycle = 0U;
+
+/**
+ * @brief Incremented each time any subscription list changes, so the cached
+ * match masks of interned topics can be recognised as stale.
+ */
+static uint32_t ulSubscriptionGeneration = 0U;
+
+/**
+ * @brief Dispatch counters returned by getSubscriptionManagerStats().
+ */
+static SubscriptionManagerStats_t xStats = { 0 };
+
+/*-----------------------------------------------------------*/
+
+uint32_t hashTopicName( const char * pcTopicName,
+                        uint16_t usTopicNameLength )
+{
+    const uint32_t ulFnvOffsetBasis = 2166136261UL, ulFnvPrime = 16777619UL;
+    uint32_t ulHash = ulFnvOffsetBasis;
+    uint16_t usIndex;
+
+    for( usIndex = 0U; usIndex < usTopicNameLength; usIndex++ )
+    {
+        ulHash ^= ( uint32_t ) ( uint8_t ) pcTopicName[ usIndex ];
+        ulHash *= ulFnvPrime;
+    }
+
+    return ulHash;
+}
+
+/*-----------------------------------------------------------*/
+
+static size_t prvFindInternedTopic( uint32_t ulHash,
+                                    const char * pcTopicName,
+                                    uint16_t usTopicNameLength )
+{
+    size_t xIndex;
+    const uint8_t * pucEncodedTopic;
+
+    for( xIndex = 0U; xIndex < SUBSCRIPTION_MANAGER_MAX_INTERNED_TOPICS; xIndex++ )
+    {
+        pucEncodedTopic = xInternedTopics[ xIndex ].ucEncodedTopic;
+
+        /* The hash is checked first so the topic name itself is normally only
+         * compared against the entry that matches. */
+        if( ( xInternedTopics[ xIndex ].ulHash == ulHash ) &&
+            ( pucEncodedTopic[ 0 ] == ( uint8_t ) ( usTopicNameLength >> 8 ) ) &&
+            ( pucEncodedTopic[ 1 ] == ( uint8_t ) ( usTopicNameLength & 0xFFU ) ) &&
+            ( usTopicNameLength > 0U ) &&
+            ( memcmp( &( pucEncodedTopic[ subscriptionENCODED_LENGTH_BYTES ] ), pcTopicName, usTopicNameLength ) == 0 ) )
+        {
+            break;
+        }
+    }
+
+    return xIndex;
+}
+
+/*-----------------------------------------------------------*/
+
+static size_t prvInsertInternedTopic( uint32_t ulHash,
+                                      const char * pcTopicName,
+                                      uint16_t usTopicNameLength,
+                                      bool xPinned )
+{
+    size_t xIndex, xCount, xAvailableIndex = SUBSCRIPTION_MANAGER_MAX_INTERNED_TOPICS;
+    InternedTopic_t * pxEntry;
+
+    /* Prefer an unused entry. */
+    for( xIndex = 0U; xIndex < SUBSCRIPTION_MANAGER_MAX_INTERNED_TOPICS; xIndex++ )
+    {
+        if( ( xInternedTopics[ xIndex ].ucEncodedTopic[ 0 ] == 0U ) &&
+            ( xInternedTopics[ xIndex ].ucEncodedTopic[ 1 ] == 0U ) )
+        {
+            xAvailableIndex = xIndex;
+            break;
+        }
+    }
+
+    /* Otherwise recycle, in turn, one of the entries that was interned
+     * automatically as a publish arrived. */
+    for( xCount = 0U;
+         ( xAvailableIndex == SUBSCRIPTION_MANAGER_MAX_INTERNED_TOPICS ) && ( xCount < SUBSCRIPTION_MANAGER_MAX_INTERNED_TOPICS );
+         xCount++ )
+    {
+        xIndex = xNextTopicToRecycle;
+        xNextTopicToRecycle = ( xNextTopicToRecycle + 1U ) % SUBSCRIPTION_MANAGER_MAX_INTERNED_TOPICS;
+
+        if( xInternedTopics[ xIndex ].xPinned == false )
+        {
+            xAvailableIndex = xIndex;
+        }
+    }
+
+    if( xAvailableIndex < SUBSCRIPTION_MANAGER_MAX_INTERNED_TOPICS )
+    {
+        pxEntry = &( xInternedTopics[ xAvailableIndex ] );
+        pxEntry->ulHash = ulHash;
+        pxEntry->ulMatchMask = 0U;
+        pxEntry->ulGeneration = 0U;
+        pxEntry->pxOwnerList = NULL;
+        pxEntry->xPinned = xPinned;
+        pxEntry->ucEncodedTopic[ 0 ] = ( uint8_t ) ( usTopicNameLength >> 8 );
+        pxEntry->ucEncodedTopic[ 1 ] = ( uint8_t ) ( usTopicNameLength & 0xFFU );
+        memcpy( &( pxEntry->ucEncodedTopic[ subscriptionENCODED_LENGTH_BYTES ] ), pcTopicName, usTopicNameLength );
+    }
+
+    return xAvailableIndex;
+}
+
+/*-----------------------------------------------------------*/
+
+static uint32_t prvMatchSubscriptions( const SubscriptionElement_t * pxSubscriptionList,
+                                       const char * pcTopicName,
+                                       uint16_t usTopicNameLength )
+{
+    int32_t lIndex = 0;
+    bool isMatched = false;
+    uint32_t ulMatchMask = 0U, ulFilterMatches = 0U, ulBytesCompared = 0U;
+
+    for( lIndex = 0; lIndex < SUBSCRIPTION_MANAGER_MAX_SUBSCRIPTIONS; lIndex++ )
+    {
+        if( pxSubscriptionList[ lIndex ].usFilterStringLength > 0 )
+        {
+            MQTT_MatchTopic( pcTopicName,
+                             usTopicNameLength,
+                             pxSubscriptionList[ lIndex ].pcSubscriptionFilterString,
+                             pxSubscriptionList[ lIndex ].usFilterStringLength,
+                             &isMatched );
+
+            ulFilterMatches++;
+            ulBytesCompared += ( uint32_t ) usTopicNameLength + ( uint32_t ) pxSubscriptionList[ lIndex ].usFilterStringLength;
+
+            if( isMatched == true )
+            {
+                ulMatchMask |= ( 1UL << ( uint32_t ) lIndex );
+            }
+        }
+    }
+
+    taskENTER_CRITICAL();
+    {
+        xStats.ulFilterMatches += ulFilterMatches;
+        xStats.ulBytesCompared += ulBytesCompared;
+    }
+    taskEXIT_CRITICAL();
+
+    return ulMatchMask;
+}
+
+/*-----------------------------------------------------------*/
 
 bool addSubscription( SubscriptionElement_t * pxSubscriptionList,
                       const char * pcTopicFilterString,
                       uint16_t usTopicFilterLength,
+                      MQTTQoS_t xRequestedQoS,
                       IncomingPubCallback_t pxIncomingPublishCallback,
                       void * pvIncomingPublishCallbackContext )
 {
@@ -71,11 +318,13 @@ bool addSubscription( SubscriptionElement_t * pxSubscriptionList,
             else if( ( pxSubscriptionList[ lIndex ].usFilterStringLength == usTopicFilterLength ) &&
                      ( strncmp( pcTopicFilterString, pxSubscriptionList[ lIndex ].pcSubscriptionFilterString, ( size_t ) usTopicFilterLength ) == 0 ) )
             {
-                /* If a subscription already exists, don't do anything. */
+                /* If a subscription already exists, only record the QoS in
+                 * case the filter was resubscribed to change it. */
                 if( ( pxSubscriptionList[ lIndex ].pxIncomingPublishCallback == pxIncomingPublishCallback ) &&
                     ( pxSubscriptionList[ lIndex ].pvIncomingPublishCallbackContext == pvIncomingPublishCallbackContext ) )
                 {
                     LogWarn( ( "Subscription already exists.\n" ) );
+                    pxSubscriptionList[ lIndex ].xRequestedQoS = xRequestedQoS;
                     xAvailableIndex = SUBSCRIPTION_MANAGER_MAX_SUBSCRIPTIONS;
                     xReturnStatus = true;
                     break;
@@ -87,9 +336,17 @@ bool addSubscription( SubscriptionElement_t * pxSubscriptionList,
         {
             pxSubscriptionList[ xAvailableIndex ].pcSubscriptionFilterString = pcTopicFilterString;
             pxSubscriptionList[ xAvailableIndex ].usFilterStringLength = usTopicFilterLength;
+            pxSubscriptionList[ xAvailableIndex ].xRequestedQoS = xRequestedQoS;
             pxSubscriptionList[ xAvailableIndex ].pxIncomingPublishCallback = pxIncomingPublishCallback;
             pxSubscriptionList[ xAvailableIndex ].pvIncomingPublishCallbackContext = pvIncomingPublishCallbackContext;
             xReturnStatus = true;
+
+            /* Topics already interned may now match the new filter. */
+            taskENTER_CRITICAL();
+            {
+                ulSubscriptionGeneration++;
+            }
+            taskEXIT_CRITICAL();
         }
     }
 
@@ -126,6 +383,13 @@ void removeSubscription( SubscriptionElement_t * pxSubscriptionList,
                 }
             }
         }
+
+        /* Invalidate the match masks cached for interned topics. */
+        taskENTER_CRITICAL();
+        {
+            ulSubscriptionGeneration++;
+        }
+        taskEXIT_CRITICAL();
     }
 }
 
@@ -135,7 +399,12 @@ bool handleIncomingPublishes( SubscriptionElement_t * pxSubscriptionList,
                               MQTTPublishInfo_t * pxPublishInfo )
 {
     int32_t lIndex = 0;
-    bool isMatched = false;
+    bool isMatched = false, xCacheHit = false;
+    uint32_t ulHash = 0U, ulMatchMask = 0U, ulGeneration;
+    size_t xTopicIndex = SUBSCRIPTION_MANAGER_MAX_INTERNED_TOPICS;
+    const bool xInternable = ( pxPublishInfo != NULL ) &&
+                             ( pxPublishInfo->topicNameLength > 0U ) &&
+                             ( pxPublishInfo->topicNameLength <= SUBSCRIPTION_MANAGER_MAX_INTERNED_TOPIC_LENGTH );
 
     if( ( pxSubscriptionList == NULL ) ||
         ( pxPublishInfo == NULL ) )
@@ -146,18 +415,91 @@ bool handleIncomingPublishes( SubscriptionElement_t * pxSubscriptionList,
     }
     else
     {
-        for( lIndex = 0; lIndex < SUBSCRIPTION_MANAGER_MAX_SUBSCRIPTIONS; lIndex++ )
+        /* Look the topic up in the interned topic table.  If it is there, and
+         * the subscriptions have not changed since it was last matched, the
+         * callbacks to invoke are already known and the topic does not need
+         * to be matched against every subscription filter again. */
+        if( xInternable )
+        {
+            ulHash = hashTopicName( pxPublishInfo->pTopicName, pxPublishInfo->topicNameLength );
+
+            taskENTER_CRITICAL();
+            {
+                xTopicIndex = prvFindInternedTopic( ulHash, pxPublishInfo->pTopicName, pxPublishInfo->topicNameLength );
+
+                if( ( xTopicIndex < SUBSCRIPTION_MANAGER_MAX_INTERNED_TOPICS ) &&
+                    ( xInternedTopics[ xTopicIndex ].pxOwnerList == pxSubscriptionList ) &&
+                    ( xInternedTopics[ xTopicIndex ].ulGeneration == ulSubscriptionGeneration ) )
+                {
+                    ulMatchMask = xInternedTopics[ xTopicIndex ].ulMatchMask;
+                    xCacheHit = true;
+                }
+
+                ulGeneration = ulSubscriptionGeneration;
+            }
+            taskEXIT_CRITICAL();
+        }
+
+        /* The counters are read by getSubscriptionManagerStats() from other
+         * tasks, so are updated in the same critical section it reads them
+         * in. */
+        taskENTER_CRITICAL();
+        {
+            xStats.ulDispatches++;
+
+            if( xCacheHit == true )
+            {
+                xStats.ulInternedTopicHits++;
+                xStats.ulBytesCompared += pxPublishInfo->topicNameLength;
+            }
+            else
+            {
+                xStats.ulInternedTopicMisses++;
+            }
+        }
+        taskEXIT_CRITICAL();
+
+        if( xCacheHit == false )
+        {
+            ulMatchMask = prvMatchSubscriptions( pxSubscriptionList,
+                                                 pxPublishInfo->pTopicName,
+                                                 pxPublishInfo->topicNameLength );
+
+            /* Remember the result so the next publish on this topic can be
+             * dispatched without matching it against each filter. */
+            if( xInternable )
+            {
+                taskENTER_CRITICAL();
+                {
+                    xTopicIndex = prvFindInternedTopic( ulHash, pxPublishInfo->pTopicName, pxPublishInfo->topicNameLength );
+
+                    if( xTopicIndex == SUBSCRIPTION_MANAGER_MAX_INTERNED_TOPICS )
+                    {
+                        xTopicIndex = prvInsertInternedTopic( ulHash, pxPublishInfo->pTopicName, pxPublishInfo->topicNameLength, false );
+                    }
+
+                    if( xTopicIndex < SUBSCRIPTION_MANAGER_MAX_INTERNED_TOPICS )
+                    {
+                        xInternedTopics[ xTopicIndex ].ulMatchMask = ulMatchMask;
+                        xInternedTopics[ xTopicIndex ].pxOwnerList = pxSubscriptionList;
+                        xInternedTopics[ xTopicIndex ].ulGeneration = ulGeneration;
+                    }
+                }
+                taskEXIT_CRITICAL();
+            }
+        }
+
+        /* The match mask indexes the subscription list directly. */
+        for( lIndex = 0; ( lIndex < SUBSCRIPTION_MANAGER_MAX_SUBSCRIPTIONS ) && ( ulMatchMask != 0U ); lIndex++ )
         {
-            if( pxSubscriptionList[ lIndex ].usFilterStringLength > 0 )
+            if( ( ulMatchMask & ( 1UL << ( uint32_t ) lIndex ) ) != 0U )
             {
-                MQTT_MatchTopic( pxPublishInfo->pTopicName,
-                                 pxPublishInfo->topicNameLength,
-                                 pxSubscriptionList[ lIndex ].pcSubscriptionFilterString,
-                                 pxSubscriptionList[ lIndex ].usFilterStringLength,
-                                 &isMatched );
+                ulMatchMask &= ~( 1UL << ( uint32_t ) lIndex );
 
-                if( isMatched == true )
+                /* A previous callback may have removed this subscription. */
+                if( pxSubscriptionList[ lIndex ].usFilterStringLength > 0 )
                 {
+                    isMatched = true;
                     pxSubscriptionList[ lIndex ].pxIncomingPublishCallback( pxSubscriptionList[ lIndex ].pvIncomingPublishCallbackContext,
                                                                             pxPublishInfo );
                 }
@@ -167,3 +509,105 @@ bool handleIncomingPublishes( SubscriptionElement_t * pxSubscriptionList,
 
     return isMatched;
 }
+
+/*-----------------------------------------------------------*/
+
+uint16_t internTopic( const char * pcTopicName,
+                      uint16_t usTopicNameLength )
+{
+    uint16_t usTopicId = SUBSCRIPTION_MANAGER_INVALID_TOPIC_ID;
+    uint32_t ulHash;
+    size_t xTopicIndex;
+
+    if( ( pcTopicName == NULL ) ||
+        ( usTopicNameLength == 0U ) ||
+        ( usTopicNameLength > SUBSCRIPTION_MANAGER_MAX_INTERNED_TOPIC_LENGTH ) )
+    {
+        LogError( ( "Invalid parameter. pcTopicName=%p, usTopicNameLength=%u.",
+                    pcTopicName,
+                    ( unsigned int ) usTopicNameLength ) );
+    }
+    else
+    {
+        ulHash = hashTopicName( pcTopicName, usTopicNameLength );
+
+        taskENTER_CRITICAL();
+        {
+            xTopicIndex = prvFindInternedTopic( ulHash, pcTopicName, usTopicNameLength );
+
+            if( xTopicIndex == SUBSCRIPTION_MANAGER_MAX_INTERNED_TOPICS )
+            {
+                xTopicIndex = prvInsertInternedTopic( ulHash, pcTopicName, usTopicNameLength, true );
+            }
+
+            if( xTopicIndex < SUBSCRIPTION_MANAGER_MAX_INTERNED_TOPICS )
+            {
+                /* The topic may already have been interned automatically by
+                 * an incoming publish - it must no longer be recycled. */
+                xInternedTopics[ xTopicIndex ].xPinned = true;
+                usTopicId = ( uint16_t ) ( xTopicIndex + 1U );
+            }
+        }
+        taskEXIT_CRITICAL();
+
+        if( usTopicId == SUBSCRIPTION_MANAGER_INVALID_TOPIC_ID )
+        {
+            LogError( ( "No space to intern topic %.*s.",
+                        ( int ) usTopicNameLength,
+                        pcTopicName ) );
+        }
+    }
+
+    return usTopicId;
+}
+
+/*-----------------------------------------------------------*/
+
+bool getInternedTopic( uint16_t usTopicId,
+                       const char ** ppcTopicName,
+                       uint16_t * pusTopicNameLength,
+                       const uint8_t ** ppucEncodedTopic )
+{
+    bool xReturnStatus = false;
+    InternedTopic_t * pxEntry;
+
+    if( ( usTopicId != SUBSCRIPTION_MANAGER_INVALID_TOPIC_ID ) &&
+        ( usTopicId <= SUBSCRIPTION_MANAGER_MAX_INTERNED_TOPICS ) &&
+        ( ppcTopicName != NULL ) &&
+        ( pusTopicNameLength != NULL ) )
+    {
+        pxEntry = &( xInternedTopics[ usTopicId - 1U ] );
+
+        /* Only pinned entries have IDs that were handed out, and pinned
+         * entries never change once written, so no critical section is
+         * needed to read them. */
+        if( pxEntry->xPinned == true )
+        {
+            *pusTopicNameLength = ( uint16_t ) ( ( ( uint16_t ) pxEntry->ucEncodedTopic[ 0 ] << 8 ) | pxEntry->ucEncodedTopic[ 1 ] );
+            *ppcTopicName = ( const char * ) &( pxEntry->ucEncodedTopic[ subscriptionENCODED_LENGTH_BYTES ] );
+
+            if( ppucEncodedTopic != NULL )
+            {
+                *ppucEncodedTopic = pxEntry->ucEncodedTopic;
+            }
+
+            xReturnStatus = true;
+        }
+    }
+
+    return xReturnStatus;
+}
+
+/*-----------------------------------------------------------*/
+
+void getSubscriptionManagerStats( SubscriptionManagerStats_t * pxStats )
+{
+    if( pxStats != NULL )
+    {
+        taskENTER_CRITICAL();
+        {
+            *pxStats = xStats;
+        }
+        taskEXIT_CRITICAL();
+    }
+}
@@ -70,6 +70,49 @@
     #define SUBSCRIPTION_MANAGER_MAX_SUBSCRIPTIONS    10U
 #endif
 
+#if ( SUBSCRIPTION_MANAGER_MAX_SUBSCRIPTIONS > 32U )
+    #error SUBSCRIPTION_MANAGER_MAX_SUBSCRIPTIONS cannot exceed 32 as interned topics record matching subscriptions in a 32-bit mask.
+#endif
+
+/**
+ * @brief Maximum number of topic names the subscription manager interns
+ * simultaneously.
+ *
+ * @note Interned topics are shared between topics explicitly interned by
+ * publishing tasks using internTopic() and topics interned automatically by
+ * handleIncomingPublishes() as publishes arrive.  Automatically interned topics
+ * are recycled when the table is full, explicitly interned topics are not.
+ */
+#ifndef SUBSCRIPTION_MANAGER_MAX_INTERNED_TOPICS
+    #define SUBSCRIPTION_MANAGER_MAX_INTERNED_TOPICS    16U
+#endif
+
+/**
+ * @brief Maximum length of a topic name that can be interned.  Publishes on
+ * longer topics are still dispatched, but their topic is matched against every
+ * subscription filter each time.
+ */
+#ifndef SUBSCRIPTION_MANAGER_MAX_INTERNED_TOPIC_LENGTH
+    #define SUBSCRIPTION_MANAGER_MAX_INTERNED_TOPIC_LENGTH    128U
+#endif
+
+/**
+ * @brief Value returned by internTopic() when a topic could not be interned.
+ */
+#define SUBSCRIPTION_MANAGER_INVALID_TOPIC_ID    ( ( uint16_t ) 0U )
+
+/**
+ * @brief Counters describing the cost of dispatching incoming publishes.
+ */
+typedef struct SubscriptionManagerStats
+{
+    uint32_t ulDispatches;          /**< Number of publishes passed to handleIncomingPublishes(). */
+    uint32_t ulInternedTopicHits;   /**< Dispatches resolved from an interned topic. */
+    uint32_t ulInternedTopicMisses; /**< Dispatches that had to match the topic against every filter. */
+    uint32_t ulFilterMatches;       /**< Number of calls made to MQTT_MatchTopic(). */
+    uint32_t ulBytesCompared;       /**< Topic and filter bytes compared while dispatching. */
+} SubscriptionManagerStats_t;
+
 /**
  * @brief Callback function called when receiving a publish.
  *
@@ -97,6 +140,7 @@ typedef struct subscriptionElement
     void * pvIncomingPublishCallbackContext;
     uint16_t usFilterStringLength;
     const char * pcSubscriptionFilterString;
+    MQTTQoS_t xRequestedQoS;
 } SubscriptionElement_t;
 
 /**
@@ -109,6 +153,8 @@ typedef struct subscriptionElement
  * @param[in] pxSubscriptionList  The pointer to the subscription list array.
  * @param[in] pcTopicFilterString Topic filter string of subscription.
  * @param[in] usTopicFilterLength Length of topic filter string.
+ * @param[in] xRequestedQoS QoS the topic filter was subscribed with, so the
+ * same QoS can be requested when the subscription is restored on reconnect.
  * @param[in] pxIncomingPublishCallback Callback function for the subscription.
  * @param[in] pvIncomingPublishCallbackContext Context for the subscription callback.
  *
@@ -117,6 +163,7 @@ typedef struct subscriptionElement
 bool addSubscription( SubscriptionElement_t * pxSubscriptionList,
                       const char * pcTopicFilterString,
                       uint16_t usTopicFilterLength,
+                      MQTTQoS_t xRequestedQoS,
                       IncomingPubCallback_t pxIncomingPublishCallback,
                       void * pvIncomingPublishCallbackContext );
 
@@ -147,4 +194,58 @@ void removeSubscription( SubscriptionElement_t * pxSubscriptionList,
 bool handleIncomingPublishes( SubscriptionElement_t * pxSubscriptionList,
                               MQTTPublishInfo_t * pxPublishInfo );
 
+/**
+ * @brief Calculate the FNV-1a hash of a topic name, as used to look topics up
+ * in the interned topic table.
+ *
+ * @param[in] pcTopicName Topic name to hash.
+ * @param[in] usTopicNameLength Length of the topic name.
+ *
+ * @return The hash value.
+ */
+uint32_t hashTopicName( const char * pcTopicName,
+                        uint16_t usTopicNameLength );
+
+/**
+ * @brief Intern a topic name, returning a compact numeric ID for it.
+ *
+ * The topic is copied into the subscription manager, along with its MQTT
+ * encoded form (two byte big endian length followed by the topic bytes), so
+ * the caller's string does not need to remain in scope.  Interning the same
+ * topic again returns the same ID.  Explicitly interned topics remain interned
+ * for the lifetime of the application.
+ *
+ * @param[in] pcTopicName Topic name to intern.
+ * @param[in] usTopicNameLength Length of the topic name.
+ *
+ * @return The topic ID, or #SUBSCRIPTION_MANAGER_INVALID_TOPIC_ID if the topic
+ * is too long or the interned topic table is full.
+ */
+uint16_t internTopic( const char * pcTopicName,
+                      uint16_t usTopicNameLength );
+
+/**
+ * @brief Retrieve an interned topic by its ID.
+ *
+ * @param[in] usTopicId ID returned by internTopic().
+ * @param[out] ppcTopicName Set to the interned topic name, which can be used
+ * as the pTopicName member of an MQTTPublishInfo_t.
+ * @param[out] pusTopicNameLength Set to the length of the topic name.
+ * @param[out] ppucEncodedTopic Optional.  If not NULL, set to the MQTT encoded
+ * form of the topic, which is ( *pusTopicNameLength + 2 ) bytes long.
+ *
+ * @return `true` if the ID refers to an interned topic, otherwise `false`.
+ */
+bool getInternedTopic( uint16_t usTopicId,
+                       const char ** ppcTopicName,
+                       uint16_t * pusTopicNameLength,
+                       const uint8_t ** ppucEncodedTopic );
+
+/**
+ * @brief Obtain a copy of the dispatch counters.
+ *
+ * @param[out] pxStats Structure into which the counters are copied.
+ */
+void getSubscriptionManagerStats( SubscriptionManagerStats_t * pxStats );
+
 #endif /* SUBSCRIPTION_MANAGER_H */